@@ -0,0 +1,57 @@
+#include "arena.h"
+
+#include <err.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct arena_block {
+  struct arena_block *next;
+  size_t size;
+  max_align_t data[];
+};
+
+void *arena_alloc(arena_t *arena, size_t size) {
+  size = (size + sizeof(max_align_t) - 1) & ~(sizeof(max_align_t) - 1);
+  struct arena_block *block = arena->block;
+  if (block == NULL || arena->used + size > block->size) {
+    size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+    struct arena_block *new = malloc(sizeof(*new) + block_size);
+    if (new == NULL) err(EXIT_FAILURE, "arena");
+    new->size = block_size;
+    if (block && size > ARENA_BLOCK_SIZE) {
+      // keep bumping in the current block, the big one is used up anyway
+      new->next = block->next;
+      block->next = new;
+      return new->data;
+    }
+    new->next = block;
+    arena->block = block = new;
+    arena->used = 0;
+  }
+  void *ptr = (char *)block->data + arena->used;
+  arena->used += size;
+  return ptr;
+}
+
+char *arena_strdup(arena_t *arena, const char *str) {
+  size_t len = strlen(str) + 1;
+  return memcpy(arena_alloc(arena, len), str, len);
+}
+
+void *arena_grow(arena_t *arena, void *items, unsigned int count,
+                 unsigned int *capacity, size_t size) {
+  if (count < *capacity) return items;
+  *capacity = *capacity ? *capacity * 2 : 8;
+  void *grown = arena_alloc(arena, *capacity * size);
+  if (count) memcpy(grown, items, count * size);
+  return grown;
+}
+
+void arena_free(arena_t *arena) {
+  while (arena->block) {
+    struct arena_block *next = arena->block->next;
+    free(arena->block);
+    arena->block = next;
+  }
+  arena->used = 0;
+}
@@ -0,0 +1,27 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+#include <stddef.h>
+
+// allocations bigger than this get a block of their own
+#define ARENA_BLOCK_SIZE (16 * 1024)
+
+struct arena_block;
+
+// bump allocator for data that lives as long as a config, everything is freed
+// at once. a zeroed arena is empty
+struct arena {
+  struct arena_block *block;
+  size_t used;
+};
+
+typedef struct arena arena_t;
+
+void *arena_alloc(arena_t *arena, size_t size);
+char *arena_strdup(arena_t *arena, const char *str);
+// room for at least one more of *count items of size bytes, the items are
+// moved to twice the space once they filled *capacity
+void *arena_grow(arena_t *arena, void *items, unsigned int count,
+                 unsigned int *capacity, size_t size);
+void arena_free(arena_t *arena);
+
+#endif
@@ -0,0 +1,314 @@
+#define _GNU_SOURCE
+#include "batch.h"
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mount.h>
+#include <unistd.h>
+
+#include "cgroup.h"
+#include "container.h"
+#include "filesystem.h"
+#include "forward.h"
+#include "json.h"
+#include "log.h"
+#include "network.h"
+#include "type.h"
+#include "utils.h"
+
+// a manifest is an array of container specs, all fields but args are
+// optional and default to the command line options:
+//   [{"image": "alpine", "args": ["/bin/true"], "hostname": "job",
+//     "env": {"KEY": "VALUE"}, "cgroup": {"memory.max": "64M"},
+//     "volumes": ["/src:/dst:ro"], "ip": "172.20.0.2", "gateway": "172.20.0.1",
+//     "ports": ["8080:80/tcp"], "network": "ipvlan:eth1:l3",
+//     "uid": 0, "gid": 0, "rm": true, "rootfs": "ephemeral", "count": 1}]
+// count launches the same spec that many times, a spec with a fixed ip or
+// ports only once
+struct batch_spec {
+  struct container_config config;
+  size_t count;
+};
+
+struct batch_slot {
+  container_t container;
+  bool running;
+  size_t index;
+  size_t spec;
+  // monotonic ns when the launch began and when the command was exec'd
+  unsigned long long launched;
+  unsigned long long started;
+};
+
+struct batch_stats {
+  size_t launched;
+  size_t exited;
+  size_t failed;
+  size_t started;
+  unsigned long long latency_sum;
+  unsigned long long latency_max;
+};
+
+static char *read_manifest(const char *path, size_t *len) {
+  int fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY);
+  if (fd == -1) err(EXIT_FAILURE, "open-manifest %s", path);
+  size_t cap = 4096;
+  char *text = malloc(cap);
+  *len = 0;
+  ssize_t n;
+  while ((n = read(fd, text + *len, cap - *len)) != 0) {
+    if (n == -1 && errno == EINTR) continue;
+    if (n == -1) err(EXIT_FAILURE, "read-manifest %s", path);
+    *len += n;
+    if (*len == cap) {
+      if (cap >= BATCH_MANIFEST_SIZE_MAX)
+        errx(EXIT_FAILURE, "manifest %s too large", path);
+      text = realloc(text, cap *= 2);
+    }
+  }
+  if (fd != STDIN_FILENO) close(fd);
+  return text;
+}
+
+// cgroup values may be given as strings or plain numbers
+static const char *scalar(const json_t *json, char *buf, size_t size) {
+  if (json && json->type == JSON_NUMBER) {
+    snprintf(buf, size, "%.0f", json->number);
+    return buf;
+  }
+  return json_string(json);
+}
+
+static int parse_spec(const json_t *entry,
+                      const struct container_config *template, arena_t *arena,
+                      struct batch_spec *spec) {
+  struct container_config *config = &spec->config;
+  *config = *template;
+  config->arena = arena;
+  if (entry->type != JSON_OBJECT) return -1;
+  // the template's arrays are shared by every spec, they move to the batch's
+  // arena once a spec adds to them
+  copy_pairs(&config->env, &template->env);
+  copy_pairs(&config->cgroup_limit, &template->cgroup_limit);
+  config->mounts.capacity = config->mounts.count;
+  config->ports.capacity = config->ports.count;
+
+  const json_t *value;
+  char buf[64];
+  if ((value = json_get(entry, "image")))
+    config->image = (char *)json_string(value);
+  if ((value = json_get(entry, "hostname")))
+    config->hostname = (char *)json_string(value);
+  if ((value = json_get(entry, "ip"))) config->ip = (char *)json_string(value);
+  if ((value = json_get(entry, "gateway")))
+    config->gateway = (char *)json_string(value);
+  if ((value = json_get(entry, "network")) &&
+      (json_string(value) == NULL ||
+       parse_network(json_string(value), &config->network) == -1))
+    return -1;
+  if ((value = json_get(entry, "uid")) && value->type == JSON_NUMBER)
+    config->uid = value->number;
+  if ((value = json_get(entry, "gid")) && value->type == JSON_NUMBER)
+    config->gid = value->number;
+  if ((value = json_get(entry, "rm")) && value->type == JSON_BOOL)
+    config->rm = value->boolean;
+  if ((value = json_get(entry, "rootfs")) &&
+      (json_string(value) == NULL ||
+       parse_rootfs_options(json_string(value), &config->rootfs) == -1))
+    return -1;
+  spec->count = 1;
+  if ((value = json_get(entry, "count"))) {
+    if (value->type != JSON_NUMBER || value->number < 1) return -1;
+    spec->count = value->number;
+  }
+  for (value = json_get(entry, "env") ? json_get(entry, "env")->child : NULL;
+       value; value = value->next) {
+    const char *str = scalar(value, buf, sizeof(buf));
+    if (str == NULL) return -1;
+    append_pair(arena, &config->env, value->key, str);
+  }
+  for (value = json_get(entry, "cgroup") ? json_get(entry, "cgroup")->child
+                                         : NULL;
+       value; value = value->next) {
+    const char *str = scalar(value, buf, sizeof(buf));
+    if (str == NULL) return -1;
+    append_pair(arena, &config->cgroup_limit, value->key, str);
+  }
+  for (value = json_get(entry, "volumes") ? json_get(entry, "volumes")->child
+                                          : NULL;
+       value; value = value->next) {
+    if (json_string(value) == NULL ||
+        parse_volume(arena, &config->mounts, json_string(value)) == -1)
+      return -1;
+  }
+  for (value = json_get(entry, "tmpfs") ? json_get(entry, "tmpfs")->child
+                                        : NULL;
+       value; value = value->next) {
+    if (json_string(value) == NULL ||
+        parse_tmpfs(arena, &config->mounts, json_string(value)) == -1)
+      return -1;
+  }
+  for (value = json_get(entry, "ports") ? json_get(entry, "ports")->child
+                                        : NULL;
+       value; value = value->next) {
+    if (json_string(value) == NULL ||
+        parse_port(arena, &config->ports, json_string(value)) == -1)
+      return -1;
+  }
+  // an address or a host port can only be taken once
+  if (spec->count > 1 &&
+      ((config->ip && strcmp(config->ip, "auto")) || config->ports.count))
+    return -1;
+
+  const json_t *args = json_get(entry, "args");
+  size_t argc = json_length(args);
+  if (config->image == NULL || argc == 0) return -1;
+  config->args = arena_alloc(arena, (argc + 1) * sizeof(char *));
+  for (size_t i = 0; i < argc; i++)
+    if ((config->args[i] = (char *)json_string(json_index(args, i))) == NULL)
+      return -1;
+  config->args[argc] = NULL;
+  container_build_env(config);
+  return 0;
+}
+
+static void launch(struct batch_slot *slot, struct batch_spec *spec,
+                   size_t index, size_t spec_index, struct batch_stats *stats) {
+  slot->index = index;
+  slot->spec = spec_index;
+  slot->started = 0;
+  slot->launched = monotonic_timestamp();
+  stats->launched++;
+  if (container_spawn(&spec->config, &slot->container) == 0) {
+    slot->running = true;
+    return;
+  }
+  // the rest of the batch goes on, the spawn failed before anything existed
+  printf("{\"index\":%zu,\"spec\":%zu,\"id\":null,\"start_latency_us\":null,"
+         "\"runtime_us\":null,\"exit_status\":null,\"error\":\"%s\"}\n",
+         index, spec_index, strerror(errno));
+  fflush(stdout);
+  stats->exited++;
+  stats->failed++;
+}
+
+static void on_started(struct batch_slot *slot, struct batch_stats *stats) {
+  // a container that failed before exec is only noticed through its exit
+  if (container_started(&slot->container) == -1) return;
+  slot->started = slot->container.trace.spans[PHASE_EXEC].end;
+  unsigned long long latency = slot->started - slot->launched;
+  stats->started++;
+  stats->latency_sum += latency;
+  if (latency > stats->latency_max) stats->latency_max = latency;
+}
+
+static void on_exited(struct batch_slot *slot, struct batch_stats *stats) {
+  int status = container_reap(&slot->container);
+  unsigned long long now = monotonic_timestamp();
+  char latency[32] = "null", runtime[32] = "null";
+  if (slot->started) {
+    snprintf(latency, sizeof(latency), "%.1f",
+             (slot->started - slot->launched) / 1000.0);
+    snprintf(runtime, sizeof(runtime), "%.1f", (now - slot->started) / 1000.0);
+  }
+  printf("{\"index\":%zu,\"spec\":%zu,\"id\":\"%s\",\"start_latency_us\":%s,"
+         "\"runtime_us\":%s,\"exit_status\":%d}\n",
+         slot->index, slot->spec, slot->container.config.id, latency, runtime,
+         status);
+  fflush(stdout);
+  container_cleanup(&slot->container);
+  slot->running = false;
+  stats->exited++;
+  if (status) stats->failed++;
+}
+
+int run_batch(struct container_config *config, const char *path,
+              int parallel) {
+  size_t len;
+  char *text = read_manifest(path, &len);
+  json_t *manifest = json_parse(text, len);
+  free(text);
+  if (manifest == NULL || manifest->type != JSON_ARRAY) {
+    error("Manifest %s is not a JSON array\n", path);
+    return EXIT_FAILURE;
+  }
+  size_t count = json_length(manifest), total = 0;
+  struct batch_spec *specs = calloc(count, sizeof(struct batch_spec));
+  arena_t arena = {0};
+  for (size_t i = 0; i < count; i++) {
+    if (parse_spec(json_index(manifest, i), config, &arena, &specs[i])) {
+      error("Invalid container spec %zu in %s\n", i, path);
+      return EXIT_FAILURE;
+    }
+    prepare_cgroup(specs[i].config.cgroup_base_path,
+                   &specs[i].config.cgroup_limit);
+    total += specs[i].count;
+  }
+  debug("Launching %zu containers, %d at a time\n", total, parallel);
+
+  struct batch_slot *slots = calloc(parallel, sizeof(struct batch_slot));
+  struct pollfd *fds = malloc(parallel * sizeof(struct pollfd));
+  int *owners = malloc(parallel * sizeof(int));
+  struct batch_stats stats = {0};
+  size_t spec = 0, copy = 0;
+  unsigned long long begin = monotonic_timestamp();
+  while (stats.exited < total) {
+    // refill every free slot before waiting on any of them
+    for (int i = 0; i < parallel && stats.launched < total; i++) {
+      if (slots[i].running) continue;
+      launch(&slots[i], &specs[spec], stats.launched, spec, &stats);
+      if (++copy == specs[spec].count) {
+        spec++;
+        copy = 0;
+      }
+    }
+    // each container is watched for its exec first, then for its exit
+    int n = 0;
+    for (int i = 0; i < parallel; i++) {
+      if (!slots[i].running) continue;
+      container_t *container = &slots[i].container;
+      fds[n] = (struct pollfd){
+          .fd = container->fd != -1 ? container->fd : container->pidfd,
+          .events = POLLIN};
+      owners[n++] = i;
+    }
+    if (n == 0) continue;
+    if (poll(fds, n, -1) == -1) {
+      if (errno == EINTR) continue;
+      err(EXIT_FAILURE, "poll");
+    }
+    for (int i = 0; i < n; i++) {
+      if (fds[i].revents == 0) continue;
+      struct batch_slot *slot = &slots[owners[i]];
+      if (slot->container.fd != -1)
+        on_started(slot, &stats);
+      else
+        on_exited(slot, &stats);
+    }
+  }
+  double elapsed = (monotonic_timestamp() - begin) / 1e9;
+
+  double rate = elapsed > 0 ? total / elapsed : 0;
+  double average =
+      stats.started ? stats.latency_sum / 1000.0 / stats.started : 0;
+  printf("{\"launched\":%zu,\"started\":%zu,\"failed\":%zu,\"elapsed_s\":%.3f,"
+         "\"launches_per_s\":%.1f,\"start_latency_avg_us\":%.1f,"
+         "\"start_latency_max_us\":%.1f}\n",
+         total, stats.started, stats.failed, elapsed, rate, average,
+         stats.latency_max / 1000.0);
+  info("Launched %zu containers in %.3f s (%.1f/s), %zu failed\n", total,
+       elapsed, rate, stats.failed);
+
+  arena_free(&arena);
+  free(specs);
+  free(slots);
+  free(fds);
+  free(owners);
+  json_free(manifest);
+  return stats.failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
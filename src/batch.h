@@ -0,0 +1,16 @@
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#include "container.h"
+
+#define BATCH_PARALLEL_DEFAULT 16
+#define BATCH_MANIFEST_SIZE_MAX (64 * 1024 * 1024)
+
+// launch every container of a JSON manifest ("-" for stdin) with at most
+// parallel of them in flight, prints one JSON line per container with its
+// start latency and exit status as it exits, or with the error if it could
+// not be spawned, then a summary line
+int run_batch(struct container_config *config, const char *manifest,
+              int parallel);
+
+#endif
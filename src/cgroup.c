@@ -1,5 +1,6 @@
 #include "cgroup.h"
 
+#include <ctype.h>
 #include <err.h>
 #include <fcntl.h>
 #include <linux/limits.h>
@@ -7,15 +8,16 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <unistd.h>
 
 #include "log.h"
 #include "type.h"
 #include "utils.h"
 
-int setup_limits(const char *cgroup_path, const list_t *limits_list) {
-  for (const list_t *node = limits_list; node; node = node->next) {
-    pair_t *limit = (pair_t *)node->data;
+int setup_limits(const char *cgroup_path, const pairs_t *limits) {
+  for (unsigned int i = 0; i < limits->count; i++) {
+    const pair_t *limit = &limits->items[i];
     if (strlen(limit->key) >= 50) {
       error("Cgroup limit key too long\n");
       exit(EXIT_FAILURE);
@@ -32,16 +34,23 @@ int setup_limits(const char *cgroup_path, const list_t *limits_list) {
   return 0;
 }
 
-int setup_cgroup(pid_t pid, const char *cgroup_base_path,
-                 const char *container_id, const list_t *limits_list) {
+int create_cgroup(const char *cgroup_base_path, const char *container_id,
+                  const pairs_t *limits) {
   char cgroup_path[PATH_MAX];
   snprintf(cgroup_path, PATH_MAX, "%s/%s", cgroup_base_path, container_id);
   debug("Cgroup path: %s\n", cgroup_path);
   debug("uid=%d, gid=%d\n", getuid(), getgid());
   if (mkdir(cgroup_path, 0700))
     err(EXIT_FAILURE, "mkdir-cgroup %s", cgroup_path);
-  if (limits_list) setup_limits(cgroup_path, limits_list);
+  setup_limits(cgroup_path, limits);
+  int fd = open(cgroup_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1) err(EXIT_FAILURE, "open-cgroup %s", cgroup_path);
+  return fd;
+}
 
+int attach_cgroup(pid_t pid, const char *cgroup_base_path,
+                  const char *container_id) {
+  char cgroup_path[PATH_MAX];
   snprintf(cgroup_path, PATH_MAX, "%s/%s/cgroup.procs", cgroup_base_path,
            container_id);
   int fd = open(cgroup_path, O_WRONLY);
@@ -53,6 +62,13 @@ int setup_cgroup(pid_t pid, const char *cgroup_base_path,
   return 0;
 }
 
+int update_cgroup(const char *cgroup_base_path, const char *container_id,
+                  const pairs_t *limits) {
+  char cgroup_path[PATH_MAX];
+  snprintf(cgroup_path, PATH_MAX, "%s/%s", cgroup_base_path, container_id);
+  return setup_limits(cgroup_path, limits);
+}
+
 int cleanup_cgroup(const char *cgroup_base_path, const char *container_id) {
   char cgroup_path[PATH_MAX];
   snprintf(cgroup_path, PATH_MAX, "%s/%s", cgroup_base_path, container_id);
@@ -60,3 +76,145 @@ int cleanup_cgroup(const char *cgroup_base_path, const char *container_id) {
   if (rmdir(cgroup_path)) err(EXIT_FAILURE, "rmdir-cgroup_path");
   return 0;
 }
+
+bool valid_limit(const char *value) {
+  if (strcmp(value, "max") == 0) return true;
+  if (*value == '\0') return false;
+  for (const char *cur = value; *cur; cur++)
+    if (!isdigit((unsigned char)*cur)) return false;
+  return true;
+}
+
+// whether the space separated list in the file has word
+static bool file_has_word(const char *path, const char *word) {
+  char buf[1024];
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) return false;
+  ssize_t len = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (len <= 0) return false;
+  buf[len] = '\0';
+  size_t word_len = strlen(word);
+  for (char *cur = strtok(buf, " \n"); cur; cur = strtok(NULL, " \n"))
+    if (strlen(cur) == word_len && strcmp(cur, word) == 0) return true;
+  return false;
+}
+
+void enable_controller(const char *cgroup_base_path, const char *controller) {
+  char path[PATH_MAX + 32];
+  snprintf(path, sizeof(path), "%s/cgroup.subtree_control", cgroup_base_path);
+  if (file_has_word(path, controller)) return;
+  snprintf(path, sizeof(path), "%s/cgroup.controllers", cgroup_base_path);
+  // a v1 hierarchy is its controller
+  if (access(path, F_OK) == -1) return;
+  if (!file_has_word(path, controller)) {
+    // available once the parent enables it, unless base is the root
+    char parent[PATH_MAX];
+    snprintf(parent, sizeof(parent), "%s", cgroup_base_path);
+    char *slash = strrchr(parent, '/');
+    if (slash) *slash = '\0';
+    snprintf(path, sizeof(path), "%s/cgroup.controllers", parent);
+    if (slash == NULL || slash == parent || access(path, F_OK) == -1)
+      errx(EXIT_FAILURE, "cgroup controller %s is not available in %s",
+           controller, cgroup_base_path);
+    enable_controller(parent, controller);
+  }
+  debug("Enabling cgroup controller %s in %s\n", controller, cgroup_base_path);
+  snprintf(path, sizeof(path), "%s/cgroup.subtree_control", cgroup_base_path);
+  int fd = open(path, O_WRONLY | O_CLOEXEC);
+  if (fd == -1) err(EXIT_FAILURE, "open %s", path);
+  // fails with EBUSY while base has processes of its own
+  if (dprintf(fd, "+%s", controller) < 0)
+    err(EXIT_FAILURE, "enable cgroup controller %s in %s", controller,
+        cgroup_base_path);
+  close(fd);
+}
+
+void prepare_cgroup(const char *cgroup_base_path, const pairs_t *limits) {
+  char path[PATH_MAX + 50];
+  snprintf(path, sizeof(path), "%s/cgroup.controllers", cgroup_base_path);
+  bool v2 = access(path, F_OK) == 0;
+  // the v2 root has no interface files of its controllers to check against
+  snprintf(path, sizeof(path), "%s/cgroup.type", cgroup_base_path);
+  bool root = v2 && access(path, F_OK) == -1;
+  for (unsigned int i = 0; i < limits->count; i++) {
+    const char *key = limits->items[i].key;
+    const char *dot = strchr(key, '.');
+    if (dot == NULL || dot == key || strchr(key, '/') ||
+        strlen(key) >= 50)
+      errx(EXIT_FAILURE, "invalid cgroup limit %s", key);
+    if (v2) {
+      char controller[50];
+      snprintf(controller, sizeof(controller), "%.*s", (int)(dot - key), key);
+      // the core files need no controller
+      if (strcmp(controller, "cgroup") != 0)
+        enable_controller(cgroup_base_path, controller);
+    }
+    // children have the files of their parent, so a limit the kernel lacks,
+    // like a huge page size it does not have, fails before the clone
+    snprintf(path, sizeof(path), "%s/%s", cgroup_base_path, key);
+    if (!root && access(path, F_OK) == -1)
+      errx(EXIT_FAILURE, "cgroup limit %s is not supported by %s", key,
+           cgroup_base_path);
+  }
+}
+
+// "MAJOR:MINOR" of a block device path or of the number itself
+static int device_number(const char *device, char *buf, size_t size) {
+  unsigned int major_number, minor_number;
+  int len;
+  if (device[0] != '/') {
+    if (sscanf(device, "%u:%u%n", &major_number, &minor_number, &len) != 2 ||
+        device[len])
+      return -1;
+  } else {
+    struct stat st;
+    if (stat(device, &st) == -1 || !S_ISBLK(st.st_mode)) return -1;
+    major_number = major(st.st_rdev);
+    minor_number = minor(st.st_rdev);
+  }
+  snprintf(buf, size, "%u:%u", major_number, minor_number);
+  return 0;
+}
+
+int format_io_limit(const char *key, const char *spec, char *line,
+                    size_t size) {
+  char device[PATH_MAX], number[32];
+  const char *value = strrchr(spec, ':');
+  if (value == NULL) {
+    // only a weight has a default for every device
+    if (strcmp(key, "io.weight") || !valid_limit(spec) ||
+        strcmp(spec, "max") == 0)
+      return -1;
+    snprintf(line, size, "default %s", spec);
+    return 0;
+  }
+  snprintf(device, sizeof(device), "%.*s", (int)(value - spec), spec);
+  value++;
+  if (device_number(device, number, sizeof(number)) == -1) return -1;
+  if (strcmp(key, "io.weight") == 0) {
+    if (!valid_limit(value) || strcmp(value, "max") == 0) return -1;
+    snprintf(line, size, "%s %s", number, value);
+  } else if (strcmp(key, "io.latency") == 0) {
+    if (!valid_limit(value) || strcmp(value, "max") == 0) return -1;
+    snprintf(line, size, "%s target=%s", number, value);
+  } else if (strcmp(key, "io.max") == 0) {
+    size_t len = snprintf(line, size, "%s", number);
+    char settings[256];
+    snprintf(settings, sizeof(settings), "%s", value);
+    for (char *cur = strtok(settings, ","); cur; cur = strtok(NULL, ",")) {
+      char *eq = strchr(cur, '=');
+      if (eq == NULL || !valid_limit(eq + 1)) return -1;
+      *eq = '\0';
+      if (strcmp(cur, "rbps") && strcmp(cur, "wbps") && strcmp(cur, "riops") &&
+          strcmp(cur, "wiops"))
+        return -1;
+      len += snprintf(line + len, len < size ? size - len : 0, " %s=%s", cur,
+                      eq + 1);
+    }
+    if (len >= size || strchr(line, ' ') == NULL) return -1;
+  } else {
+    return -1;
+  }
+  return 0;
+}
@@ -1,10 +1,34 @@
 #ifndef _CGROUP_H_
 #define _CGROUP_H_
 
+#include <stdbool.h>
 #include <sys/types.h>
 
 #include "type.h"
-int setup_cgroup(pid_t pid, const char *cgroup_base_path,
-                 const char *container_id, const list_t *limits_list);
+
+// make the controllers the limits need available to containers under base
+// before any is created: on cgroup v2 they are enabled in its
+// cgroup.subtree_control, on v1 the limit files must exist. exits naming the
+// first limit that cannot be applied
+void prepare_cgroup(const char *cgroup_base_path, const pairs_t *limits);
+// enable one controller on cgroup v2, nothing to do on v1
+void enable_controller(const char *cgroup_base_path, const char *controller);
+// the line written for a command line io limit. io.max takes
+// "DEVICE:KEY=VALUE[,KEY=VALUE...]" with rbps, wbps, riops and wiops,
+// io.weight "[DEVICE:]WEIGHT" and io.latency "DEVICE:TARGET_US". DEVICE is a
+// block device path or MAJOR:MINOR
+int format_io_limit(const char *key, const char *spec, char *line,
+                    size_t size);
+// a number or "max"
+bool valid_limit(const char *value);
+// create the container's cgroup with its limits applied, returns a directory
+// fd usable with CLONE_INTO_CGROUP
+int create_cgroup(const char *cgroup_base_path, const char *container_id,
+                  const pairs_t *limits);
+// move pid into an existing container cgroup
+int attach_cgroup(pid_t pid, const char *cgroup_base_path,
+                  const char *container_id);
+int update_cgroup(const char *cgroup_base_path, const char *container_id,
+                  const pairs_t *limits);
 int cleanup_cgroup(const char *cgroup_base_path, const char *container_id);
 #endif
\ No newline at end of file
@@ -0,0 +1,919 @@
+#define _GNU_SOURCE
+#include "console.h"
+
+#include <dirent.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "container.h"
+#include "log.h"
+
+#define CONSOLE_EVENTS_MAX 64
+// how long the relay waits for a slow terminal to take the last output of
+// a container
+#define CONSOLE_FLUSH_TIMEOUT_MS 1000
+// ctrl-p ctrl-q leaves an attached container running
+#define DETACH_KEY_1 0x10
+#define DETACH_KEY_2 0x11
+
+// which stdio fds follow a request, in this order
+#define REQUEST_STDIN 0x1
+#define REQUEST_STDOUT 0x2
+#define REQUEST_STDERR 0x4
+
+struct console_request {
+  char id[CONTAINER_ID_LEN_MAX + 1];
+  char log_path[PATH_MAX];
+  bool tty;
+  unsigned int fds;
+};
+
+enum source_kind {
+  SOURCE_CONTROL = 0,
+  SOURCE_SIGNAL,
+  SOURCE_STDIN,
+  SOURCE_STREAM,
+  SOURCE_LISTEN,
+  SOURCE_VIEWER
+};
+
+struct source {
+  enum source_kind kind;
+  void *owner;
+};
+
+struct console;
+
+// something watching the output, the terminal or an attached client. it is
+// fed through its own pipe by tee, so a slow viewer only ever misses output
+// and never holds up the container or its log
+struct viewer {
+  struct source source;
+  // the console of a client, whose socket also carries its input
+  struct console *console;
+  int pipe[2];
+  int fd;
+  // always polled for, on top of EPOLLOUT while the pipe backs up
+  unsigned int events;
+  unsigned int polled;
+  bool backed_up;
+};
+
+// the container's stdout or stderr, or its pty master. a pty goes through a
+// staging pipe first, only pipes can be tee'd
+struct stream {
+  struct source source;
+  struct console *console;
+  int fd;
+  int stage[2];
+  struct viewer *terminal;
+  bool open;
+};
+
+struct console {
+  char id[CONTAINER_ID_LEN_MAX + 1];
+  bool tty;
+  struct stream streams[2];
+  int open_streams;
+  // the container's stdin, -1 if it has none of ours
+  int input;
+  int input_stage[2];
+  char log_path[PATH_MAX];
+  int log_fd;
+  unsigned long long log_written;
+  char socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+  int listen_fd;
+  struct source listen_source;
+  struct viewer client;
+  struct console *next;
+};
+
+struct relay {
+  int epoll_fd;
+  int control_fd;
+  int null_fd;
+  unsigned long long log_size;
+  int log_files;
+  // stdout and stderr of the launcher, unused when it detached
+  struct viewer terminal[2];
+  // the pty that gets the launcher's stdin and window size
+  struct console *foreground;
+  struct source stdin_source;
+  bool stdin_watched;
+  bool stdin_closed;
+  struct console *consoles;
+};
+
+static struct console_options relay_options;
+static int control_fd = -1;
+static pid_t relay_pid = -1;
+static int detach_fd = -1;
+static struct termios saved_termios;
+static bool raw_mode;
+
+static void epoll_add(struct relay *relay, int fd, unsigned int events,
+                      struct source *source) {
+  struct epoll_event event = {.events = events, .data.ptr = source};
+  if (epoll_ctl(relay->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+    warn("epoll_ctl: %s\n", strerror(errno));
+}
+
+static void set_pipe_size(int fd) {
+  // best effort, unprivileged users are capped by pipe-max-size
+  fcntl(fd, F_SETPIPE_SZ, CONSOLE_CHUNK_SIZE);
+}
+
+static bool viewer_active(const struct viewer *viewer) {
+  return viewer->fd != -1;
+}
+
+static void viewer_poll(struct relay *relay, struct viewer *viewer,
+                        bool backed_up) {
+  viewer->backed_up = backed_up;
+  unsigned int events = viewer->events | (backed_up ? EPOLLOUT : 0);
+  if (events == viewer->polled) return;
+  struct epoll_event event = {.events = events, .data.ptr = &viewer->source};
+  int op = !viewer->polled ? EPOLL_CTL_ADD
+           : events        ? EPOLL_CTL_MOD
+                           : EPOLL_CTL_DEL;
+  // regular files never back up and cannot be polled
+  if (epoll_ctl(relay->epoll_fd, op, viewer->fd, &event) == 0)
+    viewer->polled = events;
+}
+
+static void viewer_close(struct relay *relay, struct viewer *viewer) {
+  if (viewer->polled)
+    epoll_ctl(relay->epoll_fd, EPOLL_CTL_DEL, viewer->fd, NULL);
+  viewer->polled = 0;
+  viewer->backed_up = false;
+  if (viewer->console) close(viewer->fd);
+  viewer->fd = -1;
+  close(viewer->pipe[0]);
+  close(viewer->pipe[1]);
+  viewer->pipe[0] = viewer->pipe[1] = -1;
+}
+
+static int viewer_open(struct viewer *viewer, int fd) {
+  if (pipe2(viewer->pipe, O_CLOEXEC | O_NONBLOCK) == -1) return -1;
+  set_pipe_size(viewer->pipe[1]);
+  viewer->fd = fd;
+  if (viewer->console) viewer->events = EPOLLIN;
+  return 0;
+}
+
+// splice from a pipe, or copy where splice is refused, as for files opened
+// for appending
+static ssize_t splice_out(int pipe_fd, int fd, size_t len, unsigned int flags) {
+  ssize_t n = splice(pipe_fd, NULL, fd, NULL, len, flags);
+  if (n != -1 || errno != EINVAL) return n;
+  char buf[PIPE_BUF];
+  n = read(pipe_fd, buf, len < sizeof(buf) ? len : sizeof(buf));
+  if (n <= 0) return n;
+  for (ssize_t done = 0; done < n;) {
+    ssize_t written = write(fd, buf + done, n - done);
+    if (written == -1) return -1;
+    done += written;
+  }
+  return n;
+}
+
+// move what the viewer's pipe holds on to it, -1 once it is gone
+static int viewer_flush(struct relay *relay, struct viewer *viewer) {
+  for (;;) {
+    int pending = 0;
+    ioctl(viewer->pipe[0], FIONREAD, &pending);
+    if (pending == 0) {
+      viewer_poll(relay, viewer, false);
+      return 0;
+    }
+    ssize_t n = splice_out(viewer->pipe[0], viewer->fd, pending,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (n > 0) continue;
+    if (n == -1 && errno == EINTR) continue;
+    if (n == -1 && errno == EAGAIN) {
+      viewer_poll(relay, viewer, true);
+      return 0;
+    }
+    return -1;
+  }
+}
+
+static void drop_client(struct relay *relay, struct console *console) {
+  if (!viewer_active(&console->client)) return;
+  debug("Client detached from %s\n", console->id);
+  viewer_close(relay, &console->client);
+}
+
+static void feed(struct relay *relay, struct console *console,
+                 struct viewer *viewer, int in, size_t len) {
+  if (!viewer_active(viewer)) return;
+  // with a full pipe this part of the output is skipped for the viewer
+  if (tee(in, viewer->pipe[1], len, SPLICE_F_NONBLOCK) == -1 &&
+      errno != EAGAIN)
+    return;
+  if (viewer_flush(relay, viewer) == 0) return;
+  if (viewer->console) {
+    drop_client(relay, console);
+  } else {
+    // the terminal is gone, keep logging
+    viewer_poll(relay, viewer, false);
+    viewer->fd = -1;
+  }
+}
+
+static void rotate_log(struct relay *relay, struct console *console) {
+  close(console->log_fd);
+  console->log_fd = -1;
+  console->log_written = 0;
+  char from[PATH_MAX + 16], to[PATH_MAX + 16];
+  for (int i = relay->log_files - 1; i > 0; i--) {
+    snprintf(from, sizeof(from), "%s.%d", console->log_path, i - 1);
+    snprintf(to, sizeof(to), "%s.%d", console->log_path, i);
+    rename(i == 1 ? console->log_path : from, to);
+  }
+  if (relay->log_files <= 1) unlink(console->log_path);
+}
+
+static int open_log(struct relay *relay, struct console *console) {
+  if (console->log_fd != -1) return console->log_fd;
+  // splice refuses files opened for appending, the relay is the only writer
+  console->log_fd = open(console->log_path, O_WRONLY | O_CREAT | O_CLOEXEC,
+                         0640);
+  if (console->log_fd == -1) {
+    // the container directory is gone already with --rm
+    console->log_fd = dup(relay->null_fd);
+    return console->log_fd;
+  }
+  off_t end = lseek(console->log_fd, 0, SEEK_END);
+  console->log_written = end > 0 ? end : 0;
+  return console->log_fd;
+}
+
+static void write_log(struct relay *relay, struct console *console, int in,
+                      size_t len) {
+  if (relay->log_size && console->log_written &&
+      console->log_written + len > relay->log_size)
+    rotate_log(relay, console);
+  int fd = open_log(relay, console);
+  while (len) {
+    ssize_t n = splice(in, NULL, fd, NULL, len, SPLICE_F_MOVE);
+    if (n == -1 && errno == EINTR) continue;
+    if (n <= 0) {
+      // never leave output in the pipe, the container would block on it
+      warn("Failed to write log of %s: %s\n", console->id, strerror(errno));
+      n = splice(in, NULL, relay->null_fd, NULL, len, SPLICE_F_MOVE);
+      if (n <= 0) return;
+    }
+    len -= n;
+    console->log_written += n;
+  }
+}
+
+static ssize_t stage(struct stream *stream) {
+  ssize_t n = splice(stream->fd, NULL, stream->stage[1], NULL,
+                     CONSOLE_CHUNK_SIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  if (n != -1 || errno != EINVAL) return n;
+  // kernels before 6.5 cannot splice from a tty
+  static char buf[PIPE_BUF];
+  n = read(stream->fd, buf, sizeof(buf));
+  if (n > 0 && write(stream->stage[1], buf, n) != n) return -1;
+  return n;
+}
+
+static void close_stream(struct relay *relay, struct stream *stream) {
+  if (!stream->open) return;
+  epoll_ctl(relay->epoll_fd, EPOLL_CTL_DEL, stream->fd, NULL);
+  close(stream->fd);
+  if (stream->stage[0] != -1) {
+    close(stream->stage[0]);
+    close(stream->stage[1]);
+  }
+  stream->open = false;
+  stream->console->open_streams--;
+}
+
+static void pump(struct relay *relay, struct stream *stream,
+                 unsigned int events) {
+  struct console *console = stream->console;
+  int in = stream->fd;
+  if (stream->stage[0] != -1) {
+    in = stream->stage[0];
+    ssize_t n = stage(stream);
+    // a pty master reads EIO once the last slave is closed
+    if (n == 0 || (n == -1 && errno != EAGAIN && errno != EINTR)) {
+      close_stream(relay, stream);
+      return;
+    }
+  }
+  int len = 0;
+  ioctl(in, FIONREAD, &len);
+  if (len == 0) {
+    if (events & (EPOLLHUP | EPOLLERR)) close_stream(relay, stream);
+    return;
+  }
+  if (stream->terminal) feed(relay, console, stream->terminal, in, len);
+  feed(relay, console, &console->client, in, len);
+  write_log(relay, console, in, len);
+}
+
+// take input from the client or the launcher's stdin, 0 at its end
+static ssize_t forward_input(struct relay *relay, struct console *console,
+                             int fd) {
+  ssize_t n = splice(fd, NULL, console->input_stage[1], NULL,
+                     CONSOLE_CHUNK_SIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  if (n <= 0) return n == -1 && errno == EAGAIN ? 1 : 0;
+  int len = 0;
+  ioctl(console->input_stage[0], FIONREAD, &len);
+  int out = console->input != -1 ? console->input : relay->null_fd;
+  // a container not reading its input keeps the rest staged
+  if (splice(console->input_stage[0], NULL, out, NULL, len,
+             SPLICE_F_MOVE | SPLICE_F_NONBLOCK) == -1 &&
+      errno != EAGAIN)
+    warn("Failed to forward input to %s: %s\n", console->id, strerror(errno));
+  return n;
+}
+
+static void sync_window_size(struct relay *relay) {
+  struct winsize size;
+  if (relay->foreground == NULL ||
+      ioctl(STDIN_FILENO, TIOCGWINSZ, &size) == -1)
+    return;
+  ioctl(relay->foreground->input, TIOCSWINSZ, &size);
+}
+
+// only a foreground pty reads the launcher's input, with pipes the container
+// inherits stdin
+static void watch_stdin(struct relay *relay, bool watch) {
+  if (watch == relay->stdin_watched || (watch && relay->stdin_closed)) return;
+  struct epoll_event event = {.events = EPOLLIN,
+                              .data.ptr = &relay->stdin_source};
+  if (epoll_ctl(relay->epoll_fd, watch ? EPOLL_CTL_ADD : EPOLL_CTL_DEL,
+                STDIN_FILENO, &event) == 0)
+    relay->stdin_watched = watch;
+}
+
+static void remove_console(struct relay *relay, struct console *console) {
+  // the last output of a foreground container is worth a short wait
+  for (int i = 0; i < 2; i++) {
+    struct viewer *terminal = &relay->terminal[i];
+    for (int waited = 0; viewer_active(terminal) && terminal->backed_up &&
+                         waited < CONSOLE_FLUSH_TIMEOUT_MS;
+         waited += 10) {
+      poll(&(struct pollfd){.fd = terminal->fd, .events = POLLOUT}, 1, 10);
+      if (viewer_flush(relay, terminal) == -1) break;
+    }
+  }
+  drop_client(relay, console);
+  epoll_ctl(relay->epoll_fd, EPOLL_CTL_DEL, console->listen_fd, NULL);
+  close(console->listen_fd);
+  unlink(console->socket_path);
+  if (console->input != -1) close(console->input);
+  close(console->input_stage[0]);
+  close(console->input_stage[1]);
+  if (console->log_fd != -1) close(console->log_fd);
+  if (relay->foreground == console) {
+    relay->foreground = NULL;
+    watch_stdin(relay, false);
+  }
+  for (struct console **cur = &relay->consoles; *cur; cur = &(*cur)->next) {
+    if (*cur == console) {
+      *cur = console->next;
+      break;
+    }
+  }
+  debug("Console of %s closed\n", console->id);
+  free(console);
+}
+
+static int listen_socket(struct console *console) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  snprintf(console->socket_path, sizeof(console->socket_path), "%s/%s.sock",
+           CONSOLE_RUN_DIR, console->id);
+  strcpy(addr.sun_path, console->socket_path);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+  if (fd == -1) return -1;
+  unlink(addr.sun_path);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+      chmod(addr.sun_path, 0600) == -1 || listen(fd, 4) == -1) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static void add_console(struct relay *relay, const struct console_request *req,
+                        int *fds, int count) {
+  struct console *console = calloc(1, sizeof(struct console));
+  memcpy(console->id, req->id, sizeof(console->id));
+  console->id[CONTAINER_ID_LEN_MAX] = '\0';
+  memcpy(console->log_path, req->log_path, sizeof(console->log_path));
+  console->log_path[PATH_MAX - 1] = '\0';
+  console->tty = req->tty;
+  console->log_fd = -1;
+  console->input = -1;
+  console->client = (struct viewer){.source = {SOURCE_VIEWER},
+                                    .console = console,
+                                    .pipe = {-1, -1},
+                                    .fd = -1,
+                                    .events = EPOLLIN};
+  console->client.source.owner = &console->client;
+  if (pipe2(console->input_stage, O_CLOEXEC | O_NONBLOCK) == -1)
+    err(EXIT_FAILURE, "pipe");
+
+  int next = 0;
+  if (req->fds & REQUEST_STDIN && next < count) console->input = fds[next++];
+  for (int i = 0; i < 2; i++) {
+    if (!(req->fds & (i ? REQUEST_STDERR : REQUEST_STDOUT)) || next >= count)
+      continue;
+    struct stream *stream = &console->streams[i];
+    *stream = (struct stream){.source = {SOURCE_STREAM, stream},
+                              .console = console,
+                              .fd = fds[next++],
+                              .stage = {-1, -1},
+                              .open = true};
+    if (viewer_active(&relay->terminal[i]))
+      stream->terminal = &relay->terminal[i];
+    struct stat st;
+    if (fstat(stream->fd, &st) == 0 && !S_ISFIFO(st.st_mode)) {
+      if (pipe2(stream->stage, O_CLOEXEC | O_NONBLOCK) == -1)
+        err(EXIT_FAILURE, "pipe");
+      set_pipe_size(stream->stage[1]);
+    }
+    fcntl(stream->fd, F_SETFL, O_NONBLOCK);
+    console->open_streams++;
+    epoll_add(relay, stream->fd, EPOLLIN, &stream->source);
+  }
+  if (console->tty && console->streams[0].open) {
+    // the master is both ends, our own description of it
+    console->input = dup(console->streams[0].fd);
+    if (viewer_active(&relay->terminal[0])) {
+      relay->foreground = console;
+      sync_window_size(relay);
+      watch_stdin(relay, true);
+    }
+  }
+  if (console->input != -1) fcntl(console->input, F_SETFL, O_NONBLOCK);
+
+  console->listen_fd = listen_socket(console);
+  if (console->listen_fd == -1)
+    warn("Cannot listen on %s: %s\n", console->socket_path, strerror(errno));
+  console->listen_source = (struct source){SOURCE_LISTEN, console};
+  if (console->listen_fd != -1)
+    epoll_add(relay, console->listen_fd, EPOLLIN, &console->listen_source);
+  console->next = relay->consoles;
+  relay->consoles = console;
+  debug("Console of %s open, %d streams\n", console->id,
+        console->open_streams);
+  if (console->open_streams == 0) remove_console(relay, console);
+}
+
+// returns false once the launcher closed the control socket
+static bool on_control(struct relay *relay) {
+  struct console_request req;
+  int fds[3];
+  char control[CMSG_SPACE(sizeof(fds))];
+  struct iovec iov = {.iov_base = &req, .iov_len = sizeof(req)};
+  struct msghdr msg = {.msg_iov = &iov,
+                       .msg_iovlen = 1,
+                       .msg_control = control,
+                       .msg_controllen = sizeof(control)};
+  ssize_t len = recvmsg(relay->control_fd, &msg, MSG_CMSG_CLOEXEC);
+  if (len <= 0) return false;
+  int count = 0;
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+    count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    memcpy(fds, CMSG_DATA(cmsg), count * sizeof(int));
+  }
+  if (len != sizeof(req)) {
+    for (int i = 0; i < count; i++) close(fds[i]);
+    return true;
+  }
+  add_console(relay, &req, fds, count);
+  return true;
+}
+
+static void on_listen(struct relay *relay, struct console *console) {
+  int fd;
+  while ((fd = accept4(console->listen_fd, NULL, NULL,
+                       SOCK_CLOEXEC | SOCK_NONBLOCK)) != -1) {
+    // one client at a time
+    if (viewer_active(&console->client) || viewer_open(&console->client, fd)) {
+      close(fd);
+      continue;
+    }
+    char kind = console->tty ? 't' : 'p';
+    if (send(fd, &kind, 1, MSG_NOSIGNAL) != 1) {
+      drop_client(relay, console);
+      continue;
+    }
+    viewer_poll(relay, &console->client, false);
+    debug("Client attached to %s\n", console->id);
+  }
+}
+
+static void on_viewer(struct relay *relay, struct viewer *viewer,
+                      unsigned int events) {
+  if (!viewer_active(viewer)) return;
+  struct console *console = viewer->console;
+  if (console && events & EPOLLIN &&
+      forward_input(relay, console, viewer->fd) == 0) {
+    // the client is done sending but still gets the output
+    viewer->events = 0;
+    viewer_poll(relay, viewer, viewer->backed_up);
+  }
+  if (events & (EPOLLOUT | EPOLLERR | EPOLLHUP) &&
+      viewer_flush(relay, viewer) == -1) {
+    if (console) {
+      drop_client(relay, console);
+    } else {
+      viewer_poll(relay, viewer, false);
+      viewer->fd = -1;
+    }
+  }
+}
+
+// the launcher's stdout and stderr, through descriptions of their own so
+// they can be non-blocking without affecting anyone else sharing them
+static void open_terminal(struct viewer *viewer, int fd) {
+  *viewer = (struct viewer){.source = {SOURCE_VIEWER, viewer},
+                            .pipe = {-1, -1},
+                            .fd = -1};
+  struct stat st;
+  if (fstat(fd, &st) == -1) return;
+  int own = -1;
+  if (!S_ISREG(st.st_mode)) {
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+    own = open(path, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+  }
+  if (own == -1) own = dup(fd);
+  if (viewer_open(viewer, own) == -1) close(own);
+}
+
+static void relay_main(int fd, const struct console_options *options) {
+  prctl(PR_SET_NAME, "mc-console");
+  struct relay relay = {.control_fd = fd,
+                        .log_size = options->log_size,
+                        .log_files = options->log_files};
+  // the launcher's interrupt is the container's business, the relay keeps
+  // going until every container it serves has closed its output
+  sigset_t mask;
+  sigfillset(&mask);
+  sigprocmask(SIG_BLOCK, &mask, NULL);
+  relay.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (relay.epoll_fd == -1) err(EXIT_FAILURE, "epoll_create1");
+  relay.null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  if (relay.null_fd == -1) err(EXIT_FAILURE, "open /dev/null");
+  for (int i = 0; i < 2; i++) {
+    relay.terminal[i] = (struct viewer){.pipe = {-1, -1}, .fd = -1};
+    if (!options->detach) open_terminal(&relay.terminal[i], i + 1);
+  }
+  struct source control = {SOURCE_CONTROL};
+  epoll_add(&relay, fd, EPOLLIN, &control);
+  sigset_t winch;
+  sigemptyset(&winch);
+  sigaddset(&winch, SIGWINCH);
+  struct source signal = {SOURCE_SIGNAL};
+  int signal_fd = signalfd(-1, &winch, SFD_CLOEXEC | SFD_NONBLOCK);
+  if (signal_fd != -1) epoll_add(&relay, signal_fd, EPOLLIN, &signal);
+  relay.stdin_source = (struct source){SOURCE_STDIN};
+
+  bool closing = false;
+  struct epoll_event events[CONSOLE_EVENTS_MAX];
+  while (!closing || relay.consoles) {
+    int count = epoll_wait(relay.epoll_fd, events, CONSOLE_EVENTS_MAX, -1);
+    if (count == -1 && errno == EINTR) continue;
+    if (count == -1) err(EXIT_FAILURE, "epoll_wait");
+    for (int i = 0; i < count; i++) {
+      struct source *source = events[i].data.ptr;
+      switch (source->kind) {
+        case SOURCE_CONTROL:
+          if (!on_control(&relay)) {
+            epoll_ctl(relay.epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+            closing = true;
+          }
+          break;
+        case SOURCE_SIGNAL: {
+          struct signalfd_siginfo siginfo;
+          while (read(signal_fd, &siginfo, sizeof(siginfo)) > 0) continue;
+          sync_window_size(&relay);
+          break;
+        }
+        case SOURCE_STDIN:
+          if (relay.foreground &&
+              forward_input(&relay, relay.foreground, STDIN_FILENO) == 0) {
+            watch_stdin(&relay, false);
+            relay.stdin_closed = true;
+          }
+          break;
+        case SOURCE_STREAM: {
+          struct stream *stream = source->owner;
+          // an earlier event of this round may have closed it already
+          if (!stream->open) break;
+          pump(&relay, stream, events[i].events);
+          if (stream->console->open_streams == 0)
+            remove_console(&relay, stream->console);
+          break;
+        }
+        case SOURCE_LISTEN:
+          on_listen(&relay, source->owner);
+          break;
+        case SOURCE_VIEWER:
+          on_viewer(&relay, source->owner, events[i].events);
+          break;
+      }
+    }
+  }
+  _exit(EXIT_SUCCESS);
+}
+
+void console_start(const struct console_options *options) {
+  relay_options = *options;
+  if (!options->capture) return;
+  if (mkdir(CONSOLE_RUN_DIR, 0700) == -1 && errno != EEXIST)
+    err(EXIT_FAILURE, "mkdir %s", CONSOLE_RUN_DIR);
+  int sockets[2];
+  if (socketpair(AF_LOCAL, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets))
+    err(EXIT_FAILURE, "socketpair");
+  pid_t pid = fork();
+  if (pid == -1) err(EXIT_FAILURE, "fork-console");
+  if (pid == 0) {
+    close(sockets[0]);
+    // the control sockets of other helpers would keep them from ending
+    int fd = fcntl(sockets[1], F_DUPFD_CLOEXEC, STDERR_FILENO + 1);
+    close_range(STDERR_FILENO + 1, fd - 1, 0);
+    close_range(fd + 1, ~0U, 0);
+    relay_main(fd, options);
+  }
+  close(sockets[1]);
+  control_fd = sockets[0];
+  relay_pid = pid;
+}
+
+void console_stop() {
+  if (control_fd == -1) return;
+  close(control_fd);
+  control_fd = -1;
+  waitpid(relay_pid, NULL, 0);
+}
+
+static void restore_terminal() {
+  if (raw_mode) tcsetattr(STDIN_FILENO, TCSADRAIN, &saved_termios);
+  raw_mode = false;
+}
+
+// keystrokes go to the pty as they are typed, the container's line
+// discipline does the echoing and editing. output processing stays on so
+// the launcher's own messages still line up
+static void make_raw(bool output) {
+  if (raw_mode || !isatty(STDIN_FILENO) ||
+      tcgetattr(STDIN_FILENO, &saved_termios) == -1)
+    return;
+  struct termios raw = saved_termios;
+  cfmakeraw(&raw);
+  if (!output) raw.c_oflag = saved_termios.c_oflag;
+  if (tcsetattr(STDIN_FILENO, TCSADRAIN, &raw) == -1) return;
+  raw_mode = true;
+  atexit(restore_terminal);
+}
+
+void console_prepare(struct container_config *config,
+                     struct container *container) {
+  for (int i = 0; i < 3; i++)
+    config->stdio_fds[i] = container->console_fds[i] = -1;
+  if (!config->console.capture || config->console.tty) return;
+  for (int i = 0; i < 3; i++) {
+    // a foreground container reads the launcher's stdin directly
+    if (i == STDIN_FILENO && !config->console.detach) continue;
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1) err(EXIT_FAILURE, "pipe");
+    int child = i == STDIN_FILENO ? fds[0] : fds[1];
+    int launcher = i == STDIN_FILENO ? fds[1] : fds[0];
+    if (i != STDIN_FILENO) set_pipe_size(launcher);
+    config->stdio_fds[i] = child;
+    container->console_fds[i] = launcher;
+  }
+}
+
+int console_setup_child(const struct container_config *config) {
+  if (!config->console.capture) return -1;
+  if (!config->console.tty) {
+    for (int i = 0; i < 3; i++) {
+      if (config->stdio_fds[i] == -1) continue;
+      if (dup2(config->stdio_fds[i], i) == -1) err(EXIT_FAILURE, "dup2");
+      close(config->stdio_fds[i]);
+    }
+    return -1;
+  }
+  // from the container's own devpts instance, so the name resolves inside
+  int master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+  if (master == -1) err(EXIT_FAILURE, "posix_openpt");
+  char name[64];
+  if (unlockpt(master) == -1 || ptsname_r(master, name, sizeof(name)))
+    err(EXIT_FAILURE, "unlockpt");
+  int slave = open(name, O_RDWR | O_CLOEXEC);
+  if (slave == -1) err(EXIT_FAILURE, "open %s", name);
+  if (setsid() == -1) err(EXIT_FAILURE, "setsid");
+  if (ioctl(slave, TIOCSCTTY, 0) == -1) err(EXIT_FAILURE, "TIOCSCTTY");
+  for (int i = 0; i < 3; i++)
+    if (dup2(slave, i) == -1) err(EXIT_FAILURE, "dup2");
+  close(slave);
+  return master;
+}
+
+void console_release(struct container *container) {
+  for (int i = 0; i < 3; i++) {
+    if (container->console_fds[i] != -1) close(container->console_fds[i]);
+    container->console_fds[i] = -1;
+  }
+}
+
+void console_register(struct container *container, int master) {
+  const struct container_config *config = &container->config;
+  if (control_fd == -1 || !config->console.capture) {
+    if (master != -1) close(master);
+    console_release(container);
+    return;
+  }
+  struct console_request req = {.tty = master != -1};
+  snprintf(req.id, sizeof(req.id), "%s", config->id);
+  snprintf(req.log_path, sizeof(req.log_path), "%s/%s/%s",
+           config->container_base, config->id, CONSOLE_LOG_NAME);
+  int fds[3], count = 0;
+  if (master != -1) {
+    req.fds = REQUEST_STDOUT;
+    fds[count++] = master;
+  } else {
+    for (int i = 0; i < 3; i++) {
+      if (container->console_fds[i] == -1) continue;
+      req.fds |= 1 << i;
+      fds[count++] = container->console_fds[i];
+    }
+  }
+  char control[CMSG_SPACE(sizeof(fds))] = {0};
+  struct iovec iov = {.iov_base = &req, .iov_len = sizeof(req)};
+  struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+  if (count) {
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(count * sizeof(int));
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(count * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, count * sizeof(int));
+  }
+  if (sendmsg(control_fd, &msg, MSG_NOSIGNAL) != sizeof(req))
+    warn("Failed to relay the output of %s\n", config->id);
+  if (master != -1) close(master);
+  console_release(container);
+  if (master != -1 && !relay_options.detach) make_raw(false);
+}
+
+void console_detach() {
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) == -1) err(EXIT_FAILURE, "pipe");
+  pid_t pid = fork();
+  if (pid == -1) err(EXIT_FAILURE, "fork");
+  if (pid > 0) {
+    close(fds[1]);
+    // only up to the newline, helpers forked later hold the pipe open
+    char id[CONTAINER_ID_LEN_MAX + 2];
+    size_t len = 0;
+    while (len < sizeof(id) - 1) {
+      ssize_t n = read(fds[0], id + len, 1);
+      if (n == -1 && errno == EINTR) continue;
+      if (n <= 0 || id[len] == '\n') break;
+      len++;
+    }
+    if (len == 0) exit(EXIT_FAILURE);
+    id[len] = '\0';
+    printf("%s\n", id);
+    exit(EXIT_SUCCESS);
+  }
+  close(fds[0]);
+  setsid();
+  int null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+  if (null_fd == -1) err(EXIT_FAILURE, "open /dev/null");
+  // stderr stays, so failures before the container runs are still seen
+  dup2(null_fd, STDIN_FILENO);
+  dup2(null_fd, STDOUT_FILENO);
+  close(null_fd);
+  detach_fd = fds[1];
+}
+
+void console_detached(const char *id) {
+  if (detach_fd == -1) return;
+  if (dprintf(detach_fd, "%s\n", id) < 0) warn("Failed to report %s\n", id);
+  close(detach_fd);
+  detach_fd = -1;
+}
+
+static int find_socket(const char *prefix, char *path, size_t size) {
+  DIR *dir = opendir(CONSOLE_RUN_DIR);
+  if (dir == NULL) return -1;
+  int found = 0;
+  size_t prefix_len = strlen(prefix);
+  struct dirent *entry;
+  while ((entry = readdir(dir))) {
+    size_t len = strlen(entry->d_name);
+    if (len < 5 || strcmp(entry->d_name + len - 5, ".sock") ||
+        strncmp(entry->d_name, prefix, prefix_len))
+      continue;
+    if (found++) break;
+    snprintf(path, size, "%s/%s", CONSOLE_RUN_DIR, entry->d_name);
+  }
+  closedir(dir);
+  return found;
+}
+
+// copy keystrokes to the container, false once the user detached or the
+// input ended
+static bool send_input(int fd, bool tty, bool *escape) {
+  char buf[PIPE_BUF];
+  ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+  if (n <= 0) {
+    shutdown(fd, SHUT_WR);
+    return false;
+  }
+  ssize_t start = 0;
+  for (ssize_t i = 0; tty && i < n; i++) {
+    if (*escape && buf[i] == DETACH_KEY_2) return false;
+    *escape = buf[i] == DETACH_KEY_1;
+  }
+  while (start < n) {
+    ssize_t sent = send(fd, buf + start, n - start, MSG_NOSIGNAL);
+    if (sent == -1) return false;
+    start += sent;
+  }
+  return true;
+}
+
+int attach_main(int argc, char *argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s ID\n", argv[0]);
+    fprintf(stderr,
+            "Connect to the stdio of a running container, ctrl-p ctrl-q "
+            "detaches from a pty\n");
+    return EXIT_FAILURE;
+  }
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  int found = find_socket(argv[1], addr.sun_path, sizeof(addr.sun_path));
+  if (found == -1 || found == 0) errx(EXIT_FAILURE, "no container %s", argv[1]);
+  if (found > 1) errx(EXIT_FAILURE, "%s is ambiguous", argv[1]);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1) err(EXIT_FAILURE, "socket");
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    err(EXIT_FAILURE, "connect %s", addr.sun_path);
+  char kind;
+  if (recv(fd, &kind, 1, 0) != 1)
+    errx(EXIT_FAILURE, "%s has another client attached", argv[1]);
+  bool tty = kind == 't' && isatty(STDIN_FILENO);
+  if (tty) make_raw(true);
+
+  int pipes[2];
+  if (pipe2(pipes, O_CLOEXEC) == -1) err(EXIT_FAILURE, "pipe");
+  struct pollfd fds[2] = {{.fd = fd, .events = POLLIN},
+                          {.fd = STDIN_FILENO, .events = POLLIN}};
+  bool escape = false;
+  for (;;) {
+    if (poll(fds, 2, -1) == -1) {
+      if (errno == EINTR) continue;
+      err(EXIT_FAILURE, "poll");
+    }
+    if (fds[0].revents) {
+      ssize_t n = splice(fd, NULL, pipes[1], NULL, CONSOLE_CHUNK_SIZE,
+                         SPLICE_F_MOVE);
+      if (n <= 0) break;
+      while (n > 0) {
+        ssize_t out = splice_out(pipes[0], STDOUT_FILENO, n, SPLICE_F_MOVE);
+        if (out <= 0) err(EXIT_FAILURE, "splice-stdout");
+        n -= out;
+      }
+    }
+    if (fds[1].revents && !send_input(fd, tty, &escape)) {
+      if (tty) break;
+      // the rest of the output still comes after our input ended
+      fds[1].fd = -1;
+    }
+  }
+  close(fd);
+  return EXIT_SUCCESS;
+}
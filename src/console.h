@@ -0,0 +1,54 @@
+#ifndef _CONSOLE_H_
+#define _CONSOLE_H_
+#include <stdbool.h>
+
+#define CONSOLE_RUN_DIR "/run/mini-container"
+#define CONSOLE_LOG_NAME "container.log"
+#define CONSOLE_LOG_SIZE_DEFAULT (10ULL << 20)
+#define CONSOLE_LOG_FILES_DEFAULT 3
+// bytes moved per splice, also the size of the relay's pipes
+#define CONSOLE_CHUNK_SIZE (1 << 20)
+
+struct console_options {
+  // relay the container's output through the console process into its log
+  bool capture;
+  // give the container a pty instead of pipes
+  bool tty;
+  // run in the background, the launcher prints the id and exits
+  bool detach;
+  // rotate the log once it reaches log_size, keeping log_files of them
+  unsigned long long log_size;
+  int log_files;
+};
+
+struct container_config;
+struct container;
+
+// fork into the background, only the child returns. it must be called
+// before anything else forks, the parent waits for console_detached
+void console_detach();
+// hand the id to the waiting parent, which prints it and exits
+void console_detached(const char *id);
+
+// start the relay process that splices each container's output into its log
+// and to the terminal or an attached client, it must be called before any
+// thread is created
+void console_start(const struct console_options *options);
+void console_stop();
+
+// pipes for the container's stdio, the child's ends go to config and the
+// launcher's to the container. does nothing for a pty or without capture
+void console_prepare(struct container_config *config,
+                     struct container *container);
+// in the container right before exec: take over the pipes, or allocate a
+// pty and return its master to send to the launcher. -1 if there is none
+int console_setup_child(const struct container_config *config);
+// hand the stdio of a started container to the relay, master is the pty
+// master from the container or -1
+void console_register(struct container *container, int master);
+// close whatever of the container's stdio the relay never got
+void console_release(struct container *container);
+
+int attach_main(int argc, char *argv[]);
+
+#endif
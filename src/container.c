@@ -2,11 +2,14 @@
 #include "container.h"
 
 #include <err.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
 #include <linux/sched.h>
 #include <openssl/sha.h>
 #include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -14,6 +17,7 @@
 #include <sys/mman.h>
 #include <sys/mount.h>
 #include <sys/prctl.h>
+#include <sys/random.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/syscall.h>
@@ -22,133 +26,430 @@
 
 #include "cgroup.h"
 #include "filesystem.h"
+#include "forward.h"
+#include "ipam.h"
+#include "layer.h"
 #include "log.h"
 #include "network.h"
+#include "placement.h"
+#include "seccomp.h"
+#include "state.h"
+#include "telemetry.h"
+#include "teardown.h"
 #include "type.h"
 #include "user.h"
 #include "utils.h"
 
 #define STACK_SIZE (1024 * 1024)
+#define LAUNCH_REQUEST_SIZE_MAX (128 * 1024)
 
+// unique across concurrent launchers without any coordination: the pid and
+// a per-process counter tell launches on this host apart, the random bytes
+// cover pids reused across pid namespaces. NULL if the hostname is too long
 char *gen_id(char *id, struct container_config *config) {
-  unsigned long long now = timestamp();
-  if (config->hostname && strlen(config->hostname) > CONTAINER_HOSTNAME_LEN_MAX)
-    err(EXIT_FAILURE, "hostname too long");
+  static atomic_ulong counter;
+  if (config->hostname &&
+      strlen(config->hostname) > CONTAINER_HOSTNAME_LEN_MAX) {
+    error("Hostname too long, at most %d characters\n",
+          CONTAINER_HOSTNAME_LEN_MAX);
+    errno = ENAMETOOLONG;
+    return NULL;
+  }
+  unsigned char nonce[16];
+  if (getrandom(nonce, sizeof(nonce), 0) != sizeof(nonce))
+    err(EXIT_FAILURE, "getrandom");
   char data[1024];
-  if (config->hostname)
-    snprintf(data, 1024, "%s%lld", config->hostname, now);
-  else
-    snprintf(data, 1024, "%lld", now);
+  int len = snprintf(data, sizeof(data) - sizeof(nonce), "%s/%ld/%lu/%llu/",
+                     config->hostname ? config->hostname : "", (long)getpid(),
+                     atomic_fetch_add(&counter, 1), timestamp());
   debug("Generating ID: %s\n", data);
-  sha256_string(data, strlen(data), id);
+  memcpy(data + len, nonce, sizeof(nonce));
+  sha256_string(data, len + sizeof(nonce), id);
   return id;
 }
 
-void cleanup(struct container_config *config) {
+void cleanup(struct container_config *config, teardown_stats_t *stats) {
   cleanup_cgroup(config->cgroup_base_path, config->id);
+  if (config->ip_leased) ipam_release(config->ip);
   char container_data_path[PATH_MAX];
   snprintf(container_data_path, PATH_MAX, "%s/%s", config->container_base,
            config->id);
   debug("Cleaning up container data path: %s\n", container_data_path);
-  if (rm_rf(container_data_path))
+  int flags = trace_enabled() ? TEARDOWN_COUNT_BYTES : 0;
+  if (teardown(container_data_path, TEARDOWN_WORKERS_MAX, flags, stats))
     err(EXIT_FAILURE, "rmdir-container_data_path: %s", container_data_path);
+  debug("Removed %llu files, %llu dirs in %llu us\n", stats->files,
+        stats->dirs, stats->duration_ns / 1000);
+}
+
+// macvlan and ipvlan skip the bridge: the host cannot reach the container
+// through the parent device to forward ports, and the IPAM hands out the
+// bridge's subnet, so the address and gateway must be given
+static int check_stacked(const struct network_options *network, const char *ip,
+                         const char *gateway,
+                         const struct port_forwards *ports) {
+  if (network->mode == NETWORK_BRIDGE) return 0;
+  const char *mode = network->mode == NETWORK_MACVLAN ? "macvlan" : "ipvlan";
+  if (ports->count) {
+    error("Ports cannot be published on %s %s\n", mode, network->parent);
+  } else if (ip && (strcmp(ip, "auto") == 0 || gateway == NULL)) {
+    error("An address on %s %s needs an explicit --ip and --gateway\n", mode,
+          network->parent);
+  } else {
+    return 0;
+  }
+  errno = EINVAL;
+  return -1;
+}
+
+// take the requested address out of the IPAM, "auto" picks a free one and
+// the subnet's gateway is used unless one was given
+static int lease_address(struct container_config *config) {
+  char cidr[IPAM_CIDR_LEN_MAX];
+  int ret = ipam_lease(config->ip, cidr);
+  if (ret == -1) {
+    int saved_errno = errno;
+    error("Cannot lease %s: %s\n", config->ip, strerror(errno));
+    errno = saved_errno;
+    return -1;
+  }
+  if (ret == 1) return 0;
+  config->ip = strdup(cidr);
+  config->ip_leased = true;
+  if (config->gateway == NULL) config->gateway = (char *)ipam_gateway();
+  debug("Container address: %s via %s\n", config->ip, config->gateway);
+  return 0;
+}
+
+// relay the published ports to the container's address, before anything is
+// spawned so a port in use fails the launch early
+static int publish_ports(container_t *container,
+                         const struct port_forwards *ports) {
+  const struct container_config *config = &container->config;
+  if (ports->count == 0) return 0;
+  if (config->ip == NULL) {
+    error("Publishing ports needs --ip\n");
+    errno = EINVAL;
+    return -1;
+  }
+  if (forward_start(ports, config->ip, &container->forwarder) == -1) {
+    int saved_errno = errno;
+    error("Cannot publish ports to %s: %s\n", config->ip, strerror(errno));
+    errno = saved_errno;
+    return -1;
+  }
+  return 0;
+}
+
+// reserve cpus for --cpus before the container joins its cgroup, an explicit
+// --cpuset-cpus keeps its cpuset and only the quota is applied
+static void place_container(struct container_config *config) {
+  config->cpuset = NULL;
+  if (config->cpus == 0) return;
+  bool pin = true;
+  for (unsigned int i = 0; i < config->cgroup_limit.count; i++)
+    if (strcmp(config->cgroup_limit.items[i].key, "cpuset.cpus") == 0)
+      pin = false;
+  arena_t arena = {0};
+  pairs_t limits = {0};
+  if (place_cpus(config->cpus, pin, config->cgroup_base_path, config->id,
+                 &arena, &limits, &config->cpuset) == -1)
+    err(EXIT_FAILURE, "place %g cpus", config->cpus);
+  update_cgroup(config->cgroup_base_path, config->id, &limits);
+  arena_free(&arena);
+}
+
+void container_build_env(struct container_config *config) {
+  const pairs_t *env = &config->env;
+  char **envp = arena_alloc(config->arena, (env->count + 1) * sizeof(char *));
+  // open addressing on the names, slots hold an index into envp plus one
+  unsigned int size = 16, count = 0;
+  while (size < env->count * 2) size *= 2;
+  unsigned int *slots = calloc(size, sizeof(unsigned int));
+  for (unsigned int i = 0; i < env->count; i++) {
+    const pair_t *pair = &env->items[i];
+    size_t key_len = strlen(pair->key), value_len = strlen(pair->value);
+    char *entry = arena_alloc(config->arena, key_len + value_len + 2);
+    memcpy(entry, pair->key, key_len);
+    entry[key_len] = '=';
+    memcpy(entry + key_len + 1, pair->value, value_len + 1);
+    unsigned int hash = 2166136261U;
+    for (size_t j = 0; j < key_len; j++)
+      hash = (hash ^ (unsigned char)pair->key[j]) * 16777619U;
+    unsigned int slot = hash & (size - 1);
+    while (slots[slot] && (strncmp(envp[slots[slot] - 1], entry,
+                                   key_len + 1) != 0))
+      slot = (slot + 1) & (size - 1);
+    if (slots[slot] == 0) {
+      envp[count++] = entry;
+      slots[slot] = count;
+    } else {
+      envp[slots[slot] - 1] = entry;
+    }
+  }
+  free(slots);
+  envp[count] = NULL;
+  config->envp = envp;
+}
+
+struct launch_header {
+  unsigned int hostname_len;
+  unsigned int env_count;
+  unsigned int argc;
+};
+
+static size_t pack_string(char *buf, size_t offset, size_t size,
+                          const char *str) {
+  size_t len = strlen(str) + 1;
+  if (offset + len > size) errx(EXIT_FAILURE, "launch request too large");
+  memcpy(buf + offset, str, len);
+  return offset + len;
+}
+
+// serialize the per-container settings of spec into one seqpacket message
+static size_t pack_launch(char *buf, size_t size,
+                          const struct container_config *spec) {
+  struct launch_header header = {0};
+  size_t offset = sizeof(header);
+  if (spec->hostname) {
+    header.hostname_len = strlen(spec->hostname) + 1;
+    offset = pack_string(buf, offset, size, spec->hostname);
+  }
+  for (char **env = spec->envp; *env; env++) {
+    offset = pack_string(buf, offset, size, *env);
+    header.env_count++;
+  }
+  for (char **arg = spec->args; *arg; arg++) {
+    offset = pack_string(buf, offset, size, *arg);
+    header.argc++;
+  }
+  memcpy(buf, &header, sizeof(header));
+  return offset;
+}
+
+static void unpack_launch(char *buf, struct container_config *config) {
+  struct launch_header header;
+  memcpy(&header, buf, sizeof(header));
+  char *cur = buf + sizeof(header);
+  if (header.hostname_len) {
+    config->hostname = cur;
+    cur += header.hostname_len;
+  }
+  // both point into buf, which lives until exec
+  config->envp = malloc((header.env_count + 1) * sizeof(char *));
+  for (unsigned int i = 0; i < header.env_count; i++) {
+    config->envp[i] = cur;
+    cur += strlen(cur) + 1;
+  }
+  config->envp[header.env_count] = NULL;
+  config->args = malloc((header.argc + 1) * sizeof(char *));
+  for (unsigned int i = 0; i < header.argc; i++) {
+    config->args[i] = cur;
+    cur += strlen(cur) + 1;
+  }
+  config->args[header.argc] = NULL;
+}
+
+// block a parked container until the launch request arrives
+static void wait_launch(struct container_config *config, int socket_fd) {
+  if (write(socket_fd, &(int){0}, sizeof(int)) != sizeof(int))
+    err(EXIT_FAILURE, "notify-ready");
+  debug("Container parked, waiting for launch request\n");
+  ssize_t size = recv(socket_fd, NULL, 0, MSG_PEEK | MSG_TRUNC);
+  // the pool may drop us before reading our ready notification, which
+  // resets the connection instead of a plain EOF
+  if (size == 0 || (size == -1 && errno == ECONNRESET)) exit(EXIT_SUCCESS);
+  if (size < (ssize_t)sizeof(struct launch_header))
+    err(EXIT_FAILURE, "recv-launch");
+  char *buf = malloc(size);
+  if (recv(socket_fd, buf, size, 0) != size) err(EXIT_FAILURE, "recv-launch");
+  unpack_launch(buf, config);
+}
+
+static void send_trace(int socket_fd, const trace_t *trace, int fd) {
+  struct iovec iov = {.iov_base = (void *)trace, .iov_len = sizeof(trace_t)};
+  struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+  char control[CMSG_SPACE(sizeof(int))] = {0};
+  if (fd != -1) {
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  }
+  sendmsg(socket_fd, &msg, MSG_NOSIGNAL);
+}
+
+// look cmd up on the container's PATH once instead of letting execvp try an
+// execve per directory. a name that is nowhere is returned as is for execve
+// to fail on
+static const char *resolve_command(const char *cmd, char *const *envp,
+                                   char *buf, size_t size) {
+  if (strchr(cmd, '/')) return cmd;
+  const char *path = "/bin:/usr/bin";
+  for (char *const *env = envp; *env; env++)
+    if (strncmp(*env, "PATH=", 5) == 0) path = *env + 5;
+  for (const char *dir = path;; dir++) {
+    const char *end = strchrnul(dir, ':');
+    // an empty entry is the working directory
+    int len = end - dir;
+    snprintf(buf, size, "%.*s/%s", len ? len : 1, len ? dir : ".", cmd);
+    struct stat st;
+    if (stat(buf, &st) == 0 && S_ISREG(st.st_mode) && access(buf, X_OK) == 0)
+      return buf;
+    if (*end == '\0') return cmd;
+    dir = end;
+  }
 }
 
 static int container_init(void *args) {
   struct container_config *config = (struct container_config *)args;
   int socket_fd = config->fd;
+  close_inherited_fds((int[]){socket_fd, config->dev_fd, config->rootfs_fd,
+                              config->hugetlbfs_fd, config->stdio_fds[0],
+                              config->stdio_fds[1], config->stdio_fds[2]},
+                      7);
+  // the daemon blocks the signals it reads through a signalfd
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigprocmask(SIG_SETMASK, &mask, NULL);
 
   // wait for user map setup
   int res;
   if (read(socket_fd, &res, sizeof(int)) != sizeof(int))
     err(EXIT_FAILURE, "read from setup_user_map");
-  close(socket_fd);
   debug("User map setup completed\n");
+  trace_t trace = {0};
 
-  setresuid(0, 0, 0);
-  setresgid(0, 0, 0);
+  if (setresuid(0, 0, 0)) err(EXIT_FAILURE, "setresuid");
+  if (setresgid(0, 0, 0)) err(EXIT_FAILURE, "setresgid");
 
   if (strlen(config->id) > CONTAINER_ID_LEN_MAX) {
     error("Container ID too long\n");
     exit(EXIT_FAILURE);
   }
 
-  char image_path[PATH_MAX];
+  char lowerdir[LAYERS_MAX * 128];
   if (strlen(config->image_base_path) + strlen(config->image) + 10 > PATH_MAX) {
     error("Image path too long\n");
     exit(EXIT_FAILURE);
   }
-  snprintf(image_path, PATH_MAX, "%s/%s/rootfs", config->image_base_path,
-           config->image);
+  if (image_lowerdir(config->image_base_path, config->image, lowerdir,
+                     sizeof(lowerdir)) == -1)
+    err(EXIT_FAILURE, "image %s", config->image);
 
-  if (setup_filesystem(image_path, config->id, config->container_base,
-                       config->mounts) ||
-      setup_hostname(config->hostname)) {
+  if (setup_filesystem(lowerdir, config->id, config->container_base,
+                       &config->rootfs, config->rootfs_fd, &config->mounts,
+                       &config->memory, config->dev_fd, config->hugetlbfs_fd,
+                       &trace)) {
     error("Error initializing container, exiting...\n");
     return 1;
   }
-  debug("Starting container...\n");
-  clearenv();
-
-  debug("Setting env...\n");
-  for (list_t *node = config->env; node; node = node->next) {
-    pair_t *env = (pair_t *)node->data;
-    debug("Setting env: %s=%s\n", env->key, env->value);
-    if (setenv(env->key, env->value, 1) == -1)
-      err(EXIT_FAILURE, "setenv %s=%s", env->key, env->value);
+  if (config->parked) {
+    wait_launch(config, socket_fd);
+    if (config->hostname == NULL) config->hostname = config->id;
+  }
+  if (setup_hostname(config->hostname)) {
+    error("Error initializing container, exiting...\n");
+    return 1;
   }
+  debug("Starting container...\n");
+  for (char **env = config->envp; *env; env++) debug("Env: %s\n", *env);
 
   char **cmd = config->args;
+  char path[PATH_MAX];
+  const char *file = resolve_command(cmd[0], config->envp, path, sizeof(path));
 
-  debug("Running command: %s...\n", cmd[0]);
-  execvp(cmd[0], cmd);
+  debug("Running command: %s...\n", file);
+  // a pty master goes to the launcher along with the trace
+  int master = console_setup_child(config);
+  // the socket is close-on-exec, so the parent sees the exec complete as EOF
+  // right after our part of the trace
+  trace_begin(&trace, PHASE_EXEC);
+  send_trace(socket_fd, &trace, master);
+  if (master != -1) close(master);
+  if (config->seccomp && seccomp_install(config->seccomp) == -1)
+    err(EXIT_FAILURE, "seccomp");
+  execve(file, cmd, config->envp);
 
   // error occurred
   err(EXIT_FAILURE, "Error running command %s", cmd[0]);
 }
 
-void run(struct container_config *config) {
-  debug("Running container...\n");
-  char *id = malloc(CONTAINER_ID_LEN_MAX + 1);
-  gen_id(id, config);
-  config->id = id;
-  debug("Container ID: %s\n", config->id);
-  // set hostname to container ID if not set
-  if (config->hostname == NULL) config->hostname = id;
+#define CONTAINER_NAMESPACES                                              \
+  (CLONE_NEWUSER | CLONE_NEWPID | CLONE_NEWNS | CLONE_NEWNET | CLONE_NEWUTS | \
+   CLONE_NEWIPC | CLONE_NEWCGROUP)
 
-  int sockets[2];
-  if (socketpair(AF_LOCAL, SOCK_SEQPACKET, 0, sockets))
-    err(EXIT_FAILURE, "socketpair");
-  config->fd = sockets[1];
-  if (fcntl(sockets[0], F_SETFD, FD_CLOEXEC) == -1) err(EXIT_FAILURE, "fcntl");
+// log how the container ended and turn it into an exit code
+static int exit_code(int status) {
+  if (WIFEXITED(status)) {
+    info("Child exited with status %d\n", WEXITSTATUS(status));
+    return WEXITSTATUS(status);
+  } else if (WIFSIGNALED(status)) {
+    error("Child killed by signal %d\n", WTERMSIG(status));
+    return 128 + WTERMSIG(status);
+  }
+  error("Child exited with unknown status\n");
+  return EXIT_FAILURE;
+}
 
-  prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0);
+// create the container straight inside its cgroup, -1 when the kernel lacks
+// clone3, CLONE_INTO_CGROUP or a cgroup v2 hierarchy at the base path
+static pid_t spawn_direct(struct container_config *config, int cgroup_fd,
+                          int parent_fd, int *pidfd) {
+  struct clone_args args = {
+      .flags = CONTAINER_NAMESPACES | CLONE_PIDFD | CLONE_INTO_CGROUP,
+      .pidfd = (unsigned long)pidfd,
+      .exit_signal = SIGCHLD,
+      .cgroup = cgroup_fd,
+  };
+  pid_t pid = clone3(&args);
+  if (pid == 0) {
+    close(parent_fd);
+    // mirror clone(): no atexit handlers or stdio buffers shared with the
+    // parent
+    _exit(container_init(config));
+  }
+  return pid;
+}
 
+// fallback through a helper process run as the configured user, which joins
+// the cgroup and clones the container on a private stack
+static pid_t spawn_helper(struct container_config *config, container_t *container,
+                          int parent_fd) {
+  trace_t *trace = &container->trace;
   int comm_socket[2];
-  if (socketpair(AF_LOCAL, SOCK_SEQPACKET, 0, comm_socket))
+  if (socketpair(AF_LOCAL, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, comm_socket))
     err(EXIT_FAILURE, "socketpair");
-  if (fcntl(comm_socket[0], F_SETFD, FD_CLOEXEC) == -1)
-    err(EXIT_FAILURE, "fcntl");
+
   pid_t pid;
-  // spawn a helper process run as configured user
+  trace_begin(trace, PHASE_FORK);
   if ((pid = fork()) == 0) {
+    close(parent_fd);
+    close(comm_socket[0]);
+    close_inherited_fds(
+        (int[]){config->fd, config->dev_fd, config->rootfs_fd,
+                config->hugetlbfs_fd, comm_socket[1], config->stdio_fds[0],
+                config->stdio_fds[1], config->stdio_fds[2]},
+        8);
     uid_t uid = config->uid;
     gid_t gid = config->gid;
 
-    if (setresuid(uid, uid, uid)) err(EXIT_FAILURE, "setresuid");
+    // the gid first, an unprivileged uid could not change it anymore
     if (setresgid(gid, gid, gid)) err(EXIT_FAILURE, "setresgid");
+    if (setresuid(uid, uid, uid)) err(EXIT_FAILURE, "setresuid");
     int res;
     if (read(comm_socket[1], &res, sizeof(int)) != sizeof(int))
       err(EXIT_FAILURE, "read-comm_socket1");
     char *container_stack;
     container_stack = mmap(NULL, STACK_SIZE, PROT_READ | PROT_WRITE,
                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
-    pid_t child_pid =
-        clone(container_init, container_stack + STACK_SIZE,
-              CLONE_NEWUSER | CLONE_NEWPID | CLONE_NEWNS | CLONE_NEWNET |
-                  CLONE_NEWUTS | CLONE_NEWIPC | CLONE_NEWCGROUP | SIGCHLD,
-              config);
+    pid_t child_pid = clone(container_init, container_stack + STACK_SIZE,
+                            CONTAINER_NAMESPACES | SIGCHLD, config);
     if (child_pid == -1) err(EXIT_FAILURE, "clone");
+    close(config->fd);
     debug("Child PID: %ld\n", (long)child_pid);
     if (write(comm_socket[1], &child_pid, sizeof(pid_t)) != sizeof(pid_t))
       err(EXIT_FAILURE, "write-comm_socket");
@@ -156,30 +457,307 @@ void run(struct container_config *config) {
     // wait for child process to terminate
     int status;
     waitpid(child_pid, &status, 0);
-    if (WIFEXITED(status))
-      info("Child exited with status %d\n", WEXITSTATUS(status));
-    else if (WIFSIGNALED(status))
-      error("Child killed by signal %d\n", WTERMSIG(status));
-    else
-      error("Child exited with unknown status\n");
-  } else {
-    setup_cgroup(pid, config->cgroup_base_path, config->id,
-                 config->cgroup_limit);
-    if (write(comm_socket[0], &(int){0}, sizeof(int)) != sizeof(int))
-      err(EXIT_FAILURE, "write-comm_socket1");
-    pid_t child_pid;
-    if (read(comm_socket[0], &child_pid, sizeof(pid_t)) != sizeof(pid_t))
-      err(EXIT_FAILURE, "read-comm_socket2");
-    close(comm_socket[0]);
-    setup_network_container(config->id, child_pid, config->ip, config->gateway);
-    int uid = config->uid, gid = config->gid;
-    setup_user_mapping(child_pid, uid, gid);
-    // notify child process to continue
-    if (write(sockets[0], &(int){0}, sizeof(int)) != sizeof(int))
-      err(EXIT_FAILURE, "notify_child");
-    close(sockets[0]);
+    exit(exit_code(status));
+  }
+  if (pid == -1) err(EXIT_FAILURE, "fork");
+  trace_end(trace, PHASE_FORK);
+  close(comm_socket[1]);
+  container->helper_pid = pid;
+
+  attach_cgroup(pid, config->cgroup_base_path, config->id);
+  trace_begin(trace, PHASE_CLONE);
+  if (write(comm_socket[0], &(int){0}, sizeof(int)) != sizeof(int))
+    err(EXIT_FAILURE, "write-comm_socket1");
+  pid_t child_pid;
+  if (read(comm_socket[0], &child_pid, sizeof(pid_t)) != sizeof(pid_t))
+    err(EXIT_FAILURE, "read-comm_socket2");
+  close(comm_socket[0]);
+  trace_end(trace, PHASE_CLONE);
+  return child_pid;
+}
+
+// the container would fail to mount this rootfs in its user namespace, it
+// gets it ready-made instead. with id ranges the image layers are idmapped,
+// so their files keep their owners inside the container
+static int prepare_container_rootfs(const struct container_config *config) {
+  char lowerdir[LAYERS_MAX * 128];
+  int fd = -1, userns_fd = -1;
+  if (config->uid_count || config->gid_count)
+    userns_fd = idmap_userns(config->uid, config->uid_count, config->gid,
+                             config->gid_count);
+  if ((userns_fd != -1 || !(config->uid_count || config->gid_count)) &&
+      image_lowerdir(config->image_base_path, config->image, lowerdir,
+                     sizeof(lowerdir)) == 0)
+    fd = prepare_rootfs(lowerdir, config->id, config->container_base,
+                        &config->rootfs, userns_fd, config->uid, config->gid);
+  if (fd == -1)
+    warn("Cannot prepare the rootfs of %s: %s\n", config->id, strerror(errno));
+  return fd;
+}
+
+int container_spawn(struct container_config *config, container_t *container) {
+  container->config = *config;
+  config = &container->config;
+  trace_t *trace = &container->trace;
+  memset(trace, 0, sizeof(trace_t));
+  trace_begin(trace, PHASE_GEN_ID);
+  char *id = malloc(CONTAINER_ID_LEN_MAX + 1);
+  if (gen_id(id, config) == NULL) {
+    free(id);
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  trace_end(trace, PHASE_GEN_ID);
+  config->id = id;
+  log_set_container(id);
+  debug("Container ID: %s\n", config->id);
+  config->ip_leased = false;
+  container->forwarder = NULL;
+  // a request that cannot be met is refused before anything exists for it.
+  // parked containers get their ports with their address on launch
+  if (check_stacked(&config->network, config->ip, config->gateway,
+                    &config->ports) == -1 ||
+      (config->ip && lease_address(config) == -1) ||
+      check_network(&config->network, config->ip, config->gateway) == -1 ||
+      (!config->parked && publish_ports(container, &config->ports) == -1)) {
+    int saved_errno = errno;
+    if (config->ip_leased) {
+      ipam_release(config->ip);
+      free(config->ip);
+    }
+    free(id);
+    errno = saved_errno;
+    return -1;
+  }
+  // set hostname to container ID if not set
+  if (config->hostname == NULL && !config->parked) config->hostname = id;
+
+  int sockets[2];
+  if (socketpair(AF_LOCAL, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets))
+    err(EXIT_FAILURE, "socketpair");
+  config->fd = sockets[1];
+  console_prepare(config, container);
+
+  prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0);
+  config->dev_fd = clone_dev_template();
+  config->rootfs_fd = -1;
+  config->hugetlbfs_fd = -1;
+  if (config->memory.hugetlbfs_target &&
+      (config->hugetlbfs_fd =
+           open_hugetlbfs(&config->memory, config->uid, config->gid)) == -1)
+    err(EXIT_FAILURE, "hugetlbfs");
+  if (config->rootfs.flags & ROOTFS_PRIVILEGED || config->uid_count ||
+      config->gid_count)
+    config->rootfs_fd = prepare_container_rootfs(config);
+
+  trace_begin(trace, PHASE_SETUP_CGROUP);
+  int cgroup_fd = create_cgroup(config->cgroup_base_path, config->id,
+                                &config->cgroup_limit);
+  place_container(config);
+  telemetry_watch(config->cgroup_base_path, config->id);
+  trace_end(trace, PHASE_SETUP_CGROUP);
+  trace_begin(trace, PHASE_CLONE);
+  container->helper_pid = 0;
+  container->pidfd = -1;
+  // the user namespace belongs to whoever creates it, so only containers
+  // run as root are cloned by the launcher. the helper drops to the
+  // configured user first
+  bool direct = config->uid == 0 && config->gid == 0;
+  pid_t child_pid =
+      direct ? spawn_direct(config, cgroup_fd, sockets[0], &container->pidfd)
+             : -1;
+  trace_end(trace, PHASE_CLONE);
+  close(cgroup_fd);
+  if (child_pid == -1) {
+    if (direct)
+      debug("clone3 into cgroup failed (%s), spawning through a helper\n",
+            strerror(errno));
+    child_pid = spawn_helper(config, container, sockets[0]);
+    // the helper reports the container's status, so it is what we wait on
+    container->pidfd = pidfd_open(container->helper_pid, 0);
+    if (container->pidfd == -1) err(EXIT_FAILURE, "pidfd_open");
+  }
+  close(sockets[1]);
+  if (config->dev_fd != -1) close(config->dev_fd);
+  if (config->rootfs_fd != -1) close(config->rootfs_fd);
+  if (config->hugetlbfs_fd != -1) close(config->hugetlbfs_fd);
+  for (int i = 0; i < 3; i++)
+    if (config->stdio_fds[i] != -1) close(config->stdio_fds[i]);
+  debug("Child PID: %ld\n", (long)child_pid);
+  container->pid = child_pid;
+  container->state_slot = state_add(
+      config, child_pid, config->parked ? STATUS_PARKED : STATUS_RUNNING);
 
-    waitpid(pid, NULL, 0);
-    if (config->rm) cleanup(config);
+  trace_begin(trace, PHASE_NETWORK);
+  setup_network_container(config->id, child_pid, &config->network,
+                          config->ip, config->gateway);
+  // parked containers get their eth0 now and their address on launch
+  if (config->parked && config->ip == NULL)
+    setup_network_link(config->id, child_pid, &config->network);
+  trace_end(trace, PHASE_NETWORK);
+  trace_begin(trace, PHASE_USER_MAPPING);
+  setup_user_mapping(child_pid, config->uid, config->uid_count, config->gid,
+                     config->gid_count);
+  trace_end(trace, PHASE_USER_MAPPING);
+  // notify child process to continue
+  if (write(sockets[0], &(int){0}, sizeof(int)) != sizeof(int))
+    err(EXIT_FAILURE, "notify_child");
+  container->fd = sockets[0];
+  return 0;
+}
+
+int container_ready(container_t *container) {
+  int res;
+  if (read(container->fd, &res, sizeof(int)) != sizeof(int)) return -1;
+  return 0;
+}
+
+int container_launch(container_t *container,
+                     const struct container_config *spec) {
+  struct container_config *config = &container->config;
+  log_set_container(config->id);
+  trace_begin(&container->trace, PHASE_LAUNCH);
+  if (spec->cgroup_limit.count)
+    update_cgroup(config->cgroup_base_path, config->id, &spec->cgroup_limit);
+  const struct network_options *network = &config->network;
+  if (check_stacked(network, spec->ip, spec->gateway, &spec->ports) == -1)
+    return -1;
+  if (spec->ip) {
+    config->ip = spec->ip;
+    config->gateway = spec->gateway;
+    if (lease_address(config) == -1 ||
+        check_network(&config->network, config->ip, config->gateway) == -1)
+      return -1;
+    setup_network_address(container->pid, config->ip, config->gateway);
+  }
+  config->ports = spec->ports;
+  if (publish_ports(container, &config->ports) == -1) return -1;
+  state_launch(container->state_slot, spec->image,
+               spec->ip ? config->ip : NULL);
+
+  char buf[LAUNCH_REQUEST_SIZE_MAX];
+  size_t size = pack_launch(buf, LAUNCH_REQUEST_SIZE_MAX, spec);
+  if (send(container->fd, buf, size, MSG_NOSIGNAL) != (ssize_t)size)
+    return -1;
+  trace_end(&container->trace, PHASE_LAUNCH);
+  return 0;
+}
+
+// master is the container's pty master if it sent one, or -1
+static int collect_trace(container_t *container, int *master) {
+  trace_t child_trace;
+  struct iovec iov = {.iov_base = &child_trace, .iov_len = sizeof(trace_t)};
+  char control[CMSG_SPACE(sizeof(int))];
+  struct msghdr msg = {.msg_iov = &iov,
+                       .msg_iovlen = 1,
+                       .msg_control = control,
+                       .msg_controllen = sizeof(control)};
+  *master = -1;
+  if (recvmsg(container->fd, &msg, MSG_CMSG_CLOEXEC) != sizeof(trace_t))
+    return -1;
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg && cmsg->cmsg_type == SCM_RIGHTS)
+    memcpy(master, CMSG_DATA(cmsg), sizeof(int));
+  trace_merge(&container->trace, &child_trace, container->pid);
+  // returns 0 once exec closed the other end
+  if (recv(container->fd, &child_trace, sizeof(trace_t), 0) != 0) return -1;
+  trace_end(&container->trace, PHASE_EXEC);
+  return 0;
+}
+
+int container_started(container_t *container) {
+  if (container->fd == -1) {
+    console_release(container);
+    return -1;
+  }
+  int master;
+  int ret = collect_trace(container, &master);
+  close(container->fd);
+  container->fd = -1;
+  if (ret == 0) {
+    console_register(container, master);
+    return 0;
+  }
+  if (master != -1) close(master);
+  console_release(container);
+  return ret;
+}
+
+int container_reap(container_t *container) {
+  log_set_container(container->config.id);
+  container_started(container);
+  trace_t *trace = &container->trace;
+  siginfo_t info;
+  int code;
+  trace_begin(trace, PHASE_WAITPID);
+  if (waitid(P_PIDFD, container->pidfd, &info, WEXITED) == -1)
+    err(EXIT_FAILURE, "waitid %ld", (long)container->pid);
+  close(container->pidfd);
+  container->pidfd = -1;
+  if (container->helper_pid)
+    // the helper already reported and mapped the container's status
+    code = info.si_code == CLD_EXITED ? info.si_status : EXIT_FAILURE;
+  else
+    code = exit_code(info.si_code == CLD_EXITED
+                         ? W_EXITCODE(info.si_status, 0)
+                         : W_EXITCODE(0, info.si_status));
+  trace_end(trace, PHASE_WAITPID);
+  telemetry_unwatch(container->config.id);
+  state_exit(container->state_slot, code);
+  return code;
+}
+
+void container_cleanup(container_t *container) {
+  trace_t *trace = &container->trace;
+  forward_stop(&container->forwarder);
+  trace_begin(trace, PHASE_CLEANUP);
+  if (container->config.rm) {
+    teardown_stats_t stats;
+    cleanup(&container->config, &stats);
+    trace->removed_files = stats.files + stats.dirs;
+    trace->removed_bytes = stats.bytes;
+    state_remove(container->state_slot);
+    container->state_slot = -1;
   }
+  trace_end(trace, PHASE_CLEANUP);
+  // parked containers discarded by their pool never ran anything
+  if (!container->config.parked || trace->spans[PHASE_LAUNCH].start)
+    trace_emit(trace, container->config.id);
+  if (container->config.cpuset)
+    release_cpus(container->config.cgroup_base_path, container->config.id);
+  free(container->config.cpuset);
+  container->config.cpuset = NULL;
+  free(container->config.id);
+  container->config.id = NULL;
+  log_set_container(NULL);
+  log_set_phase(-1);
+  if (container->config.ip_leased) free(container->config.ip);
+  container->config.ip_leased = false;
+}
+
+int container_wait(container_t *container) {
+  int code = container_reap(container);
+  container_cleanup(container);
+  return code;
+}
+
+int container_kill(container_t *container, int sig) {
+  // the helper's pidfd would signal the helper, not the container
+  if (container->helper_pid) return kill(container->pid, sig);
+  return pidfd_send_signal(container->pidfd, sig, NULL, 0);
+}
+
+void container_destroy(container_t *container) {
+  // a parked container exits on its own once the launch socket is closed
+  if (container->fd != -1) close(container->fd);
+  container->fd = -1;
+  container_wait(container);
+}
+
+void run(struct container_config *config) {
+  debug("Running container...\n");
+  container_t container;
+  if (container_spawn(config, &container) == -1) exit(EXIT_FAILURE);
+  console_detached(container.config.id);
+  container_wait(&container);
 }
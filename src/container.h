@@ -1,10 +1,16 @@
 #ifndef _CONTAINER_H_
 #define _CONTAINER_H_
+#include <linux/filter.h>
 #include <linux/limits.h>
 #include <stdbool.h>
 #include <syscall.h>
 #include <unistd.h>
 
+#include "console.h"
+#include "filesystem.h"
+#include "forward.h"
+#include "network.h"
+#include "trace.h"
 #include "type.h"
 
 #define CONTAINER_ID_LEN_MAX 64
@@ -12,26 +18,114 @@
 #define CONTAINER_HOSTNAME_LEN_MAX 253
 
 struct container_config {
+  // where env, mounts, cgroup_limit and envp are allocated, shared by every
+  // copy of the config
+  arena_t *arena;
   char *image_base_path;
   char *image;
   char *container_base;
+  struct rootfs_options rootfs;
   char *hostname;
   char *cgroup_base_path;
   char *id;
-  list_t *cgroup_limit;
-  list_t *mounts;
+  pairs_t cgroup_limit;
+  // cpus asked for with --cpus, 0 without
+  double cpus;
+  // the cpus placement reserved for this container, released on exit
+  char *cpuset;
+  struct mounts mounts;
+  struct memory_mounts memory;
   bool rm;
   int fd;
+  int dev_fd;
+  // overlay built by the launcher, -1 if the container mounts its own
+  int rootfs_fd;
+  // hugetlbfs for memory.hugetlbfs_target, built by the launcher
+  int hugetlbfs_fd;
+  struct network_options network;
   char *ip;
   char *gateway;
-  list_t *env;
+  // ip was leased from the IPAM and is owned by the config, it is released
+  // on cleanup
+  bool ip_leased;
+  // host ports relayed to ip
+  struct port_forwards ports;
+  pairs_t env;
+  // "KEY=VALUE" strings for execve, from container_build_env
+  char **envp;
+  // host ids of the container's root, and the sizes of the subordinate id
+  // ranges starting there, 0 to map root alone
   uid_t uid;
   gid_t gid;
+  unsigned int uid_count;
+  unsigned int gid_count;
   char **args;
+  struct console_options console;
+  // the container's ends of its stdio pipes, -1 where it inherits ours
+  int stdio_fds[3];
+  // syscall filter installed right before exec, NULL for none
+  struct sock_fprog *seccomp;
+  // park the container after its rootfs is ready and wait for a launch
+  // request instead of exec'ing args right away
+  bool parked;
+  int pool_size;
+  char *daemon_socket;
+  char *batch_manifest;
+  int batch_parallel;
 };
 
 typedef struct container_config container_config_t;
 
+// a spawned container, config is a private copy owning the generated id
+struct container {
+  struct container_config config;
+  // set when the container was spawned through the fallback helper process,
+  // otherwise it is our direct child
+  pid_t helper_pid;
+  // becomes readable once the container, or its helper, has exited
+  int pidfd;
+  pid_t pid;
+  int fd;
+  // our ends of the container's stdio pipes until the relay takes them
+  int console_fds[3];
+  // the container's record in the state index, -1 if it has none
+  int state_slot;
+  // relays the published ports until the container exited, NULL without
+  struct forwarder *forwarder;
+  trace_t trace;
+};
+
+typedef struct container container_t;
+
 void run(struct container_config *config);
 
+// build envp from env once the config is complete, a later variable wins over
+// an earlier one with the same name. every container spawned from the config
+// shares it, copies that change env need their own
+void container_build_env(struct container_config *config);
+
+// -1 with errno set and nothing left behind when the request cannot be met,
+// such as an address or port that is taken or a missing network parent
+int container_spawn(struct container_config *config, container_t *container);
+// wait for a parked container to finish its setup, 0 once it is ready
+int container_ready(container_t *container);
+// apply per-container settings from spec to a parked container and exec.
+// -1 with errno set if spec cannot be met, EPIPE or ECONNRESET if the
+// container is gone
+int container_launch(container_t *container,
+                     const struct container_config *spec);
+// wait for the container to exec its command, -1 if it failed before, does
+// not block once fd is readable
+int container_started(container_t *container);
+// wait for the container to exit and return its exit status, does not block
+// once pidfd is readable
+int container_reap(container_t *container);
+// remove the data of a reaped container and emit its trace
+void container_cleanup(container_t *container);
+// wait for the container to exit, clean it up and return its exit status
+int container_wait(container_t *container);
+int container_kill(container_t *container, int sig);
+// discard a parked container without launching it
+void container_destroy(container_t *container);
+
 #endif
\ No newline at end of file
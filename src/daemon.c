@@ -0,0 +1,574 @@
+#define _GNU_SOURCE
+#include "daemon.h"
+
+#include <err.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "container.h"
+#include "forward.h"
+#include "log.h"
+#include "type.h"
+#include "utils.h"
+
+// what an epoll event is about, objects closed while handling a batch of
+// events are only freed once the whole batch is done
+enum source_kind {
+  SOURCE_LISTEN = 0,
+  SOURCE_SIGNAL,
+  SOURCE_CLIENT,
+  SOURCE_CONTAINER,
+  SOURCE_STOP_TIMER,
+  SOURCE_CLEANUP
+};
+
+struct source {
+  enum source_kind kind;
+  void *owner;
+  bool dead;
+};
+
+struct supervised;
+
+// a connection carries one request, run without -d, stop and wait keep it
+// open until the container exits
+struct client {
+  int fd;
+  struct source source;
+  struct supervised *waiting;
+  struct client *next;
+};
+
+struct supervised {
+  container_t container;
+  // the request the container was started from, backs image and args
+  char *request;
+  char **words;
+  unsigned long long started;
+  bool stopping;
+  int stop_timer;
+  struct source source;
+  struct source timer_source;
+  struct client *waiters;
+  struct supervised *prev;
+  struct supervised *next;
+};
+
+// a child removing the data of an exited container
+struct cleanup {
+  int pidfd;
+  char id[CONTAINER_ID_LEN_MAX + 1];
+  struct source source;
+};
+
+struct daemon {
+  const char *path;
+  int epoll_fd;
+  int listen_fd;
+  int signal_fd;
+  const struct container_config *template;
+  struct supervised *containers;
+  size_t count;
+  size_t cleanups;
+  bool shutdown;
+  list_t *garbage;
+};
+
+static void epoll_add(struct daemon *daemon, int fd, uint32_t events,
+                      struct source *source) {
+  struct epoll_event event = {.events = events, .data.ptr = source};
+  if (epoll_ctl(daemon->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+    err(EXIT_FAILURE, "epoll_ctl");
+}
+
+static void discard(struct daemon *daemon, void *owner) {
+  append(&daemon->garbage, owner);
+}
+
+static void collect_garbage(struct daemon *daemon) {
+  while (daemon->garbage) {
+    list_t *next = daemon->garbage->next;
+    free(daemon->garbage->data);
+    free(daemon->garbage);
+    daemon->garbage = next;
+  }
+}
+
+static void reply(struct client *client, const char *fmt, ...) {
+  char buf[DAEMON_REPLY_MAX];
+  va_list args;
+  va_start(args, fmt);
+  int len = vsnprintf(buf, sizeof(buf), fmt, args);
+  va_end(args);
+  if (len >= (int)sizeof(buf)) len = sizeof(buf) - 1;
+  // a client that hung up only misses its reply
+  send(client->fd, buf, len, MSG_NOSIGNAL);
+}
+
+static void close_client(struct daemon *daemon, struct client *client) {
+  if (client->waiting) {
+    struct client **cur = &client->waiting->waiters;
+    while (*cur != client) cur = &(*cur)->next;
+    *cur = client->next;
+    client->waiting = NULL;
+  }
+  close(client->fd);
+  client->source.dead = true;
+  discard(daemon, client);
+}
+
+static void add_waiter(struct supervised *supervised, struct client *client) {
+  client->waiting = supervised;
+  client->next = supervised->waiters;
+  supervised->waiters = client;
+}
+
+// containers are addressed by any unique prefix of their id
+static struct supervised *find(struct daemon *daemon, struct client *client,
+                               const char *id) {
+  struct supervised *found = NULL;
+  size_t len = id ? strlen(id) : 0;
+  for (struct supervised *cur = daemon->containers; len && cur;
+       cur = cur->next) {
+    if (strncmp(cur->container.config.id, id, len)) continue;
+    if (found) {
+      reply(client, "error: container id %s is ambiguous\n", id);
+      return NULL;
+    }
+    found = cur;
+  }
+  if (found == NULL) reply(client, "error: no such container %s\n", id);
+  return found;
+}
+
+// parse "run [-d] [-e KEY=VALUE] [--hostname NAME] [--ip IP] [--gateway IP]
+// [-p HOSTPORT:PORT] image command..." and spawn the container
+static struct supervised *start(struct daemon *daemon, struct client *client,
+                                char **words, bool *detach) {
+  struct container_config config = *daemon->template;
+  // only needed until the container is spawned
+  arena_t arena = {0};
+  config.arena = &arena;
+  copy_pairs(&config.env, &daemon->template->env);
+  *detach = false;
+  int i = 1;
+  for (; words[i] && words[i][0] == '-'; i++) {
+    char *option = words[i], *value = words[i + 1];
+    if (strcmp(option, "-d") == 0) {
+      *detach = true;
+      continue;
+    }
+    if (value == NULL) {
+      reply(client, "error: missing value for %s\n", option);
+      goto fail;
+    }
+    i++;
+    if (strcmp(option, "-e") == 0) {
+      char *sep = strchr(value, '=');
+      if (sep == NULL) {
+        reply(client, "error: invalid environment variable %s\n", value);
+        goto fail;
+      }
+      *sep = '\0';
+      append_pair(&arena, &config.env, value, sep + 1);
+    } else if (strcmp(option, "--hostname") == 0) {
+      config.hostname = value;
+    } else if (strcmp(option, "--ip") == 0) {
+      config.ip = value;
+    } else if (strcmp(option, "--gateway") == 0) {
+      config.gateway = value;
+    } else if (strcmp(option, "-p") == 0) {
+      if (parse_port(&arena, &config.ports, value) == -1) {
+        reply(client, "error: invalid port %s\n", value);
+        goto fail;
+      }
+    } else {
+      reply(client, "error: unknown option %s\n", option);
+      goto fail;
+    }
+  }
+  if (words[i] == NULL || words[i + 1] == NULL) {
+    reply(client, "error: missing image or command\n");
+    goto fail;
+  }
+  config.image = words[i];
+  config.args = words + i + 1;
+  container_build_env(&config);
+
+  struct supervised *supervised = calloc(1, sizeof(struct supervised));
+  if (container_spawn(&config, &supervised->container) == -1) {
+    reply(client, "error: cannot start the container: %s\n", strerror(errno));
+    free(supervised);
+    goto fail;
+  }
+  // the container has its own copy by now
+  arena_free(&arena);
+  supervised->container.config.arena = NULL;
+  supervised->container.config.env = (pairs_t){0};
+  supervised->container.config.envp = NULL;
+  supervised->container.config.ports = (struct port_forwards){0};
+  supervised->started = timestamp();
+  supervised->stop_timer = -1;
+  supervised->source = (struct source){SOURCE_CONTAINER, supervised};
+  supervised->timer_source = (struct source){SOURCE_STOP_TIMER, supervised};
+  epoll_add(daemon, supervised->container.pidfd, EPOLLIN,
+            &supervised->source);
+  supervised->next = daemon->containers;
+  if (daemon->containers) daemon->containers->prev = supervised;
+  daemon->containers = supervised;
+  daemon->count++;
+  debug("Started container %s\n", supervised->container.config.id);
+  reply(client, "%s\n", supervised->container.config.id);
+  return supervised;
+
+fail:
+  arena_free(&arena);
+  return NULL;
+}
+
+static void stop(struct daemon *daemon, struct supervised *supervised,
+                 unsigned int timeout) {
+  if (supervised->stopping) return;
+  supervised->stopping = true;
+  if (timeout == 0) {
+    container_kill(&supervised->container, SIGKILL);
+    return;
+  }
+  // pid 1 of the container ignores SIGTERM unless it handles it, so it is
+  // killed once the timeout expires
+  container_kill(&supervised->container, SIGTERM);
+  supervised->stop_timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  if (supervised->stop_timer == -1) err(EXIT_FAILURE, "timerfd_create");
+  struct itimerspec spec = {.it_value = {.tv_sec = timeout}};
+  timerfd_settime(supervised->stop_timer, 0, &spec, NULL);
+  epoll_add(daemon, supervised->stop_timer, EPOLLIN,
+            &supervised->timer_source);
+}
+
+static void list(struct daemon *daemon, struct client *client) {
+  char buf[DAEMON_REPLY_MAX], line[512];
+  size_t len = snprintf(buf, sizeof(buf), "%-12s %-8s %-8s %-8s %s\n", "ID",
+                        "PID", "STATE", "UPTIME", "IMAGE COMMAND");
+  unsigned long long now = timestamp();
+  for (struct supervised *cur = daemon->containers; cur; cur = cur->next) {
+    const struct container_config *config = &cur->container.config;
+    size_t n = snprintf(line, sizeof(line), "%.12s %-8ld %-8s %-8llu %s %s\n",
+                        config->id, (long)cur->container.pid,
+                        cur->stopping ? "stopping" : "running",
+                        (now - cur->started) / 1000000, config->image,
+                        config->args[0]);
+    if (n >= sizeof(line)) n = sizeof(line) - 1;
+    // one message per batch of lines
+    if (len + n > sizeof(buf)) {
+      send(client->fd, buf, len, MSG_NOSIGNAL);
+      len = 0;
+    }
+    memcpy(buf + len, line, n);
+    len += n;
+  }
+  send(client->fd, buf, len, MSG_NOSIGNAL);
+}
+
+// everything but the trace output, which the cleanup still writes to
+static void close_daemon_fds(struct daemon *daemon) {
+  close(daemon->epoll_fd);
+  close(daemon->signal_fd);
+  if (daemon->listen_fd != -1) close(daemon->listen_fd);
+  for (struct supervised *cur = daemon->containers; cur; cur = cur->next)
+    for (struct client *client = cur->waiters; client; client = client->next)
+      close(client->fd);
+}
+
+// removing a rootfs can take a while, it runs in a child so launches are not
+// held up behind it
+static void start_cleanup(struct daemon *daemon, container_t *container) {
+  pid_t pid = fork();
+  if (pid == -1) err(EXIT_FAILURE, "fork-cleanup");
+  if (pid == 0) {
+    close_daemon_fds(daemon);
+    container_cleanup(container);
+    _exit(EXIT_SUCCESS);
+  }
+  struct cleanup *cleanup = malloc(sizeof(struct cleanup));
+  snprintf(cleanup->id, sizeof(cleanup->id), "%s", container->config.id);
+  free(container->config.id);
+  container->config.id = NULL;
+  if (container->config.ip_leased) free(container->config.ip);
+  cleanup->pidfd = pidfd_open(pid, 0);
+  if (cleanup->pidfd == -1) err(EXIT_FAILURE, "pidfd_open");
+  cleanup->source = (struct source){SOURCE_CLEANUP, cleanup};
+  epoll_add(daemon, cleanup->pidfd, EPOLLIN, &cleanup->source);
+  daemon->cleanups++;
+}
+
+static void on_cleanup(struct daemon *daemon, struct cleanup *cleanup) {
+  siginfo_t info;
+  if (waitid(P_PIDFD, cleanup->pidfd, &info, WEXITED) == -1)
+    err(EXIT_FAILURE, "waitid-cleanup");
+  if (info.si_code != CLD_EXITED || info.si_status != 0)
+    warn("Failed to clean up container %s\n", cleanup->id);
+  close(cleanup->pidfd);
+  cleanup->source.dead = true;
+  discard(daemon, cleanup);
+  daemon->cleanups--;
+}
+
+static void on_container_exit(struct daemon *daemon,
+                              struct supervised *supervised) {
+  int code = container_reap(&supervised->container);
+  while (supervised->waiters) {
+    struct client *client = supervised->waiters;
+    reply(client, "exit %d\n", code);
+    close_client(daemon, client);
+  }
+  if (supervised->stop_timer != -1) close(supervised->stop_timer);
+  if (supervised->prev)
+    supervised->prev->next = supervised->next;
+  else
+    daemon->containers = supervised->next;
+  if (supervised->next) supervised->next->prev = supervised->prev;
+  daemon->count--;
+  // the cleanup runs in a child, the published ports are the daemon's own
+  forward_stop(&supervised->container.forwarder);
+  start_cleanup(daemon, &supervised->container);
+  free(supervised->request);
+  free(supervised->words);
+  supervised->source.dead = true;
+  supervised->timer_source.dead = true;
+  discard(daemon, supervised);
+}
+
+static void on_request(struct daemon *daemon, struct client *client) {
+  ssize_t size = recv(client->fd, NULL, 0, MSG_PEEK | MSG_TRUNC);
+  // waiting clients have nothing more to say, anything but a hangup is
+  // treated as one
+  if (size <= 0 || client->waiting) {
+    close_client(daemon, client);
+    return;
+  }
+  if (size > DAEMON_REQUEST_MAX) {
+    reply(client, "error: request too large\n");
+    close_client(daemon, client);
+    return;
+  }
+  char *buf = malloc(size + 1);
+  if (recv(client->fd, buf, size, 0) != size) {
+    free(buf);
+    close_client(daemon, client);
+    return;
+  }
+  buf[size] = '\0';
+  size_t count = 0;
+  for (char *cur = buf; cur < buf + size; cur += strlen(cur) + 1) count++;
+  char **words = malloc((count + 1) * sizeof(char *));
+  count = 0;
+  for (char *cur = buf; cur < buf + size; cur += strlen(cur) + 1)
+    words[count++] = cur;
+  words[count] = NULL;
+
+  const char *command = words[0] ? words[0] : "";
+  struct supervised *supervised;
+  if (strcmp(command, "run") == 0) {
+    bool detach;
+    if ((supervised = start(daemon, client, words, &detach))) {
+      supervised->request = buf;
+      supervised->words = words;
+      buf = NULL;
+      words = NULL;
+      if (!detach) add_waiter(supervised, client);
+    }
+  } else if (strcmp(command, "stop") == 0) {
+    unsigned int timeout =
+        words[1] && words[2] ? strtoul(words[2], NULL, 10) : DAEMON_STOP_TIMEOUT;
+    if ((supervised = find(daemon, client, words[1]))) {
+      stop(daemon, supervised, timeout);
+      add_waiter(supervised, client);
+    }
+  } else if (strcmp(command, "wait") == 0) {
+    if ((supervised = find(daemon, client, words[1])))
+      add_waiter(supervised, client);
+  } else if (strcmp(command, "list") == 0) {
+    list(daemon, client);
+  } else {
+    reply(client, "error: unknown request %s\n", command);
+  }
+  free(buf);
+  free(words);
+  if (client->waiting == NULL) close_client(daemon, client);
+}
+
+static void on_accept(struct daemon *daemon) {
+  int fd;
+  while ((fd = accept4(daemon->listen_fd, NULL, NULL, SOCK_CLOEXEC)) != -1) {
+    struct client *client = calloc(1, sizeof(struct client));
+    client->fd = fd;
+    client->source = (struct source){SOURCE_CLIENT, client};
+    epoll_add(daemon, fd, EPOLLIN, &client->source);
+  }
+  if (errno != EAGAIN && errno != EINTR) warn("accept: %s\n", strerror(errno));
+}
+
+// stop taking requests and kill every container, the loop ends once all of
+// them are cleaned up
+static void on_signal(struct daemon *daemon) {
+  struct signalfd_siginfo siginfo;
+  if (read(daemon->signal_fd, &siginfo, sizeof(siginfo)) != sizeof(siginfo))
+    return;
+  if (daemon->shutdown) return;
+  info("Shutting down, killing %zu containers\n", daemon->count);
+  daemon->shutdown = true;
+  close(daemon->listen_fd);
+  daemon->listen_fd = -1;
+  unlink(daemon->path);
+  for (struct supervised *cur = daemon->containers; cur; cur = cur->next) {
+    cur->stopping = true;
+    container_kill(&cur->container, SIGKILL);
+  }
+}
+
+static int listen_socket(const char *path) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(path) >= sizeof(addr.sun_path))
+    errx(EXIT_FAILURE, "socket path too long: %s", path);
+  strcpy(addr.sun_path, path);
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+  if (fd == -1) err(EXIT_FAILURE, "socket");
+  // left behind by a daemon that did not shut down cleanly
+  unlink(path);
+  mode_t mask = umask(0177);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    err(EXIT_FAILURE, "bind %s", path);
+  umask(mask);
+  if (listen(fd, SOMAXCONN) == -1) err(EXIT_FAILURE, "listen %s", path);
+  return fd;
+}
+
+int run_daemon(struct container_config *config, const char *path) {
+  // per-container settings come with each run request
+  struct container_config template = *config;
+  template.image = NULL;
+  template.args = NULL;
+  template.hostname = NULL;
+  template.ip = NULL;
+  // a host port can only be published once
+  template.ports = (struct port_forwards){0};
+  struct daemon daemon = {.path = path, .template = &template};
+
+  daemon.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (daemon.epoll_fd == -1) err(EXIT_FAILURE, "epoll_create1");
+  // containers reset their signal mask before they exec
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGTERM);
+  sigprocmask(SIG_BLOCK, &mask, NULL);
+  daemon.signal_fd = signalfd(-1, &mask, SFD_CLOEXEC);
+  if (daemon.signal_fd == -1) err(EXIT_FAILURE, "signalfd");
+  daemon.listen_fd = listen_socket(path);
+  struct source listen_source = {SOURCE_LISTEN};
+  struct source signal_source = {SOURCE_SIGNAL};
+  epoll_add(&daemon, daemon.listen_fd, EPOLLIN, &listen_source);
+  epoll_add(&daemon, daemon.signal_fd, EPOLLIN, &signal_source);
+  info("Listening on %s\n", path);
+
+  struct epoll_event events[DAEMON_EVENTS_MAX];
+  while (!daemon.shutdown || daemon.count || daemon.cleanups) {
+    int count = epoll_wait(daemon.epoll_fd, events, DAEMON_EVENTS_MAX, -1);
+    if (count == -1 && errno == EINTR) continue;
+    if (count == -1) err(EXIT_FAILURE, "epoll_wait");
+    for (int i = 0; i < count; i++) {
+      struct source *source = events[i].data.ptr;
+      if (source->dead) continue;
+      switch (source->kind) {
+        case SOURCE_LISTEN:
+          if (!daemon.shutdown) on_accept(&daemon);
+          break;
+        case SOURCE_SIGNAL:
+          on_signal(&daemon);
+          break;
+        case SOURCE_CLIENT:
+          on_request(&daemon, source->owner);
+          break;
+        case SOURCE_CONTAINER:
+          on_container_exit(&daemon, source->owner);
+          break;
+        case SOURCE_STOP_TIMER: {
+          struct supervised *supervised = source->owner;
+          debug("Container %s did not stop in time, killing it\n",
+                supervised->container.config.id);
+          container_kill(&supervised->container, SIGKILL);
+          epoll_ctl(daemon.epoll_fd, EPOLL_CTL_DEL, supervised->stop_timer,
+                    NULL);
+          break;
+        }
+        case SOURCE_CLEANUP:
+          on_cleanup(&daemon, source->owner);
+          break;
+      }
+    }
+    collect_garbage(&daemon);
+  }
+  close(daemon.signal_fd);
+  close(daemon.epoll_fd);
+  sigprocmask(SIG_UNBLOCK, &mask, NULL);
+  return EXIT_SUCCESS;
+}
+
+int ctl_main(int argc, char *argv[]) {
+  if (argc < 3) {
+    fprintf(stderr, "Usage: %s SOCKET run|stop|wait|list [args]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  char request[DAEMON_REQUEST_MAX];
+  size_t len = 0;
+  for (int i = 2; i < argc; i++) {
+    size_t n = strlen(argv[i]) + 1;
+    if (len + n > sizeof(request)) errx(EXIT_FAILURE, "request too large");
+    memcpy(request + len, argv[i], n);
+    len += n;
+  }
+
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(argv[1]) >= sizeof(addr.sun_path))
+    errx(EXIT_FAILURE, "socket path too long: %s", argv[1]);
+  strcpy(addr.sun_path, argv[1]);
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (fd == -1) err(EXIT_FAILURE, "socket");
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    err(EXIT_FAILURE, "connect %s", argv[1]);
+  if (send(fd, request, len, 0) != (ssize_t)len) err(EXIT_FAILURE, "send");
+
+  // replies are printed as they come, "exit N" ends run and wait with the
+  // container's status
+  int ret = EXIT_SUCCESS;
+  char reply[DAEMON_REPLY_MAX + 1];
+  ssize_t n;
+  while ((n = recv(fd, reply, DAEMON_REPLY_MAX, 0)) > 0) {
+    reply[n] = '\0';
+    if (strncmp(reply, "exit ", 5) == 0) {
+      ret = atoi(reply + 5);
+    } else if (strncmp(reply, "error: ", 7) == 0) {
+      fputs(reply + 7, stderr);
+      ret = EXIT_FAILURE;
+    } else {
+      fputs(reply, stdout);
+      fflush(stdout);
+    }
+  }
+  if (n == -1) err(EXIT_FAILURE, "recv");
+  close(fd);
+  return ret;
+}
@@ -0,0 +1,20 @@
+#ifndef _DAEMON_H_
+#define _DAEMON_H_
+
+#include "container.h"
+
+// one request is a single seqpacket message of NUL terminated words
+#define DAEMON_REQUEST_MAX (64 * 1024)
+#define DAEMON_REPLY_MAX (16 * 1024)
+#define DAEMON_EVENTS_MAX 64
+// seconds between SIGTERM and SIGKILL when stop is not given a timeout
+#define DAEMON_STOP_TIMEOUT 10
+
+// supervise containers from a single event loop, driven by run, stop, list
+// and wait requests on the unix socket at path
+int run_daemon(struct container_config *config, const char *path);
+// send one request to a daemon and print its replies, returns the exit status
+// of the container for run and wait
+int ctl_main(int argc, char *argv[]);
+
+#endif
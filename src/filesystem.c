@@ -1,9 +1,12 @@
+#define _GNU_SOURCE
 #include "filesystem.h"
 
 #include <err.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <linux/limits.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,64 +14,433 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "layer.h"
 #include "log.h"
+#include "trace.h"
 #include "type.h"
 #include "utils.h"
 
-list_t *append_mount_options(list_t **head, const char *source,
-                             const char *target, const char *filesystem,
-                             unsigned long flags, const char *data) {
-  struct mount_options *new = malloc(sizeof(struct mount_options));
-  new->source = source ? strdup(source) : NULL;
-  new->target = target ? strdup(target) : NULL;
-  new->filesystem = filesystem ? strdup(filesystem) : NULL;
+struct mount_options *append_mount_options(arena_t *arena,
+                                           struct mounts *mounts,
+                                           const char *source,
+                                           const char *target,
+                                           const char *filesystem,
+                                           unsigned long flags,
+                                           const char *data) {
+  mounts->items = arena_grow(arena, mounts->items, mounts->count,
+                             &mounts->capacity, sizeof(struct mount_options));
+  struct mount_options *new = &mounts->items[mounts->count++];
+  new->source = source ? arena_strdup(arena, source) : NULL;
+  new->target = target ? arena_strdup(arena, target) : NULL;
+  new->filesystem = filesystem ? arena_strdup(arena, filesystem) : NULL;
   new->flags = flags;
-  new->data = data ? strdup(data) : NULL;
-  return append(head, new);
+  new->data = data ? arena_strdup(arena, data) : NULL;
+  new->propagation = 0;
+  return new;
+}
+
+static unsigned long long mount_attr_flags(unsigned long flags) {
+  unsigned long long attr = 0;
+  if (flags & MS_RDONLY) attr |= MOUNT_ATTR_RDONLY;
+  if (flags & MS_NOSUID) attr |= MOUNT_ATTR_NOSUID;
+  if (flags & MS_NODEV) attr |= MOUNT_ATTR_NODEV;
+  if (flags & MS_NOEXEC) attr |= MOUNT_ATTR_NOEXEC;
+  if (flags & MS_NOATIME) attr |= MOUNT_ATTR_NOATIME;
+  return attr;
+}
+
+// clone source, set its attributes and attach it, so the mount is never
+// visible without them. with MS_REC the mounts below source come along and
+// get the attributes too; returns -1 with ENOSYS on kernels before 5.12
+static int bind_mount_attr(const char *source, const char *target,
+                           unsigned long flags) {
+  unsigned int recursive = flags & MS_REC ? AT_RECURSIVE : 0;
+  int fd = open_tree(AT_FDCWD, source,
+                     OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC | recursive);
+  if (fd == -1) return -1;
+  struct mount_attr attr = {.attr_set = mount_attr_flags(flags)};
+  // the atime modes are a field, not flags
+  if (attr.attr_set & MOUNT_ATTR_NOATIME) attr.attr_clr = MOUNT_ATTR__ATIME;
+  if ((attr.attr_set && mount_setattr(fd, "", AT_EMPTY_PATH | recursive, &attr,
+                                      sizeof(attr)) == -1) ||
+      move_mount(fd, "", AT_FDCWD, target, MOVE_MOUNT_F_EMPTY_PATH) == -1) {
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return -1;
+  }
+  close(fd);
+  return 0;
+}
+
+// overlay as a detached mount. the mount(2) data string is limited to a
+// page, so layers are passed one at a time through fsconfig's lowerdir+
+// (Linux 6.8), options are the comma separated flags and key=value pairs
+// after the layers
+static int overlay_fsmount(const char *lowerdir, const char *options,
+                           unsigned int attr) {
+  int fs = fsopen("overlay", FSOPEN_CLOEXEC);
+  if (fs == -1) return -1;
+  int mnt = -1;
+  char *layers = strdup(lowerdir);
+  char *params = strdup(options);
+  char *saveptr;
+  for (char *layer = strtok_r(layers, ":", &saveptr); layer;
+       layer = strtok_r(NULL, ":", &saveptr))
+    if (fsconfig(fs, FSCONFIG_SET_STRING, "lowerdir+", layer, 0) == -1)
+      goto out;
+  for (char *param = strtok_r(params, ",", &saveptr); param;
+       param = strtok_r(NULL, ",", &saveptr)) {
+    char *value = strchr(param, '=');
+    if (value) *value++ = '\0';
+    if (fsconfig(fs, value ? FSCONFIG_SET_STRING : FSCONFIG_SET_FLAG, param,
+                 value, 0) == -1)
+      goto out;
+  }
+  if (fsconfig(fs, FSCONFIG_CMD_CREATE, NULL, NULL, 0) == -1) goto out;
+  mnt = fsmount(fs, FSMOUNT_CLOEXEC, attr);
+out:
+  free(layers);
+  free(params);
+  close(fs);
+  return mnt;
+}
+
+static int mount_overlay_layers(const char *lowerdir, const char *options,
+                                unsigned int attr, const char *target) {
+  int mnt = overlay_fsmount(lowerdir, options, attr);
+  if (mnt == -1) return -1;
+  int ret = move_mount(mnt, "", AT_FDCWD, target, MOVE_MOUNT_F_EMPTY_PATH);
+  close(mnt);
+  return ret;
+}
+
+// upperdir and workdir of the writable layer below dir, and the overlay
+// options to use them
+static int upper_layer_options(const char *dir,
+                               const struct rootfs_options *rootfs,
+                               char *options, size_t size) {
+  char diff_dir[PATH_MAX];
+  snprintf(diff_dir, PATH_MAX, "%s/diff", dir);
+  if (mkdir(diff_dir, 0700)) return -1;
+
+  char work_dir[PATH_MAX];
+  snprintf(work_dir, PATH_MAX, "%s/work", dir);
+  if (mkdir(work_dir, 0700)) return -1;
+
+  // a volatile overlay never syncs its upper layer, which is fine for one
+  // that does not outlive the container anyway
+  snprintf(options, size, "upperdir=%s,workdir=%s%s%s%s%s", diff_dir,
+           work_dir, rootfs->driver == ROOTFS_EPHEMERAL ? ",volatile" : "",
+           rootfs->flags & ROOTFS_METACOPY ? ",metacopy=on" : "",
+           rootfs->flags & ROOTFS_REDIRECT_DIR ? ",redirect_dir=on" : "",
+           rootfs->flags & ROOTFS_INDEX ? ",index=on" : "");
+  return 0;
+}
+
+static void scratch_data(const struct rootfs_options *rootfs, char *data,
+                         size_t size) {
+  snprintf(data, size, "mode=0700,size=%s",
+           rootfs->size ? rootfs->size : ROOTFS_SIZE_DEFAULT);
 }
 
 int setup_container_data(const char *container_data_path,
-                         const char *image_path) {
+                         const char *lowerdir,
+                         const struct rootfs_options *rootfs) {
   if (access(container_data_path, F_OK) != 0)
     err(EXIT_FAILURE, "access %s", container_data_path);
-  if (access(image_path, F_OK) != 0) err(EXIT_FAILURE, "access %s", image_path);
-
-  char lower_dir[PATH_MAX];
-  snprintf(lower_dir, PATH_MAX, "%s/lower", container_data_path);
-  if (mkdir(lower_dir, 0700)) err(EXIT_FAILURE, "mkdir %s", lower_dir);
 
   char merged_root[PATH_MAX];
   snprintf(merged_root, PATH_MAX, "%s/merged", container_data_path);
   if (mkdir(merged_root, 0700)) err(EXIT_FAILURE, "mkdir %s", merged_root);
 
-  char diff_dir[PATH_MAX];
-  snprintf(diff_dir, PATH_MAX, "%s/diff", container_data_path);
-  if (mkdir(diff_dir, 0700)) err(EXIT_FAILURE, "mkdir %s", diff_dir);
+  if (rootfs->driver == ROOTFS_READONLY && strchr(lowerdir, ':') == NULL) {
+    // overlay wants two layers when there is no upper one
+    if (bind_mount_attr(lowerdir, merged_root, MS_RDONLY) == -1 &&
+        (errno != ENOSYS ||
+         mount(lowerdir, merged_root, NULL, MS_BIND, NULL) == -1 ||
+         mount(NULL, merged_root, NULL, MS_REMOUNT | MS_BIND | MS_RDONLY,
+               NULL) == -1))
+      err(EXIT_FAILURE, "mount-rootfs %s", lowerdir);
+    debug("Container data setup completed\n");
+    return 0;
+  }
 
-  char work_dir[PATH_MAX];
-  snprintf(work_dir, PATH_MAX, "%s/work", container_data_path);
-  if (mkdir(work_dir, 0700)) err(EXIT_FAILURE, "mkdir %s", work_dir);
-
-  // mount overlayfs
-  if (mount(image_path, lower_dir, NULL, MS_BIND, NULL) == -1)
-    err(EXIT_FAILURE, "bindmount-rootfs");
-  char options[PATH_MAX * 4];
-  snprintf(options, PATH_MAX * 4, "lowerdir=%s,upperdir=%s,workdir=%s",
-           lower_dir, diff_dir, work_dir);
-  if (mount("overlay", merged_root, "overlay", 0, options) == -1)
-    err(EXIT_FAILURE, "mount-overlay");
+  char options[PATH_MAX * 3] = "";
+  if (rootfs->driver != ROOTFS_READONLY) {
+    char dir[PATH_MAX - MOUNT_POINT_LEN_MAX];
+    snprintf(dir, sizeof(dir), "%s", container_data_path);
+    // the writable layer of ephemeral containers lives on a size capped tmpfs
+    // in their mount namespace, its pages are charged to their memory cgroup
+    if (rootfs->driver == ROOTFS_EPHEMERAL) {
+      snprintf(dir, sizeof(dir), "%s/scratch", container_data_path);
+      if (mkdir(dir, 0700)) err(EXIT_FAILURE, "mkdir %s", dir);
+      char data[64];
+      scratch_data(rootfs, data, sizeof(data));
+      if (mount("tmpfs", dir, "tmpfs", 0, data) == -1)
+        err(EXIT_FAILURE, "mount-scratch %s", data);
+    }
+    if (upper_layer_options(dir, rootfs, options, sizeof(options)) == -1)
+      err(EXIT_FAILURE, "mkdir-upper %s", dir);
+  }
+  bool readonly = rootfs->driver == ROOTFS_READONLY;
+
+  // mount overlayfs straight on the shared layer directories, so containers
+  // of images with common layers share their page cache
+  char data[PATH_MAX * 4];
+  int len = snprintf(data, PATH_MAX * 4, "lowerdir=%s%s%s", lowerdir,
+                     *options ? "," : "", options);
+  if (len >= getpagesize()) {
+    if (mount_overlay_layers(lowerdir, options,
+                             readonly ? MOUNT_ATTR_RDONLY : 0,
+                             merged_root) == -1)
+      err(EXIT_FAILURE, "mount-overlay");
+  } else if (mount("overlay", merged_root, "overlay", readonly ? MS_RDONLY : 0,
+                   data) == -1) {
+    err(EXIT_FAILURE, "mount-overlay %s", options);
+  }
 
   debug("Container data setup completed\n");
 
   return 0;
 }
 
-int setup_mounts(const char *merged_root, list_t *mounts) {
-  char mount_point[PATH_MAX];
-  snprintf(mount_point, PATH_MAX, "%s/proc", merged_root);
-  if (mount("proc", mount_point, "proc", 0, NULL) == -1)
-    err(EXIT_FAILURE, "mount-proc");
+// detached clones of the layers showing their files through the id mapping
+// of userns, as a colon separated list of paths to them. nothing on disk is
+// chowned, every container of an image shares its layers and page cache
+// whatever its ids
+static int idmap_layers(const char *lowerdir, int userns_fd, char *paths,
+                        size_t size, int *fds, int *count) {
+  char *layers = strdup(lowerdir);
+  char *saveptr;
+  size_t len = 0;
+  *count = 0;
+  *paths = '\0';
+  char *layer;
+  for (layer = strtok_r(layers, ":", &saveptr); layer && *count < LAYERS_MAX;
+       layer = strtok_r(NULL, ":", &saveptr)) {
+    int fd = open_tree(AT_FDCWD, layer, OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC);
+    if (fd == -1) break;
+    fds[(*count)++] = fd;
+    struct mount_attr attr = {.attr_set = MOUNT_ATTR_IDMAP,
+                              .userns_fd = userns_fd};
+    if (mount_setattr(fd, "", AT_EMPTY_PATH, &attr, sizeof(attr)) == -1) break;
+    len += snprintf(paths + len, size - len, "%s/proc/self/fd/%d",
+                    len ? ":" : "", fd);
+  }
+  int ret = layer ? -1 : 0;
+  free(layers);
+  return ret;
+}
+
+int prepare_rootfs(const char *lowerdir, const char *container_id,
+                   const char *container_base,
+                   const struct rootfs_options *rootfs, int userns_fd,
+                   uid_t uid, gid_t gid) {
+  char container_path[PATH_MAX - MOUNT_POINT_LEN_MAX];
+  snprintf(container_path, sizeof(container_path), "%s/%s", container_base,
+           container_id);
+  // searchable by a container root that is not the launcher's
+  if (mkdir(container_path, 0711)) return -1;
+  char merged_root[PATH_MAX];
+  snprintf(merged_root, PATH_MAX, "%s/merged", container_path);
+  if (mkdir(merged_root, 0700)) return -1;
+
+  // the topmost layer's root is the one the overlay shows
+  struct stat image_root;
+  size_t top = strcspn(lowerdir, ":");
+  char *top_layer = strndup(lowerdir, top);
+  int ret = stat(top_layer, &image_root);
+  free(top_layer);
+  if (ret == -1) return -1;
+
+  int mnt = -1, scratch = -1, count = 0;
+  int *layer_fds = calloc(LAYERS_MAX, sizeof(int));
+  char *layers = malloc(LAYERS_MAX * 32);
+  if (userns_fd != -1) {
+    if (idmap_layers(lowerdir, userns_fd, layers, LAYERS_MAX * 32, layer_fds,
+                     &count) == -1)
+      goto out;
+    lowerdir = layers;
+  }
+  if (rootfs->driver == ROOTFS_READONLY && count == 1) {
+    // overlay wants two layers when there is no upper one
+    struct mount_attr attr = {.attr_set = MOUNT_ATTR_RDONLY};
+    if (mount_setattr(layer_fds[0], "", AT_EMPTY_PATH, &attr, sizeof(attr)) ==
+        0)
+      mnt = dup(layer_fds[0]);
+    goto out;
+  }
+  if (rootfs->driver == ROOTFS_READONLY) {
+    mnt = overlay_fsmount(lowerdir, "", MOUNT_ATTR_RDONLY);
+    goto out;
+  }
+
+  // the ephemeral tmpfs is never attached anywhere, the overlay on top of it
+  // holds the only reference once the launcher closes it
+  char dir[PATH_MAX - MOUNT_POINT_LEN_MAX];
+  snprintf(dir, sizeof(dir), "%s", container_path);
+  if (rootfs->driver == ROOTFS_EPHEMERAL) {
+    char data[64];
+    scratch_data(rootfs, data, sizeof(data));
+    int fs = fsopen("tmpfs", FSOPEN_CLOEXEC);
+    if (fs == -1) goto out;
+    char *saveptr;
+    for (char *param = strtok_r(data, ",", &saveptr); param;
+         param = strtok_r(NULL, ",", &saveptr)) {
+      char *value = strchr(param, '=');
+      *value++ = '\0';
+      if (fsconfig(fs, FSCONFIG_SET_STRING, param, value, 0) == -1) break;
+    }
+    if (fsconfig(fs, FSCONFIG_CMD_CREATE, NULL, NULL, 0) == 0)
+      scratch = fsmount(fs, FSMOUNT_CLOEXEC, 0);
+    close(fs);
+    if (scratch == -1) goto out;
+    snprintf(dir, sizeof(dir), "/proc/self/fd/%d", scratch);
+  }
+
+  char options[PATH_MAX * 3];
+  if (upper_layer_options(dir, rootfs, options, sizeof(options)) == -1)
+    goto out;
+  // the root directory of the overlay is the upper one, it gets the mode of
+  // the image's and is owned by the container's root
+  char diff_dir[PATH_MAX];
+  snprintf(diff_dir, PATH_MAX, "%s/diff", dir);
+  if (chown(diff_dir, uid, gid) == -1 ||
+      chmod(diff_dir, image_root.st_mode & 07777) == -1)
+    goto out;
+  mnt = overlay_fsmount(lowerdir, options, 0);
+out:
+  if (scratch != -1) close(scratch);
+  for (int i = 0; i < count; i++) close(layer_fds[i]);
+  free(layer_fds);
+  free(layers);
+  return mnt;
+}
+
+static const char *devs[] = {"/dev/null", "/dev/zero",   "/dev/full",
+                             "/dev/tty",  "/dev/random", "/dev/urandom"};
+
+static int dev_template_fd = -1;
+static pthread_once_t dev_template_once = PTHREAD_ONCE_INIT;
+
+// build /dev once as a detached, read-only tmpfs holding the device nodes and
+// the mount points for the per-container pts, shm, mqueue and hugetlbfs
+// instances
+static void build_dev_template() {
+  int fs = fsopen("tmpfs", FSOPEN_CLOEXEC);
+  if (fs == -1) return;
+  int mnt = -1;
+  if (fsconfig(fs, FSCONFIG_SET_STRING, "mode", "0755", 0) == -1 ||
+      fsconfig(fs, FSCONFIG_SET_STRING, "size", "64k", 0) == -1 ||
+      fsconfig(fs, FSCONFIG_CMD_CREATE, NULL, NULL, 0) == -1 ||
+      (mnt = fsmount(fs, FSMOUNT_CLOEXEC,
+                     MOUNT_ATTR_NOSUID | MOUNT_ATTR_NOEXEC)) == -1)
+    goto fail;
+  for (int i = 0; i < 6; i++) {
+    struct stat st;
+    const char *name = devs[i] + strlen("/dev/");
+    if (stat(devs[i], &st) == -1 ||
+        mknodat(mnt, name, S_IFCHR | 0666, st.st_rdev) == -1 ||
+        fchmodat(mnt, name, 0666, 0) == -1)
+      goto fail;
+  }
+  if (mkdirat(mnt, "pts", 0755) == -1 || mkdirat(mnt, "shm", 0755) == -1 ||
+      mkdirat(mnt, "mqueue", 0755) == -1 ||
+      mkdirat(mnt, "hugepages", 0755) == -1 ||
+      symlinkat("/dev/pts/ptmx", mnt, "ptmx") == -1)
+    goto fail;
+  // every container shares this superblock, so the superblock itself is made
+  // read-only. a read-only mount alone could be remounted writable by a
+  // container's root, reconfiguring the superblock takes the host's root
+  close(fs);
+  fs = fspick(mnt, "", FSPICK_EMPTY_PATH | FSPICK_CLOEXEC);
+  if (fs == -1 || fsconfig(fs, FSCONFIG_SET_FLAG, "ro", NULL, 0) == -1 ||
+      fsconfig(fs, FSCONFIG_CMD_RECONFIGURE, NULL, NULL, 0) == -1)
+    goto fail;
+  struct mount_attr attr = {.attr_set = MOUNT_ATTR_RDONLY};
+  if (mount_setattr(mnt, "", AT_EMPTY_PATH, &attr, sizeof(attr)) == -1)
+    goto fail;
+  close(fs);
+  dev_template_fd = mnt;
+  debug("Built /dev template\n");
+  return;
+
+fail:
+  debug("Cannot build /dev template: %s\n", strerror(errno));
+  if (mnt != -1) close(mnt);
+  if (fs != -1) close(fs);
+}
+
+int parse_hugetlbfs(const char *spec, struct memory_mounts *memory) {
+  char *copy = strdup(spec);
+  char *saveptr;
+  char *page_size = strtok_r(copy, ":", &saveptr);
+  char *size = strtok_r(NULL, ":", &saveptr);
+  char *target = strtok_r(NULL, "", &saveptr);
+  int ret = -1;
+  char path[PATH_MAX];
+  if (page_size == NULL || size == NULL ||
+      parse_size(page_size, &memory->huge_page_size) == -1 ||
+      parse_size(size, &memory->hugetlbfs_size) == -1 ||
+      memory->huge_page_size == 0 ||
+      memory->hugetlbfs_size % memory->huge_page_size ||
+      (target && target[0] != '/'))
+    goto out;
+  snprintf(path, sizeof(path), "/sys/kernel/mm/hugepages/hugepages-%llukB",
+           memory->huge_page_size >> 10);
+  if (access(path, F_OK) == -1) goto out;
+  memory->hugetlbfs_target = strdup(target ? target : HUGETLBFS_TARGET_DEFAULT);
+  ret = 0;
+out:
+  free(copy);
+  return ret;
+}
+
+void huge_page_label(unsigned long long page_size, char *buf, size_t size) {
+  if (page_size >= 1ULL << 30 && page_size % (1ULL << 30) == 0)
+    snprintf(buf, size, "%lluGB", page_size >> 30);
+  else if (page_size >= 1ULL << 20 && page_size % (1ULL << 20) == 0)
+    snprintf(buf, size, "%lluMB", page_size >> 20);
+  else
+    snprintf(buf, size, "%lluKB", page_size >> 10);
+}
 
+int open_hugetlbfs(const struct memory_mounts *memory, uid_t uid, gid_t gid) {
+  int fs = fsopen("hugetlbfs", FSOPEN_CLOEXEC);
+  if (fs == -1) return -1;
+  char page_size[32], size[32], uid_str[16], gid_str[16];
+  snprintf(page_size, sizeof(page_size), "%llu", memory->huge_page_size);
+  snprintf(size, sizeof(size), "%llu", memory->hugetlbfs_size);
+  snprintf(uid_str, sizeof(uid_str), "%u", uid);
+  snprintf(gid_str, sizeof(gid_str), "%u", gid);
+  int mnt = -1;
+  if (fsconfig(fs, FSCONFIG_SET_STRING, "pagesize", page_size, 0) == -1 ||
+      fsconfig(fs, FSCONFIG_SET_STRING, "size", size, 0) == -1 ||
+      fsconfig(fs, FSCONFIG_SET_STRING, "uid", uid_str, 0) == -1 ||
+      fsconfig(fs, FSCONFIG_SET_STRING, "gid", gid_str, 0) == -1 ||
+      fsconfig(fs, FSCONFIG_SET_STRING, "mode", "0755", 0) == -1 ||
+      fsconfig(fs, FSCONFIG_CMD_CREATE, NULL, NULL, 0) == -1 ||
+      (mnt = fsmount(fs, FSMOUNT_CLOEXEC,
+                     MOUNT_ATTR_NOSUID | MOUNT_ATTR_NODEV)) == -1) {
+    int saved_errno = errno;
+    close(fs);
+    errno = saved_errno;
+    return -1;
+  }
+  close(fs);
+  return mnt;
+}
+
+int clone_dev_template() {
+  pthread_once(&dev_template_once, build_dev_template);
+  if (dev_template_fd == -1) return -1;
+  return open_tree(dev_template_fd, "",
+                   OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC | AT_EMPTY_PATH);
+}
+
+static void setup_dev(const char *merged_root) {
+  char mount_point[PATH_MAX];
   snprintf(mount_point, PATH_MAX, "%s/dev", merged_root);
   if (mount("tmpfs", mount_point, "tmpfs", MS_NOSUID | MS_STRICTATIME,
             "mode=0755,size=65536k") == -1)
@@ -76,18 +448,75 @@ int setup_mounts(const char *merged_root, list_t *mounts) {
 
   snprintf(mount_point, PATH_MAX, "%s/dev/pts", merged_root);
   if (mkdir(mount_point, 0700)) err(EXIT_FAILURE, "mkdir-dev/pts");
+  snprintf(mount_point, PATH_MAX, "%s/dev/shm", merged_root);
+  if (mkdir(mount_point, 0700)) err(EXIT_FAILURE, "mkdir-dev/shm");
+  snprintf(mount_point, PATH_MAX, "%s/dev/mqueue", merged_root);
+  if (mkdir(mount_point, 0700)) err(EXIT_FAILURE, "mkdir-dev/mqueue");
+  snprintf(mount_point, PATH_MAX, "%s/dev/hugepages", merged_root);
+  if (mkdir(mount_point, 0700)) err(EXIT_FAILURE, "mkdir-dev/hugepages");
+
+  for (int i = 0; i < 6; i++) {
+    snprintf(mount_point, PATH_MAX, "%s%s", merged_root, devs[i]);
+    int fd;
+    if (((fd = open(mount_point, O_CREAT, 0644)) == -1) || close(fd))
+      err(EXIT_FAILURE, "create-dev");
+    if (mount(devs[i], mount_point, NULL, MS_BIND, NULL) == -1)
+      err(EXIT_FAILURE, "mount-dev/null");
+  }
+
+  snprintf(mount_point, PATH_MAX, "%s/dev/ptmx", merged_root);
+  if (symlink("/dev/pts/ptmx", mount_point) == -1)
+    err(EXIT_FAILURE, "symlink-ptmx");
+}
+
+static void set_propagation(const struct mount_options *mount_option,
+                            const char *mount_point) {
+  if (mount_option->propagation &&
+      mount(NULL, mount_point, NULL, mount_option->propagation, NULL) == -1)
+    err(EXIT_FAILURE, "mount-propagation-%s", mount_point);
+}
+
+int setup_mounts(const char *merged_root, const struct mounts *mounts,
+                 const struct memory_mounts *memory, int dev_fd,
+                 int hugetlbfs_fd) {
+  char mount_point[PATH_MAX];
+  snprintf(mount_point, PATH_MAX, "%s/proc", merged_root);
+  if (mount("proc", mount_point, "proc", 0, NULL) == -1)
+    err(EXIT_FAILURE, "mount-proc");
+
+  snprintf(mount_point, PATH_MAX, "%s/dev", merged_root);
+  if (dev_fd == -1 || move_mount(dev_fd, "", AT_FDCWD, mount_point,
+                                 MOVE_MOUNT_F_EMPTY_PATH) == -1) {
+    if (dev_fd != -1) debug("move_mount-dev: %s\n", strerror(errno));
+    setup_dev(merged_root);
+  }
+  if (dev_fd != -1) close(dev_fd);
+
+  snprintf(mount_point, PATH_MAX, "%s/dev/pts", merged_root);
   if (mount("devpts", mount_point, "devpts", MS_NOEXEC | MS_NOSUID,
             "newinstance,ptmxmode=0666,mode=620") == -1)
     err(EXIT_FAILURE, "mount-dev/pts");
 
+  char shm_data[64];
+  snprintf(shm_data, sizeof(shm_data), "mode=1777,size=%llu",
+           memory->shm_size ? memory->shm_size : SHM_SIZE_DEFAULT);
   snprintf(mount_point, PATH_MAX, "%s/dev/shm", merged_root);
-  if (mkdir(mount_point, 0700)) err(EXIT_FAILURE, "mkdir-dev/shm");
   if (mount("shm", mount_point, "tmpfs", MS_NOEXEC | MS_NOSUID | MS_NODEV,
-            "mode=1777,size=65536k") == -1)
+            shm_data) == -1)
     err(EXIT_FAILURE, "mount-dev/shm");
 
+  if (hugetlbfs_fd != -1) {
+    snprintf(mount_point, PATH_MAX, "%s%s", merged_root,
+             memory->hugetlbfs_target);
+    if (mkdir(mount_point, 0755) == -1 && errno != EEXIST)
+      err(EXIT_FAILURE, "mkdir-%s", mount_point);
+    if (move_mount(hugetlbfs_fd, "", AT_FDCWD, mount_point,
+                   MOVE_MOUNT_F_EMPTY_PATH) == -1)
+      err(EXIT_FAILURE, "mount-hugetlbfs %s", memory->hugetlbfs_target);
+    close(hugetlbfs_fd);
+  }
+
   snprintf(mount_point, PATH_MAX, "%s/dev/mqueue", merged_root);
-  if (mkdir(mount_point, 0700)) err(EXIT_FAILURE, "mkdir-dev/mqueue");
   if (mount("mqueue", mount_point, "mqueue", MS_NOEXEC | MS_NOSUID | MS_NODEV,
             NULL) == -1)
     err(EXIT_FAILURE, "mount-dev/mqueue");
@@ -102,28 +531,30 @@ int setup_mounts(const char *merged_root, list_t *mounts) {
   //           MS_NOSUID | MS_NODEV | MS_NOEXEC | MS_RELATIME, NULL) == -1)
   //   err(EXIT_FAILURE, "mount-cgroup");
 
-  const char *devs[] = {"/dev/null", "/dev/zero",   "/dev/full",
-                        "/dev/tty",  "/dev/random", "/dev/urandom"};
-  for (int i = 0; i < 6; i++) {
-    snprintf(mount_point, PATH_MAX, "%s%s", merged_root, devs[i]);
-    int fd;
-    if (((fd = open(mount_point, O_CREAT, 0644)) == -1) || close(fd))
-      err(EXIT_FAILURE, "create-dev");
-    if (mount(devs[i], mount_point, NULL, MS_BIND, NULL) == -1)
-      err(EXIT_FAILURE, "mount-dev/null");
-  }
   snprintf(mount_point, PATH_MAX, "%s/etc/resolv.conf", merged_root);
   if (mount("/etc/resolv.conf", mount_point, NULL,
             MS_BIND | MS_NOATIME | MS_RDONLY, NULL) == -1)
     err(EXIT_FAILURE, "mount-resolv.conf");
 
   // mount user specified mounts
-  for (list_t *node = mounts; node; node = node->next) {
-    struct mount_options *mount_option = (struct mount_options *)node->data;
-    debug("Mounting %s to %s, fstype: %s, flags: 0x%x, options: %s\n",
+  bool mount_api = true;
+  for (unsigned int i = 0; i < mounts->count; i++) {
+    const struct mount_options *mount_option = &mounts->items[i];
+    debug("Mounting %s to %s, fstype: %s, flags: 0x%lx, options: %s\n",
           mount_option->source, mount_option->target, mount_option->filesystem,
           mount_option->flags, mount_option->data);
     snprintf(mount_point, PATH_MAX, "%s%s", merged_root, mount_option->target);
+    if (mount_option->filesystem) {
+      // a filesystem of its own, the container may mount these itself
+      if (mkdir(mount_point, 0755) == -1 && errno != EEXIST)
+        err(EXIT_FAILURE, "mkdir-%s", mount_point);
+      if (mount(mount_option->source, mount_point, mount_option->filesystem,
+                mount_option->flags, mount_option->data) == -1)
+        err(EXIT_FAILURE, "mount-%s:%s", mount_option->filesystem,
+            mount_option->target);
+      set_propagation(mount_option, mount_point);
+      continue;
+    }
     if (access(mount_point, F_OK) == -1) {
       struct stat st;
       if (stat(mount_option->source, &st) == -1)
@@ -138,22 +569,47 @@ int setup_mounts(const char *merged_root, list_t *mounts) {
         close(fd);
       }
     }
-    if (mount(mount_option->source, mount_point, mount_option->filesystem,
-              MS_BIND, mount_option->data) == -1)
+    if (mount_api) {
+      if (bind_mount_attr(mount_option->source, mount_point,
+                          mount_option->flags) == 0) {
+        set_propagation(mount_option, mount_point);
+        continue;
+      }
+      // mounts from the host keep their atime mode in a user namespace
+      if (errno == EPERM && mount_option->flags & MS_NOATIME)
+        errx(EXIT_FAILURE, "mount-%s:%s: atime mode of the source is locked",
+             mount_option->source, mount_option->target);
+      // nor may a bind uncover what the host mounted over
+      if (errno == EINVAL && !(mount_option->flags & MS_REC))
+        errx(EXIT_FAILURE, "mount-%s:%s: the source has submounts, use rbind",
+             mount_option->source, mount_option->target);
+      if (errno != ENOSYS)
+        err(EXIT_FAILURE, "mount-%s:%s", mount_option->source,
+            mount_option->target);
+      mount_api = false;
+    }
+    if (mount(mount_option->source, mount_point, NULL,
+              MS_BIND | (mount_option->flags & MS_REC), NULL) == -1)
       err(EXIT_FAILURE, "mount-%s:%s", mount_option->source,
           mount_option->target);
-    if (mount(NULL, mount_point, NULL, mount_option->flags | MS_REMOUNT,
-              NULL) == -1)
+    // only reaches the top of a recursive bind
+    if (mount(NULL, mount_point, NULL,
+              (mount_option->flags & ~MS_REC) | MS_REMOUNT, NULL) == -1)
       err(EXIT_FAILURE, "mount-remount-%s", mount_point);
+    set_propagation(mount_option, mount_point);
   }
 
   return 0;
 }
 
-int setup_filesystem(const char *image_path, const char *container_id,
-                     const char *container_base, list_t *mounts) {
-  debug("Image path: %s\n", image_path);
-  if (image_path == NULL || container_base == NULL) {
+int setup_filesystem(const char *lowerdir, const char *container_id,
+                     const char *container_base,
+                     const struct rootfs_options *rootfs, int rootfs_fd,
+                     const struct mounts *mounts,
+                     const struct memory_mounts *memory, int dev_fd,
+                     int hugetlbfs_fd, trace_t *trace) {
+  debug("Image layers: %s\n", lowerdir);
+  if (lowerdir == NULL || container_base == NULL) {
     error("Neither rootfs nor container_base should be NULL\n");
     exit(EXIT_FAILURE);
   }
@@ -164,16 +620,27 @@ int setup_filesystem(const char *image_path, const char *container_id,
 
   char container_path[PATH_MAX - MOUNT_POINT_LEN_MAX];
   snprintf(container_path, PATH_MAX, "%s/%s", container_base, container_id);
-  if (mkdir(container_path, 0700))
-    err(EXIT_FAILURE, "mkdir %s", container_path);
-  debug("Container path: %s\n", container_path);
-
-  setup_container_data(container_path, image_path);
-
   char merged_root[PATH_MAX];
   snprintf(merged_root, PATH_MAX, "%s/merged", container_path);
+  debug("Container path: %s\n", container_path);
+
+  trace_begin(trace, PHASE_OVERLAY_MOUNT);
+  if (rootfs_fd != -1) {
+    // built by the launcher, which also created the container path
+    if (move_mount(rootfs_fd, "", AT_FDCWD, merged_root,
+                   MOVE_MOUNT_F_EMPTY_PATH) == -1)
+      err(EXIT_FAILURE, "move_mount-rootfs");
+    close(rootfs_fd);
+  } else {
+    if (mkdir(container_path, 0700))
+      err(EXIT_FAILURE, "mkdir %s", container_path);
+    setup_container_data(container_path, lowerdir, rootfs);
+  }
+  trace_end(trace, PHASE_OVERLAY_MOUNT);
 
-  setup_mounts(merged_root, mounts);
+  trace_begin(trace, PHASE_SETUP_MOUNTS);
+  setup_mounts(merged_root, mounts, memory, dev_fd, hugetlbfs_fd);
+  trace_end(trace, PHASE_SETUP_MOUNTS);
 
   // char cgroup_path[PATH_MAX + 30];
   // snprintf(cgroup_path, PATH_MAX + 30, "/sys/fs/cgroup/system.slice/%s",
@@ -187,17 +654,13 @@ int setup_filesystem(const char *image_path, const char *container_id,
   //     -1)
   //   err(EXIT_FAILURE, "mount-cgroup-remount");
 
-  char put_old[PATH_MAX + 10];
-  snprintf(put_old, PATH_MAX + 10, "%s/old_root", merged_root);
-  if (mkdir(put_old, 0700)) err(EXIT_FAILURE, "mkdir-put_old");
-  if (pivot_root(merged_root, put_old) == -1) err(EXIT_FAILURE, "pivot_root");
-
-  // remove old_root
-  if (umount2("/old_root", MNT_DETACH) == -1) perror("umount2");
-  if (rmdir("/old_root") == -1) perror("rmdir");
-
-  if (symlink("/dev/pts/ptmx", "/dev/ptmx") == -1)
-    err(EXIT_FAILURE, "symlink-ptmx");
+  trace_begin(trace, PHASE_PIVOT_ROOT);
+  // stack the old root on the new one and detach it from there, so nothing
+  // has to be created in a read-only rootfs
+  if (chdir(merged_root) == -1) err(EXIT_FAILURE, "chdir %s", merged_root);
+  if (pivot_root(".", ".") == -1) err(EXIT_FAILURE, "pivot_root");
+  if (umount2(".", MNT_DETACH) == -1) perror("umount2");
+  trace_end(trace, PHASE_PIVOT_ROOT);
 
   if (mount("tmpfs", "/tmp", "tmpfs", 0, NULL) == -1)
     err(EXIT_FAILURE, "mount-tmpfs");
@@ -212,20 +675,139 @@ int setup_filesystem(const char *image_path, const char *container_id,
   return 0;
 }
 
-int parse_bind_mount_option(const char *options) {
-  if (!options) return 0;
-  char *options_copy = strdup(options);
-  char *option = strtok(options_copy, ",");
-  int flags = 0;
-  while (option) {
-    if (strncmp(option, "ro", 2) == 0) {
-      flags |= MS_RDONLY;
-    } else if (strncmp(option, "rw", 2) == 0) {
-      flags &= ~MS_RDONLY;
-    } else {
-      err(EXIT_FAILURE, "Invalid bind mount option: %s\n", option);
+// the options volumes and tmpfs mounts share, false for any other
+static bool parse_mount_option(const char *option,
+                               struct mount_options *mount_option) {
+  static const struct {
+    const char *name;
+    unsigned long set;
+    unsigned long clear;
+  } flags[] = {
+      {"ro", MS_RDONLY, 0},      {"rw", 0, MS_RDONLY},
+      {"nosuid", MS_NOSUID, 0},  {"suid", 0, MS_NOSUID},
+      {"nodev", MS_NODEV, 0},    {"dev", 0, MS_NODEV},
+      {"noexec", MS_NOEXEC, 0},  {"exec", 0, MS_NOEXEC},
+      {"noatime", MS_NOATIME, 0}, {"atime", 0, MS_NOATIME},
+  };
+  static const struct {
+    const char *name;
+    unsigned long propagation;
+  } propagations[] = {
+      {"private", MS_PRIVATE},
+      {"rprivate", MS_PRIVATE | MS_REC},
+      {"shared", MS_SHARED},
+      {"rshared", MS_SHARED | MS_REC},
+      {"slave", MS_SLAVE},
+      {"rslave", MS_SLAVE | MS_REC},
+      {"unbindable", MS_UNBINDABLE},
+      {"runbindable", MS_UNBINDABLE | MS_REC},
+  };
+  for (size_t i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+    if (strcmp(option, flags[i].name)) continue;
+    mount_option->flags |= flags[i].set;
+    mount_option->flags &= ~flags[i].clear;
+    return true;
+  }
+  for (size_t i = 0; i < sizeof(propagations) / sizeof(propagations[0]); i++) {
+    if (strcmp(option, propagations[i].name)) continue;
+    mount_option->propagation = propagations[i].propagation;
+    return true;
+  }
+  return false;
+}
+
+int parse_volume(arena_t *arena, struct mounts *mounts, const char *spec) {
+  char *copy = strdup(spec);
+  char *saveptr;
+  char *source = strtok_r(copy, ":", &saveptr);
+  char *target = strtok_r(NULL, ":", &saveptr);
+  char *options = strtok_r(NULL, "", &saveptr);
+  int ret = -1;
+  if (source == NULL || target == NULL || target[0] != '/') goto out;
+  // nested mounts come along unless norbind
+  struct mount_options volume = {.flags = MS_BIND | MS_REC};
+  for (char *option = options ? strtok_r(options, ",", &saveptr) : NULL;
+       option; option = strtok_r(NULL, ",", &saveptr)) {
+    if (strcmp(option, "rbind") == 0)
+      volume.flags |= MS_REC;
+    else if (strcmp(option, "norbind") == 0)
+      volume.flags &= ~MS_REC;
+    else if (!parse_mount_option(option, &volume))
+      goto out;
+  }
+  append_mount_options(arena, mounts, source, target, NULL, volume.flags, NULL)
+      ->propagation = volume.propagation;
+  ret = 0;
+out:
+  free(copy);
+  return ret;
+}
+
+int parse_tmpfs(arena_t *arena, struct mounts *mounts, const char *spec) {
+  char *copy = strdup(spec);
+  char *saveptr;
+  char *target = strtok_r(copy, ":", &saveptr);
+  char *options = strtok_r(NULL, "", &saveptr);
+  int ret = -1;
+  if (target == NULL || target[0] != '/') goto out;
+  struct mount_options tmpfs = {.flags = MS_NOSUID | MS_NODEV};
+  char data[64] = "mode=1777";
+  unsigned long long size = 0;
+  for (char *option = options ? strtok_r(options, ",", &saveptr) : NULL;
+       option; option = strtok_r(NULL, ",", &saveptr)) {
+    char *end;
+    if (strncmp(option, "size=", 5) == 0) {
+      if (parse_size(option + 5, &size) == -1 || size == 0) goto out;
+    } else if (strncmp(option, "mode=", 5) == 0) {
+      unsigned long mode = strtoul(option + 5, &end, 8);
+      if (end == option + 5 || *end || mode > 07777) goto out;
+      snprintf(data, sizeof(data), "mode=%lo", mode);
+    } else if (!parse_mount_option(option, &tmpfs)) {
+      goto out;
     }
-    option = strtok(NULL, ",");
   }
-  return flags;
-}
\ No newline at end of file
+  // without a size the kernel allows half of the memory
+  if (size) snprintf(data + strlen(data), sizeof(data) - strlen(data),
+                     ",size=%llu", size);
+  append_mount_options(arena, mounts, "tmpfs", target, "tmpfs", tmpfs.flags,
+                       data)
+      ->propagation = tmpfs.propagation;
+  ret = 0;
+out:
+  free(copy);
+  return ret;
+}
+
+int parse_rootfs_options(const char *spec, struct rootfs_options *rootfs) {
+  *rootfs = (struct rootfs_options){0};
+  char *copy = strdup(spec);
+  char *saveptr;
+  char *driver = strtok_r(copy, ",", &saveptr);
+  int ret = 0;
+  if (driver == NULL || strcmp(driver, "overlay") == 0)
+    rootfs->driver = ROOTFS_OVERLAY;
+  else if (strcmp(driver, "ephemeral") == 0)
+    rootfs->driver = ROOTFS_EPHEMERAL;
+  else if (strcmp(driver, "ro") == 0)
+    rootfs->driver = ROOTFS_READONLY;
+  else
+    ret = -1;
+  for (char *option = strtok_r(NULL, ",", &saveptr); option && ret == 0;
+       option = strtok_r(NULL, ",", &saveptr)) {
+    if (strcmp(option, "metacopy") == 0)
+      rootfs->flags |= ROOTFS_METACOPY;
+    else if (strcmp(option, "redirect_dir") == 0)
+      rootfs->flags |= ROOTFS_REDIRECT_DIR;
+    else if (strcmp(option, "index") == 0)
+      rootfs->flags |= ROOTFS_INDEX;
+    else if (strncmp(option, "size=", 5) == 0 &&
+             rootfs->driver == ROOTFS_EPHEMERAL)
+      rootfs->size = strdup(option + 5);
+    else
+      ret = -1;
+  }
+  // there is nothing to copy up without a writable layer
+  if (rootfs->driver == ROOTFS_READONLY && rootfs->flags) ret = -1;
+  free(copy);
+  return ret;
+}
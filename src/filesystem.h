@@ -1,7 +1,38 @@
 #ifndef _FILESYSTEM_H_
 #define _FILESYSTEM_H_
+#include <sys/types.h>
+
+#include "trace.h"
 #include "type.h"
 #define MOUNT_POINT_LEN_MAX 256
+// cap of the tmpfs holding the writable layer of ephemeral containers
+#define ROOTFS_SIZE_DEFAULT "512m"
+#define SHM_SIZE_DEFAULT (64ULL << 20)
+#define HUGETLBFS_TARGET_DEFAULT "/dev/hugepages"
+
+enum rootfs_driver {
+  // overlay with its writable layer on the container base
+  ROOTFS_OVERLAY = 0,
+  // overlay with a volatile writable layer on a tmpfs, lost with the container
+  ROOTFS_EPHEMERAL,
+  // the image layers alone, read-only
+  ROOTFS_READONLY,
+};
+
+// copy up only metadata on chmod/chown, and the rename and hard link
+// handling it relies on
+#define ROOTFS_METACOPY 0x1
+#define ROOTFS_REDIRECT_DIR 0x2
+#define ROOTFS_INDEX 0x4
+// options only prepare_rootfs can apply
+#define ROOTFS_PRIVILEGED (ROOTFS_METACOPY | ROOTFS_REDIRECT_DIR | ROOTFS_INDEX)
+
+struct rootfs_options {
+  enum rootfs_driver driver;
+  int flags;
+  // tmpfs size of ephemeral containers, NULL for ROOTFS_SIZE_DEFAULT
+  char *size;
+};
 
 struct mount_options {
   char *source;
@@ -9,15 +40,79 @@ struct mount_options {
   char *filesystem;
   unsigned long flags;
   char *data;
+  // MS_SHARED, MS_SLAVE, MS_PRIVATE or MS_UNBINDABLE, with MS_REC for the
+  // mounts below too. 0 keeps what the mount inherits
+  unsigned long propagation;
+};
+
+// a growable array of mounts, the array and its strings live in an arena
+struct mounts {
+  struct mount_options *items;
+  unsigned int count;
+  unsigned int capacity;
+};
+
+// filesystem NULL for a bind mount of source
+struct mount_options *append_mount_options(arena_t *arena,
+                                           struct mounts *mounts,
+                                           const char *source,
+                                           const char *target,
+                                           const char *filesystem,
+                                           unsigned long flags,
+                                           const char *data);
+
+// the memory backed filesystems of a container: its /dev/shm tmpfs and a
+// hugetlbfs instance when hugetlbfs_target is set
+struct memory_mounts {
+  unsigned long long shm_size;
+  char *hugetlbfs_target;
+  unsigned long long huge_page_size;
+  unsigned long long hugetlbfs_size;
 };
 
-list_t *append_mount_options(list_t **head, const char *source,
-                             const char *target, const char *filesystem,
-                             unsigned long flags, const char *data);
+// "PAGESIZE:SIZE[:TARGET]" with sizes as N[kmg], SIZE a multiple of a page
+// size the kernel supports
+int parse_hugetlbfs(const char *spec, struct memory_mounts *memory);
+// how hugetlb cgroup files name a page size, "2MB" or "1GB"
+void huge_page_label(unsigned long long page_size, char *buf, size_t size);
+// detached hugetlbfs owned by the container's root, which only the initial
+// user namespace may create. -1 on failure
+int open_hugetlbfs(const struct memory_mounts *memory, uid_t uid, gid_t gid);
+
+// detached read-only clone of the shared /dev template for one container,
+// -1 if the kernel lacks the new mount API
+int clone_dev_template();
+
+// the rootfs of a container as a detached mount, built by the launcher for
+// the copy-up options, which keep their state in trusted.* xattrs the
+// container's user namespace may not set, and to idmap the image layers into
+// userns, -1 for none. uid and gid are the host ids of the container's root.
+// creates the container path, -1 on failure
+int prepare_rootfs(const char *lowerdir, const char *container_id,
+                   const char *container_base,
+                   const struct rootfs_options *rootfs, int userns_fd,
+                   uid_t uid, gid_t gid);
+
+// lowerdir is the colon separated layer list, topmost first. rootfs_fd is
+// the overlay from prepare_rootfs, -1 to mount one here. hugetlbfs_fd is the
+// mount from open_hugetlbfs, -1 for none
+int setup_filesystem(const char *lowerdir, const char *container_id,
+                     const char *container_base,
+                     const struct rootfs_options *rootfs, int rootfs_fd,
+                     const struct mounts *mounts,
+                     const struct memory_mounts *memory, int dev_fd,
+                     int hugetlbfs_fd, trace_t *trace);
 
-int setup_filesystem(const char *image_path, const char *container_id,
-                     const char *container_base, list_t *mounts);
+// "DRIVER[,OPTION...]" with driver overlay, ephemeral or ro and options
+// metacopy, redirect_dir, index and size=SIZE
+int parse_rootfs_options(const char *spec, struct rootfs_options *rootfs);
 
-int parse_bind_mount_option(const char *options);
+// "SRC:DST[:OPTION,...]" with ro, rw, nosuid, nodev, noexec, noatime, the
+// propagation modes private, shared, slave, unbindable and their recursive
+// r variants, and rbind, the default, or norbind
+int parse_volume(arena_t *arena, struct mounts *mounts, const char *spec);
+// "DST[:OPTION,...]" with size=N[kmg], mode=OCTAL and the volume options but
+// the bind ones. nosuid and nodev by default
+int parse_tmpfs(arena_t *arena, struct mounts *mounts, const char *spec);
 
 #endif
\ No newline at end of file
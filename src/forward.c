@@ -0,0 +1,523 @@
+#define _GNU_SOURCE
+#include "forward.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "utils.h"
+
+// what an epoll event is about
+enum source_kind {
+  SOURCE_STOP = 0,
+  SOURCE_LISTEN,
+  SOURCE_CLIENT,
+  SOURCE_UPSTREAM,
+  SOURCE_SESSION
+};
+
+struct source {
+  enum source_kind kind;
+  void *owner;
+};
+
+// one direction of a tcp connection, what arrives on from waits in the pipe
+// until to takes it
+struct flow {
+  int from;
+  int to;
+  int pipe[2];
+  size_t pending;
+  bool eof;
+  bool shut;
+};
+
+// fds[0] is the client and fds[1] the connection into the container,
+// flows[0] carries what the client sends and flows[1] the replies
+struct connection {
+  struct port *port;
+  int fds[2];
+  struct flow flows[2];
+  struct source sources[2];
+  bool connecting;
+  // closed while handling a batch of events, freed once the batch is done
+  bool dead;
+  struct connection *next;
+};
+
+// a udp client and its socket connected to the container, fd is -1 for a
+// free slot
+struct session {
+  struct port *port;
+  struct sockaddr_in client;
+  int fd;
+  unsigned long long last;
+  struct source source;
+};
+
+// a published port in the relay process, every port shares its epoll_fd
+struct port {
+  struct port_forward forward;
+  struct sockaddr_in target;
+  int listen_fd;
+  int epoll_fd;
+  struct source listen_source;
+  struct connection *connections;
+  bool reap;
+  struct session *sessions;
+  // bytes[0] went into the container, bytes[1] came out of it
+  unsigned long long clients;
+  unsigned long long bytes[2];
+};
+
+// the relay process of a container's ports, it reports and exits on SIGTERM
+struct forwarder {
+  pid_t pid;
+};
+
+static const char *protocol_name(const struct port_forward *forward) {
+  return forward->type == SOCK_DGRAM ? "udp" : "tcp";
+}
+
+static int parse_port_number(const char *str, uint16_t *port) {
+  char *end;
+  errno = 0;
+  unsigned long value = strtoul(str, &end, 10);
+  if (errno || end == str || *end || value == 0 || value > UINT16_MAX)
+    return -1;
+  *port = value;
+  return 0;
+}
+
+int parse_port(arena_t *arena, struct port_forwards *ports, const char *spec) {
+  char *copy = strdup(spec);
+  char *protocol = strchr(copy, '/');
+  if (protocol) *protocol++ = '\0';
+  char *container_port = strchr(copy, ':');
+  struct port_forward forward = {.type = SOCK_STREAM};
+  int ret = -1;
+  if (container_port == NULL) goto out;
+  *container_port++ = '\0';
+  if (parse_port_number(copy, &forward.host_port) == -1 ||
+      parse_port_number(container_port, &forward.container_port) == -1)
+    goto out;
+  if (protocol && strcmp(protocol, "udp") == 0)
+    forward.type = SOCK_DGRAM;
+  else if (protocol && strcmp(protocol, "tcp") != 0)
+    goto out;
+  ports->items = arena_grow(arena, ports->items, ports->count,
+                            &ports->capacity, sizeof(struct port_forward));
+  ports->items[ports->count++] = forward;
+  ret = 0;
+out:
+  free(copy);
+  return ret;
+}
+
+static int epoll_add(struct port *port, int fd, unsigned int events,
+                     struct source *source) {
+  struct epoll_event event = {.events = events, .data.ptr = source};
+  return epoll_ctl(port->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+static void close_fd(int *fd) {
+  if (*fd != -1) close(*fd);
+  *fd = -1;
+}
+
+static void close_connection(struct port *port, struct connection *conn) {
+  for (int i = 0; i < 2; i++) {
+    close_fd(&conn->fds[i]);
+    close_fd(&conn->flows[i].pipe[0]);
+    close_fd(&conn->flows[i].pipe[1]);
+  }
+  conn->dead = true;
+  port->reap = true;
+}
+
+static void reap_connections(struct port *port) {
+  struct connection **cur = &port->connections;
+  while (*cur) {
+    struct connection *conn = *cur;
+    if (conn->dead) {
+      *cur = conn->next;
+      free(conn);
+    } else {
+      cur = &conn->next;
+    }
+  }
+  port->reap = false;
+}
+
+static void open_connection(struct port *port, int client) {
+  struct connection *conn = calloc(1, sizeof(struct connection));
+  conn->port = port;
+  conn->fds[0] = client;
+  conn->fds[1] = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  for (int i = 0; i < 2; i++) {
+    struct flow *flow = &conn->flows[i];
+    flow->from = conn->fds[i];
+    flow->to = conn->fds[1 - i];
+    flow->pipe[0] = flow->pipe[1] = -1;
+    if (pipe2(flow->pipe, O_CLOEXEC | O_NONBLOCK) == 0)
+      // best effort, a smaller pipe only means more splices
+      fcntl(flow->pipe[1], F_SETPIPE_SZ, FORWARD_PIPE_SIZE);
+    conn->sources[i] = (struct source){i ? SOURCE_UPSTREAM : SOURCE_CLIENT,
+                                       conn};
+  }
+  conn->next = port->connections;
+  port->connections = conn;
+  port->clients++;
+  if (conn->fds[1] == -1 || conn->flows[0].pipe[0] == -1 ||
+      conn->flows[1].pipe[0] == -1) {
+    warn("Cannot forward a connection to port %u: %s\n",
+         port->forward.container_port, strerror(errno));
+    close_connection(port, conn);
+    return;
+  }
+  // relayed requests are usually whole messages already
+  int one = 1;
+  setsockopt(conn->fds[0], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  setsockopt(conn->fds[1], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  conn->connecting =
+      connect(conn->fds[1], (struct sockaddr *)&port->target,
+              sizeof(port->target)) == -1;
+  if ((conn->connecting && errno != EINPROGRESS) ||
+      epoll_add(port, conn->fds[0], EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+                &conn->sources[0]) == -1 ||
+      epoll_add(port, conn->fds[1], EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+                &conn->sources[1]) == -1) {
+    debug("Cannot connect to port %u: %s\n", port->forward.container_port,
+          strerror(errno));
+    close_connection(port, conn);
+  }
+}
+
+static void accept_connections(struct port *port) {
+  for (;;) {
+    int client = accept4(port->listen_fd, NULL, NULL,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (client != -1) {
+      open_connection(port, client);
+      continue;
+    }
+    if (errno == EINTR || errno == ECONNABORTED) continue;
+    if (errno != EAGAIN)
+      warn("accept on port %u: %s\n", port->forward.host_port,
+           strerror(errno));
+    return;
+  }
+}
+
+// move what from has on to to until one of them would block, -1 once the
+// connection failed. the edge triggered events only come again after that
+static int pump(struct flow *flow, unsigned long long *bytes) {
+  for (;;) {
+    ssize_t n;
+    if (flow->pending) {
+      n = splice(flow->pipe[0], NULL, flow->to, NULL, flow->pending,
+                 SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if (n > 0) {
+        flow->pending -= n;
+        *bytes += n;
+        continue;
+      }
+    } else if (flow->eof) {
+      if (!flow->shut) shutdown(flow->to, SHUT_WR);
+      flow->shut = true;
+      return 0;
+    } else {
+      n = splice(flow->from, NULL, flow->pipe[1], NULL, FORWARD_PIPE_SIZE,
+                 SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if (n >= 0) {
+        flow->pending = n;
+        flow->eof = n == 0;
+        continue;
+      }
+    }
+    if (errno == EINTR) continue;
+    return errno == EAGAIN ? 0 : -1;
+  }
+}
+
+static void handle_connection(struct connection *conn, int side,
+                              unsigned int events) {
+  struct port *port = conn->port;
+  if (conn->dead) return;
+  if (conn->connecting) {
+    // the client waits in its socket until the container answered
+    if (side == 0) return;
+    int error = 0;
+    socklen_t len = sizeof(error);
+    getsockopt(conn->fds[1], SOL_SOCKET, SO_ERROR, &error, &len);
+    if (error || events & (EPOLLERR | EPOLLHUP)) {
+      debug("Cannot connect to port %u: %s\n", port->forward.container_port,
+            strerror(error));
+      close_connection(port, conn);
+      return;
+    }
+    conn->connecting = false;
+  }
+  if (events & EPOLLERR || pump(&conn->flows[0], &port->bytes[0]) == -1 ||
+      pump(&conn->flows[1], &port->bytes[1]) == -1 ||
+      (conn->flows[0].shut && conn->flows[1].shut))
+    close_connection(port, conn);
+}
+
+// the session of client, a new one if it has none. the oldest session makes
+// room when all are taken
+static struct session *find_session(struct port *port,
+                                    const struct sockaddr_in *client) {
+  struct session *free_slot = NULL, *oldest = NULL;
+  for (int i = 0; i < FORWARD_UDP_SESSIONS_MAX; i++) {
+    struct session *session = &port->sessions[i];
+    if (session->fd == -1) {
+      if (free_slot == NULL) free_slot = session;
+      continue;
+    }
+    if (session->client.sin_addr.s_addr == client->sin_addr.s_addr &&
+        session->client.sin_port == client->sin_port)
+      return session;
+    if (oldest == NULL || session->last < oldest->last) oldest = session;
+  }
+  struct session *session = free_slot ? free_slot : oldest;
+  close_fd(&session->fd);
+  session->fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  session->port = port;
+  session->client = *client;
+  session->source = (struct source){SOURCE_SESSION, session};
+  if (session->fd == -1 ||
+      connect(session->fd, (struct sockaddr *)&port->target,
+              sizeof(port->target)) == -1 ||
+      epoll_add(port, session->fd, EPOLLIN, &session->source) == -1) {
+    warn("Cannot forward datagrams to port %u: %s\n",
+         port->forward.container_port, strerror(errno));
+    close_fd(&session->fd);
+    return NULL;
+  }
+  port->clients++;
+  return session;
+}
+
+static void relay_requests(struct port *port) {
+  char buf[FORWARD_DATAGRAM_MAX];
+  for (;;) {
+    struct sockaddr_in client;
+    socklen_t len = sizeof(client);
+    ssize_t n = recvfrom(port->listen_fd, buf, sizeof(buf), 0,
+                         (struct sockaddr *)&client, &len);
+    if (n == -1 && errno == EINTR) continue;
+    if (n == -1) return;
+    struct session *session = find_session(port, &client);
+    if (session == NULL) continue;
+    session->last = monotonic_timestamp();
+    if (send(session->fd, buf, n, 0) == n) port->bytes[0] += n;
+  }
+}
+
+static void relay_replies(struct session *session) {
+  struct port *port = session->port;
+  char buf[FORWARD_DATAGRAM_MAX];
+  while (session->fd != -1) {
+    ssize_t n = recv(session->fd, buf, sizeof(buf), 0);
+    if (n == -1 && errno == EINTR) continue;
+    // refused datagrams show up as errors of the next receive
+    if (n == -1) return;
+    session->last = monotonic_timestamp();
+    if (sendto(port->listen_fd, buf, n, 0,
+               (struct sockaddr *)&session->client,
+               sizeof(session->client)) == n)
+      port->bytes[1] += n;
+  }
+}
+
+static void expire_sessions(struct port *port) {
+  unsigned long long now = monotonic_timestamp();
+  for (int i = 0; i < FORWARD_UDP_SESSIONS_MAX; i++) {
+    struct session *session = &port->sessions[i];
+    if (session->fd != -1 &&
+        now - session->last > FORWARD_UDP_TIMEOUT_MS * 1000000ULL)
+      close_fd(&session->fd);
+  }
+}
+
+// the relay process: one epoll loop for every port of the container until
+// the launcher sends SIGTERM or goes away
+static void relay_main(struct port *ports, unsigned int count, pid_t parent) {
+  prctl(PR_SET_NAME, "mc-forward");
+  prctl(PR_SET_PDEATHSIG, SIGTERM);
+  sigset_t mask;
+  sigfillset(&mask);
+  sigprocmask(SIG_BLOCK, &mask, NULL);
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGTERM);
+  int signal_fd = signalfd(-1, &mask, SFD_CLOEXEC);
+  if (signal_fd == -1 || getppid() != parent) _exit(EXIT_FAILURE);
+  // the launcher's other children must not be kept alive through their fds
+  int keep[count + 2];
+  keep[0] = ports[0].epoll_fd;
+  keep[1] = signal_fd;
+  for (unsigned int i = 0; i < count; i++) keep[i + 2] = ports[i].listen_fd;
+  close_inherited_fds(keep, count + 2);
+  struct source stop_source = {SOURCE_STOP, NULL};
+  if (epoll_add(&ports[0], signal_fd, EPOLLIN, &stop_source) == -1)
+    _exit(EXIT_FAILURE);
+  bool udp = false;
+  for (unsigned int i = 0; i < count; i++) {
+    if (ports[i].forward.type != SOCK_DGRAM) continue;
+    udp = true;
+    ports[i].sessions =
+        calloc(FORWARD_UDP_SESSIONS_MAX, sizeof(struct session));
+    for (int j = 0; j < FORWARD_UDP_SESSIONS_MAX; j++)
+      ports[i].sessions[j].fd = -1;
+  }
+
+  struct epoll_event events[FORWARD_EVENTS_MAX];
+  bool stopping = false;
+  while (!stopping) {
+    // udp sessions have no end but their timeout
+    int n = epoll_wait(ports[0].epoll_fd, events, FORWARD_EVENTS_MAX,
+                       udp ? FORWARD_UDP_TIMEOUT_MS / 10 : -1);
+    if (n == -1 && errno == EINTR) continue;
+    if (n == -1) {
+      warn("epoll_wait-forward: %s\n", strerror(errno));
+      break;
+    }
+    for (int i = 0; i < n; i++) {
+      struct source *source = events[i].data.ptr;
+      switch (source->kind) {
+        case SOURCE_STOP:
+          stopping = true;
+          break;
+        case SOURCE_LISTEN: {
+          struct port *port = source->owner;
+          if (port->forward.type == SOCK_DGRAM)
+            relay_requests(port);
+          else
+            accept_connections(port);
+          break;
+        }
+        case SOURCE_CLIENT:
+        case SOURCE_UPSTREAM:
+          handle_connection(source->owner, source->kind == SOURCE_UPSTREAM,
+                            events[i].events);
+          break;
+        case SOURCE_SESSION:
+          relay_replies(source->owner);
+          break;
+      }
+    }
+    for (unsigned int i = 0; i < count; i++) {
+      if (ports[i].reap) reap_connections(&ports[i]);
+      if (ports[i].sessions) expire_sessions(&ports[i]);
+    }
+  }
+  for (unsigned int i = 0; i < count; i++) {
+    struct port *port = &ports[i];
+    info("Port %u/%s: %llu %s, %llu bytes in, %llu bytes out\n",
+         port->forward.host_port, protocol_name(&port->forward),
+         port->clients,
+         port->forward.type == SOCK_DGRAM ? "clients" : "connections",
+         port->bytes[0], port->bytes[1]);
+  }
+  _exit(EXIT_SUCCESS);
+}
+
+static int open_port(struct port *port) {
+  const struct port_forward *forward = &port->forward;
+  port->listen_fd =
+      socket(AF_INET, forward->type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (port->listen_fd == -1) return -1;
+  // tcp only: a reused udp port would be shared with another listener, and
+  // one of them would silently get the other's datagrams
+  int one = 1;
+  if (forward->type == SOCK_STREAM)
+    setsockopt(port->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in addr = {.sin_family = AF_INET,
+                             .sin_port = htons(forward->host_port),
+                             .sin_addr.s_addr = htonl(INADDR_ANY)};
+  if (bind(port->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+      (forward->type == SOCK_STREAM &&
+       listen(port->listen_fd, SOMAXCONN) == -1))
+    return -1;
+  port->listen_source = (struct source){SOURCE_LISTEN, port};
+  return epoll_add(port, port->listen_fd, EPOLLIN, &port->listen_source);
+}
+
+int forward_start(const struct port_forwards *ports, const char *address,
+                  struct forwarder **forwarder) {
+  *forwarder = NULL;
+  if (ports->count == 0) return 0;
+  // leased addresses come with their prefix length
+  char host[INET_ADDRSTRLEN] = "";
+  size_t len = strcspn(address, "/");
+  if (len < sizeof(host)) memcpy(host, address, len);
+  struct in_addr target;
+  if (inet_pton(AF_INET, host, &target) != 1) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  // the ports are bound here so a port in use fails the launch, the relay
+  // runs in a process of its own: the launcher keeps to a single thread
+  // for its raw clone3 children
+  unsigned int count = ports->count;
+  struct port *list = calloc(count, sizeof(struct port));
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  for (unsigned int i = 0; i < count; i++) {
+    struct port *port = &list[i];
+    port->forward = ports->items[i];
+    port->target = (struct sockaddr_in){
+        .sin_family = AF_INET,
+        .sin_port = htons(port->forward.container_port),
+        .sin_addr = target};
+    port->listen_fd = -1;
+    port->epoll_fd = epoll_fd;
+  }
+  int ret = -1;
+  if (epoll_fd == -1) goto out;
+  for (unsigned int i = 0; i < count; i++)
+    if (open_port(&list[i]) == -1) goto out;
+  pid_t parent = getpid();
+  pid_t pid = fork();
+  if (pid == -1) goto out;
+  if (pid == 0) relay_main(list, count, parent);
+  for (unsigned int i = 0; i < count; i++)
+    debug("Forwarding port %u/%s to %s:%u\n", list[i].forward.host_port,
+          protocol_name(&list[i].forward), host,
+          list[i].forward.container_port);
+  *forwarder = malloc(sizeof(struct forwarder));
+  (*forwarder)->pid = pid;
+  ret = 0;
+out:;
+  int saved_errno = errno;
+  for (unsigned int i = 0; i < count; i++) close_fd(&list[i].listen_fd);
+  close_fd(&epoll_fd);
+  free(list);
+  errno = saved_errno;
+  return ret;
+}
+
+void forward_stop(struct forwarder **forwarder) {
+  if (*forwarder == NULL) return;
+  pid_t pid = (*forwarder)->pid;
+  if (kill(pid, SIGTERM) == -1)
+    warn("Cannot stop the port forwarding: %s\n", strerror(errno));
+  while (waitpid(pid, NULL, 0) == -1 && errno == EINTR) continue;
+  free(*forwarder);
+  *forwarder = NULL;
+}
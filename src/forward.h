@@ -0,0 +1,45 @@
+#ifndef _FORWARD_H_
+#define _FORWARD_H_
+#include <stdint.h>
+
+#include "arena.h"
+
+// bytes in flight per direction of a tcp connection, the size of its pipes
+#define FORWARD_PIPE_SIZE (1 << 20)
+#define FORWARD_EVENTS_MAX 64
+// udp clients get a socket of their own towards the container, it is closed
+// once they were quiet for this long or to make room for a new client
+#define FORWARD_UDP_SESSIONS_MAX 256
+#define FORWARD_UDP_TIMEOUT_MS 30000
+#define FORWARD_DATAGRAM_MAX 65536
+
+// a port published with -p HOSTPORT:CONTAINERPORT[/tcp|udp]
+struct port_forward {
+  uint16_t host_port;
+  uint16_t container_port;
+  // SOCK_STREAM or SOCK_DGRAM
+  int type;
+};
+
+// a growable array of published ports, it lives in an arena
+struct port_forwards {
+  struct port_forward *items;
+  unsigned int count;
+  unsigned int capacity;
+};
+
+struct forwarder;
+
+int parse_port(arena_t *arena, struct port_forwards *ports, const char *spec);
+
+// listen on the host's side of every port and relay what arrives to the same
+// port of the container at address, from a forked process serving all of
+// them. tcp is spliced through pipes without copying it to userspace. -1 if
+// a port cannot be bound
+int forward_start(const struct port_forwards *ports, const char *address,
+                  struct forwarder **forwarder);
+// stop the relay process, which logs what each port moved, and clear
+// forwarder. nothing happens if it is already NULL
+void forward_stop(struct forwarder **forwarder);
+
+#endif
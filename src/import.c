@@ -0,0 +1,782 @@
+#define _GNU_SOURCE
+#include "import.h"
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <linux/limits.h>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "json.h"
+#include "layer.h"
+#include "log.h"
+#include "tar.h"
+#include "teardown.h"
+#include "utils.h"
+
+#define ALIAS_DEPTH_MAX 8
+#define INDEX_DEPTH_MAX 4
+
+enum compression { COMPRESSION_NONE = 0, COMPRESSION_GZIP, COMPRESSION_ZSTD };
+
+struct chunk {
+  size_t len;
+  char data[IMPORT_CHUNK_SIZE];
+};
+
+struct import;
+
+// one layer in flight: the archive reader pushes chunks, the worker pulls
+// them through sha256, the decompressor and the tar extractor
+struct layer_job {
+  struct import *import;
+  char *name;
+  char staging[PATH_MAX];
+  pthread_t thread;
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  struct chunk *queue[IMPORT_QUEUE_LEN];
+  size_t head, count;
+  bool eof, aborted;
+
+  struct chunk *current;
+  size_t offset;
+  enum compression compression;
+  z_stream gzip;
+#ifdef HAVE_ZSTD
+  ZSTD_DStream *zstd;
+  ZSTD_inBuffer zstd_in;
+#endif
+  char *input;
+  bool stream_end;
+  EVP_MD_CTX *blob_ctx, *diff_ctx;
+
+  int status;
+  bool committed;
+  char blob_digest[LAYER_DIGEST_LEN + 1];
+  char diff_id[LAYER_DIGEST_LEN + 1];
+  // the key in the layer store, the same layer_add would give the tree
+  char digest[LAYER_DIGEST_LEN + 1];
+  unsigned long long compressed_bytes;
+  tar_stats_t stats;
+  struct layer_job *next;
+};
+
+// a small member kept in memory, or a link to another member
+struct blob {
+  char *name;
+  char *data;
+  size_t len;
+  char *target;
+  char digest[LAYER_DIGEST_LEN + 1];
+  struct blob *next;
+};
+
+struct import {
+  const char *image_base_path;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int active;
+  int staged;
+  struct layer_job *jobs;
+  struct layer_job **jobs_tail;
+  struct blob *blobs;
+};
+
+static ssize_t fd_read(void *arg, void *buf, size_t len) {
+  ssize_t n;
+  do n = read(*(int *)arg, buf, len);
+  while (n == -1 && errno == EINTR);
+  return n;
+}
+
+// strip "./" and resolve ".." so member names can be compared
+static char *normalize(const char *dir, const char *path) {
+  char joined[PATH_MAX * 2];
+  snprintf(joined, sizeof(joined), "%s%s%s", path[0] == '/' ? "" : dir,
+           path[0] == '/' || dir[0] == '\0' ? "" : "/", path);
+  char *out = malloc(strlen(joined) + 1);
+  size_t len = 0;
+  for (char *save, *part = strtok_r(joined, "/", &save); part;
+       part = strtok_r(NULL, "/", &save)) {
+    if (strcmp(part, ".") == 0) continue;
+    if (strcmp(part, "..") == 0) {
+      while (len > 0 && out[len - 1] != '/') len--;
+      if (len > 0) len--;
+      continue;
+    }
+    len += sprintf(out + len, "%s%s", len ? "/" : "", part);
+  }
+  out[len] = '\0';
+  return out;
+}
+
+static void digest_final(EVP_MD_CTX *ctx, char *hex) {
+  unsigned char digest[SHA256_DIGEST_LENGTH];
+  EVP_DigestFinal_ex(ctx, digest, NULL);
+  EVP_MD_CTX_free(ctx);
+  sha256_hex(digest, hex);
+}
+
+static void job_abort(struct layer_job *job) {
+  pthread_mutex_lock(&job->lock);
+  job->aborted = true;
+  pthread_cond_broadcast(&job->cond);
+  pthread_mutex_unlock(&job->lock);
+}
+
+// producer side, blocks while the worker is IMPORT_QUEUE_LEN chunks behind
+static void job_push(struct layer_job *job, struct chunk *chunk) {
+  pthread_mutex_lock(&job->lock);
+  while (job->count == IMPORT_QUEUE_LEN && !job->aborted)
+    pthread_cond_wait(&job->cond, &job->lock);
+  if (job->aborted) {
+    free(chunk);
+  } else {
+    job->queue[(job->head + job->count) % IMPORT_QUEUE_LEN] = chunk;
+    job->count++;
+    pthread_cond_signal(&job->cond);
+  }
+  pthread_mutex_unlock(&job->lock);
+}
+
+static void job_finish_input(struct layer_job *job) {
+  pthread_mutex_lock(&job->lock);
+  job->eof = true;
+  pthread_cond_signal(&job->cond);
+  pthread_mutex_unlock(&job->lock);
+}
+
+static bool raw_fill(struct layer_job *job) {
+  if (job->current && job->offset < job->current->len) return true;
+  free(job->current);
+  job->current = NULL;
+  pthread_mutex_lock(&job->lock);
+  while (job->count == 0 && !job->eof) pthread_cond_wait(&job->cond, &job->lock);
+  if (job->count) {
+    job->current = job->queue[job->head];
+    job->head = (job->head + 1) % IMPORT_QUEUE_LEN;
+    job->count--;
+    pthread_cond_signal(&job->cond);
+  }
+  pthread_mutex_unlock(&job->lock);
+  job->offset = 0;
+  return job->current != NULL;
+}
+
+// compressed bytes as they appear in the archive, hashed for the blob digest
+static ssize_t raw_read(struct layer_job *job, void *buf, size_t len) {
+  if (!raw_fill(job)) return 0;
+  size_t n = job->current->len - job->offset;
+  if (n > len) n = len;
+  memcpy(buf, job->current->data + job->offset, n);
+  job->offset += n;
+  job->compressed_bytes += n;
+  EVP_DigestUpdate(job->blob_ctx, buf, n);
+  return n;
+}
+
+static ssize_t gzip_read(struct layer_job *job, void *buf, size_t len) {
+  z_stream *z = &job->gzip;
+  z->next_out = buf;
+  z->avail_out = len;
+  while (z->avail_out == len && !job->stream_end) {
+    if (z->avail_in == 0) {
+      ssize_t n = raw_read(job, job->input, IMPORT_CHUNK_SIZE);
+      if (n == 0) break;
+      z->next_in = (unsigned char *)job->input;
+      z->avail_in = n;
+    }
+    int ret = inflate(z, Z_NO_FLUSH);
+    if (ret == Z_STREAM_END) {
+      // concatenated members form a single stream
+      if (z->avail_in == 0) {
+        ssize_t n = raw_read(job, job->input, IMPORT_CHUNK_SIZE);
+        z->next_in = (unsigned char *)job->input;
+        z->avail_in = n;
+      }
+      if (z->avail_in == 0)
+        job->stream_end = true;
+      else
+        inflateReset(z);
+    } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+      error("%s: %s\n", job->name, z->msg ? z->msg : "invalid gzip data");
+      errno = EINVAL;
+      return -1;
+    }
+  }
+  if (z->avail_out == len && !job->stream_end) {
+    error("%s: truncated gzip stream\n", job->name);
+    errno = EIO;
+    return -1;
+  }
+  return len - z->avail_out;
+}
+
+#ifdef HAVE_ZSTD
+static ssize_t zstd_read(struct layer_job *job, void *buf, size_t len) {
+  ZSTD_outBuffer out = {.dst = buf, .size = len};
+  while (out.pos == 0) {
+    if (job->zstd_in.pos == job->zstd_in.size) {
+      ssize_t n = raw_read(job, job->input, IMPORT_CHUNK_SIZE);
+      if (n == 0) break;
+      job->zstd_in = (ZSTD_inBuffer){.src = job->input, .size = n};
+    }
+    size_t ret = ZSTD_decompressStream(job->zstd, &out, &job->zstd_in);
+    if (ZSTD_isError(ret)) {
+      error("%s: %s\n", job->name, ZSTD_getErrorName(ret));
+      errno = EINVAL;
+      return -1;
+    }
+    // 0 once a frame is complete, frames may follow each other
+    job->stream_end = ret == 0;
+  }
+  if (out.pos == 0 && !job->stream_end) {
+    error("%s: truncated zstd stream\n", job->name);
+    errno = EIO;
+    return -1;
+  }
+  return out.pos;
+}
+#endif
+
+// the uncompressed layer, hashed for the diff id on its way to the extractor
+static ssize_t layer_read(void *arg, void *buf, size_t len) {
+  struct layer_job *job = arg;
+  ssize_t n;
+  switch (job->compression) {
+    case COMPRESSION_GZIP:
+      n = gzip_read(job, buf, len);
+      break;
+#ifdef HAVE_ZSTD
+    case COMPRESSION_ZSTD:
+      n = zstd_read(job, buf, len);
+      break;
+#endif
+    default:
+      n = raw_read(job, buf, len);
+      break;
+  }
+  if (n > 0) EVP_DigestUpdate(job->diff_ctx, buf, n);
+  return n;
+}
+
+static enum compression detect_compression(const unsigned char *data,
+                                           size_t len) {
+  if (len >= 2 && data[0] == 0x1f && data[1] == 0x8b) return COMPRESSION_GZIP;
+  if (len >= 4 && data[0] == 0x28 && data[1] == 0xb5 && data[2] == 0x2f &&
+      data[3] == 0xfd)
+    return COMPRESSION_ZSTD;
+  return COMPRESSION_NONE;
+}
+
+static int extract_layer(struct layer_job *job) {
+  if (raw_fill(job))
+    job->compression =
+        detect_compression((unsigned char *)job->current->data,
+                           job->current->len);
+  if (job->compression == COMPRESSION_GZIP) {
+    if (inflateInit2(&job->gzip, 32 + MAX_WBITS) != Z_OK) return -1;
+  } else if (job->compression == COMPRESSION_ZSTD) {
+#ifdef HAVE_ZSTD
+    job->zstd = ZSTD_createDStream();
+    ZSTD_initDStream(job->zstd);
+#else
+    error("%s: zstd layers are not supported in this build\n", job->name);
+    return -1;
+#endif
+  }
+  if (job->compression != COMPRESSION_NONE)
+    job->input = malloc(IMPORT_CHUNK_SIZE);
+
+  int root_fd = open(job->staging, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (root_fd == -1) return -1;
+  tar_reader_t reader;
+  tar_init(&reader, layer_read, job);
+  int ret = tar_extract(root_fd, &reader, &job->stats);
+  close(root_fd);
+  if (ret == -1) return -1;
+
+  // the digests cover the end-of-archive blocks and any trailing padding
+  char buf[16 * 1024];
+  ssize_t n;
+  while ((n = layer_read(job, buf, sizeof(buf))) > 0) continue;
+  if (n == -1) return -1;
+  while (raw_read(job, buf, sizeof(buf)) > 0) continue;
+  return 0;
+}
+
+static void *layer_worker(void *arg) {
+  struct layer_job *job = arg;
+  job->blob_ctx = EVP_MD_CTX_new();
+  job->diff_ctx = EVP_MD_CTX_new();
+  EVP_DigestInit_ex(job->blob_ctx, EVP_sha256(), NULL);
+  EVP_DigestInit_ex(job->diff_ctx, EVP_sha256(), NULL);
+
+  job->status = extract_layer(job);
+  if (job->status == -1) {
+    error("Failed to import layer %s\n", job->name);
+    job_abort(job);
+  }
+  digest_final(job->blob_ctx, job->blob_digest);
+  digest_final(job->diff_ctx, job->diff_id);
+  if (job->status == 0) layer_digest(job->staging, job->digest);
+  if (job->compression == COMPRESSION_GZIP) inflateEnd(&job->gzip);
+#ifdef HAVE_ZSTD
+  if (job->zstd) ZSTD_freeDStream(job->zstd);
+#endif
+  free(job->input);
+  free(job->current);
+  pthread_mutex_lock(&job->lock);
+  while (job->count) {
+    free(job->queue[job->head]);
+    job->head = (job->head + 1) % IMPORT_QUEUE_LEN;
+    job->count--;
+  }
+  pthread_mutex_unlock(&job->lock);
+
+  struct import *import = job->import;
+  pthread_mutex_lock(&import->lock);
+  import->active--;
+  pthread_cond_signal(&import->cond);
+  pthread_mutex_unlock(&import->lock);
+  return NULL;
+}
+
+static struct layer_job *start_layer(struct import *import, const char *name) {
+  pthread_mutex_lock(&import->lock);
+  while (import->active == IMPORT_WORKERS_MAX)
+    pthread_cond_wait(&import->cond, &import->lock);
+  import->active++;
+  pthread_mutex_unlock(&import->lock);
+
+  struct layer_job *job = calloc(1, sizeof(struct layer_job));
+  job->import = import;
+  job->name = strdup(name);
+  pthread_mutex_init(&job->lock, NULL);
+  pthread_cond_init(&job->cond, NULL);
+  snprintf(job->staging, PATH_MAX, "%s/%s/.import-%d-%d",
+           import->image_base_path, LAYER_DIR, getpid(), import->staged++);
+  if (mkdir(job->staging, 0755) == -1)
+    err(EXIT_FAILURE, "mkdir %s", job->staging);
+  *import->jobs_tail = job;
+  import->jobs_tail = &job->next;
+  if (pthread_create(&job->thread, NULL, layer_worker, job))
+    err(EXIT_FAILURE, "pthread_create-import");
+  return job;
+}
+
+// fill a chunk from the current archive member, NULL once it is consumed or
+// on a read error, which leaves data in the member
+static struct chunk *read_chunk(tar_reader_t *reader) {
+  struct chunk *chunk = malloc(sizeof(struct chunk));
+  chunk->len = 0;
+  while (chunk->len < IMPORT_CHUNK_SIZE) {
+    ssize_t n = tar_read(reader, chunk->data + chunk->len,
+                         IMPORT_CHUNK_SIZE - chunk->len);
+    if (n <= 0) break;
+    chunk->len += n;
+  }
+  if (chunk->len == 0) {
+    free(chunk);
+    return NULL;
+  }
+  return chunk;
+}
+
+static bool is_layer(const char *name, const struct chunk *chunk) {
+  const unsigned char *data = (const unsigned char *)chunk->data;
+  if (detect_compression(data, chunk->len) != COMPRESSION_NONE) return true;
+  if (chunk->len >= TAR_BLOCK_SIZE &&
+      memcmp(chunk->data + 257, "ustar", 5) == 0)
+    return true;
+  size_t len = strlen(name);
+  if (len >= 9 && strcmp(name + len - 9, "layer.tar") == 0) return true;
+  // an empty layer is nothing but the end-of-archive blocks
+  bool zero = chunk->len >= TAR_BLOCK_SIZE;
+  for (size_t i = 0; i < TAR_BLOCK_SIZE && zero; i++) zero = data[i] == 0;
+  return zero;
+}
+
+static void add_blob(struct import *import, char *name, char *data,
+                     size_t len, char *target) {
+  struct blob *blob = calloc(1, sizeof(struct blob));
+  blob->name = name;
+  blob->data = data;
+  blob->len = len;
+  blob->target = target;
+  if (data) {
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    SHA256((unsigned char *)data, len, digest);
+    sha256_hex(digest, blob->digest);
+  }
+  blob->next = import->blobs;
+  import->blobs = blob;
+}
+
+static int read_archive(struct import *import, int fd) {
+  tar_reader_t reader;
+  tar_init(&reader, fd_read, &fd);
+  tar_entry_t *entry = calloc(1, sizeof(tar_entry_t));
+  int ret;
+  while ((ret = tar_next(&reader, entry)) == 1) {
+    char *slash = strrchr(entry->path, '/');
+    char dir[PATH_MAX] = "";
+    if (slash) snprintf(dir, PATH_MAX, "%.*s", (int)(slash - entry->path),
+                        entry->path);
+    char *name = normalize("", entry->path);
+    // docker save links layers shared between images instead of copying
+    if (entry->type == '2') {
+      add_blob(import, name, NULL, 0, normalize(dir, entry->linkpath));
+      continue;
+    } else if (entry->type == '1') {
+      add_blob(import, name, NULL, 0, normalize("", entry->linkpath));
+      continue;
+    } else if (entry->type != '0' && entry->type != '\0') {
+      free(name);
+      continue;
+    }
+
+    struct chunk *chunk = read_chunk(&reader);
+    if (chunk && is_layer(name, chunk)) {
+      struct layer_job *job = start_layer(import, name);
+      do job_push(job, chunk);
+      while ((chunk = read_chunk(&reader)));
+      job_finish_input(job);
+      free(name);
+      if (reader.remaining) break;
+    } else if (entry->size <= IMPORT_SMALL_MAX) {
+      char *data = malloc(entry->size + 1);
+      size_t len = 0;
+      if (chunk) memcpy(data, chunk->data, len = chunk->len);
+      free(chunk);
+      while ((chunk = read_chunk(&reader))) {
+        memcpy(data + len, chunk->data, chunk->len);
+        len += chunk->len;
+        free(chunk);
+      }
+      data[len] = '\0';
+      add_blob(import, name, data, len, NULL);
+      if (reader.remaining) break;
+    } else {
+      warn("Skipping %s\n", name);
+      free(chunk);
+      free(name);
+    }
+  }
+  if (ret == 1 || ret == -1) error("Failed to read %s: %s\n", entry->path,
+                                   strerror(errno));
+  tar_entry_free(entry);
+  free(entry);
+  return ret == 0 ? 0 : -1;
+}
+
+static const char *resolve_alias(struct import *import, const char *name) {
+  for (int depth = 0; depth < ALIAS_DEPTH_MAX; depth++) {
+    struct blob *blob = import->blobs;
+    while (blob && strcmp(blob->name, name)) blob = blob->next;
+    if (blob == NULL || blob->target == NULL) return name;
+    name = blob->target;
+  }
+  return name;
+}
+
+static struct blob *find_blob(struct import *import, const char *name) {
+  name = resolve_alias(import, name);
+  for (struct blob *blob = import->blobs; blob; blob = blob->next)
+    if (blob->data && strcmp(blob->name, name) == 0) return blob;
+  return NULL;
+}
+
+static struct layer_job *find_job(struct import *import, const char *name) {
+  name = resolve_alias(import, name);
+  for (struct layer_job *job = import->jobs; job; job = job->next)
+    if (strcmp(job->name, name) == 0) return job;
+  return NULL;
+}
+
+static const char *strip_algorithm(const char *digest) {
+  return strncmp(digest, "sha256:", 7) == 0 ? digest + 7 : digest;
+}
+
+// blobs in an OCI layout are named after their digest, check it
+static bool verify_name(const char *name, const char *digest) {
+  const char *prefix = "blobs/sha256/";
+  if (strncmp(name, prefix, strlen(prefix))) return true;
+  if (strcmp(name + strlen(prefix), digest) == 0) return true;
+  error("Digest mismatch for %s: got sha256:%s\n", name, digest);
+  return false;
+}
+
+static json_t *parse_blob(struct import *import, const char *name) {
+  struct blob *blob = find_blob(import, name);
+  if (blob == NULL) {
+    error("Missing %s in archive\n", name);
+    return NULL;
+  }
+  if (!verify_name(blob->name, blob->digest)) return NULL;
+  json_t *json = json_parse(blob->data, blob->len);
+  if (json == NULL) error("Malformed JSON in %s\n", name);
+  return json;
+}
+
+static char *digest_blob_name(const json_t *descriptor) {
+  const char *digest = json_string(json_get(descriptor, "digest"));
+  if (digest == NULL || strncmp(digest, "sha256:", 7) ||
+      !valid_digest(digest + 7))
+    return NULL;
+  char *name;
+  if (asprintf(&name, "blobs/sha256/%s", digest + 7) == -1) return NULL;
+  return name;
+}
+
+static const json_t *select_manifest(const json_t *manifests) {
+  struct utsname uts;
+  uname(&uts);
+  const char *arch = strcmp(uts.machine, "x86_64") == 0    ? "amd64"
+                     : strcmp(uts.machine, "aarch64") == 0 ? "arm64"
+                                                           : uts.machine;
+  for (json_t *m = manifests ? manifests->child : NULL; m; m = m->next) {
+    const char *platform =
+        json_string(json_get(json_get(m, "platform"), "architecture"));
+    if (platform == NULL || strcmp(platform, arch) == 0) return m;
+  }
+  return json_index(manifests, 0);
+}
+
+struct image_spec {
+  char *layers[LAYERS_MAX];
+  int count;
+  char *config;
+  char *name;
+};
+
+static int docker_spec(struct import *import, struct image_spec *spec) {
+  json_t *manifest = parse_blob(import, "manifest.json");
+  if (manifest == NULL) return -1;
+  json_t *entry = json_index(manifest, 0);
+  const char *config = json_string(json_get(entry, "Config"));
+  const char *tag = json_string(json_index(json_get(entry, "RepoTags"), 0));
+  json_t *layers = json_get(entry, "Layers");
+  if (config == NULL || layers == NULL) {
+    error("manifest.json does not describe an image\n");
+    json_free(manifest);
+    return -1;
+  }
+  spec->config = normalize("", config);
+  if (tag) spec->name = strdup(tag);
+  for (json_t *layer = layers->child; layer && spec->count < LAYERS_MAX;
+       layer = layer->next)
+    if (json_string(layer))
+      spec->layers[spec->count++] = normalize("", json_string(layer));
+  json_free(manifest);
+  return 0;
+}
+
+static int oci_spec(struct import *import, struct image_spec *spec) {
+  json_t *index = parse_blob(import, "index.json");
+  if (index == NULL) return -1;
+  const json_t *descriptor = select_manifest(json_get(index, "manifests"));
+  json_t *annotations = json_get(descriptor, "annotations");
+  const char *name =
+      json_string(json_get(annotations, "io.containerd.image.name"));
+  if (name == NULL)
+    name = json_string(json_get(annotations, "org.opencontainers.image.ref.name"));
+  if (name) spec->name = strdup(name);
+
+  // follow nested indexes down to a single-platform manifest
+  json_t *manifest = NULL;
+  for (int depth = 0; depth < INDEX_DEPTH_MAX && descriptor; depth++) {
+    char *blob_name = digest_blob_name(descriptor);
+    json_t *next = blob_name ? parse_blob(import, blob_name) : NULL;
+    free(blob_name);
+    json_free(manifest);
+    manifest = next;
+    if (manifest == NULL || json_get(manifest, "layers")) break;
+    descriptor = select_manifest(json_get(manifest, "manifests"));
+  }
+  json_free(index);
+  json_t *layers = json_get(manifest, "layers");
+  if (layers == NULL ||
+      (spec->config = digest_blob_name(json_get(manifest, "config"))) == NULL) {
+    error("index.json does not lead to an image manifest\n");
+    json_free(manifest);
+    return -1;
+  }
+  for (json_t *layer = layers->child; layer && spec->count < LAYERS_MAX;
+       layer = layer->next) {
+    char *blob_name = digest_blob_name(layer);
+    if (blob_name == NULL) {
+      error("Unsupported layer descriptor\n");
+      json_free(manifest);
+      return -1;
+    }
+    spec->layers[spec->count++] = blob_name;
+  }
+  json_free(manifest);
+  return 0;
+}
+
+// match the unpacked layers against the image config and move them into the
+// store under their diff ids
+static int commit_image(struct import *import, struct image_spec *spec,
+                        const char *image) {
+  json_t *config = parse_blob(import, spec->config);
+  if (config == NULL) return -1;
+  json_t *diff_ids = json_get(json_get(config, "rootfs"), "diff_ids");
+  int ret = -1;
+  if ((int)json_length(diff_ids) != spec->count) {
+    error("Image config lists %zu layers, manifest %d\n", json_length(diff_ids),
+          spec->count);
+    goto out;
+  }
+
+  struct layer_job *jobs[LAYERS_MAX];
+  for (int i = 0; i < spec->count; i++) {
+    jobs[i] = find_job(import, spec->layers[i]);
+    if (jobs[i] == NULL) {
+      error("Missing layer %s in archive\n", spec->layers[i]);
+      goto out;
+    }
+    const char *diff_id = json_string(json_index(diff_ids, i));
+    if (jobs[i]->status || !verify_name(jobs[i]->name, jobs[i]->blob_digest))
+      goto out;
+    if (diff_id == NULL || strcmp(strip_algorithm(diff_id), jobs[i]->diff_id)) {
+      error("Layer %s does not match diff id %s\n", jobs[i]->name,
+            diff_id ? diff_id : "(null)");
+      goto out;
+    }
+  }
+
+  char *digests[LAYERS_MAX];
+  char path[PATH_MAX];
+  for (int i = 0; i < spec->count; i++) {
+    struct layer_job *job = jobs[i];
+    digests[i] = job->digest;
+    if (job->committed) continue;
+    job->committed = true;
+    layer_path(import->image_base_path, job->digest, path);
+    if (access(path, F_OK) == 0) {
+      info("Layer %s already present\n", job->digest);
+      teardown(job->staging, TEARDOWN_WORKERS_MAX, 0, NULL);
+    } else if (rename(job->staging, path) == -1) {
+      err(EXIT_FAILURE, "rename %s to %s", job->staging, path);
+    }
+  }
+  ret = image_create(import->image_base_path, image, digests, spec->count);
+
+out:
+  json_free(config);
+  return ret;
+}
+
+static char *image_name(const char *name) {
+  char *image = strdup(name);
+  for (char *c = image; *c; c++)
+    if (*c == '/') *c = '_';
+  return image;
+}
+
+int import_main(int argc, char *argv[], const char *image_base_path) {
+  const char *name = NULL;
+  struct option long_options[] = {{"name", required_argument, 0, 'n'},
+                                  {0, 0, 0, 0}};
+  int opt;
+  while ((opt = getopt_long(argc, argv, "n:", long_options, NULL)) != -1) {
+    if (opt != 'n') goto usage;
+    name = optarg;
+  }
+  if (optind != argc - 1) goto usage;
+
+  const char *file = argv[optind];
+  int fd = strcmp(file, "-") == 0 ? STDIN_FILENO
+                                  : open(file, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) err(EXIT_FAILURE, "open %s", file);
+  char path[PATH_MAX];
+  snprintf(path, PATH_MAX, "%s/%s", image_base_path, LAYER_DIR);
+  if (mkdir(path, 0755) == -1 && errno != EEXIST)
+    err(EXIT_FAILURE, "mkdir %s", path);
+
+  unsigned long long start = monotonic_timestamp();
+  struct import import = {.image_base_path = image_base_path};
+  import.jobs_tail = &import.jobs;
+  pthread_mutex_init(&import.lock, NULL);
+  pthread_cond_init(&import.cond, NULL);
+  int ret = read_archive(&import, fd);
+  if (fd != STDIN_FILENO) close(fd);
+  for (struct layer_job *job = import.jobs; job; job = job->next)
+    pthread_join(job->thread, NULL);
+
+  struct image_spec spec = {0};
+  if (ret == 0)
+    ret = find_blob(&import, "manifest.json") ? docker_spec(&import, &spec)
+                                              : oci_spec(&import, &spec);
+  char *image = NULL;
+  if (ret == 0 && name == NULL && spec.name == NULL) {
+    error("Archive carries no image name, use --name\n");
+    ret = -1;
+  }
+  if (ret == 0) {
+    image = image_name(name ? name : spec.name);
+    // before any layer is moved into the store
+    if (!valid_image_name(image)) {
+      error("Invalid image name: %s\n", image);
+      ret = -1;
+    }
+  }
+  if (ret == 0) ret = commit_image(&import, &spec, image);
+
+  unsigned long long files = 0, bytes = 0, compressed = 0;
+  while (import.jobs) {
+    struct layer_job *job = import.jobs;
+    if (!job->committed) teardown(job->staging, TEARDOWN_WORKERS_MAX, 0, NULL);
+    files += job->stats.entries;
+    bytes += job->stats.bytes;
+    compressed += job->compressed_bytes;
+    import.jobs = job->next;
+    pthread_mutex_destroy(&job->lock);
+    pthread_cond_destroy(&job->cond);
+    free(job->name);
+    free(job);
+  }
+  while (import.blobs) {
+    struct blob *blob = import.blobs;
+    import.blobs = blob->next;
+    free(blob->name);
+    free(blob->data);
+    free(blob->target);
+    free(blob);
+  }
+  for (int i = 0; i < spec.count; i++) free(spec.layers[i]);
+  free(spec.config);
+  free(spec.name);
+  if (ret == 0) {
+    info("Imported %s: %d layers, %llu files, %llu MB (%llu MB compressed) in "
+         "%.2fs\n",
+         image, spec.count, files, bytes >> 20, compressed >> 20,
+         (monotonic_timestamp() - start) / 1e9);
+    printf("%s\n", image);
+  }
+  free(image);
+  return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+
+usage:
+  fprintf(stderr, "Usage: %s [--name NAME] FILE|-\n", argv[0]);
+  fprintf(stderr, "FILE is an OCI image layout or docker save tarball\n");
+  return EXIT_FAILURE;
+}
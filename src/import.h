@@ -0,0 +1,15 @@
+#ifndef _IMPORT_H_
+#define _IMPORT_H_
+
+#define IMPORT_WORKERS_MAX 4
+// chunks queued per layer between the archive reader and its worker
+#define IMPORT_QUEUE_LEN 8
+#define IMPORT_CHUNK_SIZE (256 * 1024)
+// manifests and configs are kept in memory, anything larger must be a layer
+#define IMPORT_SMALL_MAX (4 * 1024 * 1024)
+
+// import an OCI image layout or docker-save tarball from a file or stdin,
+// layers are decompressed, verified and unpacked while the archive streams in
+int import_main(int argc, char *argv[], const char *image_base_path);
+
+#endif
@@ -0,0 +1,195 @@
+#include "ipam.h"
+
+#include <arpa/inet.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "log.h"
+
+#define IPAM_MAGIC "mcipam1"
+
+// the file is this header followed by one bit per address of the subnet, a
+// set bit is leased. bits are flipped with atomic operations on the shared
+// mapping, so leasing and releasing never takes a lock and a crashed process
+// leaves no lock behind
+struct ipam_header {
+  char magic[8];
+  uint32_t network;
+  uint32_t prefix;
+  // word to start the next search at, leases walk through the subnet so a
+  // released address is not handed out again right away
+  uint64_t hint;
+};
+
+static const char *ipam_path = IPAM_PATH_DEFAULT;
+static const char *ipam_subnet = IPAM_SUBNET_DEFAULT;
+static struct ipam_header *header;
+static uint64_t *bitmap;
+static size_t words;
+
+// "a.b.c.d[/nn]" in host order, prefix is -1 without one
+static int parse_cidr(const char *cidr, uint32_t *addr, int *prefix) {
+  char buf[IPAM_CIDR_LEN_MAX + 1];
+  if (strlen(cidr) >= sizeof(buf)) return -1;
+  strcpy(buf, cidr);
+  *prefix = -1;
+  char *slash = strchr(buf, '/');
+  if (slash) {
+    *slash = '\0';
+    char *end;
+    long len = strtol(slash + 1, &end, 10);
+    if (*end || len < 0 || len > 32) return -1;
+    *prefix = len;
+  }
+  struct in_addr in;
+  if (inet_pton(AF_INET, buf, &in) != 1) return -1;
+  *addr = ntohl(in.s_addr);
+  return 0;
+}
+
+static void parse_subnet(uint32_t *network, uint32_t *prefix) {
+  uint32_t addr;
+  int len;
+  if (parse_cidr(ipam_subnet, &addr, &len) == -1 || len < IPAM_PREFIX_MIN ||
+      len > IPAM_PREFIX_MAX)
+    errx(EXIT_FAILURE, "invalid subnet %s", ipam_subnet);
+  *prefix = len;
+  *network = addr & ~0U << (32 - len);
+}
+
+static void format_cidr(uint32_t addr, uint32_t prefix, char *cidr) {
+  struct in_addr in = {.s_addr = htonl(addr)};
+  char buf[INET_ADDRSTRLEN];
+  inet_ntop(AF_INET, &in, buf, sizeof(buf));
+  snprintf(cidr, IPAM_CIDR_LEN_MAX, "%s/%u", buf, prefix);
+}
+
+void ipam_configure(const char *path, const char *subnet) {
+  if (path) ipam_path = path;
+  if (subnet) ipam_subnet = subnet;
+}
+
+static void ipam_open() {
+  if (header) return;
+  uint32_t network, prefix;
+  parse_subnet(&network, &prefix);
+  size_t addresses = 1UL << (32 - prefix);
+  words = (addresses + 63) / 64;
+  size_t size = sizeof(struct ipam_header) + words * sizeof(uint64_t);
+
+  int fd = open(ipam_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd == -1) err(EXIT_FAILURE, "open-ipam %s", ipam_path);
+  // only held while the first process to open the file initializes it
+  if (flock(fd, LOCK_EX) == -1) err(EXIT_FAILURE, "flock-ipam %s", ipam_path);
+  struct stat st;
+  if (fstat(fd, &st) == -1) err(EXIT_FAILURE, "stat-ipam %s", ipam_path);
+  bool fresh = st.st_size == 0;
+  if (fresh && ftruncate(fd, size) == -1)
+    err(EXIT_FAILURE, "ftruncate-ipam %s", ipam_path);
+  if (!fresh && (size_t)st.st_size != size)
+    errx(EXIT_FAILURE, "%s does not manage %s", ipam_path, ipam_subnet);
+  void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) err(EXIT_FAILURE, "mmap-ipam %s", ipam_path);
+  header = map;
+  bitmap = (uint64_t *)(header + 1);
+  if (fresh) {
+    memcpy(header->magic, IPAM_MAGIC, sizeof(header->magic));
+    header->network = network;
+    header->prefix = prefix;
+    // the network address, the gateway, the broadcast address and the bits
+    // past the end of a small subnet are never leased
+    bitmap[0] |= 3;
+    for (size_t bit = addresses - 1; bit < words * 64; bit++)
+      bitmap[bit / 64] |= 1ULL << (bit % 64);
+  } else if (memcmp(header->magic, IPAM_MAGIC, sizeof(header->magic)) ||
+             header->network != network || header->prefix != prefix) {
+    errx(EXIT_FAILURE, "%s does not manage %s", ipam_path, ipam_subnet);
+  }
+  flock(fd, LOCK_UN);
+  close(fd);
+}
+
+// take the first free address from the hint on, wrapping around once
+static int lease_any(uint32_t *offset) {
+  size_t start = __atomic_load_n(&header->hint, __ATOMIC_RELAXED) % words;
+  for (size_t n = 0; n < words; n++) {
+    size_t i = (start + n) % words;
+    uint64_t word = __atomic_load_n(&bitmap[i], __ATOMIC_RELAXED);
+    while (word != ~0ULL) {
+      int bit = __builtin_ctzll(~word);
+      uint64_t taken = word | 1ULL << bit;
+      if (__atomic_compare_exchange_n(&bitmap[i], &word, taken, false,
+                                      __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        // once this word is full the next search starts at the following one
+        __atomic_store_n(&header->hint, taken == ~0ULL ? i + 1 : i,
+                         __ATOMIC_RELAXED);
+        *offset = i * 64 + bit;
+        return 0;
+      }
+    }
+  }
+  errno = ENOSPC;
+  return -1;
+}
+
+int ipam_lease(const char *request, char *cidr) {
+  uint32_t network, prefix, offset;
+  parse_subnet(&network, &prefix);
+  if (strcmp(request, "auto") == 0) {
+    ipam_open();
+    if (lease_any(&offset) == -1) return -1;
+  } else {
+    uint32_t addr;
+    int len;
+    if (parse_cidr(request, &addr, &len) == -1) {
+      errno = EINVAL;
+      return -1;
+    }
+    if ((addr & ~0U << (32 - prefix)) != network) return 1;
+    ipam_open();
+    offset = addr - network;
+    uint64_t bit = 1ULL << (offset % 64);
+    if (__atomic_fetch_or(&bitmap[offset / 64], bit, __ATOMIC_ACQ_REL) & bit) {
+      errno = EADDRINUSE;
+      return -1;
+    }
+  }
+  format_cidr(network + offset, prefix, cidr);
+  debug("Leased %s\n", cidr);
+  return 0;
+}
+
+void ipam_release(const char *cidr) {
+  uint32_t network, prefix, addr;
+  int len;
+  parse_subnet(&network, &prefix);
+  if (parse_cidr(cidr, &addr, &len) == -1 ||
+      (addr & ~0U << (32 - prefix)) != network)
+    return;
+  uint32_t offset = addr - network;
+  // the reserved addresses stay leased
+  if (offset <= 1 || offset >= (1U << (32 - prefix)) - 1) return;
+  ipam_open();
+  __atomic_fetch_and(&bitmap[offset / 64], ~(1ULL << (offset % 64)),
+                     __ATOMIC_ACQ_REL);
+  debug("Released %s\n", cidr);
+}
+
+const char *ipam_gateway() {
+  static char gateway[INET_ADDRSTRLEN];
+  uint32_t network, prefix;
+  parse_subnet(&network, &prefix);
+  struct in_addr in = {.s_addr = htonl(network + 1)};
+  inet_ntop(AF_INET, &in, gateway, sizeof(gateway));
+  return gateway;
+}
@@ -0,0 +1,26 @@
+#ifndef _IPAM_H_
+#define _IPAM_H_
+#include <netinet/in.h>
+
+// the subnet of the bridge created by scripts/setup_bridge.sh, its first
+// address is the gateway
+#define IPAM_SUBNET_DEFAULT "172.20.0.0/16"
+#define IPAM_PATH_DEFAULT "/var/lib/mini-container/ipam"
+#define IPAM_PREFIX_MIN 8
+#define IPAM_PREFIX_MAX 30
+// room for "a.b.c.d/nn"
+#define IPAM_CIDR_LEN_MAX (INET_ADDRSTRLEN + 3)
+
+// the bitmap file shared by every mini-container process and the subnet it
+// manages, the file is only opened on the first lease
+void ipam_configure(const char *path, const char *subnet);
+// lease request for a container: "auto" takes any free address, an address
+// in the subnet is reserved as given. cidr receives the leased address with
+// the subnet prefix. returns 1 for addresses outside the subnet, which are
+// not managed, and -1 with errno ENOSPC or EADDRINUSE if nothing was leased
+int ipam_lease(const char *request, char *cidr);
+void ipam_release(const char *cidr);
+// the subnet's gateway, for containers that do not name one
+const char *ipam_gateway();
+
+#endif
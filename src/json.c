@@ -0,0 +1,275 @@
+#include "json.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define JSON_DEPTH_MAX 64
+
+struct parser {
+  const char *cur;
+  const char *end;
+  int depth;
+};
+
+static json_t *parse_value(struct parser *p);
+
+static void skip_space(struct parser *p) {
+  while (p->cur < p->end && (*p->cur == ' ' || *p->cur == '\t' ||
+                             *p->cur == '\n' || *p->cur == '\r'))
+    p->cur++;
+}
+
+static bool consume(struct parser *p, const char *literal) {
+  size_t len = strlen(literal);
+  if ((size_t)(p->end - p->cur) < len || strncmp(p->cur, literal, len)) return false;
+  p->cur += len;
+  return true;
+}
+
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+static size_t put_utf8(char *out, unsigned int cp) {
+  if (cp < 0x80) {
+    out[0] = cp;
+    return 1;
+  } else if (cp < 0x800) {
+    out[0] = 0xc0 | (cp >> 6);
+    out[1] = 0x80 | (cp & 0x3f);
+    return 2;
+  } else if (cp < 0x10000) {
+    out[0] = 0xe0 | (cp >> 12);
+    out[1] = 0x80 | ((cp >> 6) & 0x3f);
+    out[2] = 0x80 | (cp & 0x3f);
+    return 3;
+  }
+  out[0] = 0xf0 | (cp >> 18);
+  out[1] = 0x80 | ((cp >> 12) & 0x3f);
+  out[2] = 0x80 | ((cp >> 6) & 0x3f);
+  out[3] = 0x80 | (cp & 0x3f);
+  return 4;
+}
+
+static bool parse_hex4(struct parser *p, unsigned int *cp) {
+  if (p->end - p->cur < 4) return false;
+  *cp = 0;
+  for (int i = 0; i < 4; i++) {
+    int v = hex_value(*p->cur++);
+    if (v < 0) return false;
+    *cp = (*cp << 4) | v;
+  }
+  return true;
+}
+
+// the decoded string is never longer than its escaped form
+static char *parse_string(struct parser *p) {
+  if (p->cur >= p->end || *p->cur != '"') return NULL;
+  p->cur++;
+  const char *start = p->cur;
+  while (p->cur < p->end && *p->cur != '"') {
+    if (*p->cur == '\\') p->cur++;
+    p->cur++;
+  }
+  if (p->cur >= p->end) return NULL;
+  char *str = malloc(p->cur - start + 1);
+  char *out = str;
+  p->cur = start;
+  while (*p->cur != '"') {
+    char c = *p->cur++;
+    if (c != '\\') {
+      *out++ = c;
+      continue;
+    }
+    c = *p->cur++;
+    switch (c) {
+      case 'b': *out++ = '\b'; break;
+      case 'f': *out++ = '\f'; break;
+      case 'n': *out++ = '\n'; break;
+      case 'r': *out++ = '\r'; break;
+      case 't': *out++ = '\t'; break;
+      case 'u': {
+        unsigned int cp;
+        if (!parse_hex4(p, &cp)) goto fail;
+        if (cp >= 0xd800 && cp < 0xdc00 && consume(p, "\\u")) {
+          unsigned int low;
+          if (!parse_hex4(p, &low)) goto fail;
+          cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+        }
+        out += put_utf8(out, cp);
+        break;
+      }
+      default: *out++ = c; break;
+    }
+  }
+  p->cur++;
+  *out = '\0';
+  return str;
+
+fail:
+  free(str);
+  return NULL;
+}
+
+static json_t *parse_container(struct parser *p, json_type_t type) {
+  char close = type == JSON_ARRAY ? ']' : '}';
+  json_t *json = calloc(1, sizeof(json_t));
+  json->type = type;
+  if (++p->depth > JSON_DEPTH_MAX) goto fail;
+  p->cur++;
+  skip_space(p);
+  if (p->cur < p->end && *p->cur == close) {
+    p->cur++;
+    p->depth--;
+    return json;
+  }
+  json_t **tail = &json->child;
+  for (;;) {
+    char *key = NULL;
+    skip_space(p);
+    if (type == JSON_OBJECT) {
+      if ((key = parse_string(p)) == NULL) goto fail;
+      skip_space(p);
+      if (!consume(p, ":")) {
+        free(key);
+        goto fail;
+      }
+    }
+    json_t *value = parse_value(p);
+    if (value == NULL) {
+      free(key);
+      goto fail;
+    }
+    value->key = key;
+    *tail = value;
+    tail = &value->next;
+    skip_space(p);
+    if (consume(p, ",")) continue;
+    if (p->cur < p->end && *p->cur == close) {
+      p->cur++;
+      p->depth--;
+      return json;
+    }
+    goto fail;
+  }
+
+fail:
+  json_free(json);
+  return NULL;
+}
+
+static json_t *parse_value(struct parser *p) {
+  skip_space(p);
+  if (p->cur >= p->end) return NULL;
+  if (*p->cur == '{') return parse_container(p, JSON_OBJECT);
+  if (*p->cur == '[') return parse_container(p, JSON_ARRAY);
+  json_t *json = calloc(1, sizeof(json_t));
+  if (*p->cur == '"') {
+    json->type = JSON_STRING;
+    if ((json->string = parse_string(p)) == NULL) goto fail;
+  } else if (consume(p, "true")) {
+    json->type = JSON_BOOL;
+    json->boolean = true;
+  } else if (consume(p, "false")) {
+    json->type = JSON_BOOL;
+  } else if (consume(p, "null")) {
+    json->type = JSON_NULL;
+  } else {
+    char buf[64];
+    size_t len = 0;
+    while (p->cur + len < p->end && len < sizeof(buf) - 1 &&
+           strchr("+-.0123456789eE", p->cur[len]))
+      len++;
+    if (len == 0) goto fail;
+    memcpy(buf, p->cur, len);
+    buf[len] = '\0';
+    char *end;
+    json->type = JSON_NUMBER;
+    json->number = strtod(buf, &end);
+    if (*end) goto fail;
+    p->cur += len;
+  }
+  return json;
+
+fail:
+  free(json);
+  return NULL;
+}
+
+json_t *json_parse(const char *text, size_t len) {
+  struct parser p = {.cur = text, .end = text + len};
+  json_t *json = parse_value(&p);
+  skip_space(&p);
+  if (json && p.cur != p.end) {
+    json_free(json);
+    return NULL;
+  }
+  return json;
+}
+
+void json_free(json_t *json) {
+  while (json) {
+    json_t *next = json->next;
+    json_free(json->child);
+    free(json->key);
+    free(json->string);
+    free(json);
+    json = next;
+  }
+}
+
+json_t *json_get(const json_t *object, const char *key) {
+  if (object == NULL || object->type != JSON_OBJECT) return NULL;
+  for (json_t *member = object->child; member; member = member->next)
+    if (strcmp(member->key, key) == 0) return member;
+  return NULL;
+}
+
+json_t *json_index(const json_t *array, size_t index) {
+  if (array == NULL || array->type != JSON_ARRAY) return NULL;
+  json_t *element = array->child;
+  while (element && index--) element = element->next;
+  return element;
+}
+
+size_t json_length(const json_t *array) {
+  if (array == NULL || (array->type != JSON_ARRAY && array->type != JSON_OBJECT))
+    return 0;
+  size_t len = 0;
+  for (json_t *element = array->child; element; element = element->next) len++;
+  return len;
+}
+
+const char *json_string(const json_t *json) {
+  return json && json->type == JSON_STRING ? json->string : NULL;
+}
+
+size_t json_escape(char *buf, size_t size, const char *str) {
+  size_t len = 0;
+#define PUT(c)                      \
+  do {                              \
+    if (len + 1 < size) buf[len] = (c); \
+    len++;                          \
+  } while (0)
+  PUT('"');
+  for (const unsigned char *c = (const unsigned char *)str; *c; c++) {
+    if (*c == '"' || *c == '\\') {
+      PUT('\\');
+      PUT(*c);
+    } else if (*c < 0x20) {
+      char esc[8];
+      snprintf(esc, sizeof(esc), "\\u%04x", *c);
+      for (char *e = esc; *e; e++) PUT(*e);
+    } else {
+      PUT(*c);
+    }
+  }
+  PUT('"');
+#undef PUT
+  if (size) buf[len < size ? len : size - 1] = '\0';
+  return len;
+}
@@ -0,0 +1,44 @@
+#ifndef _JSON_H_
+#define _JSON_H_
+#include <stdbool.h>
+#include <stddef.h>
+
+enum json_type {
+  JSON_NULL = 0,
+  JSON_BOOL,
+  JSON_NUMBER,
+  JSON_STRING,
+  JSON_ARRAY,
+  JSON_OBJECT
+};
+
+typedef enum json_type json_type_t;
+
+// a parsed value, members of arrays and objects are linked through next and
+// object members carry their key
+struct json {
+  json_type_t type;
+  char *key;
+  bool boolean;
+  double number;
+  char *string;
+  struct json *child;
+  struct json *next;
+};
+
+typedef struct json json_t;
+
+// returns NULL on malformed input
+json_t *json_parse(const char *text, size_t len);
+void json_free(json_t *json);
+
+json_t *json_get(const json_t *object, const char *key);
+json_t *json_index(const json_t *array, size_t index);
+size_t json_length(const json_t *array);
+// value of a string, NULL if json is not a string
+const char *json_string(const json_t *json);
+
+// write str as a quoted JSON string into buf, returns the length it needs
+size_t json_escape(char *buf, size_t size, const char *str);
+
+#endif
@@ -0,0 +1,278 @@
+#define _GNU_SOURCE
+#include "layer.h"
+
+#include <dirent.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "utils.h"
+
+char *layer_path(const char *image_base_path, const char *digest, char *path) {
+  snprintf(path, PATH_MAX, "%s/%s/%s", image_base_path, LAYER_DIR, digest);
+  return path;
+}
+
+int valid_digest(const char *digest) {
+  if (strlen(digest) != LAYER_DIGEST_LEN) return 0;
+  for (const char *c = digest; *c; c++)
+    if (!((*c >= '0' && *c <= '9') || (*c >= 'a' && *c <= 'f'))) return 0;
+  return 1;
+}
+
+static const char *strip_algorithm(const char *digest) {
+  return strncmp(digest, "sha256:", 7) == 0 ? digest + 7 : digest;
+}
+
+int image_lowerdir(const char *image_base_path, const char *image,
+                   char *lowerdir, size_t size) {
+  char path[PATH_MAX];
+  snprintf(path, PATH_MAX, "%s/%s/%s", image_base_path, image, MANIFEST_FILE);
+  FILE *manifest = fopen(path, "r");
+  if (manifest == NULL) {
+    if (errno != ENOENT) return -1;
+    snprintf(lowerdir, size, "%s/%s/rootfs", image_base_path, image);
+    return 0;
+  }
+
+  char digests[LAYERS_MAX][LAYER_DIGEST_LEN + 1];
+  int count = 0;
+  char line[128];
+  while (fgets(line, sizeof(line), manifest)) {
+    line[strcspn(line, "\n")] = '\0';
+    const char *digest = strip_algorithm(line);
+    if (digest[0] == '\0') continue;
+    if (!valid_digest(digest) || count == LAYERS_MAX) {
+      error("Invalid manifest %s\n", path);
+      fclose(manifest);
+      errno = EINVAL;
+      return -1;
+    }
+    strcpy(digests[count++], digest);
+  }
+  fclose(manifest);
+  if (count == 0) {
+    error("Image %s has no layers\n", image);
+    errno = EINVAL;
+    return -1;
+  }
+
+  // the manifest lists the base first, overlay wants the top first
+  size_t len = 0;
+  lowerdir[0] = '\0';
+  for (int i = count - 1; i >= 0; i--) {
+    layer_path(image_base_path, digests[i], path);
+    len += snprintf(lowerdir + len, size - len, "%s%s",
+                    i == count - 1 ? "" : ":", path);
+    if (len >= size) {
+      errno = ENAMETOOLONG;
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static void hash_file(int dir_fd, const char *name, char *hex) {
+  unsigned char digest[SHA256_DIGEST_LENGTH];
+  int fd = openat(dir_fd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+  if (fd == -1) err(EXIT_FAILURE, "open %s", name);
+  EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+  EVP_DigestInit_ex(ctx, EVP_sha256(), NULL);
+  char buf[64 * 1024];
+  ssize_t len;
+  while ((len = read(fd, buf, sizeof(buf))) > 0)
+    EVP_DigestUpdate(ctx, buf, len);
+  if (len == -1) err(EXIT_FAILURE, "read %s", name);
+  EVP_DigestFinal_ex(ctx, digest, NULL);
+  EVP_MD_CTX_free(ctx);
+  close(fd);
+  sha256_hex(digest, hex);
+}
+
+static int compare_names(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// a line per xattr of the entry followed by its raw value, sorted by name as
+// the filesystem lists them in any order. overlay's opaque markers live here.
+// security.selinux is the host's label, not part of the layer
+static void hash_xattrs(EVP_MD_CTX *ctx, int dir_fd, const char *name,
+                        const char *prefix) {
+  char path[PATH_MAX];
+  snprintf(path, PATH_MAX, "/proc/self/fd/%d/%s", dir_fd, name);
+  ssize_t size = llistxattr(path, NULL, 0);
+  if (size == -1 && errno == ENOTSUP) return;
+  if (size == -1) err(EXIT_FAILURE, "listxattr %s/%s", prefix, name);
+  if (size == 0) return;
+  char *list = malloc(size);
+  if ((size = llistxattr(path, list, size)) == -1)
+    err(EXIT_FAILURE, "listxattr %s/%s", prefix, name);
+  size_t count = 0;
+  char **keys = malloc(size * sizeof(char *));
+  for (char *key = list; key < list + size; key += strlen(key) + 1)
+    if (strcmp(key, "security.selinux")) keys[count++] = key;
+  qsort(keys, count, sizeof(char *), compare_names);
+  for (size_t i = 0; i < count; i++) {
+    ssize_t len = lgetxattr(path, keys[i], NULL, 0);
+    char *value = len > 0 ? malloc(len) : NULL;
+    if (len > 0) len = lgetxattr(path, keys[i], value, len);
+    if (len == -1)
+      err(EXIT_FAILURE, "getxattr %s on %s/%s", keys[i], prefix, name);
+    char line[PATH_MAX * 2 + XATTR_NAME_MAX + 64];
+    int n = snprintf(line, sizeof(line), "%s/%s xattr %s %zd\n", prefix, name,
+                     keys[i], len);
+    EVP_DigestUpdate(ctx, line, n);
+    if (len > 0) EVP_DigestUpdate(ctx, value, len);
+    free(value);
+  }
+  free(keys);
+  free(list);
+}
+
+// feed a canonical, sorted listing of the tree into ctx: one line per entry
+// with its path, mode, owner and size plus the content digest or link target,
+// then its xattrs
+static void hash_tree(EVP_MD_CTX *ctx, int dir_fd, const char *prefix) {
+  struct dirent **entries;
+  int count = scandirat(dir_fd, ".", &entries, NULL, alphasort);
+  if (count == -1) err(EXIT_FAILURE, "scandir %s", prefix);
+  for (int i = 0; i < count; i++) {
+    const char *name = entries[i]->d_name;
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+      free(entries[i]);
+      continue;
+    }
+    struct stat st;
+    if (fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) == -1)
+      err(EXIT_FAILURE, "stat %s/%s", prefix, name);
+    char line[PATH_MAX * 2 + 128];
+    char extra[PATH_MAX] = "";
+    if (S_ISREG(st.st_mode)) {
+      hash_file(dir_fd, name, extra);
+    } else if (S_ISLNK(st.st_mode)) {
+      ssize_t len = readlinkat(dir_fd, name, extra, PATH_MAX - 1);
+      if (len == -1) err(EXIT_FAILURE, "readlink %s/%s", prefix, name);
+      extra[len] = '\0';
+    } else if (S_ISCHR(st.st_mode) || S_ISBLK(st.st_mode)) {
+      snprintf(extra, PATH_MAX, "%lx", (unsigned long)st.st_rdev);
+    }
+    int len = snprintf(line, sizeof(line), "%s/%s %o %d %d %lld %s\n", prefix,
+                       name, st.st_mode, st.st_uid, st.st_gid,
+                       S_ISREG(st.st_mode) ? (long long)st.st_size : 0LL,
+                       extra);
+    EVP_DigestUpdate(ctx, line, len);
+    hash_xattrs(ctx, dir_fd, name, prefix);
+    if (S_ISDIR(st.st_mode)) {
+      int child = openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+      if (child == -1) err(EXIT_FAILURE, "open %s/%s", prefix, name);
+      char child_prefix[PATH_MAX];
+      snprintf(child_prefix, PATH_MAX, "%s/%s", prefix, name);
+      hash_tree(ctx, child, child_prefix);
+      close(child);
+    }
+    free(entries[i]);
+  }
+  free(entries);
+}
+
+void layer_digest(const char *dir, char *digest) {
+  int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1) err(EXIT_FAILURE, "open %s", dir);
+  unsigned char raw[SHA256_DIGEST_LENGTH];
+  EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+  EVP_DigestInit_ex(ctx, EVP_sha256(), NULL);
+  hash_tree(ctx, fd, "");
+  EVP_DigestFinal_ex(ctx, raw, NULL);
+  EVP_MD_CTX_free(ctx);
+  close(fd);
+  sha256_hex(raw, digest);
+}
+
+int layer_add(const char *image_base_path, const char *dir, char *digest) {
+  layer_digest(dir, digest);
+  char path[PATH_MAX];
+  snprintf(path, PATH_MAX, "%s/%s", image_base_path, LAYER_DIR);
+  if (mkdir(path, 0755) == -1 && errno != EEXIST)
+    err(EXIT_FAILURE, "mkdir %s", path);
+  layer_path(image_base_path, digest, path);
+  if (access(path, F_OK) == 0) {
+    info("Layer %s already present\n", digest);
+    return 0;
+  }
+  // a rename keeps the data where it is, the store must be on the same fs
+  if (rename(dir, path) == -1) err(EXIT_FAILURE, "rename %s to %s", dir, path);
+  return 0;
+}
+
+int valid_image_name(const char *image) {
+  return *image && strcmp(image, ".") && strcmp(image, "..") &&
+         strcmp(image, LAYER_DIR) && strchr(image, '/') == NULL;
+}
+
+int image_create(const char *image_base_path, const char *image,
+                 char *const *digests, int count) {
+  if (!valid_image_name(image)) {
+    error("Invalid image name: %s\n", image);
+    return -1;
+  }
+  if (count > LAYERS_MAX) {
+    error("Too many layers, at most %d are supported\n", LAYERS_MAX);
+    return -1;
+  }
+  char path[PATH_MAX];
+  for (int i = 0; i < count; i++) {
+    const char *digest = strip_algorithm(digests[i]);
+    if (!valid_digest(digest) ||
+        access(layer_path(image_base_path, digest, path), F_OK) == -1) {
+      error("Unknown layer: %s\n", digests[i]);
+      return -1;
+    }
+  }
+
+  snprintf(path, PATH_MAX, "%s/%s", image_base_path, image);
+  if (mkdir(path, 0755) == -1 && errno != EEXIST)
+    err(EXIT_FAILURE, "mkdir %s", path);
+  char tmp_path[PATH_MAX + 16], manifest_path[PATH_MAX + 16];
+  snprintf(tmp_path, sizeof(tmp_path), "%s/%s.tmp", path, MANIFEST_FILE);
+  snprintf(manifest_path, sizeof(manifest_path), "%s/%s", path, MANIFEST_FILE);
+  FILE *manifest = fopen(tmp_path, "w");
+  if (manifest == NULL) err(EXIT_FAILURE, "fopen %s", tmp_path);
+  for (int i = 0; i < count; i++)
+    fprintf(manifest, "sha256:%s\n", strip_algorithm(digests[i]));
+  if (fclose(manifest)) err(EXIT_FAILURE, "write %s", tmp_path);
+  // containers starting concurrently see either the old or the new manifest
+  if (rename(tmp_path, manifest_path) == -1)
+    err(EXIT_FAILURE, "rename %s", manifest_path);
+  return 0;
+}
+
+int layer_main(int argc, char *argv[], const char *image_base_path) {
+  if (argc == 3 && strcmp(argv[1], "add") == 0) {
+    char digest[LAYER_DIGEST_LEN + 1];
+    layer_add(image_base_path, argv[2], digest);
+    printf("sha256:%s\n", digest);
+    return EXIT_SUCCESS;
+  }
+  fprintf(stderr, "Usage: %s add DIR\n", argv[0]);
+  return EXIT_FAILURE;
+}
+
+int image_main(int argc, char *argv[], const char *image_base_path) {
+  if (argc >= 4 && strcmp(argv[1], "create") == 0)
+    return image_create(image_base_path, argv[2], argv + 3, argc - 3)
+               ? EXIT_FAILURE
+               : EXIT_SUCCESS;
+  fprintf(stderr, "Usage: %s create NAME LAYER...\n", argv[0]);
+  fprintf(stderr, "Layers are listed from the base up\n");
+  return EXIT_FAILURE;
+}
@@ -0,0 +1,34 @@
+#ifndef _LAYER_H_
+#define _LAYER_H_
+#include <stddef.h>
+
+#define LAYER_DIR "layers"
+#define MANIFEST_FILE "manifest"
+#define LAYER_DIGEST_LEN 64
+#define LAYERS_MAX 128
+
+// layers live in <image_base_path>/layers/<sha256>, keyed by layer_digest()
+// whether they were added or imported. an image is a manifest listing its
+// layer digests from the base up
+char *layer_path(const char *image_base_path, const char *digest, char *path);
+int valid_digest(const char *digest);
+// an image name is a single path component other than the layer store
+int valid_image_name(const char *image);
+
+// overlay lowerdir for image, topmost layer first, falling back to the
+// single-directory <image>/rootfs layout when there is no manifest
+int image_lowerdir(const char *image_base_path, const char *image,
+                   char *lowerdir, size_t size);
+
+// the sha256 of a canonical listing of the tree at dir: paths, modes,
+// owners, contents, link targets and xattrs
+void layer_digest(const char *dir, char *digest);
+// move dir into the store under its layer_digest()
+int layer_add(const char *image_base_path, const char *dir, char *digest);
+int image_create(const char *image_base_path, const char *image,
+                 char *const *digests, int count);
+
+int layer_main(int argc, char *argv[], const char *image_base_path);
+int image_main(int argc, char *argv[], const char *image_base_path);
+
+#endif
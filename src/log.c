@@ -1,23 +1,306 @@
+#define _GNU_SOURCE
 #include "log.h"
 
+#include <errno.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "json.h"
+#include "trace.h"
+#include "utils.h"
+
+// text and JSON lines are written in batches of this size
+#define LOG_BATCH_SIZE (64 * 1024)
+// how long the drain sleeps when nobody wakes it, it also notices a launcher
+// that is gone this way
+#define LOG_DRAIN_TIMEOUT_MS 100
+// writers only wake the drain for warnings and errors or once this many
+// records piled up, anything else waits for the timeout
+#define LOG_WAKE_RECORDS (LOG_RING_RECORDS / 4)
+// a slot claimed but not filled for this long belongs to a writer that died
+#define LOG_STALL_MS 500
+
+// one slot of the ring. turn is 2 * lap while the slot is free for the
+// writer of that lap and 2 * lap + 1 once the record is complete, so the
+// zeroed mapping is an empty ring
+struct log_record {
+  uint64_t turn;
+  uint64_t timestamp;
+  int32_t pid;
+  uint8_t level;
+  int8_t phase;
+  uint16_t len;
+  char id[LOG_ID_LEN_MAX + 1];
+  char message[LOG_MESSAGE_MAX];
+};
+
+// shared by the launcher, everything it forks and the drain. writers claim
+// slots by moving head forward, only the drain reads them
+struct log_ring {
+  uint64_t head __attribute__((aligned(64)));
+  uint64_t dropped __attribute__((aligned(64)));
+  // bumped by writers that find the drain asleep on it
+  uint32_t futex;
+  uint32_t sleeping;
+  uint32_t closing;
+  pid_t launcher;
+  struct log_record records[LOG_RING_RECORDS] __attribute__((aligned(64)));
+};
+
+static const char *level_names[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+static const char *level_json_names[] = {"debug", "info", "warn", "error"};
 
 log_level_t log_level = LOG_INFO;
+static enum log_format log_format = LOG_FORMAT_TEXT;
+static struct log_ring *ring;
+static pid_t drain_pid = -1;
+static char context_id[LOG_ID_LEN_MAX + 1];
+static int context_phase = -1;
 
 void set_log_level(log_level_t level) { log_level = level; }
 
-#define LOG_FUNC(level, level_upper)           \
-  void level(const char *fmt, ...) {           \
-    if (log_level > LOG_##level_upper) return; \
-    fprintf(stderr, "[" #level_upper "] ");    \
-    va_list args;                              \
-    va_start(args, fmt);                       \
-    vfprintf(stderr, fmt, args);               \
-    va_end(args);                              \
+void set_log_format(enum log_format format) { log_format = format; }
+
+void log_set_container(const char *id) {
+  if (id == NULL) id = "";
+  snprintf(context_id, sizeof(context_id), "%s", id);
+}
+
+void log_set_phase(int phase) { context_phase = phase; }
+
+static int futex(uint32_t *addr, int op, uint32_t val,
+                 const struct timespec *timeout) {
+  return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+static uint64_t realtime_timestamp() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// append the line of a record to buf, returns its length or 0 if it does
+// not fit
+static size_t format_record(const struct log_record *record, char *buf,
+                            size_t size) {
+  int len;
+  if (log_format == LOG_FORMAT_TEXT) {
+    // the messages bring their own newline
+    len = snprintf(buf, size, "[%s] %.*s", level_names[record->level],
+                   record->len, record->message);
+    return len > 0 && (size_t)len < size ? len : 0;
+  }
+  char message[LOG_MESSAGE_MAX + 1];
+  size_t message_len = record->len;
+  while (message_len && record->message[message_len - 1] == '\n')
+    message_len--;
+  memcpy(message, record->message, message_len);
+  message[message_len] = '\0';
+  char escaped[LOG_MESSAGE_MAX * 6 + 3];
+  json_escape(escaped, sizeof(escaped), message);
+  char id[LOG_ID_LEN_MAX + 3] = "null";
+  if (record->id[0]) json_escape(id, sizeof(id), record->id);
+  char phase[32] = "null";
+  if (record->phase >= 0)
+    snprintf(phase, sizeof(phase), "\"%s\"", trace_phase_name(record->phase));
+  len = snprintf(buf, size,
+                 "{\"time_ns\":%llu,\"pid\":%ld,\"level\":\"%s\",\"id\":%s,"
+                 "\"phase\":%s,\"message\":%s}\n",
+                 (unsigned long long)record->timestamp, (long)record->pid,
+                 level_json_names[record->level], id, phase, escaped);
+  return len > 0 && (size_t)len < size ? len : 0;
+}
+
+static void fill_record(struct log_record *record, log_level_t level,
+                        const char *fmt, va_list args) {
+  record->timestamp = realtime_timestamp();
+  record->pid = getpid();
+  record->level = level;
+  record->phase = context_phase;
+  memcpy(record->id, context_id, sizeof(record->id));
+  int len = vsnprintf(record->message, LOG_MESSAGE_MAX, fmt, args);
+  if (len < 0) len = 0;
+  if (len >= LOG_MESSAGE_MAX) {
+    // keep the line ending of a truncated message
+    len = LOG_MESSAGE_MAX - 1;
+    if (fmt[0] && fmt[strlen(fmt) - 1] == '\n') record->message[len++] = '\n';
+  }
+  record->len = len;
+}
+
+static void write_line(const struct log_record *record) {
+  char line[LOG_MESSAGE_MAX * 6 + 256];
+  size_t len = format_record(record, line, sizeof(line));
+  if (write(STDERR_FILENO, line, len) == -1) return;
+}
+
+// a free slot for the caller, NULL when the drain is a full ring behind
+static struct log_record *claim(uint64_t *head, uint64_t *lap) {
+  *head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+  for (;;) {
+    struct log_record *record = &ring->records[*head % LOG_RING_RECORDS];
+    uint64_t turn = __atomic_load_n(&record->turn, __ATOMIC_ACQUIRE);
+    *lap = *head / LOG_RING_RECORDS * 2;
+    if (turn == *lap) {
+      if (__atomic_compare_exchange_n(&ring->head, head, *head + 1, false,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        return record;
+    } else if (turn < *lap) {
+      __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+      return NULL;
+    } else {
+      *head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+void log_write(log_level_t level, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  if (ring == NULL) {
+    // before log_start and in the subcommands, one write per record
+    struct log_record record;
+    fill_record(&record, level, fmt, args);
+    va_end(args);
+    write_line(&record);
+    return;
+  }
+  uint64_t head, lap;
+  struct log_record *record = claim(&head, &lap);
+  if (record) {
+    fill_record(record, level, fmt, args);
+    // the drain skips a slot that stalled for too long, the record is lost
+    // then
+    if (!__atomic_compare_exchange_n(&record->turn, &lap, lap + 1, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+      __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+  }
+  va_end(args);
+  // waking costs a syscall and a context switch on the launch path
+  if ((!record || level >= LOG_WARN || head % LOG_WAKE_RECORDS == 0) &&
+      __atomic_load_n(&ring->sleeping, __ATOMIC_SEQ_CST)) {
+    __atomic_fetch_add(&ring->futex, 1, __ATOMIC_SEQ_CST);
+    futex(&ring->futex, FUTEX_WAKE, 1, NULL);
+  }
+}
+
+static void flush(char *batch, size_t *len) {
+  size_t done = 0;
+  while (done < *len) {
+    ssize_t n = write(STDERR_FILENO, batch + done, *len - done);
+    if (n == -1 && errno == EINTR) continue;
+    if (n == -1) break;
+    done += n;
+  }
+  *len = 0;
+}
+
+static void drain_main() {
+  prctl(PR_SET_NAME, "mc-log");
+  // the launcher's interrupt would take the records still in the ring along
+  sigset_t mask;
+  sigfillset(&mask);
+  sigprocmask(SIG_BLOCK, &mask, NULL);
+  static char batch[LOG_BATCH_SIZE];
+  size_t len = 0;
+  uint64_t tail = 0;
+  uint64_t stalled_since = 0;
+  uint64_t dropped = 0;
+  for (;;) {
+    struct log_record *record = &ring->records[tail % LOG_RING_RECORDS];
+    uint64_t lap = tail / LOG_RING_RECORDS * 2;
+    uint64_t turn = __atomic_load_n(&record->turn, __ATOMIC_ACQUIRE);
+    if (turn == lap + 1) {
+      char line[LOG_MESSAGE_MAX * 6 + 256];
+      size_t line_len = format_record(record, line, sizeof(line));
+      __atomic_store_n(&record->turn, lap + 2, __ATOMIC_RELEASE);
+      tail++;
+      stalled_since = 0;
+      if (len + line_len > sizeof(batch)) flush(batch, &len);
+      memcpy(batch + len, line, line_len);
+      len += line_len;
+      continue;
+    }
+
+    uint64_t total = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+    flush(batch, &len);
+    if (total != dropped) {
+      len = snprintf(batch + len, sizeof(batch) - len,
+                      "[WARN] dropped %llu log records\n",
+                      (unsigned long long)(total - dropped));
+      dropped = total;
+      flush(batch, &len);
+    }
+    if (__atomic_load_n(&ring->head, __ATOMIC_RELAXED) != tail) {
+      // claimed but not complete yet
+      uint64_t now = monotonic_timestamp();
+      if (stalled_since == 0) stalled_since = now;
+      if (now - stalled_since > LOG_STALL_MS * 1000000ULL &&
+          __atomic_compare_exchange_n(&record->turn, &lap, lap + 2, false,
+                                      __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+        tail++;
+        stalled_since = 0;
+      } else {
+        sched_yield();
+      }
+      continue;
+    }
+    if (__atomic_load_n(&ring->closing, __ATOMIC_ACQUIRE) ||
+        getppid() != ring->launcher)
+      _exit(EXIT_SUCCESS);
+
+    uint32_t seen = __atomic_load_n(&ring->futex, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&ring->sleeping, 1, __ATOMIC_SEQ_CST);
+    // a writer that missed the flag published before this check
+    if (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) == tail &&
+        !__atomic_load_n(&ring->closing, __ATOMIC_SEQ_CST)) {
+      struct timespec timeout = {0, LOG_DRAIN_TIMEOUT_MS * 1000000L};
+      futex(&ring->futex, FUTEX_WAIT, seen, &timeout);
+    }
+    __atomic_store_n(&ring->sleeping, 0, __ATOMIC_SEQ_CST);
+  }
+}
+
+void log_start() {
+  if (ring) return;
+  struct log_ring *map = mmap(NULL, sizeof(struct log_ring),
+                              PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED) err(EXIT_FAILURE, "mmap-log");
+  map->launcher = getpid();
+  pid_t pid = fork();
+  if (pid == -1) err(EXIT_FAILURE, "fork-log");
+  if (pid == 0) {
+    ring = map;
+    close(STDIN_FILENO);
+    close(STDOUT_FILENO);
+    drain_main();
   }
+  drain_pid = pid;
+  ring = map;
+  // err() exits through here too
+  atexit(log_stop);
+}
 
-LOG_FUNC(debug, DEBUG)
-LOG_FUNC(info, INFO)
-LOG_FUNC(warn, WARN)
-LOG_FUNC(error, ERROR)
\ No newline at end of file
+void log_stop() {
+  if (ring == NULL || getpid() != ring->launcher) return;
+  __atomic_store_n(&ring->closing, 1, __ATOMIC_SEQ_CST);
+  __atomic_fetch_add(&ring->futex, 1, __ATOMIC_SEQ_CST);
+  futex(&ring->futex, FUTEX_WAKE, 1, NULL);
+  while (waitpid(drain_pid, NULL, 0) == -1 && errno == EINTR) continue;
+  ring = NULL;
+}
@@ -1,14 +1,50 @@
 #ifndef _LOG_H_
 #define _LOG_H_
+// declared before the macros below replace its warn
+#include <err.h>
 
 enum log_level { LOG_DEBUG = 0, LOG_INFO, LOG_WARN, LOG_ERROR };
 
 typedef enum log_level log_level_t;
 
+enum log_format { LOG_FORMAT_TEXT = 0, LOG_FORMAT_JSON };
+
+// records are fixed size, longer messages are truncated
+#define LOG_MESSAGE_MAX 216
+#define LOG_ID_LEN_MAX 15
+// records in the ring, a power of two. once the drain falls this far behind
+// new records are dropped and counted rather than blocking the caller
+#define LOG_RING_RECORDS 4096
+
+extern log_level_t log_level;
+
 void set_log_level(log_level_t level);
-void debug(const char *fmt, ...);
-void info(const char *fmt, ...);
-void warn(const char *fmt, ...);
-void error(const char *fmt, ...);
+void set_log_format(enum log_format format);
+// the container and launch phase the following records of this process are
+// about, NULL and -1 for none
+void log_set_container(const char *id);
+void log_set_phase(int phase);
+
+// fork the drain and have every process forked from here on write into the
+// shared ring instead of stderr. log_stop flushes it and waits for the drain
+void log_start();
+void log_stop();
+
+void log_write(log_level_t level, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+// the arguments are only evaluated when the level is enabled, building with
+// LOG_NO_DEBUG removes debug calls altogether
+#ifdef LOG_NO_DEBUG
+#define debug(...) ((void)0)
+#else
+#define debug(...) \
+  (log_level <= LOG_DEBUG ? log_write(LOG_DEBUG, __VA_ARGS__) : (void)0)
+#endif
+#define info(...) \
+  (log_level <= LOG_INFO ? log_write(LOG_INFO, __VA_ARGS__) : (void)0)
+#define warn(...) \
+  (log_level <= LOG_WARN ? log_write(LOG_WARN, __VA_ARGS__) : (void)0)
+#define error(...) log_write(LOG_ERROR, __VA_ARGS__)
 
-#endif
\ No newline at end of file
+#endif
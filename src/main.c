@@ -5,61 +5,254 @@
 #include <string.h>
 #include <sys/mount.h>
 
+#include "batch.h"
+#include "cgroup.h"
 #include "container.h"
+#include "daemon.h"
 #include "filesystem.h"
+#include "forward.h"
+#include "import.h"
+#include "ipam.h"
+#include "layer.h"
 #include "log.h"
+#include "network.h"
+#include "placement.h"
+#include "pool.h"
+#include "seccomp.h"
+#include "state.h"
+#include "telemetry.h"
+#include "trace.h"
 #include "type.h"
+#include "user.h"
 #include "utils.h"
 
 void usage(const char* name) {
   fprintf(stderr, "Usage: %s [options] image command [args]\n", name);
+  fprintf(stderr, "       %s layer add DIR\n", name);
+  fprintf(stderr, "       %s image create NAME LAYER...\n", name);
+  fprintf(stderr, "       %s import [--name NAME] FILE|-\n", name);
+  fprintf(stderr, "       %s [options] --batch MANIFEST\n", name);
+  fprintf(stderr, "       %s [options] --daemon SOCKET\n", name);
+  fprintf(stderr,
+          "       %s ctl SOCKET run [-d] [-e KEY=VALUE] [--hostname NAME]\n"
+          "                  [--ip IP] [--gateway IP] [-p HOSTPORT:PORT]\n"
+          "                  image command [args]\n",
+          name);
+  fprintf(stderr, "       %s ctl SOCKET stop ID [SECONDS]|wait ID|list\n",
+          name);
+  fprintf(stderr, "       %s ps [-a] [--state-file PATH]\n", name);
+  fprintf(stderr, "       %s inspect [--state-file PATH] ID...\n", name);
+  fprintf(stderr, "       %s attach ID\n", name);
+  fprintf(stderr, "       %s cpus [--placement-file PATH]\n", name);
+  fprintf(stderr, "       %s seccomp [--hints FILE] PROFILE...\n", name);
   fprintf(stderr, "Options:\n");
   fprintf(stderr, "  -h, --help\t\tShow this help message and exit\n");
   fprintf(stderr, "  --hostname\t\tSet container hostname\n");
   fprintf(stderr, "  --rm\t\t\tRemove container when it exits\n");
   fprintf(stderr, "  --container-base\tSet container base path\n");
+  fprintf(stderr,
+          "  --rootfs\t\tRoot filesystem driver: overlay (default), ephemeral\n"
+          "\t\t\tfor a volatile writable layer on a tmpfs or ro, with\n"
+          "\t\t\toptions metacopy,redirect_dir,index,size=SIZE\n");
   fprintf(stderr, "  --cgroup-base\t\tSet cgroup base path\n");
   fprintf(stderr, "  -m, --memory\t\tSet memory limit in MB\n");
   fprintf(stderr, "  --memory-swap\t\tSet memory swap limit in MB\n");
-  fprintf(stderr, "  --cpus\t\tNumber of CPUs\n");
+  fprintf(stderr, "  --shm-size\t\tSize of /dev/shm as N[kmg] (default 64m)\n");
+  fprintf(stderr,
+          "  --hugetlbfs\t\tPAGESIZE:SIZE[:TARGET], mount SIZE of huge pages\n"
+          "\t\t\tat TARGET (default " HUGETLBFS_TARGET_DEFAULT "), the\n"
+          "\t\t\thugetlb limit defaults to SIZE\n");
+  fprintf(stderr,
+          "  --memory-high\t\tThrottle and reclaim above this many MB\n");
+  fprintf(stderr, "  --memory-low\t\tBest-effort memory protection in MB\n");
+  fprintf(stderr, "  --memory-min\t\tHard memory protection in MB\n");
+  fprintf(stderr,
+          "  --hugetlb-limit\tPAGESIZE:MB, e.g. 2MB:512, limit the huge\n"
+          "\t\t\tpages of that size\n");
+  fprintf(stderr, "  --pids-limit\t\tMaximum number of processes\n");
+  fprintf(stderr,
+          "  --io-max\t\tDEVICE:KEY=VALUE[,...] with rbps, wbps, riops or\n"
+          "\t\t\twiops, DEVICE is a block device or MAJOR:MINOR\n");
+  fprintf(stderr, "  --io-weight\t\t[DEVICE:]WEIGHT from 1 to 10000\n");
+  fprintf(stderr, "  --io-latency\t\tDEVICE:TARGET latency target in us\n");
+  fprintf(stderr,
+          "  --cpus\t\tNumber of CPUs, placed on idle cache-local cores\n"
+          "\t\t\tunless --cpuset-cpus is given, a fraction adds a\n"
+          "\t\t\tcpu.max quota\n");
   fprintf(stderr, "  --cpuset-cpus\t\tCPUs in which to allow execution\n");
   fprintf(stderr, "  --cpu-weight\t\tSet CPU weight, ranges from 1 to 10000\n");
   fprintf(stderr, "  --cpu-max\t\tLimit max CPU usage in period of 1000000\n");
+  fprintf(stderr,
+          "  --cpu-max-burst\tUnused quota in us that may be used later\n");
   fprintf(stderr, "  --debug\t\tPrint debug info\n");
+  fprintf(stderr, "  --log-format\t\tLog records as text or json lines\n");
   fprintf(stderr, "  -e, --env\t\tSet environment variables\n");
-  fprintf(stderr, "  -v, --volume\t\tBind mount a volume\n");
-  fprintf(stderr, "  --ip\t\t\tContainer IP\n");
-  fprintf(stderr, "  --gateway\t\tContainer gateway\n");
+  fprintf(stderr,
+          "  --logs\t\tRelay the container's output into a rotating log in\n"
+          "\t\t\tits directory, attach connects to it\n");
+  fprintf(stderr, "  -t, --tty\t\tAllocate a pty, implies --logs\n");
+  fprintf(stderr,
+          "  -d, --detach\t\tRun in the background and print the container\n"
+          "\t\t\tID, implies --logs\n");
+  fprintf(stderr,
+          "  --log-max-size\tRotate the log at this size, 0 for never\n"
+          "\t\t\t(default 10m)\n");
+  fprintf(stderr, "  --log-max-files\tLogs kept by rotation (default %d)\n",
+          CONSOLE_LOG_FILES_DEFAULT);
+  fprintf(stderr,
+          "  -v, --volume\t\tSRC:DST[:OPTIONS], bind mount SRC with ro, rw,\n"
+          "\t\t\tnosuid, nodev, noexec, noatime, norbind or a\n"
+          "\t\t\tpropagation mode such as rslave\n");
+  fprintf(stderr,
+          "  --tmpfs\t\tDST[:OPTIONS], scratch tmpfs with size=N[kmg],\n"
+          "\t\t\tmode=OCTAL and the volume flags\n");
+  fprintf(stderr,
+          "  --subuid\t\tMap container uids from 0 onto host uids\n"
+          "\t\t\tSTART:COUNT, image layers are idmapped\n");
+  fprintf(stderr, "  --subgid\t\tLikewise for gids\n");
+  fprintf(stderr,
+          "  --subids\t\tTake both ranges from the user's entries in\n"
+          "\t\t\t" SUBUID_FILE " and " SUBGID_FILE "\n");
+  fprintf(stderr,
+          "  --ip\t\t\tContainer IP, auto to lease a free address of the\n"
+          "\t\t\tsubnet\n");
+  fprintf(stderr,
+          "  --network\t\tbridge (default), macvlan:PARENT or\n"
+          "\t\t\tipvlan:PARENT[:l2|l3] for a sub-interface of the\n"
+          "\t\t\tPARENT device instead of a veth on the bridge,\n"
+          "\t\t\twithout -p and with an explicit --ip and --gateway\n");
+  fprintf(stderr,
+          "  -p, --publish\t\tHOSTPORT:PORT[/tcp|udp], relay a host port\n"
+          "\t\t\tto PORT of the container's IP\n");
+  fprintf(stderr,
+          "  --gateway\t\tContainer gateway, defaults to the subnet's first\n"
+          "\t\t\taddress for leased IPs\n");
+  fprintf(stderr,
+          "  --subnet\t\tSubnet whose addresses are leased (default "
+          IPAM_SUBNET_DEFAULT ")\n");
+  fprintf(stderr,
+          "  --ipam-file\t\tAddress bitmap shared by all launchers\n"
+          "\t\t\t(default " IPAM_PATH_DEFAULT ")\n");
+  fprintf(stderr,
+          "  --placement-file\tCPU loads shared by all launchers\n"
+          "\t\t\t(default " PLACEMENT_PATH_DEFAULT ")\n");
+  fprintf(stderr,
+          "  --state-file\t\tContainer index read by ps and inspect\n"
+          "\t\t\t(default " STATE_PATH_DEFAULT ")\n");
+  fprintf(stderr,
+          "  --seccomp\t\tFilter syscalls with a Docker-style JSON profile\n");
+  fprintf(stderr,
+          "  --seccomp-hints\tFile of \"syscall count\" lines, frequent\n"
+          "\t\t\tsyscalls get the shortest paths through the filter\n");
+  fprintf(stderr,
+          "  --trace\t\tAppend per-phase launch timings as JSON lines to\n"
+          "\t\t\ta file, - for stderr\n");
+  fprintf(stderr,
+          "  --trace-events\tAppend chrome trace events to a file\n");
+  fprintf(stderr,
+          "  --pool\t\tKeep N pre-warmed containers and launch one per\n"
+          "\t\t\tcommand line read from stdin\n");
+  fprintf(stderr,
+          "  --batch\t\tLaunch the containers of a JSON manifest, - for\n"
+          "\t\t\tstdin, and report their start latency and status\n");
+  fprintf(stderr,
+          "  --parallel\t\tContainers in flight at once in batch mode\n"
+          "\t\t\t(default %d)\n",
+          BATCH_PARALLEL_DEFAULT);
+  fprintf(stderr,
+          "  --daemon\t\tSupervise containers started through requests on\n"
+          "\t\t\ta unix socket, options apply to all of them\n");
+  fprintf(stderr,
+          "  --telemetry\t\tAppend cgroup samples and pressure events as\n"
+          "\t\t\tJSON lines to a file, - for stderr\n");
+  fprintf(stderr,
+          "  --telemetry-interval\tSampling period in ms, 0 for events only\n"
+          "\t\t\t(default 1000)\n");
+  fprintf(stderr,
+          "  --telemetry-psi\tPSI trigger for cpu, memory and io pressure\n"
+          "\t\t\t(default \"" TELEMETRY_PSI_DEFAULT "\")\n");
   exit(EXIT_SUCCESS);
 }
 
+static void parse_id_range(const char* range, unsigned int* start,
+                           unsigned int* count) {
+  char* end;
+  *start = strtoul(range, &end, 10);
+  if (*end != ':' || (*count = strtoul(end + 1, &end, 10)) == 0 || *end)
+    errx(EXIT_FAILURE, "invalid id range %s", range);
+}
+
 void parse(int argc, char* argv[], container_config_t* config) {
   debug("Parsing arguments...\n");
   // default values
   config->uid = getuid();
   config->gid = getgid();
 
+  const char *trace_summary = NULL, *trace_events = NULL;
+  const char *telemetry = NULL, *telemetry_psi = NULL;
+  const char *seccomp_profile = NULL, *seccomp_hints = NULL;
+  unsigned int telemetry_interval = 1000;
   int opt, option_index;
   struct option long_options[] = {{"hostname", required_argument, 0, 0},
                                   {"rm", no_argument, 0, 0},
+                                  {"rootfs", required_argument, 0, 0},
                                   {"container-base", required_argument, 0, 0},
                                   {"cgroup-base", required_argument, 0, 0},
                                   {"help", no_argument, 0, 'h'},
                                   {"uid", required_argument, 0, 'u'},
                                   {"gid", required_argument, 0, 'g'},
+                                  {"subuid", required_argument, 0, 0},
+                                  {"subgid", required_argument, 0, 0},
+                                  {"subids", required_argument, 0, 0},
                                   {"debug", no_argument, 0, 0},
+                                  {"log-format", required_argument, 0, 0},
                                   {"env", required_argument, 0, 'e'},
+                                  {"logs", no_argument, 0, 0},
+                                  {"tty", no_argument, 0, 't'},
+                                  {"detach", no_argument, 0, 'd'},
+                                  {"log-max-size", required_argument, 0, 0},
+                                  {"log-max-files", required_argument, 0, 0},
                                   {"memory", required_argument, 0, 'm'},
                                   {"memory-swap", required_argument, 0, 0},
+                                  {"shm-size", required_argument, 0, 0},
+                                  {"hugetlbfs", required_argument, 0, 0},
+                                  {"memory-high", required_argument, 0, 0},
+                                  {"memory-low", required_argument, 0, 0},
+                                  {"memory-min", required_argument, 0, 0},
+                                  {"hugetlb-limit", required_argument, 0, 0},
+                                  {"pids-limit", required_argument, 0, 0},
+                                  {"io-max", required_argument, 0, 0},
+                                  {"io-weight", required_argument, 0, 0},
+                                  {"io-latency", required_argument, 0, 0},
                                   {"cpus", required_argument, 0, 0},
                                   {"cpuset-cpus", required_argument, 0, 0},
                                   {"cpu-weight", required_argument, 0, 0},
                                   {"cpu-max", required_argument, 0, 0},
+                                  {"cpu-max-burst", required_argument, 0, 0},
                                   {"volume", required_argument, 0, 'v'},
+                                  {"tmpfs", required_argument, 0, 0},
                                   {"ip", required_argument, 0, 0},
+                                  {"network", required_argument, 0, 0},
+                                  {"publish", required_argument, 0, 'p'},
                                   {"gateway", required_argument, 0, 0},
+                                  {"subnet", required_argument, 0, 0},
+                                  {"ipam-file", required_argument, 0, 0},
+                                  {"placement-file", required_argument, 0, 0},
+                                  {"state-file", required_argument, 0, 0},
+                                  {"seccomp", required_argument, 0, 0},
+                                  {"seccomp-hints", required_argument, 0, 0},
+                                  {"pool", required_argument, 0, 0},
+                                  {"daemon", required_argument, 0, 0},
+                                  {"batch", required_argument, 0, 0},
+                                  {"parallel", required_argument, 0, 0},
+                                  {"trace", required_argument, 0, 0},
+                                  {"trace-events", required_argument, 0, 0},
+                                  {"telemetry", required_argument, 0, 0},
+                                  {"telemetry-interval", required_argument, 0,
+                                   0},
+                                  {"telemetry-psi", required_argument, 0, 0},
                                   {0, 0, 0, 0}};
-  while ((opt = getopt_long(argc, argv, "he:m:v:u:g:", long_options,
+  while ((opt = getopt_long(argc, argv, "he:m:v:p:u:g:td", long_options,
                             &option_index)) != -1) {
     switch (opt) {
       case 'h': {
@@ -75,7 +268,7 @@ void parse(int argc, char* argv[], container_config_t* config) {
           exit(EXIT_FAILURE);
         }
         free(arg);
-        append_pair(&config->env, key, value);
+        append_pair(config->arena, &config->env, key, value);
         break;
       }
       case 'm': {
@@ -83,22 +276,19 @@ void parse(int argc, char* argv[], container_config_t* config) {
         debug("Memory limit: %lld MB\n", memory_limit);
         char buf[50];
         snprintf(buf, 50, "%lld", memory_limit * 1024 * 1024);
-        append_pair(&config->cgroup_limit, "memory.max", buf);
+        append_pair(config->arena, &config->cgroup_limit, "memory.max", buf);
         break;
       }
       case 'v': {
-        char* arg = strdup(optarg);
-        char* source = strtok(optarg, ":");
-        char* target = strtok(NULL, ":");
-        char* options = strtok(NULL, ":");
-        debug("Source: %s, Target: %s, options: %s\n", source, target, options);
-        if (source == NULL || target == NULL) {
-          error("Invalid volume format: %s\n", arg);
+        if (parse_volume(config->arena, &config->mounts, optarg) == -1) {
+          error("Invalid volume format: %s\n", optarg);
           exit(EXIT_FAILURE);
         }
-        free(arg);
-        append_mount_options(&config->mounts, source, target, NULL,
-                             MS_BIND | parse_bind_mount_option(options), NULL);
+        break;
+      }
+      case 'p': {
+        if (parse_port(config->arena, &config->ports, optarg) == -1)
+          errx(EXIT_FAILURE, "invalid port %s", optarg);
         break;
       }
       case 'u': {
@@ -109,6 +299,14 @@ void parse(int argc, char* argv[], container_config_t* config) {
         config->gid = atoi(optarg);
         break;
       }
+      case 't': {
+        config->console.tty = config->console.capture = true;
+        break;
+      }
+      case 'd': {
+        config->console.detach = config->console.capture = true;
+        break;
+      }
       case '?': {
         err(EXIT_FAILURE, "Invalid option argument: %s\n", argv[optind]);
         break;
@@ -122,30 +320,155 @@ void parse(int argc, char* argv[], container_config_t* config) {
           config->rm = true;
         } else if (strcmp("container-base", option) == 0) {
           config->container_base = optarg;
+        } else if (strcmp("rootfs", option) == 0) {
+          if (parse_rootfs_options(optarg, &config->rootfs) == -1)
+            errx(EXIT_FAILURE, "invalid rootfs driver %s", optarg);
         } else if (strcmp("cgroup-base", option) == 0) {
           config->cgroup_base_path = optarg;
         } else if (strcmp("debug", option) == 0) {
           set_log_level(LOG_DEBUG);
+        } else if (strcmp("logs", option) == 0) {
+          config->console.capture = true;
+        } else if (strcmp("log-max-size", option) == 0) {
+          if (parse_size(optarg, &config->console.log_size) == -1)
+            errx(EXIT_FAILURE, "invalid log size %s", optarg);
+        } else if (strcmp("log-max-files", option) == 0) {
+          config->console.log_files = atoi(optarg);
+          if (config->console.log_files <= 0)
+            errx(EXIT_FAILURE, "invalid log count %s", optarg);
+        } else if (strcmp("log-format", option) == 0) {
+          if (strcmp(optarg, "text") == 0)
+            set_log_format(LOG_FORMAT_TEXT);
+          else if (strcmp(optarg, "json") == 0)
+            set_log_format(LOG_FORMAT_JSON);
+          else
+            errx(EXIT_FAILURE, "invalid log format %s", optarg);
         } else if (strcmp("cpus", option) == 0) {
-          char buf[50];
-          int cpus = atoi(optarg);
-          snprintf(buf, 50, "0-%d", cpus - 1);
-          append_pair(&config->cgroup_limit, "cpuset.cpus", buf);
+          char *end;
+          config->cpus = strtod(optarg, &end);
+          if (*end || !(config->cpus > 0))
+            errx(EXIT_FAILURE, "invalid cpu count %s", optarg);
         } else if (strcmp("cpuset-cpus", option) == 0) {
-          append_pair(&config->cgroup_limit, "cpuset.cpus", optarg);
+          append_pair(config->arena, &config->cgroup_limit, "cpuset.cpus",
+                      optarg);
         } else if (strcmp("cpu-weight", option) == 0) {
-          append_pair(&config->cgroup_limit, "cpu.weight", optarg);
+          append_pair(config->arena, &config->cgroup_limit, "cpu.weight",
+                      optarg);
         } else if (strcmp("cpu-max", option) == 0) {
-          append_pair(&config->cgroup_limit, "cpu.max", optarg);
+          append_pair(config->arena, &config->cgroup_limit, "cpu.max", optarg);
+        } else if (strcmp("tmpfs", option) == 0) {
+          if (parse_tmpfs(config->arena, &config->mounts, optarg) == -1)
+            errx(EXIT_FAILURE, "invalid tmpfs %s", optarg);
+        } else if (strcmp("shm-size", option) == 0) {
+          if (parse_size(optarg, &config->memory.shm_size) == -1 ||
+              config->memory.shm_size == 0)
+            errx(EXIT_FAILURE, "invalid shm size %s", optarg);
+        } else if (strcmp("hugetlbfs", option) == 0) {
+          if (parse_hugetlbfs(optarg, &config->memory) == -1)
+            errx(EXIT_FAILURE, "invalid hugetlbfs %s", optarg);
+        } else if (strcmp("cpu-max-burst", option) == 0) {
+          if (!valid_limit(optarg) || strcmp(optarg, "max") == 0)
+            errx(EXIT_FAILURE, "invalid cpu burst %s", optarg);
+          append_pair(config->arena, &config->cgroup_limit, "cpu.max.burst",
+                      optarg);
+        } else if (strcmp("memory-high", option) == 0 ||
+                   strcmp("memory-low", option) == 0 ||
+                   strcmp("memory-min", option) == 0) {
+          char key[32], buf[50];
+          snprintf(key, sizeof(key), "memory.%s", option + 7);
+          if (!valid_limit(optarg))
+            errx(EXIT_FAILURE, "invalid %s %s", key, optarg);
+          if (strcmp(optarg, "max"))
+            snprintf(buf, 50, "%llu", strtoull(optarg, NULL, 10) << 20);
+          else
+            snprintf(buf, 50, "max");
+          append_pair(config->arena, &config->cgroup_limit, key, buf);
+        } else if (strcmp("hugetlb-limit", option) == 0) {
+          char key[64], buf[50];
+          const char *limit = strrchr(optarg, ':');
+          if (limit == NULL || limit == optarg || !valid_limit(limit + 1) ||
+              limit - optarg > 16)
+            errx(EXIT_FAILURE, "invalid hugetlb limit %s", optarg);
+          snprintf(key, sizeof(key), "hugetlb.%.*s.max", (int)(limit - optarg),
+                   optarg);
+          if (strcmp(limit + 1, "max"))
+            snprintf(buf, 50, "%llu", strtoull(limit + 1, NULL, 10) << 20);
+          else
+            snprintf(buf, 50, "max");
+          append_pair(config->arena, &config->cgroup_limit, key, buf);
+        } else if (strcmp("pids-limit", option) == 0) {
+          if (!valid_limit(optarg))
+            errx(EXIT_FAILURE, "invalid pids limit %s", optarg);
+          append_pair(config->arena, &config->cgroup_limit, "pids.max", optarg);
+        } else if (strcmp("io-max", option) == 0 ||
+                   strcmp("io-weight", option) == 0 ||
+                   strcmp("io-latency", option) == 0) {
+          char key[32], buf[512];
+          snprintf(key, sizeof(key), "io.%s", option + 3);
+          if (format_io_limit(key, optarg, buf, sizeof(buf)) == -1)
+            errx(EXIT_FAILURE, "invalid %s %s", key, optarg);
+          append_pair(config->arena, &config->cgroup_limit, key, buf);
         } else if (strcmp("ip", option) == 0) {
           config->ip = optarg;
+        } else if (strcmp("network", option) == 0) {
+          if (parse_network(optarg, &config->network) == -1)
+            errx(EXIT_FAILURE, "invalid network %s", optarg);
         } else if (strcmp("gateway", option) == 0) {
           config->gateway = optarg;
+        } else if (strcmp("subnet", option) == 0) {
+          ipam_configure(NULL, optarg);
+        } else if (strcmp("ipam-file", option) == 0) {
+          ipam_configure(optarg, NULL);
+        } else if (strcmp("placement-file", option) == 0) {
+          placement_configure(optarg);
+        } else if (strcmp("subuid", option) == 0) {
+          parse_id_range(optarg, &config->uid, &config->uid_count);
+        } else if (strcmp("subgid", option) == 0) {
+          parse_id_range(optarg, &config->gid, &config->gid_count);
+        } else if (strcmp("subids", option) == 0) {
+          if (read_subids(SUBUID_FILE, optarg, &config->uid,
+                          &config->uid_count) == -1 ||
+              read_subids(SUBGID_FILE, optarg, &config->gid,
+                          &config->gid_count) == -1)
+            errx(EXIT_FAILURE, "no subordinate ids for %s", optarg);
+        } else if (strcmp("seccomp", option) == 0) {
+          seccomp_profile = optarg;
+        } else if (strcmp("seccomp-hints", option) == 0) {
+          seccomp_hints = optarg;
+        } else if (strcmp("state-file", option) == 0) {
+          state_configure(optarg);
+        } else if (strcmp("trace", option) == 0) {
+          trace_summary = optarg;
+        } else if (strcmp("trace-events", option) == 0) {
+          trace_events = optarg;
+        } else if (strcmp("telemetry", option) == 0) {
+          telemetry = optarg;
+        } else if (strcmp("telemetry-interval", option) == 0) {
+          telemetry_interval = strtoul(optarg, NULL, 10);
+        } else if (strcmp("telemetry-psi", option) == 0) {
+          telemetry_psi = optarg;
+        } else if (strcmp("batch", option) == 0) {
+          config->batch_manifest = optarg;
+        } else if (strcmp("parallel", option) == 0) {
+          config->batch_parallel = atoi(optarg);
+          if (config->batch_parallel <= 0) {
+            error("Invalid parallelism: %s\n", optarg);
+            exit(EXIT_FAILURE);
+          }
+        } else if (strcmp("daemon", option) == 0) {
+          config->daemon_socket = optarg;
+        } else if (strcmp("pool", option) == 0) {
+          config->pool_size = atoi(optarg);
+          if (config->pool_size <= 0) {
+            error("Invalid pool size: %s\n", optarg);
+            exit(EXIT_FAILURE);
+          }
         } else if (strcmp("memory-swap", option) == 0) {
           char buf[50];
           unsigned long long memory_swap = strtoull(optarg, NULL, 10);
           snprintf(buf, 50, "%lld", memory_swap * 1024 * 1024);
-          append_pair(&config->cgroup_limit, "memory.swap.max", buf);
+          append_pair(config->arena, &config->cgroup_limit, "memory.swap.max",
+                      buf);
         } else {
           err(EXIT_FAILURE, "Unknown option: %s\n", option);
         }
@@ -158,30 +481,114 @@ void parse(int argc, char* argv[], container_config_t* config) {
       }
     }
   }
-  if (optind > argc - 2) {
+  // the mount draws on the host's huge page pool, the cgroup keeps the
+  // container to its size unless --hugetlb-limit set one
+  if (config->memory.hugetlbfs_target) {
+    char label[16], key[64], size[32];
+    huge_page_label(config->memory.huge_page_size, label, sizeof(label));
+    snprintf(key, sizeof(key), "hugetlb.%s.max", label);
+    bool limited = false;
+    for (unsigned int i = 0; i < config->cgroup_limit.count; i++)
+      if (strcmp(config->cgroup_limit.items[i].key, key) == 0) limited = true;
+    snprintf(size, sizeof(size), "%llu", config->memory.hugetlbfs_size);
+    if (!limited) append_pair(config->arena, &config->cgroup_limit, key, size);
+  }
+  // in pool mode commands come from stdin, a daemon gets both per request
+  // and a batch from its manifest, where they can still default to the
+  // command line
+  int positional = config->daemon_socket ? 0 : config->pool_size ? 1 : 2;
+  if (config->batch_manifest) positional = 0;
+  if (optind > argc - positional) {
     error("Missing image path or command\n");
     usage(argv[0]);
   }
+  // a host port is bound once, pooled and batched containers would all
+  // claim it. a batch publishes per spec instead
+  if (config->ports.count && (config->pool_size || config->batch_manifest))
+    errx(EXIT_FAILURE, "-p only publishes a single container's ports");
+  // every pooled container would lease the same address
+  if (config->pool_size && config->ip && strcmp(config->ip, "auto"))
+    errx(EXIT_FAILURE, "--pool only takes --ip auto");
+  if (config->console.detach) {
+    if (config->daemon_socket || config->pool_size || config->batch_manifest)
+      errx(EXIT_FAILURE, "--detach only runs a single container");
+    console_detach();
+  }
+  // before anything else forks, so every process shares the drain
+  log_start();
+  set_trace_output(trace_summary, trace_events);
+  telemetry_start(telemetry, telemetry_interval, telemetry_psi);
+  // last, it must not hold the other helpers' sockets
+  console_start(&config->console);
+  // compiled once, every container gets a copy of the program
+  if (seccomp_profile)
+    config->seccomp = seccomp_compile(seccomp_profile, seccomp_hints);
+  if (config->daemon_socket || optind == argc) return;
   config->image = argv[optind];
   config->args = argv + optind + 1;
   debug("Image: %s\n", config->image);
-  debug("Command: %s\n", config->args[0]);
+  if (config->args[0]) debug("Command: %s\n", config->args[0]);
 }
 
 int main(int argc, char* argv[]) {
+  // the launcher's config lives as long as the process
+  arena_t arena = {0};
   struct container_config config = {
+      .arena = &arena,
       .image_base_path = "/var/lib/mini-container/images",
       .container_base = "/var/lib/mini-container/volumns",
       .rm = true,
-      .cgroup_base_path = "/sys/fs/cgroup/system.slice"};
+      .cgroup_base_path = "/sys/fs/cgroup/system.slice",
+      .console = {.log_size = CONSOLE_LOG_SIZE_DEFAULT,
+                  .log_files = CONSOLE_LOG_FILES_DEFAULT}};
+
+  if (argc > 1 && strcmp(argv[1], "layer") == 0)
+    return layer_main(argc - 1, argv + 1, config.image_base_path);
+  if (argc > 1 && strcmp(argv[1], "image") == 0)
+    return image_main(argc - 1, argv + 1, config.image_base_path);
+  if (argc > 1 && strcmp(argv[1], "import") == 0)
+    return import_main(argc - 1, argv + 1, config.image_base_path);
+  if (argc > 1 && strcmp(argv[1], "ctl") == 0)
+    return ctl_main(argc - 1, argv + 1);
+  if (argc > 1 && strcmp(argv[1], "ps") == 0)
+    return ps_main(argc - 1, argv + 1);
+  if (argc > 1 && strcmp(argv[1], "inspect") == 0)
+    return inspect_main(argc - 1, argv + 1);
+  if (argc > 1 && strcmp(argv[1], "attach") == 0)
+    return attach_main(argc - 1, argv + 1);
+  if (argc > 1 && strcmp(argv[1], "cpus") == 0)
+    return cpus_main(argc - 1, argv + 1);
+  if (argc > 1 && strcmp(argv[1], "seccomp") == 0)
+    return seccomp_main(argc - 1, argv + 1);
 
-  append_pair(&config.env, "PATH", "/bin:/sbin:/usr/bin:/usr/sbin");
-  append_pair(&config.env, "HOME", "/root");
-  append_pair(&config.env, "USER", "root");
-  append_pair(&config.env, "TERM", "xterm-256color");
+  append_pair(&arena, &config.env, "PATH", "/bin:/sbin:/usr/bin:/usr/sbin");
+  append_pair(&arena, &config.env, "HOME", "/root");
+  append_pair(&arena, &config.env, "USER", "root");
+  append_pair(&arena, &config.env, "TERM", "xterm-256color");
   parse(argc, argv, &config);
+  container_build_env(&config);
+  // every container's limits are checked before the first one is cloned
+  prepare_cgroup(config.cgroup_base_path, &config.cgroup_limit);
+  // --cpus writes a cpuset, and a fraction a cpu.max quota
+  if (config.cpus) {
+    enable_controller(config.cgroup_base_path, "cpuset");
+    if (config.cpus != (int)config.cpus)
+      enable_controller(config.cgroup_base_path, "cpu");
+  }
   debug("mini-container starting... PID: %ld\n", (long)getpid());
   debug("uid: %d, gid: %d\n", getuid(), getgid());
-  run(&config);
-  return 0;
+  int ret = EXIT_SUCCESS;
+  if (config.batch_manifest)
+    ret = run_batch(&config, config.batch_manifest,
+                    config.batch_parallel ? config.batch_parallel
+                                          : BATCH_PARALLEL_DEFAULT);
+  else if (config.daemon_socket)
+    ret = run_daemon(&config, config.daemon_socket);
+  else if (config.pool_size)
+    ret = run_pool(&config);
+  else
+    run(&config);
+  console_stop();
+  telemetry_stop();
+  return ret;
 }
\ No newline at end of file
@@ -0,0 +1,365 @@
+#define _GNU_SOURCE
+#include "netlink.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/if.h>
+#include <linux/if_link.h>
+#include <linux/limits.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/veth.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "log.h"
+
+#define NLMSG_TAIL(n) \
+  ((struct rtattr *)(((char *)(n)) + NLMSG_ALIGN((n)->nlmsg_len)))
+
+static int nl_socket() {
+  int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (fd == -1) return -1;
+  struct sockaddr_nl addr = {.nl_family = AF_NETLINK};
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int nl_open(nl_batch_t *batch, pid_t netns_pid) {
+  batch->seq = 0;
+  batch->pending = 0;
+  batch->len = 0;
+  if (netns_pid == 0) {
+    batch->fd = nl_socket();
+    return batch->fd == -1 ? -1 : 0;
+  }
+
+  // a socket stays bound to the namespace it was created in, so switch
+  // there just long enough to create it
+  char path[PATH_MAX];
+  snprintf(path, PATH_MAX, "/proc/%ld/ns/net", (long)netns_pid);
+  int self_ns = open("/proc/self/ns/net", O_RDONLY | O_CLOEXEC);
+  if (self_ns == -1) return -1;
+  int target_ns = open(path, O_RDONLY | O_CLOEXEC);
+  if (target_ns == -1) {
+    close(self_ns);
+    return -1;
+  }
+  batch->fd = -1;
+  if (setns(target_ns, CLONE_NEWNET) == 0) {
+    batch->fd = nl_socket();
+    int saved_errno = errno;
+    if (setns(self_ns, CLONE_NEWNET) == -1) {
+      error("Failed to return to host network namespace\n");
+      exit(EXIT_FAILURE);
+    }
+    errno = saved_errno;
+  }
+  close(target_ns);
+  close(self_ns);
+  return batch->fd == -1 ? -1 : 0;
+}
+
+void nl_close(nl_batch_t *batch) {
+  if (batch->fd != -1) close(batch->fd);
+  batch->fd = -1;
+}
+
+static struct nlmsghdr *nl_msg(nl_batch_t *batch, int type, int flags,
+                               const void *hdr, size_t hdr_len) {
+  size_t len = NLMSG_LENGTH(hdr_len);
+  if (batch->len + NLMSG_ALIGN(len) > NL_BATCH_SIZE) {
+    errno = ENOBUFS;
+    return NULL;
+  }
+  struct nlmsghdr *n = (struct nlmsghdr *)(batch->buf + batch->len);
+  memset(n, 0, NLMSG_ALIGN(len));
+  n->nlmsg_len = len;
+  n->nlmsg_type = type;
+  n->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+  n->nlmsg_seq = ++batch->seq;
+  memcpy(NLMSG_DATA(n), hdr, hdr_len);
+  return n;
+}
+
+// messages are built in place, so a message is only complete after its last
+// attribute has been appended and nl_msg_done() has accounted for it
+static void nl_msg_done(nl_batch_t *batch, struct nlmsghdr *n) {
+  batch->len += NLMSG_ALIGN(n->nlmsg_len);
+  batch->pending++;
+}
+
+static int nl_attr(nl_batch_t *batch, struct nlmsghdr *n, int type,
+                   const void *data, size_t data_len) {
+  size_t len = RTA_LENGTH(data_len);
+  size_t offset = (char *)n - batch->buf;
+  if (offset + NLMSG_ALIGN(n->nlmsg_len) + RTA_ALIGN(len) > NL_BATCH_SIZE) {
+    errno = ENOBUFS;
+    return -1;
+  }
+  struct rtattr *rta = NLMSG_TAIL(n);
+  rta->rta_type = type;
+  rta->rta_len = len;
+  if (data_len) memcpy(RTA_DATA(rta), data, data_len);
+  n->nlmsg_len = NLMSG_ALIGN(n->nlmsg_len) + RTA_ALIGN(len);
+  return 0;
+}
+
+static int nl_attr_str(nl_batch_t *batch, struct nlmsghdr *n, int type,
+                       const char *str) {
+  return nl_attr(batch, n, type, str, strlen(str) + 1);
+}
+
+static struct rtattr *nl_nest_begin(nl_batch_t *batch, struct nlmsghdr *n,
+                                    int type) {
+  struct rtattr *nest = NLMSG_TAIL(n);
+  if (nl_attr(batch, n, type, NULL, 0) == -1) return NULL;
+  return nest;
+}
+
+static void nl_nest_end(struct nlmsghdr *n, struct rtattr *nest) {
+  nest->rta_len = (char *)NLMSG_TAIL(n) - (char *)nest;
+}
+
+int nl_commit(nl_batch_t *batch) {
+  if (batch->pending == 0) return 0;
+  struct sockaddr_nl kernel = {.nl_family = AF_NETLINK};
+  struct iovec iov = {.iov_base = batch->buf, .iov_len = batch->len};
+  struct msghdr msg = {.msg_name = &kernel,
+                       .msg_namelen = sizeof(kernel),
+                       .msg_iov = &iov,
+                       .msg_iovlen = 1};
+  unsigned int pending = batch->pending;
+  batch->len = 0;
+  batch->pending = 0;
+  if (sendmsg(batch->fd, &msg, 0) == -1) return -1;
+
+  int first_error = 0;
+  char buf[NL_BATCH_SIZE] __attribute__((aligned(4)));
+  while (pending) {
+    ssize_t len = recv(batch->fd, buf, sizeof(buf), 0);
+    if (len == -1) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    for (struct nlmsghdr *n = (struct nlmsghdr *)buf; NLMSG_OK(n, len);
+         n = NLMSG_NEXT(n, len)) {
+      if (n->nlmsg_type != NLMSG_ERROR) continue;
+      struct nlmsgerr *e = (struct nlmsgerr *)NLMSG_DATA(n);
+      if (e->error && !first_error) {
+        debug("Netlink request %u failed: %s\n", n->nlmsg_seq,
+              strerror(-e->error));
+        first_error = -e->error;
+      }
+      pending--;
+    }
+  }
+  if (first_error) {
+    errno = first_error;
+    return -1;
+  }
+  return 0;
+}
+
+int nl_link_index(nl_batch_t *batch, const char *name) {
+  if (nl_commit(batch) == -1) return -1;
+  struct ifinfomsg ifi = {.ifi_family = AF_UNSPEC};
+  struct nlmsghdr *n = nl_msg(batch, RTM_GETLINK, 0, &ifi, sizeof(ifi));
+  if (!n || nl_attr_str(batch, n, IFLA_IFNAME, name) == -1) return -1;
+  n->nlmsg_flags &= ~NLM_F_ACK;
+  unsigned int seq = n->nlmsg_seq;
+  if (send(batch->fd, n, n->nlmsg_len, 0) == -1) return -1;
+
+  char buf[NL_BATCH_SIZE] __attribute__((aligned(4)));
+  for (;;) {
+    ssize_t len = recv(batch->fd, buf, sizeof(buf), 0);
+    if (len == -1) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    for (struct nlmsghdr *r = (struct nlmsghdr *)buf; NLMSG_OK(r, len);
+         r = NLMSG_NEXT(r, len)) {
+      if (r->nlmsg_seq != seq) continue;
+      if (r->nlmsg_type == NLMSG_ERROR) {
+        errno = -((struct nlmsgerr *)NLMSG_DATA(r))->error;
+        return -1;
+      }
+      if (r->nlmsg_type == RTM_NEWLINK)
+        return ((struct ifinfomsg *)NLMSG_DATA(r))->ifi_index;
+    }
+  }
+}
+
+static struct nlmsghdr *nl_newlink(nl_batch_t *batch, int flags,
+                                   const char *name, unsigned int up) {
+  struct ifinfomsg ifi = {.ifi_family = AF_UNSPEC,
+                          .ifi_flags = up ? IFF_UP : 0,
+                          .ifi_change = up ? IFF_UP : 0};
+  struct nlmsghdr *n = nl_msg(batch, RTM_NEWLINK, flags, &ifi, sizeof(ifi));
+  if (!n || nl_attr_str(batch, n, IFLA_IFNAME, name) == -1) return NULL;
+  return n;
+}
+
+int nl_link_add_bridge(nl_batch_t *batch, const char *name) {
+  // without NLM_F_EXCL an existing bridge is simply brought up
+  struct nlmsghdr *n = nl_newlink(batch, NLM_F_CREATE, name, 1);
+  if (!n) return -1;
+  struct rtattr *linkinfo = nl_nest_begin(batch, n, IFLA_LINKINFO);
+  if (!linkinfo || nl_attr_str(batch, n, IFLA_INFO_KIND, "bridge") == -1)
+    return -1;
+  nl_nest_end(n, linkinfo);
+  nl_msg_done(batch, n);
+  return 0;
+}
+
+int nl_link_add_veth(nl_batch_t *batch, const char *name, int master,
+                     const char *peer, pid_t peer_netns_pid) {
+  struct nlmsghdr *n =
+      nl_newlink(batch, NLM_F_CREATE | NLM_F_EXCL, name, 1);
+  if (!n) return -1;
+  if (master && nl_attr(batch, n, IFLA_MASTER, &master, sizeof(int)) == -1)
+    return -1;
+  struct rtattr *linkinfo = nl_nest_begin(batch, n, IFLA_LINKINFO);
+  if (!linkinfo || nl_attr_str(batch, n, IFLA_INFO_KIND, "veth") == -1)
+    return -1;
+  struct rtattr *data = nl_nest_begin(batch, n, IFLA_INFO_DATA);
+  struct rtattr *info_peer = data ? nl_nest_begin(batch, n, VETH_INFO_PEER) : NULL;
+  if (!info_peer) return -1;
+  // the peer attributes are prefixed by their own ifinfomsg
+  struct ifinfomsg peer_ifi = {.ifi_family = AF_UNSPEC};
+  size_t offset = (char *)n - batch->buf;
+  if (offset + NLMSG_ALIGN(n->nlmsg_len) + sizeof(peer_ifi) > NL_BATCH_SIZE) {
+    errno = ENOBUFS;
+    return -1;
+  }
+  memcpy(NLMSG_TAIL(n), &peer_ifi, sizeof(peer_ifi));
+  n->nlmsg_len = NLMSG_ALIGN(n->nlmsg_len) + sizeof(peer_ifi);
+  if (nl_attr_str(batch, n, IFLA_IFNAME, peer) == -1) return -1;
+  if (peer_netns_pid) {
+    unsigned int pid = peer_netns_pid;
+    if (nl_attr(batch, n, IFLA_NET_NS_PID, &pid, sizeof(pid)) == -1) return -1;
+  }
+  nl_nest_end(n, info_peer);
+  nl_nest_end(n, data);
+  nl_nest_end(n, linkinfo);
+  nl_msg_done(batch, n);
+  return 0;
+}
+
+// a device of kind stacked on parent, created directly inside netns_pid with
+// its mode as the only kind specific attribute
+static int nl_link_add_stacked(nl_batch_t *batch, const char *kind,
+                               int parent, int mode_type, const void *mode,
+                               size_t mode_len, const char *name,
+                               pid_t netns_pid) {
+  struct nlmsghdr *n =
+      nl_newlink(batch, NLM_F_CREATE | NLM_F_EXCL, name, 0);
+  if (!n || nl_attr(batch, n, IFLA_LINK, &parent, sizeof(int)) == -1)
+    return -1;
+  if (netns_pid) {
+    unsigned int pid = netns_pid;
+    if (nl_attr(batch, n, IFLA_NET_NS_PID, &pid, sizeof(pid)) == -1) return -1;
+  }
+  struct rtattr *linkinfo = nl_nest_begin(batch, n, IFLA_LINKINFO);
+  if (!linkinfo || nl_attr_str(batch, n, IFLA_INFO_KIND, kind) == -1)
+    return -1;
+  struct rtattr *data = nl_nest_begin(batch, n, IFLA_INFO_DATA);
+  if (!data || nl_attr(batch, n, mode_type, mode, mode_len) == -1) return -1;
+  nl_nest_end(n, data);
+  nl_nest_end(n, linkinfo);
+  nl_msg_done(batch, n);
+  return 0;
+}
+
+int nl_link_add_macvlan(nl_batch_t *batch, int parent, unsigned int mode,
+                        const char *name, pid_t netns_pid) {
+  uint32_t value = mode;
+  return nl_link_add_stacked(batch, "macvlan", parent, IFLA_MACVLAN_MODE,
+                             &value, sizeof(value), name, netns_pid);
+}
+
+int nl_link_add_ipvlan(nl_batch_t *batch, int parent, unsigned int mode,
+                       const char *name, pid_t netns_pid) {
+  uint16_t value = mode;
+  return nl_link_add_stacked(batch, "ipvlan", parent, IFLA_IPVLAN_MODE,
+                             &value, sizeof(value), name, netns_pid);
+}
+
+int nl_link_set_up(nl_batch_t *batch, const char *name) {
+  struct nlmsghdr *n = nl_newlink(batch, 0, name, 1);
+  if (!n) return -1;
+  nl_msg_done(batch, n);
+  return 0;
+}
+
+int nl_link_del(nl_batch_t *batch, const char *name) {
+  struct ifinfomsg ifi = {.ifi_family = AF_UNSPEC};
+  struct nlmsghdr *n = nl_msg(batch, RTM_DELLINK, 0, &ifi, sizeof(ifi));
+  if (!n || nl_attr_str(batch, n, IFLA_IFNAME, name) == -1) return -1;
+  nl_msg_done(batch, n);
+  return 0;
+}
+
+int nl_parse_cidr(const char *cidr, struct in_addr *addr,
+                  unsigned char *prefix) {
+  char buf[INET_ADDRSTRLEN + 4];
+  if (strlen(cidr) >= sizeof(buf)) return -1;
+  strcpy(buf, cidr);
+  *prefix = 32;
+  char *slash = strchr(buf, '/');
+  if (slash) {
+    *slash = '\0';
+    char *end;
+    long len = strtol(slash + 1, &end, 10);
+    if (*end || len < 0 || len > 32) return -1;
+    *prefix = len;
+  }
+  return inet_pton(AF_INET, buf, addr) == 1 ? 0 : -1;
+}
+
+int nl_addr_add(nl_batch_t *batch, int ifindex, const char *cidr) {
+  struct in_addr addr;
+  unsigned char prefix;
+  if (nl_parse_cidr(cidr, &addr, &prefix) == -1) {
+    errno = EINVAL;
+    return -1;
+  }
+  struct ifaddrmsg ifa = {.ifa_family = AF_INET,
+                          .ifa_prefixlen = prefix,
+                          .ifa_scope = RT_SCOPE_UNIVERSE,
+                          .ifa_index = ifindex};
+  struct nlmsghdr *n = nl_msg(batch, RTM_NEWADDR, NLM_F_CREATE | NLM_F_EXCL,
+                              &ifa, sizeof(ifa));
+  if (!n || nl_attr(batch, n, IFA_LOCAL, &addr, sizeof(addr)) == -1 ||
+      nl_attr(batch, n, IFA_ADDRESS, &addr, sizeof(addr)) == -1)
+    return -1;
+  nl_msg_done(batch, n);
+  return 0;
+}
+
+int nl_route_add_default(nl_batch_t *batch, const char *gateway) {
+  struct in_addr gw;
+  if (inet_pton(AF_INET, gateway, &gw) != 1) {
+    errno = EINVAL;
+    return -1;
+  }
+  struct rtmsg rtm = {.rtm_family = AF_INET,
+                      .rtm_table = RT_TABLE_MAIN,
+                      .rtm_protocol = RTPROT_BOOT,
+                      .rtm_scope = RT_SCOPE_UNIVERSE,
+                      .rtm_type = RTN_UNICAST};
+  struct nlmsghdr *n = nl_msg(batch, RTM_NEWROUTE, NLM_F_CREATE | NLM_F_EXCL,
+                              &rtm, sizeof(rtm));
+  if (!n || nl_attr(batch, n, RTA_GATEWAY, &gw, sizeof(gw)) == -1) return -1;
+  nl_msg_done(batch, n);
+  return 0;
+}
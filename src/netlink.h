@@ -0,0 +1,50 @@
+#ifndef _NETLINK_H_
+#define _NETLINK_H_
+#include <netinet/in.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define NL_BATCH_SIZE 8192
+
+// a NETLINK_ROUTE socket plus a buffer of queued requests, all of which are
+// sent with a single sendmsg() by nl_commit()
+struct nl_batch {
+  int fd;
+  unsigned int seq;
+  unsigned int pending;
+  size_t len;
+  char buf[NL_BATCH_SIZE] __attribute__((aligned(4)));
+};
+
+typedef struct nl_batch nl_batch_t;
+
+// open a rtnetlink socket in the network namespace of pid, 0 for the current
+int nl_open(nl_batch_t *batch, pid_t netns_pid);
+void nl_close(nl_batch_t *batch);
+// send every queued request and wait for all acks, returns -1 with errno set
+// to the first error reported by the kernel
+int nl_commit(nl_batch_t *batch);
+
+// immediate query, returns the ifindex of name in the socket's namespace
+int nl_link_index(nl_batch_t *batch, const char *name);
+
+int nl_link_add_bridge(nl_batch_t *batch, const char *name);
+// create a veth pair, name stays in the socket's namespace attached to master
+// (if non-zero) and up, peer is created directly inside peer_netns_pid
+int nl_link_add_veth(nl_batch_t *batch, const char *name, int master,
+                     const char *peer, pid_t peer_netns_pid);
+// create a macvlan (mode is a MACVLAN_MODE_*) or an ipvlan (an IPVLAN_MODE_*)
+// on the parent ifindex, name is created directly inside netns_pid, down
+int nl_link_add_macvlan(nl_batch_t *batch, int parent, unsigned int mode,
+                        const char *name, pid_t netns_pid);
+int nl_link_add_ipvlan(nl_batch_t *batch, int parent, unsigned int mode,
+                       const char *name, pid_t netns_pid);
+int nl_link_set_up(nl_batch_t *batch, const char *name);
+int nl_link_del(nl_batch_t *batch, const char *name);
+// cidr is "a.b.c.d[/prefix]", the prefix defaults to 32
+int nl_parse_cidr(const char *cidr, struct in_addr *addr,
+                  unsigned char *prefix);
+int nl_addr_add(nl_batch_t *batch, int ifindex, const char *cidr);
+int nl_route_add_default(nl_batch_t *batch, const char *gateway);
+
+#endif
@@ -1,6 +1,10 @@
 #include "network.h"
 
+#include <arpa/inet.h>
 #include <err.h>
+#include <errno.h>
+#include <linux/if_link.h>
+#include <net/if.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -8,29 +12,181 @@
 #include <unistd.h>
 
 #include "log.h"
+#include "netlink.h"
 #include "utils.h"
 
-int setup_network_container(const char* id, const pid_t pid, const char* ip,
-                            const char* gateway) {
-  debug("Bring up lo...\n");
-  system("ip link set lo up");
-  if (ip == NULL || gateway == NULL) return 1;
+#define BRIDGE_NAME "mini-container"
+
+static void create_veth(const char* id, const pid_t pid) {
+  // as much of the id as fits the interface name, so concurrent containers
+  // do not collide
   char id_short[10];
-  snprintf(id_short, 6, "%s", id);
+  snprintf(id_short, sizeof(id_short), "%s", id);
   debug("id_short %s\n", id_short);
-  char cmd[1024];
-  snprintf(cmd, 1024, "./scripts/setup_veth.sh %s %ld %s %s", id_short,
-           (unsigned long)pid, ip, gateway);
-  system(cmd);
+  char veth_outside[IF_NAMESIZE];
+  snprintf(veth_outside, IF_NAMESIZE, "veth%s-1", id_short);
+
+  // the peer is created inside the container as eth0 directly, so there is
+  // no move or rename step
+  int bridge = if_nametoindex(BRIDGE_NAME);
+  if (bridge == 0) err(EXIT_FAILURE, "bridge %s", BRIDGE_NAME);
+  nl_batch_t host_nl;
+  if (nl_open(&host_nl, 0) == -1) err(EXIT_FAILURE, "netlink-open");
+  if (nl_link_add_veth(&host_nl, veth_outside, bridge, "eth0", pid) == -1 ||
+      nl_commit(&host_nl) == -1)
+    err(EXIT_FAILURE, "netlink-veth %s", veth_outside);
+  nl_close(&host_nl);
+}
+
+// eth0 of the container as a sub-interface of the parent device, its
+// packets skip the bridge and the veth pair
+static void create_stacked(const struct network_options* network,
+                           const pid_t pid) {
+  int parent = if_nametoindex(network->parent);
+  if (parent == 0) err(EXIT_FAILURE, "network parent %s", network->parent);
+  nl_batch_t host_nl;
+  if (nl_open(&host_nl, 0) == -1) err(EXIT_FAILURE, "netlink-open");
+  int ret = network->mode == NETWORK_MACVLAN
+                ? nl_link_add_macvlan(&host_nl, parent, MACVLAN_MODE_BRIDGE,
+                                      "eth0", pid)
+                : nl_link_add_ipvlan(&host_nl, parent,
+                                     network->mode == NETWORK_IPVLAN_L3
+                                         ? IPVLAN_MODE_L3
+                                         : IPVLAN_MODE_L2,
+                                     "eth0", pid);
+  if (ret == -1 || nl_commit(&host_nl) == -1)
+    err(EXIT_FAILURE, "netlink-%s %s",
+        network->mode == NETWORK_MACVLAN ? "macvlan" : "ipvlan",
+        network->parent);
+  nl_close(&host_nl);
+}
+
+static void create_link(const char* id, const pid_t pid,
+                        const struct network_options* network) {
+  if (network->mode == NETWORK_BRIDGE)
+    create_veth(id, pid);
+  else
+    create_stacked(network, pid);
+}
+
+static void configure_eth0(nl_batch_t* container_nl, const char* ip,
+                           const char* gateway) {
+  int eth0 = nl_link_index(container_nl, "eth0");
+  if (eth0 == -1) err(EXIT_FAILURE, "netlink-eth0");
+  if (nl_link_set_up(container_nl, "eth0") == -1 ||
+      nl_addr_add(container_nl, eth0, ip) == -1 ||
+      nl_route_add_default(container_nl, gateway) == -1)
+    err(EXIT_FAILURE, "netlink-build");
+  if (nl_commit(container_nl) == -1)
+    err(EXIT_FAILURE, "netlink-eth0 %s via %s", ip, gateway);
+}
+
+int parse_network(const char* spec, struct network_options* network) {
+  if (strcmp(spec, "bridge") == 0) {
+    *network = (struct network_options){.mode = NETWORK_BRIDGE};
+    return 0;
+  }
+  char* copy = strdup(spec);
+  char* saveptr;
+  char* kind = strtok_r(copy, ":", &saveptr);
+  char* parent = strtok_r(NULL, ":", &saveptr);
+  char* mode = strtok_r(NULL, "", &saveptr);
+  int ret = -1;
+  if (kind == NULL || parent == NULL || strlen(parent) >= IF_NAMESIZE)
+    goto out;
+  if (strcmp(kind, "macvlan") == 0 && mode == NULL)
+    network->mode = NETWORK_MACVLAN;
+  else if (strcmp(kind, "ipvlan") != 0)
+    goto out;
+  else if (mode == NULL || strcmp(mode, "l2") == 0)
+    network->mode = NETWORK_IPVLAN_L2;
+  else if (strcmp(mode, "l3") == 0)
+    network->mode = NETWORK_IPVLAN_L3;
+  else
+    goto out;
+  network->parent = strdup(parent);
+  ret = 0;
+out:
+  free(copy);
+  return ret;
+}
+
+int check_network(const struct network_options* network, const char* ip,
+                  const char* gateway) {
+  if (network->mode != NETWORK_BRIDGE &&
+      if_nametoindex(network->parent) == 0) {
+    error("Network parent %s: %s\n", network->parent, strerror(errno));
+    errno = ENODEV;
+    return -1;
+  }
+  if (ip == NULL || gateway == NULL) return 0;
+  struct in_addr addr, gw;
+  unsigned char prefix;
+  if (nl_parse_cidr(ip, &addr, &prefix) == -1 ||
+      inet_pton(AF_INET, gateway, &gw) != 1) {
+    error("Invalid address %s via %s\n", ip, gateway);
+    errno = EINVAL;
+    return -1;
+  }
+  // the default route needs the gateway on eth0's subnet
+  uint32_t mask = prefix ? htonl(~0U << (32 - prefix)) : 0;
+  if ((addr.s_addr ^ gw.s_addr) & mask) {
+    error("Gateway %s is not on the subnet of %s\n", gateway, ip);
+    errno = ENETUNREACH;
+    return -1;
+  }
+  return 0;
+}
+
+int setup_network_container(const char* id, const pid_t pid,
+                            const struct network_options* network,
+                            const char* ip, const char* gateway) {
+  nl_batch_t container_nl;
+  if (nl_open(&container_nl, pid) == -1)
+    err(EXIT_FAILURE, "netlink-open netns of %ld", (long)pid);
+
+  debug("Bring up lo...\n");
+  if (nl_link_set_up(&container_nl, "lo") == -1)
+    err(EXIT_FAILURE, "netlink-lo");
+  if (ip == NULL || gateway == NULL) {
+    if (nl_commit(&container_nl) == -1) err(EXIT_FAILURE, "netlink-lo up");
+    nl_close(&container_nl);
+    return 1;
+  }
+
+  create_link(id, pid, network);
+  configure_eth0(&container_nl, ip, gateway);
+  nl_close(&container_nl);
 
   return 0;
 }
 
+int setup_network_link(const char* id, const pid_t pid,
+                       const struct network_options* network) {
+  if (network->mode == NETWORK_BRIDGE && if_nametoindex(BRIDGE_NAME) == 0)
+    return 1;
+  create_link(id, pid, network);
+  return 0;
+}
+
+int setup_network_address(const pid_t pid, const char* ip,
+                          const char* gateway) {
+  if (ip == NULL || gateway == NULL) return 1;
+  nl_batch_t container_nl;
+  if (nl_open(&container_nl, pid) == -1)
+    err(EXIT_FAILURE, "netlink-open netns of %ld", (long)pid);
+  configure_eth0(&container_nl, ip, gateway);
+  nl_close(&container_nl);
+  return 0;
+}
+
 int setup_network_host() {
   debug("Setting up network bridge\n");
-  if (system("ip link show mini-container"))
-    system("ip link add name mini-container type bridge");
-  system("ip link set mini-container up");
+  nl_batch_t nl;
+  if (nl_open(&nl, 0) == -1) err(EXIT_FAILURE, "netlink-open");
+  if (nl_link_add_bridge(&nl, BRIDGE_NAME) == -1 || nl_commit(&nl) == -1)
+    err(EXIT_FAILURE, "netlink-bridge %s", BRIDGE_NAME);
+  nl_close(&nl);
   return 0;
 }
 
@@ -2,7 +2,40 @@
 #define _NETWORK_H_
 #include <sys/types.h>
 
-int setup_network_container(const char* id, const pid_t pid, const char* ip, const char* gateway);
+// how a container's eth0 reaches the outside
+enum network_mode {
+  // a veth pair on the mini-container bridge
+  NETWORK_BRIDGE = 0,
+  // a sub-interface of a parent device, without the bridge hop. the host
+  // cannot reach a macvlan through its parent
+  NETWORK_MACVLAN,
+  NETWORK_IPVLAN_L2,
+  NETWORK_IPVLAN_L3
+};
+
+struct network_options {
+  enum network_mode mode;
+  // the parent device of macvlan and ipvlan
+  char* parent;
+};
+
+// "bridge", "macvlan:PARENT" or "ipvlan:PARENT[:l2|l3]"
+int parse_network(const char* spec, struct network_options* network);
+
+// -1 with an error logged when a container could not get this network, so
+// it can be refused before anything is created for it
+int check_network(const struct network_options* network, const char* ip,
+                  const char* gateway);
+
+int setup_network_container(const char* id, const pid_t pid,
+                            const struct network_options* network,
+                            const char* ip, const char* gateway);
+
+// split form of setup_network_container() for pre-warmed containers: eth0 is
+// created ahead of time and only addressed when the container is used
+int setup_network_link(const char* id, const pid_t pid,
+                       const struct network_options* network);
+int setup_network_address(const pid_t pid, const char* ip, const char* gateway);
 
 int setup_network_host();
 
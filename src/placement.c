@@ -0,0 +1,561 @@
+#include "placement.h"
+
+#include <dirent.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "log.h"
+
+#define PLACEMENT_MAGIC "mccpus2"
+#ifndef PLACEMENT_SYSFS
+#define PLACEMENT_SYSFS "/sys/devices/system"
+#endif
+// attempts to claim a choice before giving up on concurrent launchers
+#define PLACEMENT_RETRIES 16
+#define PLACEMENT_RESERVATIONS_MAX 4096
+#define PLACEMENT_CGROUP_LEN_MAX 256
+
+// the file is this header followed by the number of containers on each cpu
+// and the reservations behind them. counts only change through atomic
+// compare and swap against the snapshot a choice was made from, so two
+// launchers never both see a cpu as idle
+struct placement_header {
+  char magic[8];
+  uint32_t cpus;
+  uint32_t reservations;
+};
+
+enum {
+  RESERVATION_FREE,
+  RESERVATION_WRITING,
+  RESERVATION_HELD,
+  RESERVATION_DROPPING,
+};
+
+// the cpus counted for one container. a launcher killed before releasing
+// them leaves the reservation behind, the next launcher drops it once the
+// cgroup is gone, or is empty with its launcher dead
+struct reservation {
+  uint32_t state;
+  pid_t owner;
+  // start time of owner, so a reused pid is not taken for it
+  uint64_t owner_start;
+  char cgroup[PLACEMENT_CGROUP_LEN_MAX];
+  uint8_t cpus[PLACEMENT_CPUS_MAX / 8];
+};
+
+// where each usable cpu sits, every domain is named by its lowest cpu
+struct topology {
+  int count;
+  int cpu[PLACEMENT_CPUS_MAX];
+  int core[PLACEMENT_CPUS_MAX];
+  int llc[PLACEMENT_CPUS_MAX];
+  int node[PLACEMENT_CPUS_MAX];
+};
+
+static const char *placement_path = PLACEMENT_PATH_DEFAULT;
+static uint32_t *loads;
+static struct reservation *reservations;
+static struct topology topology;
+
+void placement_configure(const char *path) {
+  if (path) placement_path = path;
+}
+
+static void placement_open() {
+  if (loads) return;
+  size_t size = sizeof(struct placement_header) +
+                PLACEMENT_CPUS_MAX * sizeof(uint32_t) +
+                PLACEMENT_RESERVATIONS_MAX * sizeof(struct reservation);
+  int fd = open(placement_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd == -1) err(EXIT_FAILURE, "open-placement %s", placement_path);
+  // only held while the first process to open the file initializes it
+  if (flock(fd, LOCK_EX) == -1)
+    err(EXIT_FAILURE, "flock-placement %s", placement_path);
+  struct stat st;
+  if (fstat(fd, &st) == -1)
+    err(EXIT_FAILURE, "stat-placement %s", placement_path);
+  bool fresh = st.st_size == 0;
+  if (fresh && ftruncate(fd, size) == -1)
+    err(EXIT_FAILURE, "ftruncate-placement %s", placement_path);
+  if (!fresh && (size_t)st.st_size != size)
+    errx(EXIT_FAILURE, "%s is not a cpu placement file", placement_path);
+  void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) err(EXIT_FAILURE, "mmap-placement %s", placement_path);
+  struct placement_header *header = map;
+  if (fresh) {
+    memcpy(header->magic, PLACEMENT_MAGIC, sizeof(header->magic));
+    header->cpus = PLACEMENT_CPUS_MAX;
+    header->reservations = PLACEMENT_RESERVATIONS_MAX;
+  } else if (memcmp(header->magic, PLACEMENT_MAGIC, sizeof(header->magic)) ||
+             header->cpus != PLACEMENT_CPUS_MAX ||
+             header->reservations != PLACEMENT_RESERVATIONS_MAX) {
+    errx(EXIT_FAILURE, "%s is not a cpu placement file", placement_path);
+  }
+  flock(fd, LOCK_UN);
+  close(fd);
+  loads = (uint32_t *)(header + 1);
+  reservations = (struct reservation *)(loads + PLACEMENT_CPUS_MAX);
+}
+
+static int read_line(const char *path, char *buf, size_t size) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) return -1;
+  ssize_t len = read(fd, buf, size - 1);
+  close(fd);
+  if (len <= 0) return -1;
+  buf[len] = '\0';
+  buf[strcspn(buf, "\n")] = '\0';
+  return 0;
+}
+
+// "0-3,8,10-11" into a set indexed by cpu number
+static int parse_cpulist(const char *list, bool *set) {
+  memset(set, 0, PLACEMENT_CPUS_MAX * sizeof(bool));
+  const char *cur = list;
+  while (*cur) {
+    char *end;
+    long first = strtol(cur, &end, 10), last = first;
+    if (end == cur) return -1;
+    if (*end == '-') {
+      cur = end + 1;
+      last = strtol(cur, &end, 10);
+      if (end == cur) return -1;
+    }
+    if (first < 0 || last < first) return -1;
+    for (long cpu = first; cpu <= last && cpu < PLACEMENT_CPUS_MAX; cpu++)
+      set[cpu] = true;
+    if (*end == ',') end++;
+    else if (*end) return -1;
+    cur = end;
+  }
+  return 0;
+}
+
+static void format_cpulist(const bool *set, char *buf, size_t size) {
+  size_t len = 0;
+  buf[0] = '\0';
+  for (int cpu = 0; cpu < PLACEMENT_CPUS_MAX; cpu++) {
+    if (!set[cpu]) continue;
+    int last = cpu;
+    while (last + 1 < PLACEMENT_CPUS_MAX && set[last + 1]) last++;
+    int n = last == cpu ? snprintf(buf + len, size - len, "%s%d",
+                                   len ? "," : "", cpu)
+                        : snprintf(buf + len, size - len, "%s%d-%d",
+                                   len ? "," : "", cpu, last);
+    if (n < 0 || (size_t)n >= size - len) return;
+    len += n;
+    cpu = last;
+  }
+}
+
+// the lowest cpu of a list file, -1 without one
+static int first_cpu(const char *path) {
+  char buf[PLACEMENT_CPULIST_LEN_MAX];
+  bool set[PLACEMENT_CPUS_MAX];
+  if (read_line(path, buf, sizeof(buf)) == -1 || parse_cpulist(buf, set))
+    return -1;
+  for (int cpu = 0; cpu < PLACEMENT_CPUS_MAX; cpu++)
+    if (set[cpu]) return cpu;
+  return -1;
+}
+
+// the cpus sharing the highest level cache of cpu, its package without
+// cache information
+static int last_level_cache(int cpu) {
+  char path[PATH_MAX], buf[16];
+  int best_level = -1, llc = -1;
+  for (int index = 0;; index++) {
+    snprintf(path, sizeof(path),
+             PLACEMENT_SYSFS "/cpu/cpu%d/cache/index%d/level", cpu, index);
+    if (read_line(path, buf, sizeof(buf)) == -1) break;
+    int level = atoi(buf);
+    if (level <= best_level) continue;
+    snprintf(path, sizeof(path),
+             PLACEMENT_SYSFS "/cpu/cpu%d/cache/index%d/shared_cpu_list", cpu,
+             index);
+    int first = first_cpu(path);
+    if (first == -1) continue;
+    best_level = level;
+    llc = first;
+  }
+  if (llc != -1) return llc;
+  snprintf(path, sizeof(path),
+           PLACEMENT_SYSFS "/cpu/cpu%d/topology/package_cpus_list", cpu);
+  llc = first_cpu(path);
+  return llc == -1 ? cpu : llc;
+}
+
+static void load_topology() {
+  if (topology.count) return;
+  char buf[PLACEMENT_CPULIST_LEN_MAX], path[PATH_MAX];
+  bool online[PLACEMENT_CPUS_MAX];
+  if (read_line(PLACEMENT_SYSFS "/cpu/online", buf, sizeof(buf)) == -1 ||
+      parse_cpulist(buf, online) == -1)
+    errx(EXIT_FAILURE, "cannot read the online cpus");
+  int node_of[PLACEMENT_CPUS_MAX] = {0};
+  DIR *dir = opendir(PLACEMENT_SYSFS "/node");
+  struct dirent *entry;
+  while (dir && (entry = readdir(dir))) {
+    int node;
+    bool set[PLACEMENT_CPUS_MAX];
+    if (sscanf(entry->d_name, "node%d", &node) != 1) continue;
+    snprintf(path, sizeof(path), PLACEMENT_SYSFS "/node/%s/cpulist",
+             entry->d_name);
+    if (read_line(path, buf, sizeof(buf)) == -1 || parse_cpulist(buf, set))
+      continue;
+    for (int cpu = 0; cpu < PLACEMENT_CPUS_MAX; cpu++)
+      if (set[cpu]) node_of[cpu] = node;
+  }
+  if (dir) closedir(dir);
+
+  for (int cpu = 0; cpu < PLACEMENT_CPUS_MAX; cpu++) {
+    if (!online[cpu]) continue;
+    int i = topology.count++;
+    topology.cpu[i] = cpu;
+    snprintf(path, sizeof(path),
+             PLACEMENT_SYSFS "/cpu/cpu%d/topology/thread_siblings_list", cpu);
+    topology.core[i] = first_cpu(path);
+    if (topology.core[i] == -1) topology.core[i] = cpu;
+    topology.llc[i] = last_level_cache(cpu);
+    topology.node[i] = node_of[cpu];
+  }
+  debug("Topology: %d cpus\n", topology.count);
+}
+
+// cpus the containers' parent cgroup lets them use, all without a cpuset
+static void allowed_cpus(const char *cgroup_base_path, bool *allowed) {
+  // cgroup v2 and v1 names
+  const char *files[] = {"cpuset.cpus.effective", "cpuset.effective_cpus"};
+  char path[PATH_MAX], buf[PLACEMENT_CPULIST_LEN_MAX];
+  for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+    snprintf(path, sizeof(path), "%s/%s", cgroup_base_path, files[i]);
+    if (read_line(path, buf, sizeof(buf)) == 0 &&
+        parse_cpulist(buf, allowed) == 0)
+      return;
+  }
+  for (int cpu = 0; cpu < PLACEMENT_CPUS_MAX; cpu++) allowed[cpu] = true;
+}
+
+// per eligible cpu, how many eligible cpus share its core, cache and node.
+// fuller domains come first, so a container takes whole idle cores and
+// spreads over as few caches and nodes as it can
+struct ranking {
+  const bool *eligible;
+  int core_free[PLACEMENT_CPUS_MAX];
+  int llc_free[PLACEMENT_CPUS_MAX];
+  int node_free[PLACEMENT_CPUS_MAX];
+  // containers already on each cpu and on the eligible cpus of its domains
+  uint32_t load[PLACEMENT_CPUS_MAX];
+  uint32_t llc_load[PLACEMENT_CPUS_MAX];
+  uint32_t node_load[PLACEMENT_CPUS_MAX];
+};
+
+static struct ranking ranking;
+
+static int compare_rank(const void *a, const void *b) {
+  int i = *(const int *)a, j = *(const int *)b;
+  if (ranking.load[i] != ranking.load[j])
+    return ranking.load[i] < ranking.load[j] ? -1 : 1;
+  if (ranking.node_free[i] != ranking.node_free[j])
+    return ranking.node_free[j] - ranking.node_free[i];
+  if (topology.node[i] != topology.node[j])
+    return topology.node[i] - topology.node[j];
+  if (ranking.llc_free[i] != ranking.llc_free[j])
+    return ranking.llc_free[j] - ranking.llc_free[i];
+  if (topology.llc[i] != topology.llc[j])
+    return topology.llc[i] - topology.llc[j];
+  if (ranking.core_free[i] != ranking.core_free[j])
+    return ranking.core_free[j] - ranking.core_free[i];
+  if (topology.core[i] != topology.core[j])
+    return topology.core[i] - topology.core[j];
+  return topology.cpu[i] - topology.cpu[j];
+}
+
+// the domain of key holding at least count eligible cpus with the fewest to
+// spare and then the least load, -1 if none does
+static int best_fit(const int *key, const int *free, const uint32_t *load,
+                    int count) {
+  int best = -1, best_free = 0;
+  uint32_t best_load = 0;
+  for (int i = 0; i < topology.count; i++) {
+    if (!ranking.eligible[i] || free[i] < count) continue;
+    if (best == -1 || free[i] < best_free ||
+        (free[i] == best_free && load[i] < best_load) ||
+        (free[i] == best_free && load[i] == best_load && key[i] < best)) {
+      best = key[i];
+      best_free = free[i];
+      best_load = load[i];
+    }
+  }
+  return best;
+}
+
+// choose count cpus among those with the lowest load, indices into the
+// topology go to chosen
+static void choose(const uint32_t *snapshot, const bool *allowed, int count,
+                   int *chosen) {
+  bool eligible[PLACEMENT_CPUS_MAX];
+  uint32_t level = UINT32_MAX;
+  for (int i = 0; i < topology.count; i++)
+    if (allowed[topology.cpu[i]] && snapshot[i] < level) level = snapshot[i];
+  // with too few idle cpus containers start sharing the least loaded ones
+  for (;; level++) {
+    int n = 0;
+    for (int i = 0; i < topology.count; i++) {
+      eligible[i] = allowed[topology.cpu[i]] && snapshot[i] <= level;
+      n += eligible[i];
+    }
+    if (n >= count) break;
+  }
+  ranking.eligible = eligible;
+  for (int i = 0; i < topology.count; i++) {
+    ranking.core_free[i] = ranking.llc_free[i] = ranking.node_free[i] = 0;
+    ranking.llc_load[i] = ranking.node_load[i] = 0;
+    ranking.load[i] = snapshot[i];
+    if (!eligible[i]) continue;
+    for (int j = 0; j < topology.count; j++) {
+      if (!eligible[j]) continue;
+      bool llc = topology.llc[j] == topology.llc[i];
+      bool node = topology.node[j] == topology.node[i];
+      ranking.core_free[i] += topology.core[j] == topology.core[i];
+      ranking.llc_free[i] += llc;
+      ranking.node_free[i] += node;
+      if (llc) ranking.llc_load[i] += snapshot[j];
+      if (node) ranking.node_load[i] += snapshot[j];
+    }
+  }
+  // a single cache, else a single node, else across nodes
+  int llc = best_fit(topology.llc, ranking.llc_free, ranking.llc_load, count);
+  int node = llc == -1 ? best_fit(topology.node, ranking.node_free,
+                                  ranking.node_load, count)
+                       : -1;
+  int candidates[PLACEMENT_CPUS_MAX], n = 0;
+  for (int i = 0; i < topology.count; i++) {
+    if (!eligible[i]) continue;
+    if (llc != -1 && topology.llc[i] != llc) continue;
+    if (node != -1 && topology.node[i] != node) continue;
+    candidates[n++] = i;
+  }
+  qsort(candidates, n, sizeof(int), compare_rank);
+  memcpy(chosen, candidates, count * sizeof(int));
+}
+
+static void format_mems(const int *chosen, int count, char *buf, size_t size) {
+  bool nodes[PLACEMENT_CPUS_MAX] = {false};
+  for (int i = 0; i < count; i++) nodes[topology.node[chosen[i]]] = true;
+  format_cpulist(nodes, buf, size);
+}
+
+// the start time of pid in clock ticks since boot, 0 once it is gone
+static uint64_t start_time(pid_t pid) {
+  char path[64], buf[1024];
+  snprintf(path, sizeof(path), "/proc/%ld/stat", (long)pid);
+  if (read_line(path, buf, sizeof(buf)) == -1) return 0;
+  // the command name may hold spaces, the fields after it do not
+  char *cur = strrchr(buf, ')');
+  if (cur == NULL) return 0;
+  // starttime is the 22nd field, the 20th after the command name
+  for (int field = 0; field < 20 && cur; field++) cur = strchr(cur + 1, ' ');
+  return cur ? strtoull(cur + 1, NULL, 10) : 0;
+}
+
+static void unload(const uint8_t *cpus) {
+  for (int cpu = 0; cpu < PLACEMENT_CPUS_MAX; cpu++) {
+    if (!(cpus[cpu / 8] & 1 << cpu % 8)) continue;
+    uint32_t load = __atomic_load_n(&loads[cpu], __ATOMIC_ACQUIRE);
+    while (load && !__atomic_compare_exchange_n(&loads[cpu], &load, load - 1,
+                                                false, __ATOMIC_ACQ_REL,
+                                                __ATOMIC_ACQUIRE))
+      continue;
+  }
+}
+
+// uncount the cpus of a held reservation, false if another process already
+// dropped it
+static bool drop_reservation(struct reservation *reservation) {
+  uint32_t expected = RESERVATION_HELD;
+  if (!__atomic_compare_exchange_n(&reservation->state, &expected,
+                                   RESERVATION_DROPPING, false,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    return false;
+  unload(reservation->cpus);
+  __atomic_store_n(&reservation->state, RESERVATION_FREE, __ATOMIC_RELEASE);
+  return true;
+}
+
+// whether the container of a reservation can still be running. its
+// launcher creates the cgroup before reserving and removes it on cleanup,
+// so a missing cgroup, or an empty one nobody will clean up, is a leak
+static bool reservation_live(const struct reservation *reservation) {
+  char path[PLACEMENT_CGROUP_LEN_MAX + 16], buf[16];
+  if (access(reservation->cgroup, F_OK) == -1) return errno != ENOENT;
+  if (start_time(reservation->owner) == reservation->owner_start) return true;
+  snprintf(path, sizeof(path), "%s/cgroup.procs", reservation->cgroup);
+  return read_line(path, buf, sizeof(buf)) == 0;
+}
+
+// drop the reservations of launchers killed or exited before releasing
+static void reconcile() {
+  for (int i = 0; i < PLACEMENT_RESERVATIONS_MAX; i++) {
+    struct reservation *reservation = &reservations[i];
+    if (__atomic_load_n(&reservation->state, __ATOMIC_ACQUIRE) !=
+            RESERVATION_HELD ||
+        reservation_live(reservation))
+      continue;
+    if (drop_reservation(reservation))
+      debug("Dropped the stale cpu reservation of %s\n", reservation->cgroup);
+  }
+}
+
+// a free reservation for cgroup, NULL if every one is taken. its cpus are
+// filled in once they are counted
+static struct reservation *reserve(const char *cgroup) {
+  static uint64_t self_start;
+  if (self_start == 0) self_start = start_time(getpid());
+  for (int i = 0; i < PLACEMENT_RESERVATIONS_MAX; i++) {
+    struct reservation *reservation = &reservations[i];
+    uint32_t expected = RESERVATION_FREE;
+    if (!__atomic_compare_exchange_n(&reservation->state, &expected,
+                                     RESERVATION_WRITING, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      continue;
+    reservation->owner = getpid();
+    reservation->owner_start = self_start;
+    snprintf(reservation->cgroup, sizeof(reservation->cgroup), "%s", cgroup);
+    memset(reservation->cpus, 0, sizeof(reservation->cpus));
+    return reservation;
+  }
+  errno = ENOSPC;
+  return NULL;
+}
+
+int place_cpus(double cpus, bool pin, const char *cgroup_base_path,
+               const char *id, arena_t *arena, pairs_t *limits,
+               char **cpuset) {
+  *cpuset = NULL;
+  int count = cpus;
+  if (count < cpus) {
+    count++;
+    char quota[64];
+    snprintf(quota, sizeof(quota), "%.0f %d", cpus * PLACEMENT_PERIOD_US,
+             PLACEMENT_PERIOD_US);
+    append_pair(arena, limits, "cpu.max", quota);
+  }
+  if (!pin) return 0;
+
+  load_topology();
+  bool allowed[PLACEMENT_CPUS_MAX];
+  allowed_cpus(cgroup_base_path, allowed);
+  int usable = 0;
+  for (int i = 0; i < topology.count; i++) usable += allowed[topology.cpu[i]];
+  if (count > usable) {
+    errno = ERANGE;
+    return -1;
+  }
+  char cgroup[PLACEMENT_CGROUP_LEN_MAX];
+  if (snprintf(cgroup, sizeof(cgroup), "%s/%s", cgroup_base_path, id) >=
+      (int)sizeof(cgroup)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  placement_open();
+  reconcile();
+  struct reservation *reservation = reserve(cgroup);
+  if (reservation == NULL) return -1;
+
+  uint32_t snapshot[PLACEMENT_CPUS_MAX];
+  int chosen[PLACEMENT_CPUS_MAX];
+  for (int attempt = 0; attempt < PLACEMENT_RETRIES; attempt++) {
+    for (int i = 0; i < topology.count; i++)
+      snapshot[i] = __atomic_load_n(&loads[topology.cpu[i]], __ATOMIC_ACQUIRE);
+    choose(snapshot, allowed, count, chosen);
+    int claimed = 0;
+    for (; claimed < count; claimed++) {
+      int i = chosen[claimed];
+      uint32_t expected = snapshot[i];
+      if (!__atomic_compare_exchange_n(&loads[topology.cpu[i]], &expected,
+                                       expected + 1, false, __ATOMIC_ACQ_REL,
+                                       __ATOMIC_ACQUIRE))
+        break;
+    }
+    if (claimed == count) {
+      bool set[PLACEMENT_CPUS_MAX] = {false};
+      for (int i = 0; i < count; i++) {
+        int cpu = topology.cpu[chosen[i]];
+        set[cpu] = true;
+        reservation->cpus[cpu / 8] |= 1 << cpu % 8;
+      }
+      __atomic_store_n(&reservation->state, RESERVATION_HELD,
+                       __ATOMIC_RELEASE);
+      char cpulist[PLACEMENT_CPULIST_LEN_MAX], mems[PLACEMENT_CPULIST_LEN_MAX];
+      format_cpulist(set, cpulist, sizeof(cpulist));
+      format_mems(chosen, count, mems, sizeof(mems));
+      append_pair(arena, limits, "cpuset.cpus", cpulist);
+      append_pair(arena, limits, "cpuset.mems", mems);
+      *cpuset = strdup(cpulist);
+      debug("Placed on cpus %s, mems %s\n", cpulist, mems);
+      return 0;
+    }
+    // another launcher took one of them first, choose again from its view
+    for (int i = 0; i < claimed; i++)
+      __atomic_fetch_sub(&loads[topology.cpu[chosen[i]]], 1, __ATOMIC_ACQ_REL);
+  }
+  __atomic_store_n(&reservation->state, RESERVATION_FREE, __ATOMIC_RELEASE);
+  errno = EAGAIN;
+  return -1;
+}
+
+void release_cpus(const char *cgroup_base_path, const char *id) {
+  char cgroup[PLACEMENT_CGROUP_LEN_MAX];
+  snprintf(cgroup, sizeof(cgroup), "%s/%s", cgroup_base_path, id);
+  placement_open();
+  // the same cgroup may belong to a later container of another launcher
+  // once this one's stale reservation is dropped
+  pid_t self = getpid();
+  for (int i = 0; i < PLACEMENT_RESERVATIONS_MAX; i++) {
+    struct reservation *reservation = &reservations[i];
+    if (__atomic_load_n(&reservation->state, __ATOMIC_ACQUIRE) !=
+            RESERVATION_HELD ||
+        reservation->owner != self || strcmp(reservation->cgroup, cgroup))
+      continue;
+    if (drop_reservation(reservation))
+      debug("Released the cpus of %s\n", cgroup);
+    return;
+  }
+}
+
+int cpus_main(int argc, char *argv[]) {
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--placement-file") == 0 && i + 1 < argc) {
+      placement_configure(argv[++i]);
+    } else {
+      fprintf(stderr, "Usage: %s [--placement-file PATH]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  load_topology();
+  bool exists = access(placement_path, F_OK) == 0;
+  if (exists) {
+    placement_open();
+    reconcile();
+  }
+  printf("%-5s %-5s %-5s %-5s %s\n", "CPU", "NODE", "LLC", "CORE",
+         "CONTAINERS");
+  for (int i = 0; i < topology.count; i++) {
+    int cpu = topology.cpu[i];
+    printf("%-5d %-5d %-5d %-5d %u\n", cpu, topology.node[i], topology.llc[i],
+           topology.core[i],
+           exists ? __atomic_load_n(&loads[cpu], __ATOMIC_RELAXED) : 0);
+  }
+  return EXIT_SUCCESS;
+}
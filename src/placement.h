@@ -0,0 +1,32 @@
+#ifndef _PLACEMENT_H_
+#define _PLACEMENT_H_
+#include <stdbool.h>
+
+#include "type.h"
+
+#define PLACEMENT_PATH_DEFAULT "/var/lib/mini-container/cpus"
+// cpu numbers the placement knows about, higher ones are never picked
+#define PLACEMENT_CPUS_MAX 1024
+#define PLACEMENT_CPULIST_LEN_MAX 4096
+// cpu.max period for fractional cpu counts
+#define PLACEMENT_PERIOD_US 100000
+
+// the load file shared by every launcher, only opened once cpus are placed
+void placement_configure(const char *path);
+
+// reserve ceil(cpus) cpus for the container id, as cache-local as the load
+// on the host allows, and append their cpuset.cpus and cpuset.mems to
+// limits. a fractional count also gets a cpu.max quota. with pin false the
+// cpuset is left to the caller and only the quota is added. *cpuset is the
+// reserved list, NULL if nothing was reserved. the reservation is tied to
+// the container's cgroup, which must exist, and is dropped by the next
+// placement once the cgroup is removed or left empty by a dead launcher
+int place_cpus(double cpus, bool pin, const char *cgroup_base_path,
+               const char *id, arena_t *arena, pairs_t *limits,
+               char **cpuset);
+void release_cpus(const char *cgroup_base_path, const char *id);
+
+// print the host topology and the containers on each cpu
+int cpus_main(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,201 @@
+#define _GNU_SOURCE
+#include "pool.h"
+
+#include <err.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "container.h"
+#include "log.h"
+
+int pool_init(pool_t *pool, const struct container_config *template,
+              size_t size) {
+  // only settings that shape the sandbox itself are kept, everything else is
+  // applied per launch
+  pool->template = *template;
+  pool->template.parked = true;
+  pool->template.hostname = NULL;
+  pool->template.cgroup_limit = (pairs_t){0};
+  pool->template.ip = NULL;
+  pool->template.gateway = NULL;
+  pool->template.env = (pairs_t){0};
+  pool->template.args = NULL;
+  container_build_env(&pool->template);
+  pool->size = size;
+  pool->count = 0;
+  pool->ready = malloc(size * sizeof(container_t));
+  pool->hits = 0;
+  pool->misses = 0;
+  pool->failed = false;
+  return 0;
+}
+
+void pool_refill(pool_t *pool, int fd) {
+  struct pollfd pfd = {.fd = fd, .events = POLLIN};
+  // containers finish their setup in the background, readiness is only
+  // checked when one is taken
+  while (!pool->failed && pool->count < pool->size && poll(&pfd, 1, 0) == 0) {
+    container_t *container = &pool->ready[pool->count++];
+    if (container_spawn(&pool->template, container) == -1) {
+      error("Cannot spawn a pooled container, stop refilling\n");
+      pool->count--;
+      pool->failed = true;
+      break;
+    }
+    debug("Pooled container %s spawned\n", container->config.id);
+  }
+}
+
+static bool pool_match(const pool_t *pool,
+                       const struct container_config *spec) {
+  return strcmp(pool->template.image, spec->image) == 0 &&
+         pool->template.uid == spec->uid && pool->template.gid == spec->gid &&
+         pool->template.mounts.items == spec->mounts.items &&
+         pool->template.mounts.count == spec->mounts.count;
+}
+
+container_t *pool_launch(pool_t *pool, const struct container_config *spec) {
+  container_t *container = malloc(sizeof(container_t));
+  bool match = pool_match(pool, spec);
+  while (match && pool->count > 0) {
+    // oldest first, it has had the most time to get ready
+    *container = pool->ready[0];
+    memmove(pool->ready, pool->ready + 1, --pool->count * sizeof(container_t));
+    if (container_ready(container) == -1) {
+      error("Pooled container %s failed to start, stop refilling\n",
+            container->config.id);
+      pool->failed = true;
+    } else if (container_launch(container, spec) == 0) {
+      pool->hits++;
+      return container;
+    } else if (errno == EPIPE || errno == ECONNRESET) {
+      // the parked container died while waiting, take the next one
+      warn("Pooled container %s is gone\n", container->config.id);
+    } else {
+      // the next one could not meet the request either
+      container_destroy(container);
+      free(container);
+      return NULL;
+    }
+    container_destroy(container);
+  }
+
+  pool->misses++;
+  struct container_config config = *spec;
+  config.parked = false;
+  if (container_spawn(&config, container) == -1) {
+    free(container);
+    return NULL;
+  }
+  return container;
+}
+
+void pool_destroy(pool_t *pool) {
+  for (size_t i = 0; i < pool->count; i++) container_destroy(&pool->ready[i]);
+  pool->count = 0;
+  free(pool->ready);
+}
+
+// stdin is read without stdio so buffered commands are visible before the
+// pool decides to spend time refilling
+struct line_reader {
+  int fd;
+  char *buf;
+  size_t cap;
+  size_t start;
+  size_t end;
+};
+
+static bool line_buffered(const struct line_reader *reader) {
+  return memchr(reader->buf + reader->start, '\n',
+                reader->end - reader->start) != NULL;
+}
+
+// next line without its newline, NULL at the end of input, the line stays
+// valid until the next call
+static char *read_line(struct line_reader *reader) {
+  for (;;) {
+    char *start = reader->buf + reader->start;
+    char *newline = memchr(start, '\n', reader->end - reader->start);
+    if (newline) {
+      *newline = '\0';
+      reader->start = newline + 1 - reader->buf;
+      return start;
+    }
+    memmove(reader->buf, start, reader->end - reader->start);
+    reader->end -= reader->start;
+    reader->start = 0;
+    if (reader->end + 1 >= reader->cap)
+      reader->buf = realloc(reader->buf, reader->cap *= 2);
+    ssize_t n = read(reader->fd, reader->buf + reader->end,
+                     reader->cap - reader->end - 1);
+    if (n == -1 && errno == EINTR) continue;
+    if (n == -1) err(EXIT_FAILURE, "read-commands");
+    if (n == 0) {
+      if (reader->end == 0) return NULL;
+      reader->buf[reader->end] = '\0';
+      reader->start = reader->end;
+      return reader->buf;
+    }
+    reader->end += n;
+  }
+}
+
+// split a command line on whitespace, the result points into line
+static char **split_args(char *line) {
+  size_t cap = 8, argc = 0;
+  char **args = malloc(cap * sizeof(char *));
+  for (char *arg = strtok(line, " \t\n"); arg; arg = strtok(NULL, " \t\n")) {
+    if (argc + 1 >= cap) args = realloc(args, (cap *= 2) * sizeof(char *));
+    args[argc++] = arg;
+  }
+  args[argc] = NULL;
+  return args;
+}
+
+int run_pool(struct container_config *config) {
+  debug("Starting pool of %d containers for %s\n", config->pool_size,
+        config->image);
+  pool_t pool;
+  pool_init(&pool, config, config->pool_size);
+
+  size_t count = 0, cap = 16;
+  int failed = 0;
+  container_t **running = malloc(cap * sizeof(container_t *));
+  struct line_reader reader = {.fd = STDIN_FILENO, .cap = 4096};
+  reader.buf = malloc(reader.cap);
+  char *line;
+  // one command per line, each launched without waiting for the previous
+  for (;;) {
+    if (!line_buffered(&reader)) pool_refill(&pool, reader.fd);
+    if ((line = read_line(&reader)) == NULL) break;
+    char **args = split_args(line);
+    if (args[0]) {
+      struct container_config spec = *config;
+      spec.args = args;
+      if (count == cap)
+        running = realloc(running, (cap *= 2) * sizeof(container_t *));
+      // a command that cannot be launched fails alone, the running ones
+      // are still waited for
+      if ((running[count] = pool_launch(&pool, &spec)) == NULL)
+        failed++;
+      else
+        count++;
+    }
+    free(args);
+  }
+  free(reader.buf);
+
+  info("Pool hits: %lu, misses: %lu\n", pool.hits, pool.misses);
+  pool_destroy(&pool);
+  for (size_t i = 0; i < count; i++) {
+    if (container_wait(running[i])) failed++;
+    free(running[i]);
+  }
+  free(running);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
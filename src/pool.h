@@ -0,0 +1,36 @@
+#ifndef _POOL_H_
+#define _POOL_H_
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "container.h"
+
+// a set of parked containers for one image, refilled from the caller's thread
+// whenever it is idle: containers are spawned with a raw clone3, which is only
+// safe while no other thread can hold libc locks
+struct pool {
+  struct container_config template;
+  size_t size;
+  size_t count;
+  container_t *ready;
+  unsigned long hits;
+  unsigned long misses;
+  // a pooled container failed to start, stop refilling
+  bool failed;
+};
+
+typedef struct pool pool_t;
+
+int pool_init(pool_t *pool, const struct container_config *template,
+              size_t size);
+// spawn parked containers until the pool is full or input is pending on fd
+void pool_refill(pool_t *pool, int fd);
+// launch spec in a parked container if one is ready, otherwise spawn one on
+// the spot, the returned container must be reaped with container_wait().
+// NULL if it cannot be launched
+container_t *pool_launch(pool_t *pool, const struct container_config *spec);
+void pool_destroy(pool_t *pool);
+
+int run_pool(struct container_config *config);
+
+#endif
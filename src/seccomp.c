@@ -0,0 +1,599 @@
+#define _GNU_SOURCE
+#include "seccomp.h"
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <linux/audit.h>
+#include <linux/limits.h>
+#include <linux/seccomp.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+#include "json.h"
+#include "log.h"
+#include "syscall_names.h"
+#include "type.h"
+
+#if defined(__x86_64__)
+#define ARCH_NATIVE AUDIT_ARCH_X86_64
+#define ARCH_NAME "SCMP_ARCH_X86_64"
+// entries name architectures the Go way
+#define ARCH_GO_NAMES {"amd64"}
+// x32 syscalls come in on the x86_64 arch with this bit set, some with
+// numbers of their own, so they are refused like other architectures
+#define ARCH_NR_MASK 0x40000000
+#elif defined(__aarch64__)
+#define ARCH_NATIVE AUDIT_ARCH_AARCH64
+#define ARCH_NAME "SCMP_ARCH_AARCH64"
+#define ARCH_GO_NAMES {"arm64"}
+#else
+#error "seccomp filters are only compiled for x86_64 and aarch64"
+#endif
+
+// the longest conditional jump, farther targets take a BPF_JA
+#define JUMP_MAX 255
+
+enum arg_op { OP_NE, OP_LT, OP_LE, OP_EQ, OP_GE, OP_GT, OP_MASKED_EQ };
+
+struct arg_check {
+  unsigned int index;
+  enum arg_op op;
+  uint64_t value;
+  uint64_t value_two;
+};
+
+// one profile entry applied to one syscall, its checks must all pass
+struct rule {
+  uint32_t action;
+  struct arg_check *checks;
+  size_t count;
+};
+
+struct syscall_rules {
+  // action of an entry without argument checks, which takes precedence
+  bool unconditional;
+  uint32_t action;
+  struct rule *rules;
+  size_t count;
+  double weight;
+};
+
+// consecutive syscall numbers deciding alike, the leaves of the search tree
+struct interval {
+  unsigned int start;
+  // the syscall number of a single syscall with argument checks, -1 for a
+  // plain action
+  int nr;
+  uint32_t action;
+  double weight;
+};
+
+struct program {
+  struct sock_filter *insns;
+  size_t len;
+  size_t cap;
+};
+
+struct compiler {
+  uint32_t default_action;
+  struct syscall_rules syscalls[SECCOMP_SYSCALL_NR_MAX];
+  // the checks of every entry, shared by the syscalls it names
+  list_t *checks;
+  struct interval *intervals;
+  size_t count;
+};
+
+static void push(struct program *prog, struct sock_filter insn) {
+  if (prog->len == prog->cap) {
+    prog->cap = prog->cap ? prog->cap * 2 : 64;
+    prog->insns = realloc(prog->insns, prog->cap * sizeof(*prog->insns));
+  }
+  prog->insns[prog->len++] = insn;
+}
+
+static void append_program(struct program *prog, struct program *tail) {
+  for (size_t i = 0; i < tail->len; i++) push(prog, tail->insns[i]);
+  free(tail->insns);
+}
+
+static char *read_file(const char *path, size_t *len) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) err(EXIT_FAILURE, "open %s", path);
+  size_t cap = 4096;
+  char *text = malloc(cap);
+  *len = 0;
+  ssize_t n;
+  while ((n = read(fd, text + *len, cap - *len - 1)) != 0) {
+    if (n == -1 && errno == EINTR) continue;
+    if (n == -1) err(EXIT_FAILURE, "read %s", path);
+    *len += n;
+    if (*len == cap - 1) {
+      if (cap >= SECCOMP_PROFILE_SIZE_MAX)
+        errx(EXIT_FAILURE, "%s too large", path);
+      text = realloc(text, cap *= 2);
+    }
+  }
+  close(fd);
+  text[*len] = '\0';
+  return text;
+}
+
+static int syscall_nr(const char *name) {
+  for (size_t i = 0; i < sizeof(syscall_names) / sizeof(*syscall_names); i++)
+    if (strcmp(syscall_names[i].name, name) == 0) return syscall_names[i].nr;
+  return -1;
+}
+
+static int parse_action(const char *name, const json_t *errno_ret,
+                        uint32_t errno_default, uint32_t *action) {
+  uint32_t data = errno_default;
+  if (errno_ret && errno_ret->type == JSON_NUMBER) data = errno_ret->number;
+  if (name == NULL) return -1;
+  if (strcmp(name, "SCMP_ACT_ALLOW") == 0)
+    *action = SECCOMP_RET_ALLOW;
+  else if (strcmp(name, "SCMP_ACT_ERRNO") == 0)
+    *action = SECCOMP_RET_ERRNO | (data & SECCOMP_RET_DATA);
+  else if (strcmp(name, "SCMP_ACT_KILL") == 0 ||
+           strcmp(name, "SCMP_ACT_KILL_THREAD") == 0)
+    *action = SECCOMP_RET_KILL_THREAD;
+  else if (strcmp(name, "SCMP_ACT_KILL_PROCESS") == 0)
+    *action = SECCOMP_RET_KILL_PROCESS;
+  else if (strcmp(name, "SCMP_ACT_TRAP") == 0)
+    *action = SECCOMP_RET_TRAP;
+  else if (strcmp(name, "SCMP_ACT_TRACE") == 0)
+    *action = SECCOMP_RET_TRACE | (data & SECCOMP_RET_DATA);
+  else if (strcmp(name, "SCMP_ACT_LOG") == 0)
+    *action = SECCOMP_RET_LOG;
+  else
+    return -1;
+  return 0;
+}
+
+static int parse_op(const char *name, enum arg_op *op) {
+  static const char *ops[] = {"SCMP_CMP_NE", "SCMP_CMP_LT", "SCMP_CMP_LE",
+                              "SCMP_CMP_EQ", "SCMP_CMP_GE", "SCMP_CMP_GT",
+                              "SCMP_CMP_MASKED_EQ"};
+  for (size_t i = 0; name && i < sizeof(ops) / sizeof(*ops); i++) {
+    if (strcmp(ops[i], name) == 0) {
+      *op = i;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+static bool json_contains(const json_t *array, const char *value) {
+  for (const json_t *item = array ? array->child : NULL; item;
+       item = item->next)
+    if (json_string(item) && strcmp(json_string(item), value) == 0)
+      return true;
+  return false;
+}
+
+// "a.b" against the running kernel's release
+static bool kernel_at_least(const char *version) {
+  struct utsname uts;
+  unsigned int major, minor, want_major, want_minor = 0;
+  if (uname(&uts) == -1 || sscanf(uts.release, "%u.%u", &major, &minor) != 2 ||
+      sscanf(version, "%u.%u", &want_major, &want_minor) < 1)
+    return true;
+  return major > want_major || (major == want_major && minor >= want_minor);
+}
+
+static bool arch_listed(const json_t *arches) {
+  static const char *const names[] = ARCH_GO_NAMES;
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    if (json_contains(arches, names[i])) return true;
+  return false;
+}
+
+// entries limited to other architectures, older kernels or added capabilities
+// do not apply. containers keep their default capabilities, so entries
+// excluded for some capability apply and entries requiring one do not
+static bool entry_applies(const json_t *entry) {
+  const json_t *includes = json_get(entry, "includes");
+  const json_t *excludes = json_get(entry, "excludes");
+  const json_t *arches = json_get(includes, "arches");
+  if (json_length(arches) && !arch_listed(arches)) return false;
+  if (json_length(json_get(includes, "caps"))) return false;
+  const char *kernel = json_string(json_get(includes, "minKernel"));
+  if (kernel && !kernel_at_least(kernel)) return false;
+  if (arch_listed(json_get(excludes, "arches"))) return false;
+  return true;
+}
+
+static int parse_entry(struct compiler *compiler, const json_t *entry,
+                       uint32_t errno_default) {
+  uint32_t action;
+  if (parse_action(json_string(json_get(entry, "action")),
+                   json_get(entry, "errnoRet"), errno_default, &action))
+    return -1;
+  const json_t *args = json_get(entry, "args");
+  size_t count = json_length(args);
+  struct arg_check *checks = calloc(count + 1, sizeof(struct arg_check));
+  for (size_t i = 0; i < count; i++) {
+    const json_t *arg = json_index(args, i);
+    const json_t *index = json_get(arg, "index");
+    if (index == NULL || index->type != JSON_NUMBER || index->number < 0 ||
+        index->number > 5 ||
+        parse_op(json_string(json_get(arg, "op")), &checks[i].op)) {
+      free(checks);
+      return -1;
+    }
+    checks[i].index = index->number;
+    const json_t *value = json_get(arg, "value");
+    const json_t *value_two = json_get(arg, "valueTwo");
+    if (value && value->type == JSON_NUMBER) checks[i].value = value->number;
+    if (value_two && value_two->type == JSON_NUMBER)
+      checks[i].value_two = value_two->number;
+  }
+
+  append(&compiler->checks, checks);
+
+  const json_t *names = json_get(entry, "names");
+  // older profiles name a single syscall
+  const json_t *name = json_get(entry, "name");
+  size_t n = name ? 1 : json_length(names);
+  for (size_t i = 0; i < n; i++) {
+    const char *syscall = json_string(name ? name : json_index(names, i));
+    if (syscall == NULL) continue;
+    int nr = syscall_nr(syscall);
+    if (nr < 0 || nr >= SECCOMP_SYSCALL_NR_MAX) {
+      debug("Syscall %s unknown on this architecture\n", syscall);
+      continue;
+    }
+    struct syscall_rules *rules = &compiler->syscalls[nr];
+    if (count == 0) {
+      if (!rules->unconditional) rules->action = action;
+      rules->unconditional = true;
+      continue;
+    }
+    rules->rules =
+        realloc(rules->rules, (rules->count + 1) * sizeof(struct rule));
+    rules->rules[rules->count++] =
+        (struct rule){.action = action, .checks = checks, .count = count};
+  }
+  return 0;
+}
+
+static void read_hints(struct compiler *compiler, const char *path) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) err(EXIT_FAILURE, "open %s", path);
+  char line[256], name[64];
+  double count;
+  while (fgets(line, sizeof(line), file)) {
+    if (line[0] == '#' || sscanf(line, "%63s %lf", name, &count) != 2)
+      continue;
+    int nr = syscall_nr(name);
+    if (nr >= 0 && nr < SECCOMP_SYSCALL_NR_MAX && count > 0)
+      compiler->syscalls[nr].weight += count;
+  }
+  fclose(file);
+}
+
+// split the syscall numbers into intervals, every syscall with argument checks
+// is one on its own
+static void build_intervals(struct compiler *compiler) {
+  compiler->intervals =
+      malloc((SECCOMP_SYSCALL_NR_MAX + 1) * sizeof(struct interval));
+  compiler->count = 0;
+  struct interval *last = NULL;
+  for (int nr = 0; nr < SECCOMP_SYSCALL_NR_MAX; nr++) {
+    struct syscall_rules *rules = &compiler->syscalls[nr];
+    bool checked = !rules->unconditional && rules->count;
+    uint32_t action =
+        rules->unconditional ? rules->action : compiler->default_action;
+    if (checked || last == NULL || last->nr != -1 || last->action != action) {
+      last = &compiler->intervals[compiler->count++];
+      *last = (struct interval){
+          .start = nr, .nr = checked ? nr : -1, .action = action};
+    }
+    last->weight += rules->weight;
+  }
+  // everything above the table
+  if (last->nr != -1 || last->action != compiler->default_action)
+    compiler->intervals[compiler->count++] =
+        (struct interval){.start = SECCOMP_SYSCALL_NR_MAX,
+                          .nr = -1,
+                          .action = compiler->default_action};
+}
+
+#define STMT(code, k) ((struct sock_filter)BPF_STMT(code, k))
+#define JUMP(code, k, jt, jf) ((struct sock_filter)BPF_JUMP(code, k, jt, jf))
+#define ARG_LOW(index) \
+  (offsetof(struct seccomp_data, args) + 8 * (index) + 4 * BIG_ENDIAN_WORD)
+#define ARG_HIGH(index) \
+  (offsetof(struct seccomp_data, args) + 8 * (index) + 4 * !BIG_ENDIAN_WORD)
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define BIG_ENDIAN_WORD 1
+#else
+#define BIG_ENDIAN_WORD 0
+#endif
+// jump target placeholder for failing a check, patched to the next rule
+#define FAIL 0xff
+
+// 64-bit argument comparisons from 32-bit loads, the high word decides unless
+// it is equal. jumps to FAIL leave the rule, falling through passes
+static void emit_check(struct program *prog, const struct arg_check *check) {
+  uint32_t high = check->value >> 32, low = check->value;
+  uint32_t datum_high = check->value_two >> 32, datum_low = check->value_two;
+  push(prog, STMT(BPF_LD | BPF_W | BPF_ABS, ARG_HIGH(check->index)));
+  switch (check->op) {
+    case OP_EQ:
+      push(prog, JUMP(BPF_JMP | BPF_JEQ | BPF_K, high, 0, FAIL));
+      push(prog, STMT(BPF_LD | BPF_W | BPF_ABS, ARG_LOW(check->index)));
+      push(prog, JUMP(BPF_JMP | BPF_JEQ | BPF_K, low, 0, FAIL));
+      break;
+    case OP_NE:
+      push(prog, JUMP(BPF_JMP | BPF_JEQ | BPF_K, high, 0, 2));
+      push(prog, STMT(BPF_LD | BPF_W | BPF_ABS, ARG_LOW(check->index)));
+      push(prog, JUMP(BPF_JMP | BPF_JEQ | BPF_K, low, FAIL, 0));
+      break;
+    case OP_MASKED_EQ:
+      // value is the mask, value_two what the masked argument must equal
+      push(prog, STMT(BPF_ALU | BPF_AND | BPF_K, high));
+      push(prog, JUMP(BPF_JMP | BPF_JEQ | BPF_K, datum_high, 0, FAIL));
+      push(prog, STMT(BPF_LD | BPF_W | BPF_ABS, ARG_LOW(check->index)));
+      push(prog, STMT(BPF_ALU | BPF_AND | BPF_K, low));
+      push(prog, JUMP(BPF_JMP | BPF_JEQ | BPF_K, datum_low, 0, FAIL));
+      break;
+    case OP_GE:
+    case OP_GT:
+      push(prog, JUMP(BPF_JMP | BPF_JGT | BPF_K, high, 3, 0));
+      push(prog, JUMP(BPF_JMP | BPF_JEQ | BPF_K, high, 0, FAIL));
+      push(prog, STMT(BPF_LD | BPF_W | BPF_ABS, ARG_LOW(check->index)));
+      push(prog, JUMP(BPF_JMP | BPF_K | (check->op == OP_GE ? BPF_JGE
+                                                             : BPF_JGT),
+                      low, 0, FAIL));
+      break;
+    case OP_LT:
+    case OP_LE:
+      push(prog, JUMP(BPF_JMP | BPF_JGT | BPF_K, high, FAIL, 0));
+      push(prog, JUMP(BPF_JMP | BPF_JEQ | BPF_K, high, 0, 2));
+      push(prog, STMT(BPF_LD | BPF_W | BPF_ABS, ARG_LOW(check->index)));
+      push(prog, JUMP(BPF_JMP | BPF_K | (check->op == OP_LT ? BPF_JGE
+                                                             : BPF_JGT),
+                      low, FAIL, 0));
+      break;
+  }
+}
+
+// the rules of one syscall in profile order, the first whose checks all pass
+// decides, the default action if none does
+static void emit_rules(struct compiler *compiler,
+                       const struct syscall_rules *rules,
+                       struct program *prog) {
+  for (size_t i = 0; i < rules->count; i++) {
+    const struct rule *rule = &rules->rules[i];
+    struct program block = {0};
+    for (size_t j = 0; j < rule->count; j++)
+      emit_check(&block, &rule->checks[j]);
+    push(&block, STMT(BPF_RET | BPF_K, rule->action));
+    if (block.len > JUMP_MAX)
+      errx(EXIT_FAILURE, "too many argument checks for one seccomp rule");
+    // a failed check resumes after the return, with the next rule
+    for (size_t j = 0; j < block.len; j++) {
+      struct sock_filter *insn = &block.insns[j];
+      if (BPF_CLASS(insn->code) != BPF_JMP) continue;
+      if (insn->jt == FAIL) insn->jt = block.len - j - 1;
+      if (insn->jf == FAIL) insn->jf = block.len - j - 1;
+    }
+    append_program(prog, &block);
+  }
+  push(prog, STMT(BPF_RET | BPF_K, compiler->default_action));
+}
+
+// split point of intervals [lo, hi) balancing the weight on both sides, each
+// interval weighs at least 1 so the tree stays balanced without hints
+static size_t split(struct compiler *compiler, size_t lo, size_t hi) {
+  double total = 0, left = 0, best = -1;
+  for (size_t i = lo; i < hi; i++) total += compiler->intervals[i].weight + 1;
+  size_t mid = lo + 1;
+  for (size_t i = lo + 1; i < hi; i++) {
+    left += compiler->intervals[i - 1].weight + 1;
+    double diff = left * 2 > total ? left * 2 - total : total - left * 2;
+    if (best < 0 || diff < best) {
+      best = diff;
+      mid = i;
+    }
+  }
+  return mid;
+}
+
+// binary search on the syscall number in A, the left half follows each
+// comparison so only jumps to the right half may need a BPF_JA
+static void emit_tree(struct compiler *compiler, size_t lo, size_t hi,
+                      struct program *prog) {
+  if (hi - lo == 1) {
+    const struct interval *interval = &compiler->intervals[lo];
+    if (interval->nr == -1)
+      push(prog, STMT(BPF_RET | BPF_K, interval->action));
+    else
+      emit_rules(compiler, &compiler->syscalls[interval->nr], prog);
+    return;
+  }
+  size_t mid = split(compiler, lo, hi);
+  struct program left = {0}, right = {0};
+  emit_tree(compiler, lo, mid, &left);
+  emit_tree(compiler, mid, hi, &right);
+  uint32_t start = compiler->intervals[mid].start;
+  if (left.len <= JUMP_MAX) {
+    push(prog, JUMP(BPF_JMP | BPF_JGE | BPF_K, start, left.len, 0));
+  } else {
+    push(prog, JUMP(BPF_JMP | BPF_JGE | BPF_K, start, 0, 1));
+    push(prog, STMT(BPF_JMP | BPF_JA, left.len));
+  }
+  append_program(prog, &left);
+  append_program(prog, &right);
+}
+
+static void compile(struct compiler *compiler, struct program *prog) {
+  // other architectures number their syscalls differently
+  push(prog,
+       STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, arch)));
+  push(prog, JUMP(BPF_JMP | BPF_JEQ | BPF_K, ARCH_NATIVE, 1, 0));
+  push(prog, STMT(BPF_RET | BPF_K, SECCOMP_RET_KILL_PROCESS));
+  push(prog, STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr)));
+#ifdef ARCH_NR_MASK
+  push(prog, JUMP(BPF_JMP | BPF_JSET | BPF_K, ARCH_NR_MASK, 0, 1));
+  push(prog, STMT(BPF_RET | BPF_K, SECCOMP_RET_KILL_PROCESS));
+#endif
+  build_intervals(compiler);
+  emit_tree(compiler, 0, compiler->count, prog);
+}
+
+static struct compiler *parse_profile(const char *profile, const char *hints) {
+  size_t len;
+  char *text = read_file(profile, &len);
+  json_t *json = json_parse(text, len);
+  free(text);
+  if (json == NULL || json->type != JSON_OBJECT)
+    errx(EXIT_FAILURE, "seccomp profile %s is not a JSON object", profile);
+  struct compiler *compiler = calloc(1, sizeof(struct compiler));
+  const json_t *errno_ret = json_get(json, "defaultErrnoRet");
+  uint32_t errno_default = EPERM;
+  if (errno_ret && errno_ret->type == JSON_NUMBER)
+    errno_default = errno_ret->number;
+  if (parse_action(json_string(json_get(json, "defaultAction")), NULL,
+                   errno_default, &compiler->default_action))
+    errx(EXIT_FAILURE, "invalid defaultAction in %s", profile);
+  const json_t *arches = json_get(json, "architectures");
+  if (json_length(arches) && !json_contains(arches, ARCH_NAME))
+    warn("Seccomp profile %s does not cover " ARCH_NAME "\n", profile);
+  const json_t *syscalls = json_get(json, "syscalls");
+  for (size_t i = 0; i < json_length(syscalls); i++) {
+    const json_t *entry = json_index(syscalls, i);
+    if (!entry_applies(entry)) continue;
+    if (parse_entry(compiler, entry, errno_default))
+      errx(EXIT_FAILURE, "invalid syscall entry %zu in %s", i, profile);
+  }
+  json_free(json);
+  if (hints) read_hints(compiler, hints);
+  return compiler;
+}
+
+static void free_compiler(struct compiler *compiler) {
+  for (int nr = 0; nr < SECCOMP_SYSCALL_NR_MAX; nr++)
+    free(compiler->syscalls[nr].rules);
+  while (compiler->checks) {
+    list_t *node = compiler->checks;
+    compiler->checks = node->next;
+    free(node->data);
+    free(node);
+  }
+  free(compiler->intervals);
+  free(compiler);
+}
+
+struct sock_fprog *seccomp_compile(const char *profile, const char *hints) {
+  struct compiler *compiler = parse_profile(profile, hints);
+  struct program prog = {0};
+  compile(compiler, &prog);
+  free_compiler(compiler);
+  if (prog.len > BPF_MAXINSNS)
+    errx(EXIT_FAILURE, "seccomp profile %s needs %zu instructions, over %d",
+         profile, prog.len, BPF_MAXINSNS);
+  struct sock_fprog *fprog = malloc(sizeof(struct sock_fprog));
+  fprog->len = prog.len;
+  fprog->filter = prog.insns;
+  debug("Compiled seccomp profile %s into %zu instructions\n", profile,
+        prog.len);
+  return fprog;
+}
+
+int seccomp_install(const struct sock_fprog *prog) {
+  if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == -1) return -1;
+  return syscall(SYS_seccomp, SECCOMP_SET_MODE_FILTER, 0, prog);
+}
+
+// run the filter on a syscall with all arguments 0, returns the number of
+// instructions executed
+static size_t path_length(const struct sock_fprog *prog, int nr) {
+  struct seccomp_data data = {.nr = nr, .arch = ARCH_NATIVE};
+  uint32_t a = 0;
+  size_t steps = 0;
+  for (size_t pc = 0; pc < prog->len; pc++) {
+    const struct sock_filter *insn = &prog->filter[pc];
+    steps++;
+    switch (insn->code) {
+      case BPF_LD | BPF_W | BPF_ABS:
+        memcpy(&a, (char *)&data + insn->k, sizeof(a));
+        break;
+      case BPF_ALU | BPF_AND | BPF_K:
+        a &= insn->k;
+        break;
+      case BPF_JMP | BPF_JA:
+        pc += insn->k;
+        break;
+      case BPF_JMP | BPF_JEQ | BPF_K:
+        pc += a == insn->k ? insn->jt : insn->jf;
+        break;
+      case BPF_JMP | BPF_JGT | BPF_K:
+        pc += a > insn->k ? insn->jt : insn->jf;
+        break;
+      case BPF_JMP | BPF_JGE | BPF_K:
+        pc += a >= insn->k ? insn->jt : insn->jf;
+        break;
+      case BPF_JMP | BPF_JSET | BPF_K:
+        pc += a & insn->k ? insn->jt : insn->jf;
+        break;
+      case BPF_RET | BPF_K:
+        return steps;
+    }
+  }
+  return steps;
+}
+
+static void print_stats(const char *profile, const char *hints) {
+  struct sock_fprog *prog = seccomp_compile(profile, hints);
+  struct compiler *weights = parse_profile(profile, hints);
+  size_t count = 0, max = 0, total = 0;
+  double weight = 0, weighted = 0;
+  for (size_t i = 0; i < sizeof(syscall_names) / sizeof(*syscall_names); i++) {
+    int nr = syscall_names[i].nr;
+    if (nr >= SECCOMP_SYSCALL_NR_MAX) continue;
+    size_t steps = path_length(prog, nr);
+    count++;
+    total += steps;
+    if (steps > max) max = steps;
+    weight += weights->syscalls[nr].weight;
+    weighted += weights->syscalls[nr].weight * steps;
+  }
+  char name[PATH_MAX * 2];
+  json_escape(name, sizeof(name), profile);
+  printf("{\"profile\":%s,\"instructions\":%u,\"path_avg\":%.2f,"
+         "\"path_max\":%zu",
+         name, prog->len, count ? (double)total / count : 0, max);
+  if (weight > 0) printf(",\"path_hinted_avg\":%.2f", weighted / weight);
+  printf("}\n");
+  free_compiler(weights);
+  free(prog->filter);
+  free(prog);
+}
+
+int seccomp_main(int argc, char *argv[]) {
+  const char *hints = NULL;
+  struct option long_options[] = {{"hints", required_argument, 0, 'h'},
+                                  {0, 0, 0, 0}};
+  int opt;
+  while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+    if (opt != 'h') goto usage;
+    hints = optarg;
+  }
+  if (optind == argc) goto usage;
+  for (int i = optind; i < argc; i++) print_stats(argv[i], hints);
+  return EXIT_SUCCESS;
+usage:
+  fprintf(stderr, "Usage: %s [--hints FILE] PROFILE...\n", argv[0]);
+  return EXIT_FAILURE;
+}
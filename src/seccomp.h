@@ -0,0 +1,20 @@
+#ifndef _SECCOMP_H_
+#define _SECCOMP_H_
+#include <linux/filter.h>
+
+#define SECCOMP_PROFILE_SIZE_MAX (1 << 20)
+// syscall numbers the filter decides on one by one, all above get the
+// profile's default action
+#define SECCOMP_SYSCALL_NR_MAX 1024
+
+// compile a Docker-style JSON profile into a filter that finds the rule of a
+// syscall by binary search on its number. hints is an optional file of
+// "name count" lines, frequent syscalls get shorter paths through the tree
+struct sock_fprog *seccomp_compile(const char *profile, const char *hints);
+// install the filter for the calling process, it stays across exec
+int seccomp_install(const struct sock_fprog *prog);
+
+// print the instruction counts of the filters compiled from profiles
+int seccomp_main(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,386 @@
+#define _GNU_SOURCE
+#include "state.h"
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "json.h"
+#include "log.h"
+#include "utils.h"
+
+#define STATE_MAGIC "mcstate1"
+// a record whose writer died halfway is shown as it is after this many
+// attempts to read it consistently
+#define STATE_READ_RETRIES 1000
+
+enum slot_state { SLOT_EMPTY = 0, SLOT_CLAIMED, SLOT_USED, SLOT_FREED };
+
+// the owning process updates fields between two increments of seq, readers
+// copy the record and retry if seq was odd or moved, so they never hold up a
+// launch
+struct state_record {
+  uint32_t slot;
+  uint32_t seq;
+  char id[CONTAINER_ID_LEN_MAX + 1];
+  int32_t pid;
+  int32_t status;
+  int32_t exit_code;
+  uint64_t started;
+  uint64_t finished;
+  char image[STATE_IMAGE_LEN_MAX];
+  char ip[STATE_IP_LEN_MAX];
+  char cgroup[STATE_CGROUP_LEN_MAX];
+};
+
+// records form an open addressing table homed on the leading bits of the id,
+// which keeps them roughly ordered by id so a prefix maps to a narrow range
+// of slots. an empty slot ends every probe sequence, so freed slots stay
+// tombstones until the slot after them is empty. used marks the slots to
+// visit when listing
+struct state_header {
+  char magic[8];
+  uint64_t records;
+  uint64_t used[STATE_RECORDS_MAX / 64];
+};
+
+static const char *state_path = STATE_PATH_DEFAULT;
+static struct state_header *header;
+static struct state_record *records;
+static bool unavailable;
+
+void state_configure(const char *path) { state_path = path; }
+
+static int state_open() {
+  if (header) return 0;
+  if (unavailable) return -1;
+  size_t size = sizeof(struct state_header) +
+                STATE_RECORDS_MAX * sizeof(struct state_record);
+  int fd = open(state_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd == -1) {
+    warn("Container state unavailable, open %s: %s\n", state_path,
+         strerror(errno));
+    unavailable = true;
+    return -1;
+  }
+  // only held while the first process to open the file initializes it
+  if (flock(fd, LOCK_EX) == -1) err(EXIT_FAILURE, "flock-state %s", state_path);
+  struct stat st;
+  if (fstat(fd, &st) == -1) err(EXIT_FAILURE, "stat-state %s", state_path);
+  bool fresh = st.st_size == 0;
+  if (fresh && ftruncate(fd, size) == -1)
+    err(EXIT_FAILURE, "ftruncate-state %s", state_path);
+  if (!fresh && (size_t)st.st_size != size)
+    errx(EXIT_FAILURE, "%s is not a container state index", state_path);
+  void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) err(EXIT_FAILURE, "mmap-state %s", state_path);
+  header = map;
+  records = (struct state_record *)(header + 1);
+  if (fresh) {
+    memcpy(header->magic, STATE_MAGIC, sizeof(header->magic));
+    header->records = STATE_RECORDS_MAX;
+  } else if (memcmp(header->magic, STATE_MAGIC, sizeof(header->magic)) ||
+             header->records != STATE_RECORDS_MAX) {
+    errx(EXIT_FAILURE, "%s is not a container state index", state_path);
+  }
+  flock(fd, LOCK_UN);
+  close(fd);
+  return 0;
+}
+
+// the first 16 hex digits of an id, a shorter prefix is padded with 0 for the
+// smallest id it matches or f for the largest, -1 if it is not hex
+static int id_key(const char *id, bool largest, uint64_t *key) {
+  *key = 0;
+  size_t len = strlen(id);
+  for (size_t i = 0; i < 16; i++) {
+    int digit;
+    if (i >= len)
+      digit = largest ? 15 : 0;
+    else if (id[i] >= '0' && id[i] <= '9')
+      digit = id[i] - '0';
+    else if (id[i] >= 'a' && id[i] <= 'f')
+      digit = id[i] - 'a' + 10;
+    else
+      return -1;
+    *key = *key << 4 | digit;
+  }
+  return 0;
+}
+
+static size_t home(uint64_t key) {
+  return (unsigned __int128)key * STATE_RECORDS_MAX >> 64;
+}
+
+static void begin_update(struct state_record *record) {
+  __atomic_fetch_add(&record->seq, 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void end_update(struct state_record *record) {
+  __atomic_fetch_add(&record->seq, 1, __ATOMIC_RELEASE);
+}
+
+static bool read_record(size_t i, struct state_record *copy) {
+  struct state_record *record = &records[i];
+  for (int tries = 0;; tries++) {
+    if (__atomic_load_n(&record->slot, __ATOMIC_ACQUIRE) != SLOT_USED)
+      return false;
+    uint32_t seq = __atomic_load_n(&record->seq, __ATOMIC_ACQUIRE);
+    memcpy(copy, record, sizeof(*copy));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (!(seq & 1) && __atomic_load_n(&record->seq, __ATOMIC_RELAXED) == seq)
+      return true;
+    if (tries == STATE_READ_RETRIES) return true;
+  }
+}
+
+// whether a slot the probe from start passed on its way to end was emptied
+// since, the record at end would be out of reach behind it
+static bool probe_cut(size_t start, size_t end) {
+  for (size_t i = start; i != end; i = (i + 1) % STATE_RECORDS_MAX)
+    if (__atomic_load_n(&records[i].slot, __ATOMIC_SEQ_CST) == SLOT_EMPTY)
+      return true;
+  return false;
+}
+
+int state_add(const struct container_config *config, pid_t pid,
+              enum container_status status) {
+  uint64_t key;
+  if (state_open() == -1 || id_key(config->id, false, &key) == -1) return -1;
+  size_t start = home(key);
+  for (size_t n = 0; n < STATE_RECORDS_MAX; n++) {
+    size_t i = (start + n) % STATE_RECORDS_MAX;
+    struct state_record *record = &records[i];
+    uint32_t slot = __atomic_load_n(&record->slot, __ATOMIC_ACQUIRE);
+    if (slot == SLOT_CLAIMED || slot == SLOT_USED) continue;
+    if (!__atomic_compare_exchange_n(&record->slot, &slot, SLOT_CLAIMED, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+      continue;
+    if (probe_cut(start, i)) {
+      // probe again from home, the emptied slot is free to take
+      __atomic_store_n(&record->slot, SLOT_FREED, __ATOMIC_RELEASE);
+      n = (size_t)-1;
+      continue;
+    }
+    // not visible to readers until it is marked used
+    snprintf(record->id, sizeof(record->id), "%s", config->id);
+    record->pid = pid;
+    record->status = status;
+    record->exit_code = 0;
+    record->started = timestamp();
+    record->finished = 0;
+    snprintf(record->image, sizeof(record->image), "%s",
+             config->image ? config->image : "");
+    snprintf(record->ip, sizeof(record->ip), "%s",
+             config->ip ? config->ip : "");
+    snprintf(record->cgroup, sizeof(record->cgroup), "%s/%s",
+             config->cgroup_base_path, config->id);
+    __atomic_store_n(&record->slot, SLOT_USED, __ATOMIC_RELEASE);
+    __atomic_fetch_or(&header->used[i / 64], 1ULL << (i % 64),
+                      __ATOMIC_RELEASE);
+    return i;
+  }
+  warn("Container state index %s is full\n", state_path);
+  return -1;
+}
+
+void state_launch(int slot, const char *image, const char *ip) {
+  if (slot == -1) return;
+  struct state_record *record = &records[slot];
+  begin_update(record);
+  record->status = STATUS_RUNNING;
+  record->started = timestamp();
+  if (image) snprintf(record->image, sizeof(record->image), "%s", image);
+  if (ip) snprintf(record->ip, sizeof(record->ip), "%s", ip);
+  end_update(record);
+}
+
+void state_exit(int slot, int exit_code) {
+  if (slot == -1) return;
+  struct state_record *record = &records[slot];
+  begin_update(record);
+  record->status = STATUS_EXITED;
+  record->exit_code = exit_code;
+  record->finished = timestamp();
+  end_update(record);
+}
+
+void state_remove(int slot) {
+  if (slot == -1) return;
+  __atomic_fetch_and(&header->used[slot / 64], ~(1ULL << (slot % 64)),
+                     __ATOMIC_RELEASE);
+  struct state_record *record = &records[slot];
+  size_t next = (slot + 1) % STATE_RECORDS_MAX;
+  // a tombstone in front of an empty slot ends no probe the empty slot would
+  // not, it and the tombstones before it are emptied to keep probes short
+  if (__atomic_load_n(&records[next].slot, __ATOMIC_ACQUIRE) != SLOT_EMPTY) {
+    __atomic_store_n(&record->slot, SLOT_FREED, __ATOMIC_RELEASE);
+    return;
+  }
+  // an add that passed this slot while it was used can claim the next one
+  // meanwhile, either this sees it or the add sees the empty slot and probes
+  // again
+  __atomic_store_n(&record->slot, SLOT_EMPTY, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&records[next].slot, __ATOMIC_SEQ_CST) != SLOT_EMPTY) {
+    uint32_t empty = SLOT_EMPTY;
+    __atomic_compare_exchange_n(&record->slot, &empty, SLOT_FREED, false,
+                                __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+    return;
+  }
+  for (size_t i = (slot + STATE_RECORDS_MAX - 1) % STATE_RECORDS_MAX;
+       i != (size_t)slot; i = (i + STATE_RECORDS_MAX - 1) % STATE_RECORDS_MAX) {
+    uint32_t freed = SLOT_FREED;
+    if (!__atomic_compare_exchange_n(&records[i].slot, &freed, SLOT_EMPTY,
+                                     false, __ATOMIC_SEQ_CST,
+                                     __ATOMIC_RELAXED))
+      break;
+  }
+}
+
+// records whose id starts with prefix, up to max of them are copied to
+// matches. they sit between the home slots of the smallest and the largest
+// matching id, or past them up to the next empty slot
+static size_t lookup(const char *prefix, struct state_record *matches,
+                     size_t max) {
+  uint64_t low, high;
+  if (*prefix == '\0' || id_key(prefix, false, &low) == -1) return 0;
+  id_key(prefix, true, &high);
+  size_t len = strlen(prefix), count = 0, last = home(high);
+  struct state_record copy;
+  for (size_t i = home(low), n = 0; n < STATE_RECORDS_MAX; i++, n++) {
+    i %= STATE_RECORDS_MAX;
+    uint32_t slot = __atomic_load_n(&records[i].slot, __ATOMIC_ACQUIRE);
+    // wrapped around past the last home slot
+    bool past = n > (last + STATE_RECORDS_MAX - home(low)) % STATE_RECORDS_MAX;
+    if (slot == SLOT_EMPTY && past) break;
+    if (!read_record(i, &copy) || strncmp(copy.id, prefix, len)) continue;
+    if (count < max) matches[count] = copy;
+    count++;
+  }
+  return count;
+}
+
+static const char *status_name(const struct state_record *record) {
+  switch (record->status) {
+    case STATUS_PARKED:
+    case STATUS_RUNNING:
+      // left behind by a launcher that died without reaping its container
+      if (kill(record->pid, 0) == -1 && errno == ESRCH) return "lost";
+      return record->status == STATUS_PARKED ? "parked" : "running";
+    case STATUS_EXITED:
+      return "exited";
+  }
+  return "unknown";
+}
+
+static int compare_started(const void *a, const void *b) {
+  const struct state_record *x = a, *y = b;
+  return x->started < y->started ? -1 : x->started > y->started;
+}
+
+static int state_main_options(int argc, char *argv[], bool *all) {
+  struct option long_options[] = {{"state-file", required_argument, 0, 's'},
+                                  {"all", no_argument, 0, 'a'},
+                                  {0, 0, 0, 0}};
+  int opt;
+  while ((opt = getopt_long(argc, argv, all ? "a" : "", long_options,
+                            NULL)) != -1) {
+    if (opt == 's')
+      state_configure(optarg);
+    else if (opt == 'a' && all)
+      *all = true;
+    else
+      return -1;
+  }
+  return 0;
+}
+
+int ps_main(int argc, char *argv[]) {
+  bool all = false;
+  if (state_main_options(argc, argv, &all) == -1 || optind != argc) {
+    fprintf(stderr, "Usage: %s [-a] [--state-file PATH]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (state_open() == -1) return EXIT_FAILURE;
+  size_t count = 0, cap = 64;
+  struct state_record *list = malloc(cap * sizeof(struct state_record));
+  for (size_t word = 0; word < STATE_RECORDS_MAX / 64; word++) {
+    uint64_t used = __atomic_load_n(&header->used[word], __ATOMIC_ACQUIRE);
+    for (; used; used &= used - 1) {
+      size_t i = word * 64 + __builtin_ctzll(used);
+      if (count == cap)
+        list = realloc(list, (cap *= 2) * sizeof(struct state_record));
+      if (!read_record(i, &list[count])) continue;
+      if (all || list[count].status != STATUS_EXITED) count++;
+    }
+  }
+  qsort(list, count, sizeof(struct state_record), compare_started);
+
+  unsigned long long now = timestamp();
+  printf("%-12s %-8s %-10s %-8s %-18s %s\n", "ID", "PID", "STATUS", "UPTIME",
+         "IP", "IMAGE");
+  for (size_t i = 0; i < count; i++) {
+    const struct state_record *record = &list[i];
+    char status[32];
+    if (record->status == STATUS_EXITED)
+      snprintf(status, sizeof(status), "exited(%d)", record->exit_code);
+    else
+      snprintf(status, sizeof(status), "%s", status_name(record));
+    unsigned long long end = record->finished ? record->finished : now;
+    printf("%.12s %-8d %-10s %-8llu %-18s %s\n", record->id, record->pid,
+           status, (end - record->started) / 1000000,
+           record->ip[0] ? record->ip : "-", record->image);
+  }
+  free(list);
+  return EXIT_SUCCESS;
+}
+
+static void print_string(const char *key, const char *value, bool last) {
+  char buf[STATE_CGROUP_LEN_MAX * 2];
+  json_escape(buf, sizeof(buf), value);
+  printf("  \"%s\": %s%s\n", key, buf, last ? "" : ",");
+}
+
+int inspect_main(int argc, char *argv[]) {
+  if (state_main_options(argc, argv, NULL) == -1 || optind == argc) {
+    fprintf(stderr, "Usage: %s [--state-file PATH] ID...\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (state_open() == -1) return EXIT_FAILURE;
+  int ret = EXIT_SUCCESS;
+  for (int i = optind; i < argc; i++) {
+    struct state_record record;
+    size_t count = lookup(argv[i], &record, 1);
+    if (count != 1) {
+      fprintf(stderr, count ? "Container id %s is ambiguous\n"
+                            : "No such container %s\n",
+              argv[i]);
+      ret = EXIT_FAILURE;
+      continue;
+    }
+    printf("{\n");
+    print_string("id", record.id, false);
+    printf("  \"pid\": %d,\n", record.pid);
+    print_string("status", status_name(&record), false);
+    if (record.status == STATUS_EXITED)
+      printf("  \"exit_code\": %d,\n", record.exit_code);
+    print_string("image", record.image, false);
+    print_string("ip", record.ip, false);
+    print_string("cgroup", record.cgroup, false);
+    printf("  \"started_us\": %llu,\n", (unsigned long long)record.started);
+    printf("  \"finished_us\": %llu\n}\n", (unsigned long long)record.finished);
+  }
+  return ret;
+}
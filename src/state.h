@@ -0,0 +1,35 @@
+#ifndef _STATE_H_
+#define _STATE_H_
+#include <sys/types.h>
+
+#include "container.h"
+
+#define STATE_PATH_DEFAULT "/var/lib/mini-container/state"
+// fixed number of records, the file is sparse so unused ones cost nothing
+#define STATE_RECORDS_MAX 32768
+#define STATE_IMAGE_LEN_MAX 128
+#define STATE_CGROUP_LEN_MAX 256
+#define STATE_IP_LEN_MAX 24
+
+enum container_status {
+  STATUS_PARKED = 1,
+  STATUS_RUNNING,
+  STATUS_EXITED,
+};
+
+// the index file shared by every mini-container process, only opened once a
+// container is recorded
+void state_configure(const char *path);
+// record a new container, returns its slot or -1 if the index is full
+int state_add(const struct container_config *config, pid_t pid,
+              enum container_status status);
+// a parked container was launched with the image and address of its spec
+void state_launch(int slot, const char *image, const char *ip);
+void state_exit(int slot, int exit_code);
+// the container and its data are gone
+void state_remove(int slot);
+
+int ps_main(int argc, char *argv[]);
+int inspect_main(int argc, char *argv[]);
+
+#endif
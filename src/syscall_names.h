@@ -0,0 +1,1101 @@
+#ifndef _SYSCALL_NAMES_H_
+#define _SYSCALL_NAMES_H_
+#include <asm/unistd.h>
+
+// every syscall name of asm/unistd_64.h, the ones an architecture lacks are
+// left out of its table
+#define SYSCALL_ENTRY(name) {#name, __NR_##name},
+
+static const struct syscall_name {
+  const char *name;
+  int nr;
+} syscall_names[] = {
+#ifdef __NR_read
+    SYSCALL_ENTRY(read)
+#endif
+#ifdef __NR_write
+    SYSCALL_ENTRY(write)
+#endif
+#ifdef __NR_open
+    SYSCALL_ENTRY(open)
+#endif
+#ifdef __NR_close
+    SYSCALL_ENTRY(close)
+#endif
+#ifdef __NR_stat
+    SYSCALL_ENTRY(stat)
+#endif
+#ifdef __NR_fstat
+    SYSCALL_ENTRY(fstat)
+#endif
+#ifdef __NR_lstat
+    SYSCALL_ENTRY(lstat)
+#endif
+#ifdef __NR_poll
+    SYSCALL_ENTRY(poll)
+#endif
+#ifdef __NR_lseek
+    SYSCALL_ENTRY(lseek)
+#endif
+#ifdef __NR_mmap
+    SYSCALL_ENTRY(mmap)
+#endif
+#ifdef __NR_mprotect
+    SYSCALL_ENTRY(mprotect)
+#endif
+#ifdef __NR_munmap
+    SYSCALL_ENTRY(munmap)
+#endif
+#ifdef __NR_brk
+    SYSCALL_ENTRY(brk)
+#endif
+#ifdef __NR_rt_sigaction
+    SYSCALL_ENTRY(rt_sigaction)
+#endif
+#ifdef __NR_rt_sigprocmask
+    SYSCALL_ENTRY(rt_sigprocmask)
+#endif
+#ifdef __NR_rt_sigreturn
+    SYSCALL_ENTRY(rt_sigreturn)
+#endif
+#ifdef __NR_ioctl
+    SYSCALL_ENTRY(ioctl)
+#endif
+#ifdef __NR_pread64
+    SYSCALL_ENTRY(pread64)
+#endif
+#ifdef __NR_pwrite64
+    SYSCALL_ENTRY(pwrite64)
+#endif
+#ifdef __NR_readv
+    SYSCALL_ENTRY(readv)
+#endif
+#ifdef __NR_writev
+    SYSCALL_ENTRY(writev)
+#endif
+#ifdef __NR_access
+    SYSCALL_ENTRY(access)
+#endif
+#ifdef __NR_pipe
+    SYSCALL_ENTRY(pipe)
+#endif
+#ifdef __NR_select
+    SYSCALL_ENTRY(select)
+#endif
+#ifdef __NR_sched_yield
+    SYSCALL_ENTRY(sched_yield)
+#endif
+#ifdef __NR_mremap
+    SYSCALL_ENTRY(mremap)
+#endif
+#ifdef __NR_msync
+    SYSCALL_ENTRY(msync)
+#endif
+#ifdef __NR_mincore
+    SYSCALL_ENTRY(mincore)
+#endif
+#ifdef __NR_madvise
+    SYSCALL_ENTRY(madvise)
+#endif
+#ifdef __NR_shmget
+    SYSCALL_ENTRY(shmget)
+#endif
+#ifdef __NR_shmat
+    SYSCALL_ENTRY(shmat)
+#endif
+#ifdef __NR_shmctl
+    SYSCALL_ENTRY(shmctl)
+#endif
+#ifdef __NR_dup
+    SYSCALL_ENTRY(dup)
+#endif
+#ifdef __NR_dup2
+    SYSCALL_ENTRY(dup2)
+#endif
+#ifdef __NR_pause
+    SYSCALL_ENTRY(pause)
+#endif
+#ifdef __NR_nanosleep
+    SYSCALL_ENTRY(nanosleep)
+#endif
+#ifdef __NR_getitimer
+    SYSCALL_ENTRY(getitimer)
+#endif
+#ifdef __NR_alarm
+    SYSCALL_ENTRY(alarm)
+#endif
+#ifdef __NR_setitimer
+    SYSCALL_ENTRY(setitimer)
+#endif
+#ifdef __NR_getpid
+    SYSCALL_ENTRY(getpid)
+#endif
+#ifdef __NR_sendfile
+    SYSCALL_ENTRY(sendfile)
+#endif
+#ifdef __NR_socket
+    SYSCALL_ENTRY(socket)
+#endif
+#ifdef __NR_connect
+    SYSCALL_ENTRY(connect)
+#endif
+#ifdef __NR_accept
+    SYSCALL_ENTRY(accept)
+#endif
+#ifdef __NR_sendto
+    SYSCALL_ENTRY(sendto)
+#endif
+#ifdef __NR_recvfrom
+    SYSCALL_ENTRY(recvfrom)
+#endif
+#ifdef __NR_sendmsg
+    SYSCALL_ENTRY(sendmsg)
+#endif
+#ifdef __NR_recvmsg
+    SYSCALL_ENTRY(recvmsg)
+#endif
+#ifdef __NR_shutdown
+    SYSCALL_ENTRY(shutdown)
+#endif
+#ifdef __NR_bind
+    SYSCALL_ENTRY(bind)
+#endif
+#ifdef __NR_listen
+    SYSCALL_ENTRY(listen)
+#endif
+#ifdef __NR_getsockname
+    SYSCALL_ENTRY(getsockname)
+#endif
+#ifdef __NR_getpeername
+    SYSCALL_ENTRY(getpeername)
+#endif
+#ifdef __NR_socketpair
+    SYSCALL_ENTRY(socketpair)
+#endif
+#ifdef __NR_setsockopt
+    SYSCALL_ENTRY(setsockopt)
+#endif
+#ifdef __NR_getsockopt
+    SYSCALL_ENTRY(getsockopt)
+#endif
+#ifdef __NR_clone
+    SYSCALL_ENTRY(clone)
+#endif
+#ifdef __NR_fork
+    SYSCALL_ENTRY(fork)
+#endif
+#ifdef __NR_vfork
+    SYSCALL_ENTRY(vfork)
+#endif
+#ifdef __NR_execve
+    SYSCALL_ENTRY(execve)
+#endif
+#ifdef __NR_exit
+    SYSCALL_ENTRY(exit)
+#endif
+#ifdef __NR_wait4
+    SYSCALL_ENTRY(wait4)
+#endif
+#ifdef __NR_kill
+    SYSCALL_ENTRY(kill)
+#endif
+#ifdef __NR_uname
+    SYSCALL_ENTRY(uname)
+#endif
+#ifdef __NR_semget
+    SYSCALL_ENTRY(semget)
+#endif
+#ifdef __NR_semop
+    SYSCALL_ENTRY(semop)
+#endif
+#ifdef __NR_semctl
+    SYSCALL_ENTRY(semctl)
+#endif
+#ifdef __NR_shmdt
+    SYSCALL_ENTRY(shmdt)
+#endif
+#ifdef __NR_msgget
+    SYSCALL_ENTRY(msgget)
+#endif
+#ifdef __NR_msgsnd
+    SYSCALL_ENTRY(msgsnd)
+#endif
+#ifdef __NR_msgrcv
+    SYSCALL_ENTRY(msgrcv)
+#endif
+#ifdef __NR_msgctl
+    SYSCALL_ENTRY(msgctl)
+#endif
+#ifdef __NR_fcntl
+    SYSCALL_ENTRY(fcntl)
+#endif
+#ifdef __NR_flock
+    SYSCALL_ENTRY(flock)
+#endif
+#ifdef __NR_fsync
+    SYSCALL_ENTRY(fsync)
+#endif
+#ifdef __NR_fdatasync
+    SYSCALL_ENTRY(fdatasync)
+#endif
+#ifdef __NR_truncate
+    SYSCALL_ENTRY(truncate)
+#endif
+#ifdef __NR_ftruncate
+    SYSCALL_ENTRY(ftruncate)
+#endif
+#ifdef __NR_getdents
+    SYSCALL_ENTRY(getdents)
+#endif
+#ifdef __NR_getcwd
+    SYSCALL_ENTRY(getcwd)
+#endif
+#ifdef __NR_chdir
+    SYSCALL_ENTRY(chdir)
+#endif
+#ifdef __NR_fchdir
+    SYSCALL_ENTRY(fchdir)
+#endif
+#ifdef __NR_rename
+    SYSCALL_ENTRY(rename)
+#endif
+#ifdef __NR_mkdir
+    SYSCALL_ENTRY(mkdir)
+#endif
+#ifdef __NR_rmdir
+    SYSCALL_ENTRY(rmdir)
+#endif
+#ifdef __NR_creat
+    SYSCALL_ENTRY(creat)
+#endif
+#ifdef __NR_link
+    SYSCALL_ENTRY(link)
+#endif
+#ifdef __NR_unlink
+    SYSCALL_ENTRY(unlink)
+#endif
+#ifdef __NR_symlink
+    SYSCALL_ENTRY(symlink)
+#endif
+#ifdef __NR_readlink
+    SYSCALL_ENTRY(readlink)
+#endif
+#ifdef __NR_chmod
+    SYSCALL_ENTRY(chmod)
+#endif
+#ifdef __NR_fchmod
+    SYSCALL_ENTRY(fchmod)
+#endif
+#ifdef __NR_chown
+    SYSCALL_ENTRY(chown)
+#endif
+#ifdef __NR_fchown
+    SYSCALL_ENTRY(fchown)
+#endif
+#ifdef __NR_lchown
+    SYSCALL_ENTRY(lchown)
+#endif
+#ifdef __NR_umask
+    SYSCALL_ENTRY(umask)
+#endif
+#ifdef __NR_gettimeofday
+    SYSCALL_ENTRY(gettimeofday)
+#endif
+#ifdef __NR_getrlimit
+    SYSCALL_ENTRY(getrlimit)
+#endif
+#ifdef __NR_getrusage
+    SYSCALL_ENTRY(getrusage)
+#endif
+#ifdef __NR_sysinfo
+    SYSCALL_ENTRY(sysinfo)
+#endif
+#ifdef __NR_times
+    SYSCALL_ENTRY(times)
+#endif
+#ifdef __NR_ptrace
+    SYSCALL_ENTRY(ptrace)
+#endif
+#ifdef __NR_getuid
+    SYSCALL_ENTRY(getuid)
+#endif
+#ifdef __NR_syslog
+    SYSCALL_ENTRY(syslog)
+#endif
+#ifdef __NR_getgid
+    SYSCALL_ENTRY(getgid)
+#endif
+#ifdef __NR_setuid
+    SYSCALL_ENTRY(setuid)
+#endif
+#ifdef __NR_setgid
+    SYSCALL_ENTRY(setgid)
+#endif
+#ifdef __NR_geteuid
+    SYSCALL_ENTRY(geteuid)
+#endif
+#ifdef __NR_getegid
+    SYSCALL_ENTRY(getegid)
+#endif
+#ifdef __NR_setpgid
+    SYSCALL_ENTRY(setpgid)
+#endif
+#ifdef __NR_getppid
+    SYSCALL_ENTRY(getppid)
+#endif
+#ifdef __NR_getpgrp
+    SYSCALL_ENTRY(getpgrp)
+#endif
+#ifdef __NR_setsid
+    SYSCALL_ENTRY(setsid)
+#endif
+#ifdef __NR_setreuid
+    SYSCALL_ENTRY(setreuid)
+#endif
+#ifdef __NR_setregid
+    SYSCALL_ENTRY(setregid)
+#endif
+#ifdef __NR_getgroups
+    SYSCALL_ENTRY(getgroups)
+#endif
+#ifdef __NR_setgroups
+    SYSCALL_ENTRY(setgroups)
+#endif
+#ifdef __NR_setresuid
+    SYSCALL_ENTRY(setresuid)
+#endif
+#ifdef __NR_getresuid
+    SYSCALL_ENTRY(getresuid)
+#endif
+#ifdef __NR_setresgid
+    SYSCALL_ENTRY(setresgid)
+#endif
+#ifdef __NR_getresgid
+    SYSCALL_ENTRY(getresgid)
+#endif
+#ifdef __NR_getpgid
+    SYSCALL_ENTRY(getpgid)
+#endif
+#ifdef __NR_setfsuid
+    SYSCALL_ENTRY(setfsuid)
+#endif
+#ifdef __NR_setfsgid
+    SYSCALL_ENTRY(setfsgid)
+#endif
+#ifdef __NR_getsid
+    SYSCALL_ENTRY(getsid)
+#endif
+#ifdef __NR_capget
+    SYSCALL_ENTRY(capget)
+#endif
+#ifdef __NR_capset
+    SYSCALL_ENTRY(capset)
+#endif
+#ifdef __NR_rt_sigpending
+    SYSCALL_ENTRY(rt_sigpending)
+#endif
+#ifdef __NR_rt_sigtimedwait
+    SYSCALL_ENTRY(rt_sigtimedwait)
+#endif
+#ifdef __NR_rt_sigqueueinfo
+    SYSCALL_ENTRY(rt_sigqueueinfo)
+#endif
+#ifdef __NR_rt_sigsuspend
+    SYSCALL_ENTRY(rt_sigsuspend)
+#endif
+#ifdef __NR_sigaltstack
+    SYSCALL_ENTRY(sigaltstack)
+#endif
+#ifdef __NR_utime
+    SYSCALL_ENTRY(utime)
+#endif
+#ifdef __NR_mknod
+    SYSCALL_ENTRY(mknod)
+#endif
+#ifdef __NR_uselib
+    SYSCALL_ENTRY(uselib)
+#endif
+#ifdef __NR_personality
+    SYSCALL_ENTRY(personality)
+#endif
+#ifdef __NR_ustat
+    SYSCALL_ENTRY(ustat)
+#endif
+#ifdef __NR_statfs
+    SYSCALL_ENTRY(statfs)
+#endif
+#ifdef __NR_fstatfs
+    SYSCALL_ENTRY(fstatfs)
+#endif
+#ifdef __NR_sysfs
+    SYSCALL_ENTRY(sysfs)
+#endif
+#ifdef __NR_getpriority
+    SYSCALL_ENTRY(getpriority)
+#endif
+#ifdef __NR_setpriority
+    SYSCALL_ENTRY(setpriority)
+#endif
+#ifdef __NR_sched_setparam
+    SYSCALL_ENTRY(sched_setparam)
+#endif
+#ifdef __NR_sched_getparam
+    SYSCALL_ENTRY(sched_getparam)
+#endif
+#ifdef __NR_sched_setscheduler
+    SYSCALL_ENTRY(sched_setscheduler)
+#endif
+#ifdef __NR_sched_getscheduler
+    SYSCALL_ENTRY(sched_getscheduler)
+#endif
+#ifdef __NR_sched_get_priority_max
+    SYSCALL_ENTRY(sched_get_priority_max)
+#endif
+#ifdef __NR_sched_get_priority_min
+    SYSCALL_ENTRY(sched_get_priority_min)
+#endif
+#ifdef __NR_sched_rr_get_interval
+    SYSCALL_ENTRY(sched_rr_get_interval)
+#endif
+#ifdef __NR_mlock
+    SYSCALL_ENTRY(mlock)
+#endif
+#ifdef __NR_munlock
+    SYSCALL_ENTRY(munlock)
+#endif
+#ifdef __NR_mlockall
+    SYSCALL_ENTRY(mlockall)
+#endif
+#ifdef __NR_munlockall
+    SYSCALL_ENTRY(munlockall)
+#endif
+#ifdef __NR_vhangup
+    SYSCALL_ENTRY(vhangup)
+#endif
+#ifdef __NR_modify_ldt
+    SYSCALL_ENTRY(modify_ldt)
+#endif
+#ifdef __NR_pivot_root
+    SYSCALL_ENTRY(pivot_root)
+#endif
+#ifdef __NR__sysctl
+    SYSCALL_ENTRY(_sysctl)
+#endif
+#ifdef __NR_prctl
+    SYSCALL_ENTRY(prctl)
+#endif
+#ifdef __NR_arch_prctl
+    SYSCALL_ENTRY(arch_prctl)
+#endif
+#ifdef __NR_adjtimex
+    SYSCALL_ENTRY(adjtimex)
+#endif
+#ifdef __NR_setrlimit
+    SYSCALL_ENTRY(setrlimit)
+#endif
+#ifdef __NR_chroot
+    SYSCALL_ENTRY(chroot)
+#endif
+#ifdef __NR_sync
+    SYSCALL_ENTRY(sync)
+#endif
+#ifdef __NR_acct
+    SYSCALL_ENTRY(acct)
+#endif
+#ifdef __NR_settimeofday
+    SYSCALL_ENTRY(settimeofday)
+#endif
+#ifdef __NR_mount
+    SYSCALL_ENTRY(mount)
+#endif
+#ifdef __NR_umount2
+    SYSCALL_ENTRY(umount2)
+#endif
+#ifdef __NR_swapon
+    SYSCALL_ENTRY(swapon)
+#endif
+#ifdef __NR_swapoff
+    SYSCALL_ENTRY(swapoff)
+#endif
+#ifdef __NR_reboot
+    SYSCALL_ENTRY(reboot)
+#endif
+#ifdef __NR_sethostname
+    SYSCALL_ENTRY(sethostname)
+#endif
+#ifdef __NR_setdomainname
+    SYSCALL_ENTRY(setdomainname)
+#endif
+#ifdef __NR_iopl
+    SYSCALL_ENTRY(iopl)
+#endif
+#ifdef __NR_ioperm
+    SYSCALL_ENTRY(ioperm)
+#endif
+#ifdef __NR_create_module
+    SYSCALL_ENTRY(create_module)
+#endif
+#ifdef __NR_init_module
+    SYSCALL_ENTRY(init_module)
+#endif
+#ifdef __NR_delete_module
+    SYSCALL_ENTRY(delete_module)
+#endif
+#ifdef __NR_get_kernel_syms
+    SYSCALL_ENTRY(get_kernel_syms)
+#endif
+#ifdef __NR_query_module
+    SYSCALL_ENTRY(query_module)
+#endif
+#ifdef __NR_quotactl
+    SYSCALL_ENTRY(quotactl)
+#endif
+#ifdef __NR_nfsservctl
+    SYSCALL_ENTRY(nfsservctl)
+#endif
+#ifdef __NR_getpmsg
+    SYSCALL_ENTRY(getpmsg)
+#endif
+#ifdef __NR_putpmsg
+    SYSCALL_ENTRY(putpmsg)
+#endif
+#ifdef __NR_afs_syscall
+    SYSCALL_ENTRY(afs_syscall)
+#endif
+#ifdef __NR_tuxcall
+    SYSCALL_ENTRY(tuxcall)
+#endif
+#ifdef __NR_security
+    SYSCALL_ENTRY(security)
+#endif
+#ifdef __NR_gettid
+    SYSCALL_ENTRY(gettid)
+#endif
+#ifdef __NR_readahead
+    SYSCALL_ENTRY(readahead)
+#endif
+#ifdef __NR_setxattr
+    SYSCALL_ENTRY(setxattr)
+#endif
+#ifdef __NR_lsetxattr
+    SYSCALL_ENTRY(lsetxattr)
+#endif
+#ifdef __NR_fsetxattr
+    SYSCALL_ENTRY(fsetxattr)
+#endif
+#ifdef __NR_getxattr
+    SYSCALL_ENTRY(getxattr)
+#endif
+#ifdef __NR_lgetxattr
+    SYSCALL_ENTRY(lgetxattr)
+#endif
+#ifdef __NR_fgetxattr
+    SYSCALL_ENTRY(fgetxattr)
+#endif
+#ifdef __NR_listxattr
+    SYSCALL_ENTRY(listxattr)
+#endif
+#ifdef __NR_llistxattr
+    SYSCALL_ENTRY(llistxattr)
+#endif
+#ifdef __NR_flistxattr
+    SYSCALL_ENTRY(flistxattr)
+#endif
+#ifdef __NR_removexattr
+    SYSCALL_ENTRY(removexattr)
+#endif
+#ifdef __NR_lremovexattr
+    SYSCALL_ENTRY(lremovexattr)
+#endif
+#ifdef __NR_fremovexattr
+    SYSCALL_ENTRY(fremovexattr)
+#endif
+#ifdef __NR_tkill
+    SYSCALL_ENTRY(tkill)
+#endif
+#ifdef __NR_time
+    SYSCALL_ENTRY(time)
+#endif
+#ifdef __NR_futex
+    SYSCALL_ENTRY(futex)
+#endif
+#ifdef __NR_sched_setaffinity
+    SYSCALL_ENTRY(sched_setaffinity)
+#endif
+#ifdef __NR_sched_getaffinity
+    SYSCALL_ENTRY(sched_getaffinity)
+#endif
+#ifdef __NR_set_thread_area
+    SYSCALL_ENTRY(set_thread_area)
+#endif
+#ifdef __NR_io_setup
+    SYSCALL_ENTRY(io_setup)
+#endif
+#ifdef __NR_io_destroy
+    SYSCALL_ENTRY(io_destroy)
+#endif
+#ifdef __NR_io_getevents
+    SYSCALL_ENTRY(io_getevents)
+#endif
+#ifdef __NR_io_submit
+    SYSCALL_ENTRY(io_submit)
+#endif
+#ifdef __NR_io_cancel
+    SYSCALL_ENTRY(io_cancel)
+#endif
+#ifdef __NR_get_thread_area
+    SYSCALL_ENTRY(get_thread_area)
+#endif
+#ifdef __NR_lookup_dcookie
+    SYSCALL_ENTRY(lookup_dcookie)
+#endif
+#ifdef __NR_epoll_create
+    SYSCALL_ENTRY(epoll_create)
+#endif
+#ifdef __NR_epoll_ctl_old
+    SYSCALL_ENTRY(epoll_ctl_old)
+#endif
+#ifdef __NR_epoll_wait_old
+    SYSCALL_ENTRY(epoll_wait_old)
+#endif
+#ifdef __NR_remap_file_pages
+    SYSCALL_ENTRY(remap_file_pages)
+#endif
+#ifdef __NR_getdents64
+    SYSCALL_ENTRY(getdents64)
+#endif
+#ifdef __NR_set_tid_address
+    SYSCALL_ENTRY(set_tid_address)
+#endif
+#ifdef __NR_restart_syscall
+    SYSCALL_ENTRY(restart_syscall)
+#endif
+#ifdef __NR_semtimedop
+    SYSCALL_ENTRY(semtimedop)
+#endif
+#ifdef __NR_fadvise64
+    SYSCALL_ENTRY(fadvise64)
+#endif
+#ifdef __NR_timer_create
+    SYSCALL_ENTRY(timer_create)
+#endif
+#ifdef __NR_timer_settime
+    SYSCALL_ENTRY(timer_settime)
+#endif
+#ifdef __NR_timer_gettime
+    SYSCALL_ENTRY(timer_gettime)
+#endif
+#ifdef __NR_timer_getoverrun
+    SYSCALL_ENTRY(timer_getoverrun)
+#endif
+#ifdef __NR_timer_delete
+    SYSCALL_ENTRY(timer_delete)
+#endif
+#ifdef __NR_clock_settime
+    SYSCALL_ENTRY(clock_settime)
+#endif
+#ifdef __NR_clock_gettime
+    SYSCALL_ENTRY(clock_gettime)
+#endif
+#ifdef __NR_clock_getres
+    SYSCALL_ENTRY(clock_getres)
+#endif
+#ifdef __NR_clock_nanosleep
+    SYSCALL_ENTRY(clock_nanosleep)
+#endif
+#ifdef __NR_exit_group
+    SYSCALL_ENTRY(exit_group)
+#endif
+#ifdef __NR_epoll_wait
+    SYSCALL_ENTRY(epoll_wait)
+#endif
+#ifdef __NR_epoll_ctl
+    SYSCALL_ENTRY(epoll_ctl)
+#endif
+#ifdef __NR_tgkill
+    SYSCALL_ENTRY(tgkill)
+#endif
+#ifdef __NR_utimes
+    SYSCALL_ENTRY(utimes)
+#endif
+#ifdef __NR_vserver
+    SYSCALL_ENTRY(vserver)
+#endif
+#ifdef __NR_mbind
+    SYSCALL_ENTRY(mbind)
+#endif
+#ifdef __NR_set_mempolicy
+    SYSCALL_ENTRY(set_mempolicy)
+#endif
+#ifdef __NR_get_mempolicy
+    SYSCALL_ENTRY(get_mempolicy)
+#endif
+#ifdef __NR_mq_open
+    SYSCALL_ENTRY(mq_open)
+#endif
+#ifdef __NR_mq_unlink
+    SYSCALL_ENTRY(mq_unlink)
+#endif
+#ifdef __NR_mq_timedsend
+    SYSCALL_ENTRY(mq_timedsend)
+#endif
+#ifdef __NR_mq_timedreceive
+    SYSCALL_ENTRY(mq_timedreceive)
+#endif
+#ifdef __NR_mq_notify
+    SYSCALL_ENTRY(mq_notify)
+#endif
+#ifdef __NR_mq_getsetattr
+    SYSCALL_ENTRY(mq_getsetattr)
+#endif
+#ifdef __NR_kexec_load
+    SYSCALL_ENTRY(kexec_load)
+#endif
+#ifdef __NR_waitid
+    SYSCALL_ENTRY(waitid)
+#endif
+#ifdef __NR_add_key
+    SYSCALL_ENTRY(add_key)
+#endif
+#ifdef __NR_request_key
+    SYSCALL_ENTRY(request_key)
+#endif
+#ifdef __NR_keyctl
+    SYSCALL_ENTRY(keyctl)
+#endif
+#ifdef __NR_ioprio_set
+    SYSCALL_ENTRY(ioprio_set)
+#endif
+#ifdef __NR_ioprio_get
+    SYSCALL_ENTRY(ioprio_get)
+#endif
+#ifdef __NR_inotify_init
+    SYSCALL_ENTRY(inotify_init)
+#endif
+#ifdef __NR_inotify_add_watch
+    SYSCALL_ENTRY(inotify_add_watch)
+#endif
+#ifdef __NR_inotify_rm_watch
+    SYSCALL_ENTRY(inotify_rm_watch)
+#endif
+#ifdef __NR_migrate_pages
+    SYSCALL_ENTRY(migrate_pages)
+#endif
+#ifdef __NR_openat
+    SYSCALL_ENTRY(openat)
+#endif
+#ifdef __NR_mkdirat
+    SYSCALL_ENTRY(mkdirat)
+#endif
+#ifdef __NR_mknodat
+    SYSCALL_ENTRY(mknodat)
+#endif
+#ifdef __NR_fchownat
+    SYSCALL_ENTRY(fchownat)
+#endif
+#ifdef __NR_futimesat
+    SYSCALL_ENTRY(futimesat)
+#endif
+#ifdef __NR_newfstatat
+    SYSCALL_ENTRY(newfstatat)
+#endif
+#ifdef __NR_unlinkat
+    SYSCALL_ENTRY(unlinkat)
+#endif
+#ifdef __NR_renameat
+    SYSCALL_ENTRY(renameat)
+#endif
+#ifdef __NR_linkat
+    SYSCALL_ENTRY(linkat)
+#endif
+#ifdef __NR_symlinkat
+    SYSCALL_ENTRY(symlinkat)
+#endif
+#ifdef __NR_readlinkat
+    SYSCALL_ENTRY(readlinkat)
+#endif
+#ifdef __NR_fchmodat
+    SYSCALL_ENTRY(fchmodat)
+#endif
+#ifdef __NR_faccessat
+    SYSCALL_ENTRY(faccessat)
+#endif
+#ifdef __NR_pselect6
+    SYSCALL_ENTRY(pselect6)
+#endif
+#ifdef __NR_ppoll
+    SYSCALL_ENTRY(ppoll)
+#endif
+#ifdef __NR_unshare
+    SYSCALL_ENTRY(unshare)
+#endif
+#ifdef __NR_set_robust_list
+    SYSCALL_ENTRY(set_robust_list)
+#endif
+#ifdef __NR_get_robust_list
+    SYSCALL_ENTRY(get_robust_list)
+#endif
+#ifdef __NR_splice
+    SYSCALL_ENTRY(splice)
+#endif
+#ifdef __NR_tee
+    SYSCALL_ENTRY(tee)
+#endif
+#ifdef __NR_sync_file_range
+    SYSCALL_ENTRY(sync_file_range)
+#endif
+#ifdef __NR_vmsplice
+    SYSCALL_ENTRY(vmsplice)
+#endif
+#ifdef __NR_move_pages
+    SYSCALL_ENTRY(move_pages)
+#endif
+#ifdef __NR_utimensat
+    SYSCALL_ENTRY(utimensat)
+#endif
+#ifdef __NR_epoll_pwait
+    SYSCALL_ENTRY(epoll_pwait)
+#endif
+#ifdef __NR_signalfd
+    SYSCALL_ENTRY(signalfd)
+#endif
+#ifdef __NR_timerfd_create
+    SYSCALL_ENTRY(timerfd_create)
+#endif
+#ifdef __NR_eventfd
+    SYSCALL_ENTRY(eventfd)
+#endif
+#ifdef __NR_fallocate
+    SYSCALL_ENTRY(fallocate)
+#endif
+#ifdef __NR_timerfd_settime
+    SYSCALL_ENTRY(timerfd_settime)
+#endif
+#ifdef __NR_timerfd_gettime
+    SYSCALL_ENTRY(timerfd_gettime)
+#endif
+#ifdef __NR_accept4
+    SYSCALL_ENTRY(accept4)
+#endif
+#ifdef __NR_signalfd4
+    SYSCALL_ENTRY(signalfd4)
+#endif
+#ifdef __NR_eventfd2
+    SYSCALL_ENTRY(eventfd2)
+#endif
+#ifdef __NR_epoll_create1
+    SYSCALL_ENTRY(epoll_create1)
+#endif
+#ifdef __NR_dup3
+    SYSCALL_ENTRY(dup3)
+#endif
+#ifdef __NR_pipe2
+    SYSCALL_ENTRY(pipe2)
+#endif
+#ifdef __NR_inotify_init1
+    SYSCALL_ENTRY(inotify_init1)
+#endif
+#ifdef __NR_preadv
+    SYSCALL_ENTRY(preadv)
+#endif
+#ifdef __NR_pwritev
+    SYSCALL_ENTRY(pwritev)
+#endif
+#ifdef __NR_rt_tgsigqueueinfo
+    SYSCALL_ENTRY(rt_tgsigqueueinfo)
+#endif
+#ifdef __NR_perf_event_open
+    SYSCALL_ENTRY(perf_event_open)
+#endif
+#ifdef __NR_recvmmsg
+    SYSCALL_ENTRY(recvmmsg)
+#endif
+#ifdef __NR_fanotify_init
+    SYSCALL_ENTRY(fanotify_init)
+#endif
+#ifdef __NR_fanotify_mark
+    SYSCALL_ENTRY(fanotify_mark)
+#endif
+#ifdef __NR_prlimit64
+    SYSCALL_ENTRY(prlimit64)
+#endif
+#ifdef __NR_name_to_handle_at
+    SYSCALL_ENTRY(name_to_handle_at)
+#endif
+#ifdef __NR_open_by_handle_at
+    SYSCALL_ENTRY(open_by_handle_at)
+#endif
+#ifdef __NR_clock_adjtime
+    SYSCALL_ENTRY(clock_adjtime)
+#endif
+#ifdef __NR_syncfs
+    SYSCALL_ENTRY(syncfs)
+#endif
+#ifdef __NR_sendmmsg
+    SYSCALL_ENTRY(sendmmsg)
+#endif
+#ifdef __NR_setns
+    SYSCALL_ENTRY(setns)
+#endif
+#ifdef __NR_getcpu
+    SYSCALL_ENTRY(getcpu)
+#endif
+#ifdef __NR_process_vm_readv
+    SYSCALL_ENTRY(process_vm_readv)
+#endif
+#ifdef __NR_process_vm_writev
+    SYSCALL_ENTRY(process_vm_writev)
+#endif
+#ifdef __NR_kcmp
+    SYSCALL_ENTRY(kcmp)
+#endif
+#ifdef __NR_finit_module
+    SYSCALL_ENTRY(finit_module)
+#endif
+#ifdef __NR_sched_setattr
+    SYSCALL_ENTRY(sched_setattr)
+#endif
+#ifdef __NR_sched_getattr
+    SYSCALL_ENTRY(sched_getattr)
+#endif
+#ifdef __NR_renameat2
+    SYSCALL_ENTRY(renameat2)
+#endif
+#ifdef __NR_seccomp
+    SYSCALL_ENTRY(seccomp)
+#endif
+#ifdef __NR_getrandom
+    SYSCALL_ENTRY(getrandom)
+#endif
+#ifdef __NR_memfd_create
+    SYSCALL_ENTRY(memfd_create)
+#endif
+#ifdef __NR_kexec_file_load
+    SYSCALL_ENTRY(kexec_file_load)
+#endif
+#ifdef __NR_bpf
+    SYSCALL_ENTRY(bpf)
+#endif
+#ifdef __NR_execveat
+    SYSCALL_ENTRY(execveat)
+#endif
+#ifdef __NR_userfaultfd
+    SYSCALL_ENTRY(userfaultfd)
+#endif
+#ifdef __NR_membarrier
+    SYSCALL_ENTRY(membarrier)
+#endif
+#ifdef __NR_mlock2
+    SYSCALL_ENTRY(mlock2)
+#endif
+#ifdef __NR_copy_file_range
+    SYSCALL_ENTRY(copy_file_range)
+#endif
+#ifdef __NR_preadv2
+    SYSCALL_ENTRY(preadv2)
+#endif
+#ifdef __NR_pwritev2
+    SYSCALL_ENTRY(pwritev2)
+#endif
+#ifdef __NR_pkey_mprotect
+    SYSCALL_ENTRY(pkey_mprotect)
+#endif
+#ifdef __NR_pkey_alloc
+    SYSCALL_ENTRY(pkey_alloc)
+#endif
+#ifdef __NR_pkey_free
+    SYSCALL_ENTRY(pkey_free)
+#endif
+#ifdef __NR_statx
+    SYSCALL_ENTRY(statx)
+#endif
+#ifdef __NR_io_pgetevents
+    SYSCALL_ENTRY(io_pgetevents)
+#endif
+#ifdef __NR_rseq
+    SYSCALL_ENTRY(rseq)
+#endif
+#ifdef __NR_pidfd_send_signal
+    SYSCALL_ENTRY(pidfd_send_signal)
+#endif
+#ifdef __NR_io_uring_setup
+    SYSCALL_ENTRY(io_uring_setup)
+#endif
+#ifdef __NR_io_uring_enter
+    SYSCALL_ENTRY(io_uring_enter)
+#endif
+#ifdef __NR_io_uring_register
+    SYSCALL_ENTRY(io_uring_register)
+#endif
+#ifdef __NR_open_tree
+    SYSCALL_ENTRY(open_tree)
+#endif
+#ifdef __NR_move_mount
+    SYSCALL_ENTRY(move_mount)
+#endif
+#ifdef __NR_fsopen
+    SYSCALL_ENTRY(fsopen)
+#endif
+#ifdef __NR_fsconfig
+    SYSCALL_ENTRY(fsconfig)
+#endif
+#ifdef __NR_fsmount
+    SYSCALL_ENTRY(fsmount)
+#endif
+#ifdef __NR_fspick
+    SYSCALL_ENTRY(fspick)
+#endif
+#ifdef __NR_pidfd_open
+    SYSCALL_ENTRY(pidfd_open)
+#endif
+#ifdef __NR_clone3
+    SYSCALL_ENTRY(clone3)
+#endif
+#ifdef __NR_close_range
+    SYSCALL_ENTRY(close_range)
+#endif
+#ifdef __NR_openat2
+    SYSCALL_ENTRY(openat2)
+#endif
+#ifdef __NR_pidfd_getfd
+    SYSCALL_ENTRY(pidfd_getfd)
+#endif
+#ifdef __NR_faccessat2
+    SYSCALL_ENTRY(faccessat2)
+#endif
+#ifdef __NR_process_madvise
+    SYSCALL_ENTRY(process_madvise)
+#endif
+#ifdef __NR_epoll_pwait2
+    SYSCALL_ENTRY(epoll_pwait2)
+#endif
+#ifdef __NR_mount_setattr
+    SYSCALL_ENTRY(mount_setattr)
+#endif
+#ifdef __NR_quotactl_fd
+    SYSCALL_ENTRY(quotactl_fd)
+#endif
+#ifdef __NR_landlock_create_ruleset
+    SYSCALL_ENTRY(landlock_create_ruleset)
+#endif
+#ifdef __NR_landlock_add_rule
+    SYSCALL_ENTRY(landlock_add_rule)
+#endif
+#ifdef __NR_landlock_restrict_self
+    SYSCALL_ENTRY(landlock_restrict_self)
+#endif
+#ifdef __NR_memfd_secret
+    SYSCALL_ENTRY(memfd_secret)
+#endif
+#ifdef __NR_process_mrelease
+    SYSCALL_ENTRY(process_mrelease)
+#endif
+#ifdef __NR_futex_waitv
+    SYSCALL_ENTRY(futex_waitv)
+#endif
+#ifdef __NR_set_mempolicy_home_node
+    SYSCALL_ENTRY(set_mempolicy_home_node)
+#endif
+};
+
+#endif
@@ -0,0 +1,542 @@
+#define _GNU_SOURCE
+#include "tar.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/openat2.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "teardown.h"
+#include "utils.h"
+
+#define PAX_HEADER_MAX (1024 * 1024)
+#define EXTRACT_BUFFER_SIZE (256 * 1024)
+#define WHITEOUT_PREFIX ".wh."
+#define WHITEOUT_OPAQUE ".wh..wh..opq"
+
+// ustar header layout
+#define H_NAME 0
+#define H_MODE 100
+#define H_UID 108
+#define H_GID 116
+#define H_SIZE 124
+#define H_MTIME 136
+#define H_CHKSUM 148
+#define H_TYPE 156
+#define H_LINKNAME 157
+#define H_MAGIC 257
+#define H_DEVMAJOR 329
+#define H_DEVMINOR 337
+#define H_PREFIX 345
+
+static ssize_t read_full(tar_reader_t *reader, void *buf, size_t len) {
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = reader->read(reader->arg, (char *)buf + done, len - done);
+    if (n == -1) return -1;
+    if (n == 0) break;
+    done += n;
+  }
+  return done;
+}
+
+static int skip(tar_reader_t *reader, long long len) {
+  char buf[16 * 1024];
+  while (len > 0) {
+    size_t chunk = len < (long long)sizeof(buf) ? len : sizeof(buf);
+    ssize_t n = read_full(reader, buf, chunk);
+    if (n == -1) return -1;
+    if ((size_t)n != chunk) {
+      errno = EIO;
+      return -1;
+    }
+    len -= n;
+  }
+  return 0;
+}
+
+// octal, or big-endian base-256 when the high bit is set (GNU and star)
+static long long parse_number(const unsigned char *field, size_t len) {
+  long long value = 0;
+  if (field[0] & 0x80) {
+    value = field[0] & 0x3f;
+    for (size_t i = 1; i < len; i++) value = (value << 8) | field[i];
+    return value;
+  }
+  size_t i = 0;
+  while (i < len && field[i] == ' ') i++;
+  for (; i < len && field[i] >= '0' && field[i] <= '7'; i++)
+    value = (value << 3) | (field[i] - '0');
+  return value;
+}
+
+static bool valid_checksum(const unsigned char *header) {
+  unsigned long sum = 0;
+  long signed_sum = 0;
+  for (int i = 0; i < TAR_BLOCK_SIZE; i++) {
+    unsigned char c = i >= H_CHKSUM && i < H_CHKSUM + 8 ? ' ' : header[i];
+    sum += c;
+    signed_sum += (signed char)c;
+  }
+  long long expected = parse_number(header + H_CHKSUM, 8);
+  return expected == (long long)sum || expected == signed_sum;
+}
+
+static void copy_field(char *dst, const unsigned char *field, size_t len) {
+  size_t n = strnlen((const char *)field, len);
+  memcpy(dst, field, n);
+  dst[n] = '\0';
+}
+
+static int read_string(tar_reader_t *reader, long long size, char *dst) {
+  long long keep = size < PATH_MAX - 1 ? size : PATH_MAX - 1;
+  if (read_full(reader, dst, keep) != keep) return -1;
+  dst[keep] = '\0';
+  return skip(reader, size - keep + (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) %
+                                        TAR_BLOCK_SIZE);
+}
+
+struct pax {
+  char path[PATH_MAX];
+  char linkpath[PATH_MAX];
+  long long size, uid, gid, mtime;
+  bool has_size, has_uid, has_gid, has_mtime;
+};
+
+// records are "<len> <key>=<value>\n", values may contain NULs
+static int parse_pax(const char *data, size_t size, struct pax *pax,
+                     tar_entry_t *entry) {
+  size_t pos = 0;
+  while (pos < size) {
+    char *end;
+    unsigned long len = strtoul(data + pos, &end, 10);
+    if (end == data + pos || *end != ' ' || len == 0 || pos + len > size ||
+        data[pos + len - 1] != '\n')
+      return -1;
+    const char *key = end + 1;
+    const char *record_end = data + pos + len - 1;
+    const char *eq = memchr(key, '=', record_end - key);
+    if (eq == NULL) return -1;
+    size_t key_len = eq - key;
+    const char *value = eq + 1;
+    size_t value_len = record_end - value;
+    char number[32];
+    snprintf(number, sizeof(number), "%.*s",
+             (int)(value_len < 31 ? value_len : 31), value);
+#define KEY(name) (key_len == strlen(name) && strncmp(key, name, key_len) == 0)
+    if (KEY("path") && value_len < PATH_MAX) {
+      memcpy(pax->path, value, value_len);
+      pax->path[value_len] = '\0';
+    } else if (KEY("linkpath") && value_len < PATH_MAX) {
+      memcpy(pax->linkpath, value, value_len);
+      pax->linkpath[value_len] = '\0';
+    } else if (KEY("size")) {
+      // the reader pads and skips by size, it must stay a plain count
+      char *digits_end;
+      errno = 0;
+      pax->size = strtoll(number, &digits_end, 10);
+      if (value_len == 0 || value_len > 30 || *digits_end || errno ||
+          number[0] < '0' || number[0] > '9' ||
+          pax->size > LLONG_MAX - TAR_BLOCK_SIZE)
+        return -1;
+      pax->has_size = true;
+    } else if (KEY("uid")) {
+      pax->uid = strtoll(number, NULL, 10);
+      pax->has_uid = true;
+    } else if (KEY("gid")) {
+      pax->gid = strtoll(number, NULL, 10);
+      pax->has_gid = true;
+    } else if (KEY("mtime")) {
+      pax->mtime = strtoll(number, NULL, 10);
+      pax->has_mtime = true;
+    } else if (key_len > 13 && strncmp(key, "SCHILY.xattr.", 13) == 0 &&
+               entry->xattr_count < TAR_XATTRS_MAX) {
+      struct tar_xattr *xattr = &entry->xattrs[entry->xattr_count++];
+      xattr->name = strndup(key + 13, key_len - 13);
+      xattr->value = malloc(value_len ? value_len : 1);
+      memcpy(xattr->value, value, value_len);
+      xattr->size = value_len;
+    }
+#undef KEY
+    pos += len;
+  }
+  return 0;
+}
+
+void tar_init(tar_reader_t *reader, tar_read_fn read, void *arg) {
+  memset(reader, 0, sizeof(*reader));
+  reader->read = read;
+  reader->arg = arg;
+}
+
+void tar_entry_free(tar_entry_t *entry) {
+  for (int i = 0; i < entry->xattr_count; i++) {
+    free(entry->xattrs[i].name);
+    free(entry->xattrs[i].value);
+  }
+  entry->xattr_count = 0;
+}
+
+int tar_next(tar_reader_t *reader, tar_entry_t *entry) {
+  if (skip(reader, reader->remaining + reader->padding) == -1) return -1;
+  reader->remaining = reader->padding = 0;
+  tar_entry_free(entry);
+
+  struct pax pax = {0};
+  char long_path[PATH_MAX] = "", long_link[PATH_MAX] = "";
+  unsigned char header[TAR_BLOCK_SIZE];
+  for (;;) {
+    ssize_t n = read_full(reader, header, TAR_BLOCK_SIZE);
+    if (n == -1) return -1;
+    // tolerate archives that stop without the two zero blocks
+    if (n == 0) return 0;
+    if (n != TAR_BLOCK_SIZE) goto invalid;
+    bool zero = true;
+    for (int i = 0; i < TAR_BLOCK_SIZE && zero; i++) zero = header[i] == 0;
+    if (zero) return 0;
+    if (!valid_checksum(header)) goto invalid;
+
+    char type = header[H_TYPE];
+    long long size = parse_number(header + H_SIZE, 12);
+    long long padding = (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+    if (size < 0) goto invalid;
+    if (type == 'x') {
+      if (size > PAX_HEADER_MAX) goto invalid;
+      char *data = malloc(size + 1);
+      if (read_full(reader, data, size) != size ||
+          parse_pax(data, size, &pax, entry) == -1) {
+        free(data);
+        goto invalid;
+      }
+      free(data);
+      if (skip(reader, padding) == -1) return -1;
+      continue;
+    } else if (type == 'g') {
+      if (skip(reader, size + padding) == -1) return -1;
+      continue;
+    } else if (type == 'L' || type == 'K') {
+      if (read_string(reader, size, type == 'L' ? long_path : long_link) == -1)
+        return -1;
+      continue;
+    }
+
+    entry->type = type;
+    if (pax.path[0]) {
+      strcpy(entry->path, pax.path);
+    } else if (long_path[0]) {
+      strcpy(entry->path, long_path);
+    } else {
+      char name[101], prefix[156] = "";
+      copy_field(name, header + H_NAME, 100);
+      if (memcmp(header + H_MAGIC, "ustar", 5) == 0)
+        copy_field(prefix, header + H_PREFIX, 155);
+      snprintf(entry->path, PATH_MAX, "%s%s%s", prefix, prefix[0] ? "/" : "",
+               name);
+    }
+    if (pax.linkpath[0])
+      strcpy(entry->linkpath, pax.linkpath);
+    else if (long_link[0])
+      strcpy(entry->linkpath, long_link);
+    else
+      copy_field(entry->linkpath, header + H_LINKNAME, 100);
+    entry->mode = parse_number(header + H_MODE, 8) & 07777;
+    entry->uid = pax.has_uid ? pax.uid : parse_number(header + H_UID, 8);
+    entry->gid = pax.has_gid ? pax.gid : parse_number(header + H_GID, 8);
+    entry->mtime = pax.has_mtime ? pax.mtime : parse_number(header + H_MTIME, 12);
+    entry->size = pax.has_size ? pax.size : size;
+    entry->devmajor = parse_number(header + H_DEVMAJOR, 8);
+    entry->devminor = parse_number(header + H_DEVMINOR, 8);
+    // links, devices and directories carry no data whatever size says
+    if (strchr("123456", type) && type != '\0') entry->size = 0;
+    reader->remaining = entry->size;
+    reader->padding =
+        (TAR_BLOCK_SIZE - entry->size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+    if (entry->size == 0 && size > 0) reader->padding = size + padding;
+    return 1;
+  }
+
+invalid:
+  error("Malformed tar archive\n");
+  errno = EINVAL;
+  return -1;
+}
+
+ssize_t tar_read(tar_reader_t *reader, void *buf, size_t len) {
+  if (reader->remaining == 0) return 0;
+  if ((long long)len > reader->remaining) len = reader->remaining;
+  ssize_t n = reader->read(reader->arg, buf, len);
+  if (n == 0) {
+    errno = EIO;
+    return -1;
+  }
+  if (n > 0) reader->remaining -= n;
+  return n;
+}
+
+struct extract {
+  int root_fd;
+  // the parent directory of the previous entry, most entries share it
+  char dir[PATH_MAX];
+  int dir_fd;
+  char *buf;
+};
+
+static int resolve(int root_fd, const char *path, int flags) {
+  struct open_how how = {
+      .flags = flags | O_CLOEXEC,
+      .resolve = RESOLVE_IN_ROOT | RESOLVE_NO_MAGICLINKS,
+  };
+  return openat2(root_fd, path, &how);
+}
+
+static int make_parents(int root_fd, char *dir) {
+  for (char *slash = dir;; slash++) {
+    slash = strchr(slash, '/');
+    if (slash) *slash = '\0';
+    char *base = strrchr(dir, '/');
+    int parent_fd;
+    if (base) {
+      *base = '\0';
+      parent_fd = resolve(root_fd, dir, O_PATH | O_DIRECTORY);
+      *base++ = '/';
+    } else {
+      base = dir;
+      parent_fd = dup(root_fd);
+    }
+    int ret = parent_fd == -1 ? -1 : mkdirat(parent_fd, base, 0755);
+    if (parent_fd != -1) close(parent_fd);
+    if (ret == -1 && errno != EEXIST) return -1;
+    if (slash == NULL) return 0;
+    *slash = '/';
+  }
+}
+
+static int open_parent(struct extract *ctx, char *dir) {
+  if (ctx->dir_fd != -1 && strcmp(ctx->dir, dir) == 0) return ctx->dir_fd;
+  if (ctx->dir_fd != -1) close(ctx->dir_fd);
+  ctx->dir_fd = -1;
+  int fd;
+  if (dir[0] == '\0') {
+    fd = dup(ctx->root_fd);
+  } else {
+    fd = resolve(ctx->root_fd, dir, O_PATH | O_DIRECTORY);
+    // layers may omit directory entries for their parents
+    if (fd == -1 && errno == ENOENT && make_parents(ctx->root_fd, dir) == 0)
+      fd = resolve(ctx->root_fd, dir, O_PATH | O_DIRECTORY);
+  }
+  if (fd == -1) return -1;
+  strcpy(ctx->dir, dir);
+  ctx->dir_fd = fd;
+  return fd;
+}
+
+// clear whatever an earlier entry left at name, returns 1 when keep_dir is
+// set and a directory is already there
+static int remove_existing(int dir_fd, const char *name, bool keep_dir) {
+  struct stat st;
+  if (fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) == -1)
+    return errno == ENOENT ? 0 : -1;
+  if (!S_ISDIR(st.st_mode)) return unlinkat(dir_fd, name, 0);
+  if (keep_dir) return 1;
+  if (unlinkat(dir_fd, name, AT_REMOVEDIR) == 0) return 0;
+  if (errno != ENOTEMPTY) return -1;
+  char path[PATH_MAX];
+  snprintf(path, PATH_MAX, "/proc/self/fd/%d/%s", dir_fd, name);
+  return teardown(path, 1, 0, NULL);
+}
+
+static void set_owner(int dir_fd, const char *name, const tar_entry_t *entry) {
+  // unprivileged imports keep the files as the calling user
+  if (fchownat(dir_fd, name, entry->uid, entry->gid,
+               AT_SYMLINK_NOFOLLOW | AT_EMPTY_PATH) == -1 &&
+      errno != EPERM && errno != EINVAL)
+    warn("chown %s: %s\n", entry->path, strerror(errno));
+}
+
+static void set_mtime(int dir_fd, const char *name, const tar_entry_t *entry) {
+  struct timespec times[2] = {{.tv_nsec = UTIME_OMIT},
+                              {.tv_sec = entry->mtime}};
+  utimensat(dir_fd, name, times, AT_SYMLINK_NOFOLLOW);
+}
+
+static void set_xattrs(int fd, const tar_entry_t *entry) {
+  for (int i = 0; i < entry->xattr_count; i++)
+    if (fsetxattr(fd, entry->xattrs[i].name, entry->xattrs[i].value,
+                  entry->xattrs[i].size, 0) == -1)
+      warn("setxattr %s on %s: %s\n", entry->xattrs[i].name, entry->path,
+           strerror(errno));
+}
+
+static int extract_file(struct extract *ctx, tar_reader_t *reader, int dir_fd,
+                        const char *name, const tar_entry_t *entry) {
+  if (remove_existing(dir_fd, name, false) == -1) return -1;
+  int fd = openat(dir_fd, name,
+                  O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+  if (fd == -1) return -1;
+  ssize_t n;
+  while ((n = tar_read(reader, ctx->buf, EXTRACT_BUFFER_SIZE)) > 0) {
+    for (ssize_t done = 0; done < n;) {
+      ssize_t written = write(fd, ctx->buf + done, n - done);
+      if (written == -1) goto fail;
+      done += written;
+    }
+  }
+  if (n == -1) goto fail;
+  set_owner(fd, "", entry);
+  // chown clears set-id bits, so the mode goes last
+  if (fchmod(fd, entry->mode) == -1) goto fail;
+  set_xattrs(fd, entry);
+  struct timespec times[2] = {{.tv_nsec = UTIME_OMIT},
+                              {.tv_sec = entry->mtime}};
+  futimens(fd, times);
+  return close(fd);
+
+fail:
+  close(fd);
+  return -1;
+}
+
+static int extract_dir(int dir_fd, const char *name, const tar_entry_t *entry) {
+  if (remove_existing(dir_fd, name, true) == 0 &&
+      mkdirat(dir_fd, name, 0700) == -1)
+    return -1;
+  int fd = openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (fd == -1) return -1;
+  set_owner(fd, "", entry);
+  int ret = fchmod(fd, entry->mode);
+  set_xattrs(fd, entry);
+  close(fd);
+  set_mtime(dir_fd, name, entry);
+  return ret;
+}
+
+static int extract_hardlink(struct extract *ctx, int dir_fd, const char *name,
+                            const tar_entry_t *entry) {
+  char target[PATH_MAX];
+  const char *link = entry->linkpath;
+  while (*link == '/') link++;
+  snprintf(target, PATH_MAX, "%s", link);
+  int target_fd = resolve(ctx->root_fd, target, O_PATH | O_NOFOLLOW);
+  if (target_fd == -1) return -1;
+  int ret = remove_existing(dir_fd, name, false);
+  if (ret == 0) ret = linkat(target_fd, "", dir_fd, name, AT_EMPTY_PATH);
+  if (ret == -1 && errno == ENOENT) {
+    // AT_EMPTY_PATH needs CAP_DAC_READ_SEARCH, go through procfs otherwise
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", target_fd);
+    ret = linkat(AT_FDCWD, path, dir_fd, name, AT_SYMLINK_FOLLOW);
+  }
+  close(target_fd);
+  return ret;
+}
+
+static int extract_whiteout(int dir_fd, const char *name) {
+  if (strcmp(name, WHITEOUT_OPAQUE) == 0) {
+    int fd = openat(dir_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) return -1;
+    // trusted.* for a privileged overlay mount, user.* for userxattr mounts
+    int ret = fsetxattr(fd, "trusted.overlay.opaque", "y", 1, 0);
+    if (fsetxattr(fd, "user.overlay.opaque", "y", 1, 0) == 0) ret = 0;
+    close(fd);
+    return ret;
+  }
+  name += strlen(WHITEOUT_PREFIX);
+  if (remove_existing(dir_fd, name, false) == -1) return -1;
+  return mknodat(dir_fd, name, S_IFCHR | 0, makedev(0, 0));
+}
+
+static int extract_entry(struct extract *ctx, tar_reader_t *reader,
+                         tar_entry_t *entry) {
+  char *path = entry->path;
+  while (*path == '/' || strncmp(path, "./", 2) == 0)
+    path += *path == '/' ? 1 : 2;
+  size_t len = strlen(path);
+  while (len > 0 && path[len - 1] == '/') path[--len] = '\0';
+  if (len == 0 || strcmp(path, ".") == 0) return 0;
+  for (char *c = path; (c = strstr(c, "..")); c += 2) {
+    if ((c == path || c[-1] == '/') && (c[2] == '\0' || c[2] == '/')) {
+      error("Refusing to extract %s\n", entry->path);
+      errno = EINVAL;
+      return -1;
+    }
+  }
+
+  char dir[PATH_MAX] = "";
+  const char *name = path;
+  char *slash = strrchr(path, '/');
+  if (slash) {
+    snprintf(dir, PATH_MAX, "%.*s", (int)(slash - path), path);
+    name = slash + 1;
+  }
+  int dir_fd = open_parent(ctx, dir);
+  if (dir_fd == -1) return -1;
+  if (strncmp(name, WHITEOUT_PREFIX, strlen(WHITEOUT_PREFIX)) == 0)
+    return extract_whiteout(dir_fd, name);
+
+  int ret = 0;
+  switch (entry->type) {
+    case '0':
+    case '\0':
+    case '7':
+      return extract_file(ctx, reader, dir_fd, name, entry);
+    case '5':
+      return extract_dir(dir_fd, name, entry);
+    case '1':
+      return extract_hardlink(ctx, dir_fd, name, entry);
+    case '2':
+      if (remove_existing(dir_fd, name, false) == -1 ||
+          symlinkat(entry->linkpath, dir_fd, name) == -1)
+        return -1;
+      break;
+    case '3':
+    case '4':
+    case '6': {
+      mode_t type = entry->type == '3'   ? S_IFCHR
+                    : entry->type == '4' ? S_IFBLK
+                                         : S_IFIFO;
+      if (remove_existing(dir_fd, name, false) == -1 ||
+          mknodat(dir_fd, name, type | entry->mode,
+                  makedev(entry->devmajor, entry->devminor)) == -1)
+        return -1;
+      ret = fchmodat(dir_fd, name, entry->mode, 0);
+      break;
+    }
+    default:
+      warn("Skipping %s with unsupported type %c\n", entry->path, entry->type);
+      return 0;
+  }
+  set_owner(dir_fd, name, entry);
+  set_mtime(dir_fd, name, entry);
+  return ret;
+}
+
+int tar_extract(int root_fd, tar_reader_t *reader, tar_stats_t *stats) {
+  struct extract ctx = {.root_fd = root_fd, .dir_fd = -1};
+  ctx.buf = malloc(EXTRACT_BUFFER_SIZE);
+  tar_entry_t *entry = calloc(1, sizeof(tar_entry_t));
+  int ret;
+  while ((ret = tar_next(reader, entry)) == 1) {
+    if (extract_entry(&ctx, reader, entry) == -1) {
+      error("Failed to extract %s: %s\n", entry->path, strerror(errno));
+      ret = -1;
+      break;
+    }
+    if (stats) {
+      stats->entries++;
+      stats->bytes += entry->size;
+    }
+  }
+  tar_entry_free(entry);
+  free(entry);
+  free(ctx.buf);
+  if (ctx.dir_fd != -1) close(ctx.dir_fd);
+  return ret;
+}
@@ -0,0 +1,66 @@
+#ifndef _TAR_H_
+#define _TAR_H_
+#include <linux/limits.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#define TAR_BLOCK_SIZE 512
+#define TAR_XATTRS_MAX 16
+
+// pull more bytes of the archive, 0 at end of stream and -1 on error
+typedef ssize_t (*tar_read_fn)(void *arg, void *buf, size_t len);
+
+struct tar_xattr {
+  char *name;
+  char *value;
+  size_t size;
+};
+
+// one member with its pax and GNU long name extensions already applied
+struct tar_entry {
+  char type;
+  char path[PATH_MAX];
+  char linkpath[PATH_MAX];
+  mode_t mode;
+  uid_t uid;
+  gid_t gid;
+  long long size;
+  long long mtime;
+  unsigned int devmajor;
+  unsigned int devminor;
+  int xattr_count;
+  struct tar_xattr xattrs[TAR_XATTRS_MAX];
+};
+
+typedef struct tar_entry tar_entry_t;
+
+struct tar_reader {
+  tar_read_fn read;
+  void *arg;
+  // data bytes and padding left in the current member
+  long long remaining;
+  long long padding;
+};
+
+typedef struct tar_reader tar_reader_t;
+
+struct tar_stats {
+  unsigned long long entries;
+  unsigned long long bytes;
+};
+
+typedef struct tar_stats tar_stats_t;
+
+void tar_init(tar_reader_t *reader, tar_read_fn read, void *arg);
+// advance to the next member, skipping whatever is left of the current one,
+// returns 1 for an entry, 0 at the end of the archive and -1 on error
+int tar_next(tar_reader_t *reader, tar_entry_t *entry);
+// read the data of the current member, 0 once it is consumed
+ssize_t tar_read(tar_reader_t *reader, void *buf, size_t len);
+void tar_entry_free(tar_entry_t *entry);
+
+// unpack an image layer below root_fd, every path is resolved inside the root
+// and overlay whiteouts are converted to their overlayfs form
+int tar_extract(int root_fd, tar_reader_t *reader, tar_stats_t *stats);
+
+#endif
@@ -0,0 +1,280 @@
+#define _GNU_SOURCE
+#include "teardown.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "utils.h"
+
+// directories up to this depth are handed out as separate tasks, anything
+// deeper is purged by the worker that owns the subtree
+#define TEARDOWN_SPLIT_DEPTH 3
+#define DENTS_BUF_SIZE (32 * 1024)
+
+struct teardown_task {
+  struct teardown_task *next;
+  int depth;
+  char path[];
+};
+
+struct teardown_ctx {
+  int root_fd;
+  dev_t dev;
+  int flags;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  struct teardown_task *head;
+  int active;
+  int threads;
+  int max_threads;
+  pthread_t *tids;
+  int error;
+  teardown_stats_t stats;
+};
+
+static bool is_dot(const char *name) {
+  return name[0] == '.' &&
+         (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+static int entry_type(int dir_fd, const struct dirent64 *entry) {
+  if (entry->d_type != DT_UNKNOWN) return entry->d_type;
+  struct stat st;
+  if (fstatat(dir_fd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1)
+    return DT_UNKNOWN;
+  return S_ISDIR(st.st_mode) ? DT_DIR : DT_REG;
+}
+
+static int remove_file(int dir_fd, const char *name, int flags,
+                       teardown_stats_t *stats) {
+  if (flags & TEARDOWN_COUNT_BYTES) {
+    struct stat st;
+    if (fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+      stats->bytes += st.st_size;
+  }
+  if (unlinkat(dir_fd, name, 0) == -1) return -1;
+  stats->files++;
+  return 0;
+}
+
+// open a subdirectory with its own file offset, refusing symlinks and other filesystems
+static int open_subdir(int dir_fd, const char *name, dev_t dev) {
+  int fd = openat(dir_fd, name,
+                  O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (fd == -1) return -1;
+  struct stat st;
+  if (fstat(fd, &st) == -1 || st.st_dev != dev) {
+    close(fd);
+    errno = EXDEV;
+    return -1;
+  }
+  return fd;
+}
+
+// empty the directory fd without removing it. Only the current directory is
+// held open: an emptied directory is left through "..", which is rescanned
+// from the start, where everything before the subdirectory is already gone
+// and the subdirectory itself is now removable. fd is always consumed.
+static int purge(int fd, dev_t dev, int flags, teardown_stats_t *stats) {
+  struct stat top;
+  if (fstat(fd, &top) == -1) goto fail;
+  char buf[DENTS_BUF_SIZE];
+  for (;;) {
+    bool descended = false;
+    ssize_t len;
+    while (!descended && (len = getdents64(fd, buf, sizeof(buf))) > 0) {
+      for (ssize_t off = 0; off < len;) {
+        struct dirent64 *entry = (struct dirent64 *)(buf + off);
+        off += entry->d_reclen;
+        if (is_dot(entry->d_name)) continue;
+        if (entry_type(fd, entry) != DT_DIR) {
+          if (remove_file(fd, entry->d_name, flags, stats) == -1) goto fail;
+          continue;
+        }
+        if (unlinkat(fd, entry->d_name, AT_REMOVEDIR) == 0) {
+          stats->dirs++;
+          continue;
+        }
+        if (errno != ENOTEMPTY && errno != EEXIST) goto fail;
+        int child = open_subdir(fd, entry->d_name, dev);
+        if (child == -1) goto fail;
+        close(fd);
+        fd = child;
+        descended = true;
+        break;
+      }
+    }
+    if (!descended && len == -1) goto fail;
+    if (descended) continue;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) goto fail;
+    if (st.st_ino == top.st_ino) break;
+    int parent = openat(fd, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (parent == -1) goto fail;
+    close(fd);
+    fd = parent;
+  }
+  close(fd);
+  return 0;
+
+fail:
+  close(fd);
+  return -1;
+}
+
+static void push_task(struct teardown_ctx *ctx, const char *parent,
+                      const char *name, int depth);
+
+// handle one directory of the upper levels: remove what can be removed
+// right away and queue the non-empty subdirectories
+static int split_dir(struct teardown_ctx *ctx, int fd, const char *path,
+                     int depth, teardown_stats_t *stats) {
+  char buf[DENTS_BUF_SIZE];
+  ssize_t len;
+  while ((len = getdents64(fd, buf, sizeof(buf))) > 0) {
+    for (ssize_t off = 0; off < len;) {
+      struct dirent64 *entry = (struct dirent64 *)(buf + off);
+      off += entry->d_reclen;
+      if (is_dot(entry->d_name)) continue;
+      if (entry_type(fd, entry) != DT_DIR) {
+        if (remove_file(fd, entry->d_name, ctx->flags, stats) == -1)
+          return -1;
+      } else if (unlinkat(fd, entry->d_name, AT_REMOVEDIR) == 0) {
+        stats->dirs++;
+      } else if (errno == ENOTEMPTY || errno == EEXIST) {
+        push_task(ctx, path, entry->d_name, depth + 1);
+      } else {
+        return -1;
+      }
+    }
+  }
+  return len == -1 ? -1 : 0;
+}
+
+static int run_task(struct teardown_ctx *ctx, struct teardown_task *task,
+                    teardown_stats_t *stats) {
+  int fd = open_subdir(ctx->root_fd, task->depth ? task->path : ".", ctx->dev);
+  if (fd == -1) return -1;
+  if (task->depth >= TEARDOWN_SPLIT_DEPTH)
+    return purge(fd, ctx->dev, ctx->flags, stats);
+  int ret = split_dir(ctx, fd, task->path, task->depth, stats);
+  close(fd);
+  return ret;
+}
+
+static void *worker(void *arg) {
+  struct teardown_ctx *ctx = (struct teardown_ctx *)arg;
+  pthread_mutex_lock(&ctx->lock);
+  for (;;) {
+    while (!ctx->head && ctx->active > 0 && !ctx->error)
+      pthread_cond_wait(&ctx->cond, &ctx->lock);
+    if (!ctx->head || ctx->error) break;
+    struct teardown_task *task = ctx->head;
+    ctx->head = task->next;
+    ctx->active++;
+    pthread_mutex_unlock(&ctx->lock);
+
+    teardown_stats_t stats = {0};
+    int ret = run_task(ctx, task, &stats);
+    int saved_errno = errno;
+    if (ret == -1)
+      debug("Teardown of %s failed: %s\n", task->path, strerror(errno));
+    free(task);
+
+    pthread_mutex_lock(&ctx->lock);
+    ctx->active--;
+    ctx->stats.files += stats.files;
+    ctx->stats.dirs += stats.dirs;
+    ctx->stats.bytes += stats.bytes;
+    if (ret == -1 && !ctx->error) ctx->error = saved_errno;
+    if (!ctx->head && ctx->active == 0) pthread_cond_broadcast(&ctx->cond);
+  }
+  pthread_cond_broadcast(&ctx->cond);
+  pthread_mutex_unlock(&ctx->lock);
+  return NULL;
+}
+
+static void push_task(struct teardown_ctx *ctx, const char *parent,
+                      const char *name, int depth) {
+  size_t len = strlen(parent) + strlen(name) + 2;
+  struct teardown_task *task = malloc(sizeof(struct teardown_task) + len);
+  if (parent[0])
+    snprintf(task->path, len, "%s/%s", parent, name);
+  else
+    snprintf(task->path, len, "%s", name);
+  task->depth = depth;
+
+  pthread_mutex_lock(&ctx->lock);
+  task->next = ctx->head;
+  ctx->head = task;
+  // threads are only started once there is more than one subtree to work on
+  if (ctx->threads < ctx->max_threads && ctx->head->next &&
+      pthread_create(&ctx->tids[ctx->threads], NULL, worker, ctx) == 0)
+    ctx->threads++;
+  pthread_cond_signal(&ctx->cond);
+  pthread_mutex_unlock(&ctx->lock);
+}
+
+int teardown(const char *path, int workers, int flags,
+             teardown_stats_t *stats) {
+  unsigned long long start = monotonic_timestamp();
+  struct teardown_ctx ctx = {.flags = flags};
+  int ret = -1;
+  ctx.root_fd = open(path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (ctx.root_fd == -1) {
+    if (errno != ENOTDIR && errno != ELOOP) return -1;
+    // not a directory, nothing to walk
+    teardown_stats_t file_stats = {0};
+    ret = remove_file(AT_FDCWD, path, flags, &file_stats);
+    file_stats.duration_ns = monotonic_timestamp() - start;
+    if (stats) *stats = file_stats;
+    return ret;
+  }
+  struct stat st;
+  if (fstat(ctx.root_fd, &st) == -1) goto out;
+  ctx.dev = st.st_dev;
+  pthread_mutex_init(&ctx.lock, NULL);
+  pthread_cond_init(&ctx.cond, NULL);
+  // the calling thread works too
+  ctx.max_threads = workers > 1 ? workers - 1 : 0;
+  ctx.tids = malloc((ctx.max_threads + 1) * sizeof(pthread_t));
+
+  push_task(&ctx, "", "", 0);
+  worker(&ctx);
+  for (int i = 0; i < ctx.threads; i++) pthread_join(ctx.tids[i], NULL);
+  while (ctx.head) {
+    struct teardown_task *task = ctx.head;
+    ctx.head = task->next;
+    free(task);
+  }
+  free(ctx.tids);
+  pthread_mutex_destroy(&ctx.lock);
+  pthread_cond_destroy(&ctx.cond);
+  if (ctx.error) {
+    errno = ctx.error;
+    goto out;
+  }
+
+  // only the empty skeleton of the split levels is left
+  int fd = open_subdir(ctx.root_fd, ".", ctx.dev);
+  if (fd == -1 || purge(fd, ctx.dev, flags, &ctx.stats) == -1) goto out;
+  if (rmdir(path) == -1) goto out;
+  ctx.stats.dirs++;
+  ret = 0;
+
+out:
+  close(ctx.root_fd);
+  ctx.stats.duration_ns = monotonic_timestamp() - start;
+  if (stats) *stats = ctx.stats;
+  return ret;
+}
@@ -0,0 +1,21 @@
+#ifndef _TEARDOWN_H_
+#define _TEARDOWN_H_
+
+#define TEARDOWN_WORKERS_MAX 8
+// stat every removed file to report freed bytes, costs one syscall per file
+#define TEARDOWN_COUNT_BYTES 0x1
+
+struct teardown_stats {
+  unsigned long long files;
+  unsigned long long dirs;
+  unsigned long long bytes;
+  unsigned long long duration_ns;
+};
+
+typedef struct teardown_stats teardown_stats_t;
+
+// remove path and everything below it without following symlinks or
+// crossing mount points, subtrees are spread across up to workers threads
+int teardown(const char *path, int workers, int flags, teardown_stats_t *stats);
+
+#endif
@@ -0,0 +1,408 @@
+#define _GNU_SOURCE
+#include "telemetry.h"
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "container.h"
+#include "log.h"
+#include "utils.h"
+
+#define TELEMETRY_EVENTS_MAX 64
+#define STAT_BUFFER_SIZE 8192
+
+enum stat_file {
+  STAT_MEMORY_CURRENT = 0,
+  STAT_MEMORY_PEAK,
+  STAT_MEMORY_STAT,
+  STAT_MEMORY_EVENTS,
+  STAT_CPU,
+  STAT_IO,
+  STAT_MAX
+};
+
+static const char *stat_files[STAT_MAX] = {
+    "memory.current", "memory.peak", "memory.stat",
+    "memory.events",  "cpu.stat",    "io.stat"};
+
+enum pressure { PRESSURE_CPU = 0, PRESSURE_MEMORY, PRESSURE_IO, PRESSURE_MAX };
+
+static const char *pressure_names[PRESSURE_MAX] = {"cpu", "memory", "io"};
+
+// flat keyed entries copied into every sample
+struct stat_key {
+  enum stat_file file;
+  const char *key;
+  const char *name;
+};
+
+static const struct stat_key stat_keys[] = {
+    {STAT_MEMORY_STAT, "anon", "memory_anon"},
+    {STAT_MEMORY_STAT, "file", "memory_file"},
+    {STAT_MEMORY_STAT, "kernel", "memory_kernel"},
+    {STAT_MEMORY_STAT, "shmem", "memory_shmem"},
+    {STAT_MEMORY_STAT, "pgmajfault", "memory_pgmajfault"},
+    {STAT_MEMORY_EVENTS, "high", "memory_high_events"},
+    {STAT_MEMORY_EVENTS, "max", "memory_max_events"},
+    {STAT_MEMORY_EVENTS, "oom", "oom"},
+    {STAT_MEMORY_EVENTS, "oom_kill", "oom_kill"},
+    {STAT_CPU, "usage_usec", "cpu_usage_us"},
+    {STAT_CPU, "user_usec", "cpu_user_us"},
+    {STAT_CPU, "system_usec", "cpu_system_us"},
+    {STAT_CPU, "nr_throttled", "cpu_nr_throttled"},
+    {STAT_CPU, "throttled_usec", "cpu_throttled_us"},
+};
+
+// what an epoll event is about: a PSI trigger, memory.events or, with no
+// owner, the control socket and the sampling timer
+enum source_kind {
+  SOURCE_PRESSURE = 0,
+  SOURCE_MEMORY_EVENTS,
+  SOURCE_CONTROL,
+  SOURCE_TIMER
+};
+
+struct watched;
+
+struct source {
+  struct watched *owner;
+  enum source_kind kind;
+  enum pressure pressure;
+};
+
+struct watched {
+  char id[CONTAINER_ID_LEN_MAX + 1];
+  int files[STAT_MAX];
+  int pressure[PRESSURE_MAX];
+  struct source sources[PRESSURE_MAX + 1];
+  unsigned long long oom_kill;
+  struct watched *next;
+};
+
+struct watcher {
+  int epoll_fd;
+  int output_fd;
+  const char *psi_trigger;
+  struct watched *watched;
+};
+
+static int control_fd = -1;
+static pid_t watcher_pid = -1;
+
+static ssize_t read_stat(int fd, char *buf, size_t size) {
+  if (fd == -1) return -1;
+  ssize_t n = pread(fd, buf, size - 1, 0);
+  if (n == -1) return -1;
+  buf[n] = '\0';
+  return n;
+}
+
+// value of key in a flat keyed file of "key value" lines
+static bool keyed_value(const char *buf, const char *key,
+                        unsigned long long *value) {
+  size_t len = strlen(key);
+  for (const char *line = buf; *line;) {
+    if (strncmp(line, key, len) == 0 && line[len] == ' ') {
+      *value = strtoull(line + len + 1, NULL, 10);
+      return true;
+    }
+    const char *next = strchr(line, '\n');
+    if (next == NULL) break;
+    line = next + 1;
+  }
+  return false;
+}
+
+// io.stat has one line per device of "key=value" pairs, report the sums
+static size_t format_io(char *line, size_t size, const char *buf) {
+  static const char *keys[] = {"rbytes", "wbytes", "rios", "wios"};
+  unsigned long long sums[4] = {0};
+  for (const char *cur = buf; (cur = strchr(cur, '=')); cur++) {
+    const char *key = cur;
+    while (key > buf && key[-1] != ' ' && key[-1] != '\n') key--;
+    for (int i = 0; i < 4; i++)
+      if ((size_t)(cur - key) == strlen(keys[i]) &&
+          strncmp(key, keys[i], cur - key) == 0)
+        sums[i] += strtoull(cur + 1, NULL, 10);
+  }
+  return snprintf(line, size,
+                  ",\"io_rbytes\":%llu,\"io_wbytes\":%llu,\"io_rios\":%llu,"
+                  "\"io_wios\":%llu",
+                  sums[0], sums[1], sums[2], sums[3]);
+}
+
+// "some avg10=0.12 avg60=0.05 avg300=0.01 total=1234" and a "full" line
+static size_t format_pressure(char *line, size_t size, const char *buf,
+                              const char *resource) {
+  size_t len = 0;
+  for (const char *cur = buf; cur && *cur;) {
+    char kind[8];
+    double avg10;
+    unsigned long long total;
+    if (sscanf(cur, "%7s avg10=%lf avg60=%*f avg300=%*f total=%llu", kind,
+               &avg10, &total) == 3)
+      len += snprintf(line + len, size - len,
+                      ",\"%s_%s_avg10\":%.2f,\"%s_%s_total_us\":%llu",
+                      resource, kind, avg10, resource, kind, total);
+    cur = strchr(cur, '\n');
+    if (cur) cur++;
+  }
+  return len;
+}
+
+// one JSON line per sample, written with a single write()
+static void emit_sample(struct watcher *watcher, struct watched *watched,
+                        const char *event) {
+  char line[TELEMETRY_LINE_MAX];
+  char bufs[STAT_MAX][STAT_BUFFER_SIZE];
+  bool present[STAT_MAX];
+  for (int i = 0; i < STAT_MAX; i++)
+    present[i] = read_stat(watched->files[i], bufs[i], STAT_BUFFER_SIZE) >= 0;
+
+  size_t len = snprintf(line, sizeof(line),
+                        "{\"ts\":%llu,\"id\":\"%s\",\"event\":\"%s\"",
+                        timestamp(), watched->id, event);
+  if (present[STAT_MEMORY_CURRENT])
+    len += snprintf(line + len, sizeof(line) - len, ",\"memory_current\":%llu",
+                    strtoull(bufs[STAT_MEMORY_CURRENT], NULL, 10));
+  if (present[STAT_MEMORY_PEAK])
+    len += snprintf(line + len, sizeof(line) - len, ",\"memory_peak\":%llu",
+                    strtoull(bufs[STAT_MEMORY_PEAK], NULL, 10));
+  for (size_t i = 0; i < sizeof(stat_keys) / sizeof(stat_keys[0]); i++) {
+    unsigned long long value;
+    if (present[stat_keys[i].file] &&
+        keyed_value(bufs[stat_keys[i].file], stat_keys[i].key, &value))
+      len += snprintf(line + len, sizeof(line) - len, ",\"%s\":%llu",
+                      stat_keys[i].name, value);
+  }
+  if (present[STAT_IO])
+    len += format_io(line + len, sizeof(line) - len, bufs[STAT_IO]);
+  char buf[STAT_BUFFER_SIZE];
+  for (int i = 0; i < PRESSURE_MAX; i++)
+    if (read_stat(watched->pressure[i], buf, sizeof(buf)) > 0)
+      len += format_pressure(line + len, sizeof(line) - len, buf,
+                             pressure_names[i]);
+  len += snprintf(line + len, sizeof(line) - len, "}\n");
+  if (len >= sizeof(line)) len = sizeof(line) - 1;
+  if (write(watcher->output_fd, line, len) == -1)
+    warn("Failed to write telemetry\n");
+}
+
+static void epoll_add(struct watcher *watcher, int fd, uint32_t events,
+                      struct source *source) {
+  struct epoll_event event = {.events = events, .data.ptr = source};
+  if (epoll_ctl(watcher->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+    err(EXIT_FAILURE, "epoll_ctl");
+}
+
+static void watch(struct watcher *watcher, const char *cgroup_path,
+                  const char *id) {
+  struct watched *watched = calloc(1, sizeof(struct watched));
+  snprintf(watched->id, sizeof(watched->id), "%s", id);
+  int dir_fd = open(cgroup_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd == -1) {
+    warn("telemetry: open %s: %s\n", cgroup_path, strerror(errno));
+    free(watched);
+    return;
+  }
+  // files of controllers that are not enabled are simply left out
+  for (int i = 0; i < STAT_MAX; i++)
+    watched->files[i] = openat(dir_fd, stat_files[i], O_RDONLY | O_CLOEXEC);
+  for (int i = 0; i < PRESSURE_MAX; i++) {
+    char name[32];
+    snprintf(name, sizeof(name), "%s.pressure", pressure_names[i]);
+    int fd = openat(dir_fd, name, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    // the trigger is registered by writing it including its NUL
+    if (fd != -1 && write(fd, watcher->psi_trigger,
+                          strlen(watcher->psi_trigger) + 1) == -1) {
+      warn("telemetry: PSI trigger on %s: %s\n", name, strerror(errno));
+      close(fd);
+      fd = -1;
+    }
+    watched->pressure[i] = fd;
+    watched->sources[i] = (struct source){watched, SOURCE_PRESSURE, i};
+    if (fd != -1) epoll_add(watcher, fd, EPOLLPRI, &watched->sources[i]);
+  }
+  close(dir_fd);
+  // memory.events signals every change, which catches OOM kills at once
+  struct source *events = &watched->sources[PRESSURE_MAX];
+  *events = (struct source){watched, SOURCE_MEMORY_EVENTS, 0};
+  if (watched->files[STAT_MEMORY_EVENTS] != -1)
+    epoll_add(watcher, watched->files[STAT_MEMORY_EVENTS], EPOLLPRI, events);
+  watched->next = watcher->watched;
+  watcher->watched = watched;
+  emit_sample(watcher, watched, "start");
+}
+
+static void unwatch(struct watcher *watcher, const char *id) {
+  struct watched **cur = &watcher->watched;
+  while (*cur && strcmp((*cur)->id, id)) cur = &(*cur)->next;
+  struct watched *watched = *cur;
+  if (watched == NULL) return;
+  *cur = watched->next;
+  emit_sample(watcher, watched, "exit");
+  // closing the fds also drops them from the epoll set
+  for (int i = 0; i < STAT_MAX; i++)
+    if (watched->files[i] != -1) close(watched->files[i]);
+  for (int i = 0; i < PRESSURE_MAX; i++)
+    if (watched->pressure[i] != -1) close(watched->pressure[i]);
+  free(watched);
+}
+
+static void on_memory_events(struct watcher *watcher, struct watched *watched) {
+  char buf[STAT_BUFFER_SIZE];
+  unsigned long long oom_kill = 0;
+  // reading the file also re-arms the notification
+  if (read_stat(watched->files[STAT_MEMORY_EVENTS], buf, sizeof(buf)) < 0)
+    return;
+  keyed_value(buf, "oom_kill", &oom_kill);
+  emit_sample(watcher, watched,
+              oom_kill > watched->oom_kill ? "oom_kill" : "memory_events");
+  watched->oom_kill = oom_kill;
+}
+
+// returns false once the launcher closed the control socket
+static bool on_control(struct watcher *watcher, int fd) {
+  char msg[TELEMETRY_CONTROL_MAX + 1];
+  ssize_t len = recv(fd, msg, TELEMETRY_CONTROL_MAX, 0);
+  if (len <= 0) return false;
+  msg[len] = '\0';
+  if (msg[0] == '+') {
+    // "+<cgroup path>\0<id>"
+    const char *path = msg + 1;
+    watch(watcher, path, path + strlen(path) + 1);
+  } else if (msg[0] == '-') {
+    unwatch(watcher, msg + 1);
+    if (send(fd, "", 1, MSG_NOSIGNAL) != 1) return false;
+  }
+  return true;
+}
+
+static void watcher_main(int fd, int output_fd, unsigned int interval_ms,
+                         const char *psi_trigger) {
+  prctl(PR_SET_NAME, "mc-telemetry");
+  struct watcher watcher = {.output_fd = output_fd, .psi_trigger = psi_trigger};
+  watcher.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (watcher.epoll_fd == -1) err(EXIT_FAILURE, "epoll_create1");
+  struct source control = {.kind = SOURCE_CONTROL};
+  struct source timer = {.kind = SOURCE_TIMER};
+  epoll_add(&watcher, fd, EPOLLIN, &control);
+  int timer_fd = -1;
+  if (interval_ms) {
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (timer_fd == -1) err(EXIT_FAILURE, "timerfd_create");
+    struct timespec interval = {.tv_sec = interval_ms / 1000,
+                                .tv_nsec = interval_ms % 1000 * 1000000L};
+    struct itimerspec spec = {.it_interval = interval, .it_value = interval};
+    timerfd_settime(timer_fd, 0, &spec, NULL);
+    epoll_add(&watcher, timer_fd, EPOLLIN, &timer);
+  }
+
+  struct epoll_event events[TELEMETRY_EVENTS_MAX];
+  for (;;) {
+    int count = epoll_wait(watcher.epoll_fd, events, TELEMETRY_EVENTS_MAX, -1);
+    if (count == -1 && errno == EINTR) continue;
+    if (count == -1) err(EXIT_FAILURE, "epoll_wait");
+    bool control_ready = false;
+    for (int i = 0; i < count; i++) {
+      struct source *source = events[i].data.ptr;
+      struct watched *watched = source->owner;
+      switch (source->kind) {
+        case SOURCE_CONTROL:
+          // handled last, an unwatch frees what other events point to
+          control_ready = true;
+          break;
+        case SOURCE_TIMER: {
+          unsigned long long expirations;
+          if (read(timer_fd, &expirations, sizeof(expirations)) == -1) break;
+          for (struct watched *w = watcher.watched; w; w = w->next)
+            emit_sample(&watcher, w, "sample");
+          break;
+        }
+        case SOURCE_MEMORY_EVENTS:
+          on_memory_events(&watcher, watched);
+          break;
+        case SOURCE_PRESSURE: {
+          char event[32];
+          snprintf(event, sizeof(event), "%s_pressure",
+                   pressure_names[source->pressure]);
+          if (events[i].events & EPOLLERR) {
+            // the cgroup went away under us
+            epoll_ctl(watcher.epoll_fd, EPOLL_CTL_DEL,
+                      watched->pressure[source->pressure], NULL);
+            break;
+          }
+          emit_sample(&watcher, watched, event);
+          break;
+        }
+      }
+    }
+    if (control_ready && !on_control(&watcher, fd)) _exit(EXIT_SUCCESS);
+  }
+}
+
+static int open_output(const char *path) {
+  if (strcmp(path, "-") == 0) return STDERR_FILENO;
+  int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd == -1) err(EXIT_FAILURE, "open-telemetry %s", path);
+  return fd;
+}
+
+int telemetry_start(const char *path, unsigned int interval_ms,
+                    const char *psi_trigger) {
+  if (path == NULL) return 0;
+  int output_fd = open_output(path);
+  int sockets[2];
+  if (socketpair(AF_LOCAL, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets))
+    err(EXIT_FAILURE, "socketpair");
+  pid_t pid = fork();
+  if (pid == -1) err(EXIT_FAILURE, "fork-telemetry");
+  if (pid == 0) {
+    close(sockets[0]);
+    watcher_main(sockets[1], output_fd, interval_ms,
+                 psi_trigger ? psi_trigger : TELEMETRY_PSI_DEFAULT);
+  }
+  close(sockets[1]);
+  if (output_fd != STDERR_FILENO) close(output_fd);
+  control_fd = sockets[0];
+  watcher_pid = pid;
+  return 0;
+}
+
+bool telemetry_enabled() { return control_fd != -1; }
+
+void telemetry_watch(const char *cgroup_base_path, const char *id) {
+  if (control_fd == -1) return;
+  char msg[TELEMETRY_CONTROL_MAX];
+  int len = snprintf(msg, sizeof(msg), "+%s/%s%c%s", cgroup_base_path, id, '\0',
+                     id);
+  if (len >= (int)sizeof(msg) || send(control_fd, msg, len, MSG_NOSIGNAL) != len)
+    warn("Failed to watch container %s\n", id);
+}
+
+void telemetry_unwatch(const char *id) {
+  if (control_fd == -1) return;
+  char msg[TELEMETRY_CONTROL_MAX], ack;
+  int len = snprintf(msg, sizeof(msg), "-%s", id);
+  if (send(control_fd, msg, len, MSG_NOSIGNAL) != len ||
+      recv(control_fd, &ack, 1, 0) != 1)
+    warn("Failed to unwatch container %s\n", id);
+}
+
+void telemetry_stop() {
+  if (control_fd == -1) return;
+  close(control_fd);
+  control_fd = -1;
+  waitpid(watcher_pid, NULL, 0);
+}
@@ -0,0 +1,25 @@
+#ifndef _TELEMETRY_H_
+#define _TELEMETRY_H_
+#include <stdbool.h>
+
+#define TELEMETRY_LINE_MAX 2048
+#define TELEMETRY_CONTROL_MAX 4352
+// PSI trigger registered on cpu, memory and io pressure: "some" stall time
+// and window, both in microseconds. without CAP_SYS_RESOURCE the kernel only
+// accepts windows that are a multiple of 2s
+#define TELEMETRY_PSI_DEFAULT "some 150000 2000000"
+
+// start a watcher process appending JSON lines to path ("-" for stderr).
+// every interval_ms it samples the memory, cpu and io stats of each watched
+// cgroup, and reports PSI trigger and memory.events changes as they happen.
+// must be called before any thread is created
+int telemetry_start(const char *path, unsigned int interval_ms,
+                    const char *psi_trigger);
+bool telemetry_enabled();
+void telemetry_watch(const char *cgroup_base_path, const char *id);
+// emit a final sample and release the cgroup, returns once the watcher is done
+// with it so the cgroup can be removed
+void telemetry_unwatch(const char *id);
+void telemetry_stop();
+
+#endif
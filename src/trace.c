@@ -0,0 +1,112 @@
+#include "trace.h"
+
+#include <err.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "utils.h"
+
+#define TRACE_LINE_MAX 4096
+
+static const char *phase_names[PHASE_MAX] = {
+    "gen_id",        "fork",         "setup_cgroup", "clone",
+    "network",       "user_mapping", "overlay_mount", "setup_mounts",
+    "pivot_root",    "launch",       "exec",         "waitpid",
+    "cleanup"};
+
+static int summary_fd = -1;
+static int events_fd = -1;
+
+void trace_begin(trace_t *trace, trace_phase_t phase) {
+  trace->spans[phase].start = monotonic_timestamp();
+  trace->spans[phase].end = 0;
+  trace->spans[phase].pid = getpid();
+  log_set_phase(phase);
+}
+
+void trace_end(trace_t *trace, trace_phase_t phase) {
+  trace->spans[phase].end = monotonic_timestamp();
+}
+
+const char *trace_phase_name(trace_phase_t phase) {
+  return phase_names[phase];
+}
+
+void trace_merge(trace_t *trace, const trace_t *other, pid_t pid) {
+  for (int i = 0; i < PHASE_MAX; i++) {
+    if (other->spans[i].start == 0) continue;
+    trace->spans[i] = other->spans[i];
+    trace->spans[i].pid = pid;
+  }
+}
+
+static int open_output(const char *path) {
+  if (path == NULL) return -1;
+  if (strcmp(path, "-") == 0) return STDERR_FILENO;
+  int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd == -1) err(EXIT_FAILURE, "open-trace %s", path);
+  return fd;
+}
+
+void set_trace_output(const char *summary_path, const char *events_path) {
+  summary_fd = open_output(summary_path);
+  events_fd = open_output(events_path);
+  // the chrome trace format tolerates a missing closing bracket, so events
+  // from later runs can keep being appended to the same file
+  struct stat st;
+  if (events_fd != -1 && fstat(events_fd, &st) == 0 && st.st_size == 0)
+    if (write(events_fd, "[\n", 2) != 2) err(EXIT_FAILURE, "write-trace");
+}
+
+// every record is a single write() so concurrent launchers can share a file
+static void emit_summary(const trace_t *trace, const char *id) {
+  char line[TRACE_LINE_MAX];
+  size_t len = snprintf(line, TRACE_LINE_MAX, "{\"id\":\"%s\"", id);
+  unsigned long long first = 0, last = 0;
+  for (int i = 0; i < PHASE_MAX; i++) {
+    const struct trace_span *span = &trace->spans[i];
+    if (span->start == 0 || span->end < span->start) continue;
+    if (first == 0 || span->start < first) first = span->start;
+    if (span->end > last) last = span->end;
+    len += snprintf(line + len, TRACE_LINE_MAX - len, ",\"%s_ns\":%llu",
+                    phase_names[i], span->end - span->start);
+  }
+  len += snprintf(line + len, TRACE_LINE_MAX - len,
+                  ",\"total_ns\":%llu,\"removed_files\":%llu,"
+                  "\"removed_bytes\":%llu}\n",
+                  last - first, trace->removed_files, trace->removed_bytes);
+  if (write(summary_fd, line, len) == -1) warn("Failed to write trace\n");
+}
+
+static void emit_events(const trace_t *trace, const char *id) {
+  char line[TRACE_LINE_MAX];
+  size_t len = 0;
+  for (int i = 0; i < PHASE_MAX; i++) {
+    const struct trace_span *span = &trace->spans[i];
+    if (span->start == 0 || span->end < span->start) continue;
+    len += snprintf(line + len, TRACE_LINE_MAX - len,
+                    "{\"name\":\"%s\",\"cat\":\"launch\",\"ph\":\"X\","
+                    "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%ld,\"tid\":%ld,"
+                    "\"args\":{\"id\":\"%.12s\"}},\n",
+                    phase_names[i], span->start / 1000.0,
+                    (span->end - span->start) / 1000.0, (long)span->pid,
+                    (long)span->pid, id);
+    if (len >= TRACE_LINE_MAX) {
+      warn("Trace events truncated\n");
+      return;
+    }
+  }
+  if (write(events_fd, line, len) == -1) warn("Failed to write trace\n");
+}
+
+bool trace_enabled() { return summary_fd != -1 || events_fd != -1; }
+
+void trace_emit(const trace_t *trace, const char *id) {
+  if (summary_fd != -1) emit_summary(trace, id);
+  if (events_fd != -1) emit_events(trace, id);
+}
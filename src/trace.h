@@ -0,0 +1,54 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+#include <stdbool.h>
+#include <sys/types.h>
+
+enum trace_phase {
+  PHASE_GEN_ID = 0,
+  PHASE_FORK,
+  PHASE_SETUP_CGROUP,
+  PHASE_CLONE,
+  PHASE_NETWORK,
+  PHASE_USER_MAPPING,
+  PHASE_OVERLAY_MOUNT,
+  PHASE_SETUP_MOUNTS,
+  PHASE_PIVOT_ROOT,
+  PHASE_LAUNCH,
+  PHASE_EXEC,
+  PHASE_WAITPID,
+  PHASE_CLEANUP,
+  PHASE_MAX
+};
+
+typedef enum trace_phase trace_phase_t;
+
+// monotonic nanoseconds, a span with start == 0 was never recorded
+struct trace_span {
+  unsigned long long start;
+  unsigned long long end;
+  pid_t pid;
+};
+
+struct trace {
+  struct trace_span spans[PHASE_MAX];
+  unsigned long long removed_files;
+  unsigned long long removed_bytes;
+};
+
+typedef struct trace trace_t;
+
+// also the phase of the log records that follow
+void trace_begin(trace_t *trace, trace_phase_t phase);
+void trace_end(trace_t *trace, trace_phase_t phase);
+// take the spans recorded by another process, attributed to pid
+void trace_merge(trace_t *trace, const trace_t *other, pid_t pid);
+
+const char *trace_phase_name(trace_phase_t phase);
+
+// output files, a NULL path disables the output, "-" is stderr
+void set_trace_output(const char *summary_path, const char *events_path);
+bool trace_enabled();
+// append a JSON line summary and chrome trace events for one container
+void trace_emit(const trace_t *trace, const char *id);
+
+#endif
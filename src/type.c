@@ -16,9 +16,16 @@ list_t *append(list_t **head, void *data) {
   return node;
 }
 
-list_t *append_pair(list_t **head, const char *key, const char *value) {
-  pair_t *new = malloc(sizeof(pair_t));
-  new->key = strdup(key);
-  new->value = strdup(value);
-  return append(head, new);
-}
\ No newline at end of file
+void append_pair(arena_t *arena, pairs_t *pairs, const char *key,
+                 const char *value) {
+  pairs->items = arena_grow(arena, pairs->items, pairs->count,
+                            &pairs->capacity, sizeof(pair_t));
+  pairs->items[pairs->count++] = (pair_t){arena_strdup(arena, key),
+                                          arena_strdup(arena, value)};
+}
+
+void copy_pairs(pairs_t *dst, const pairs_t *src) {
+  *dst = *src;
+  // a full array is moved before it grows
+  dst->capacity = dst->count;
+}
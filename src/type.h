@@ -1,6 +1,8 @@
 #ifndef _TYPE_H_
 #define _TYPE_H_
 
+#include "arena.h"
+
 struct linked_list {
   void *data;
   struct linked_list *next;
@@ -14,7 +16,19 @@ struct pair {
 typedef struct pair pair_t;
 typedef struct linked_list list_t;
 
+// a growable array of pairs, the array and its strings live in an arena
+struct pairs {
+  pair_t *items;
+  unsigned int count;
+  unsigned int capacity;
+};
+
+typedef struct pairs pairs_t;
+
 list_t *append(list_t **head, void *data);
-list_t *append_pair(list_t **head, const char *key, const char *value);
+void append_pair(arena_t *arena, pairs_t *pairs, const char *key,
+                 const char *value);
+// dst shares the items of src until something is appended to it
+void copy_pairs(pairs_t *dst, const pairs_t *src);
 
 #endif
@@ -1,40 +1,116 @@
+#define _GNU_SOURCE
 #include "user.h"
 
 #include <err.h>
+#include <fcntl.h>
 #include <linux/limits.h>
+#include <pwd.h>
 #include <sched.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include "log.h"
 #include "utils.h"
 
-int setup_user_mapping(pid_t child_pid, uid_t uid, gid_t gid) {
-  debug("Setting up user map for child %ld with uid=%d, gid=%d...\n",
-        (long)child_pid, uid, gid);
+static void write_map(const char *path, unsigned int host,
+                      unsigned int count) {
+  char map[64];
+  int len = snprintf(map, sizeof(map), "0 %u %u\n", host, count ? count : 1);
+  int fd = open(path, O_WRONLY | O_CLOEXEC);
+  if (fd == -1) err(EXIT_FAILURE, "open %s", path);
+  // the kernel takes the whole map from a single write
+  if (write(fd, map, len) != len) err(EXIT_FAILURE, "write %s", path);
+  close(fd);
+}
+
+int setup_user_mapping(pid_t child_pid, uid_t uid, unsigned int uid_count,
+                       gid_t gid, unsigned int gid_count) {
+  debug("Setting up user map for child %ld with uid=%d+%u, gid=%d+%u...\n",
+        (long)child_pid, uid, uid_count, gid, gid_count);
   char path[PATH_MAX];
   sprintf(path, "/proc/%ld/uid_map", (long)child_pid);
-  FILE *uid_map = fopen(path, "w");
-  if (uid_map == NULL) err(EXIT_FAILURE, "fopen-uid_map");
-  fprintf(uid_map, "0 %d 1\n", uid);
-  fclose(uid_map);
+  write_map(path, uid, uid_count);
 
   // since Linux 3.19, gid map is only writable by unprivileged process when
   // setgroups is disabled
-  sprintf(path, "/proc/%ld/setgroups", (long)child_pid);
-  FILE *setgroups = fopen(path, "w");
-  if (setgroups == NULL) err(EXIT_FAILURE, "fopen-setgroups");
-  fprintf(setgroups, "deny");
-  fclose(setgroups);
+  if (gid_count == 0) {
+    sprintf(path, "/proc/%ld/setgroups", (long)child_pid);
+    FILE *setgroups = fopen(path, "w");
+    if (setgroups == NULL) err(EXIT_FAILURE, "fopen-setgroups");
+    fprintf(setgroups, "deny");
+    fclose(setgroups);
+  }
 
   sprintf(path, "/proc/%ld/gid_map", (long)child_pid);
-  FILE *gid_map = fopen(path, "w");
-  if (gid_map == NULL) err(EXIT_FAILURE, "fopen-gid_map");
-  fprintf(gid_map, "0 %d 1\n", gid);
-  fclose(gid_map);
+  write_map(path, gid, gid_count);
 
   return 0;
-}
\ No newline at end of file
+}
+
+int idmap_userns(uid_t uid, unsigned int uid_count, gid_t gid,
+                 unsigned int gid_count) {
+  static int userns_fd = -1;
+  static unsigned int key[4];
+  unsigned int mapping[4] = {uid, uid_count, gid, gid_count};
+  if (userns_fd != -1 && memcmp(key, mapping, sizeof(key)) == 0)
+    return userns_fd;
+  if (userns_fd != -1) close(userns_fd);
+  userns_fd = -1;
+
+  // a process that only lives to own the namespace until it is opened
+  int ready[2];
+  if (pipe2(ready, O_CLOEXEC) == -1) return -1;
+  pid_t pid = fork();
+  if (pid == -1) err(EXIT_FAILURE, "fork");
+  if (pid == 0) {
+    close(ready[0]);
+    if (unshare(CLONE_NEWUSER) == -1) _exit(EXIT_FAILURE);
+    if (write(ready[1], "", 1) != 1) _exit(EXIT_FAILURE);
+    for (;;) pause();
+  }
+  close(ready[1]);
+  char c;
+  if (read(ready[0], &c, 1) == 1) {
+    setup_user_mapping(pid, uid, uid_count, gid, gid_count);
+    char path[PATH_MAX];
+    sprintf(path, "/proc/%ld/ns/user", (long)pid);
+    userns_fd = open(path, O_RDONLY | O_CLOEXEC);
+  }
+  close(ready[0]);
+  kill(pid, SIGKILL);
+  waitpid(pid, NULL, 0);
+  memcpy(key, mapping, sizeof(key));
+  return userns_fd;
+}
+
+int read_subids(const char *path, const char *user, unsigned int *start,
+                unsigned int *count) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) return -1;
+  // entries name the user or give its id
+  char uid[16] = "";
+  struct passwd *pw = getpwnam(user);
+  if (pw) snprintf(uid, sizeof(uid), "%u", pw->pw_uid);
+  char line[256];
+  int ret = -1;
+  while (ret == -1 && fgets(line, sizeof(line), file)) {
+    char *saveptr;
+    char *name = strtok_r(line, ":", &saveptr);
+    char *first = strtok_r(NULL, ":", &saveptr);
+    char *size = strtok_r(NULL, ":\n", &saveptr);
+    if (name == NULL || first == NULL || size == NULL ||
+        (strcmp(name, user) && strcmp(name, uid)))
+      continue;
+    *start = strtoul(first, NULL, 10);
+    *count = strtoul(size, NULL, 10);
+    if (*count) ret = 0;
+  }
+  fclose(file);
+  return ret;
+}
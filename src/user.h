@@ -3,6 +3,20 @@
 
 #include <sys/types.h>
 
-int setup_user_mapping(pid_t child_pid, uid_t uid, gid_t gid);
+#define SUBUID_FILE "/etc/subuid"
+#define SUBGID_FILE "/etc/subgid"
 
-#endif
\ No newline at end of file
+// map the container's ids 0 to count - 1 onto the host ids from uid and gid,
+// a count of 0 maps root alone and denies setgroups
+int setup_user_mapping(pid_t child_pid, uid_t uid, unsigned int uid_count,
+                       gid_t gid, unsigned int gid_count);
+// a user namespace with the same mapping, for idmapped mounts. it is kept
+// and handed out again while the mapping does not change
+int idmap_userns(uid_t uid, unsigned int uid_count, gid_t gid,
+                 unsigned int gid_count);
+// the first subordinate id range of user, by name or id, in a subuid or
+// subgid file
+int read_subids(const char *path, const char *user, unsigned int *start,
+                unsigned int *count);
+
+#endif
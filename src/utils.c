@@ -1,4 +1,4 @@
-#include <dirent.h>
+#define _GNU_SOURCE
 #include <openssl/sha.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -11,58 +11,55 @@
 
 #include "log.h"
 
-int rm_rf(const char *path) {
-  struct stat st;
-  if (stat(path, &st) == 0) {
-    if (S_ISDIR(st.st_mode)) {
-      DIR *dir = opendir(path);
-      if (dir == NULL) {
-        perror("opendir");
-        return -1;
-      }
-      struct dirent *entry;
-      while ((entry = readdir(dir)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0 ||
-            strcmp(entry->d_name, "..") == 0) {
-          continue;
-        }
-        char *new_path =
-            (char *)malloc(strlen(path) + strlen(entry->d_name) + 2);
-        sprintf(new_path, "%s/%s", path, entry->d_name);
-        if (rm_rf(new_path) != 0) {
-          return -1;
-        }
-        free(new_path);
-      }
-      closedir(dir);
-      if (rmdir(path) != 0) {
-        perror("rmdir");
-        return -1;
-      }
-    } else {
-      if (unlink(path) != 0) {
-        perror("unlink");
-        return -1;
-      }
-    }
-  } else {
-    perror("stat");
-    return -1;
+char *sha256_hex(const unsigned char *digest, char *sha256) {
+  for (size_t i = 0; i < SHA256_DIGEST_LENGTH; i++) {
+    sprintf(sha256 + i * 2, "%02x", digest[i]);
   }
-  return 0;
+  return sha256;
 }
 
 char *sha256_string(const char *data, size_t size, char *sha256) {
   unsigned char buf[SHA256_DIGEST_LENGTH + 1];
-  SHA256((unsigned char *)data, strlen(data), buf);
-  for (size_t i = 0; i < SHA256_DIGEST_LENGTH; i++) {
-    sprintf(sha256 + i * 2, "%02x", buf[i]);
-  }
-  return sha256;
+  SHA256((unsigned char *)data, size, buf);
+  return sha256_hex(buf, sha256);
 }
 
 unsigned long long timestamp() {
   struct timeval tv;
   gettimeofday(&tv, NULL);
   return tv.tv_sec * 1000000LL + tv.tv_usec;
-}
\ No newline at end of file
+}
+
+unsigned long long monotonic_timestamp() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int parse_size(const char *size, unsigned long long *bytes) {
+  char *end;
+  unsigned long long value = strtoull(size, &end, 10);
+  int shift = 0;
+  if (*end == 'k' || *end == 'K') shift = 10;
+  if (*end == 'm' || *end == 'M') shift = 20;
+  if (*end == 'g' || *end == 'G') shift = 30;
+  if (shift) end++;
+  if (end == size || *end) return -1;
+  *bytes = value << shift;
+  return 0;
+}
+
+void close_inherited_fds(int *keep, int count) {
+  for (int i = 1; i < count; i++) {
+    int fd = keep[i], j = i;
+    for (; j > 0 && keep[j - 1] > fd; j--) keep[j] = keep[j - 1];
+    keep[j] = fd;
+  }
+  unsigned int next = 3;
+  for (int i = 0; i < count; i++) {
+    if (keep[i] < (int)next) continue;
+    if (keep[i] > (int)next) close_range(next, keep[i] - 1, 0);
+    next = keep[i] + 1;
+  }
+  close_range(next, ~0U, 0);
+}
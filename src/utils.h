@@ -4,11 +4,26 @@
 
 #define clone3(args) syscall(SYS_clone3, args, sizeof(struct clone_args))
 #define pivot_root(new_root, put_old) syscall(SYS_pivot_root, new_root, put_old)
+#define openat2(dirfd, path, how) \
+  syscall(SYS_openat2, dirfd, path, how, sizeof(struct open_how))
+#define pidfd_open(pid, flags) syscall(SYS_pidfd_open, pid, flags)
+#define pidfd_send_signal(pidfd, sig, info, flags) \
+  syscall(SYS_pidfd_send_signal, pidfd, sig, info, flags)
 
-int rm_rf(const char *path);
-
+// hex encode a raw SHA256 digest into sha256, which needs 65 bytes
+char *sha256_hex(const unsigned char *digest, char *sha256);
 char *sha256_string(const char *data, size_t size, char *sha256);
 
 unsigned long long timestamp();
+// nanoseconds on CLOCK_MONOTONIC, for measuring intervals
+unsigned long long monotonic_timestamp();
+
+// "N[kmg]" in bytes
+int parse_size(const char *size, unsigned long long *bytes);
+
+// close every fd above stderr except those in keep, which gets sorted. for
+// children that never exec, such as parked containers, which would hold
+// sibling containers' sockets open past their close-on-exec flag
+void close_inherited_fds(int *keep, int count);
 
 #endif
\ No newline at end of file